@@ -1,9 +1,453 @@
 #include "cpu_rt.h"
 
+#include <algorithm>
+#include <atomic>
+
+#include "cpu_rt_accel_file.h"
+#include "cpu_rt_hash.h"
+#include "cpu_rt_integrator.h"
+#include "cpu_rt_sampler.h"
+#include "cpu_rt_traversal.h"
+
 namespace cpu_rt
 {
-    void Render(const scene_core::Scene& scene)
+    Renderer::Renderer(const RenderSettings& settings)
+        : m_settings(settings)
+    {
+        m_pool = std::make_unique<WorkerPool>(m_settings.threading, CpuTopology::Detect());
+        AllocateFramebuffer();
+    }
+
+    Renderer::~Renderer() = default;
+
+    void Renderer::AllocateFramebuffer()
+    {
+        m_tiles = MakeTiles(m_settings.width, m_settings.height, m_settings.tileSize, *m_pool);
+        m_scheduler.SetPriority(m_tiles, m_settings.width, m_settings.height, m_settings.tilePriority);
+        const AovFlags aovs = m_settings.aovs | (m_settings.denoise ? DenoiseAovs : 0);
+        m_framebuffer.Allocate(m_settings.width, m_settings.height, m_settings.tileSize, m_tiles, aovs, *m_pool);
+        m_primaryHits.Allocate(m_settings.width, m_settings.height, m_settings.primaryHitCacheSamples);
+    }
+
+    void Renderer::SetResolution(std::uint32_t width, std::uint32_t height)
+    {
+        if (width == m_settings.width && height == m_settings.height) {
+            return;
+        }
+        CloseCheckpoint();
+        m_settings.width = width;
+        m_settings.height = height;
+        AllocateFramebuffer();
+        m_history.Clear();
+        m_accumulatedSamples = 0;
+    }
+
+    void Renderer::SetScene(const scene_core::Scene& scene)
+    {
+        CloseCheckpoint();
+        m_scene = BuildRtScene(scene, m_settings.bvh, m_settings.accelStorage);
+        m_tracePath = SelectTracePath(m_scene.features);
+        m_primaryHits.Clear();
+        m_guiding.Reset(m_settings.guiding.enabled ? m_scene.bounds : Aabb{}, m_settings.guiding);
+
+        // Copy the top level on a worker of each node so its pages are local to that socket.
+        m_topLevelReplicas.clear();
+        if (m_settings.threading.replicateTopLevelPerNode && m_pool->NumaNodeCount() > 1) {
+            m_topLevelReplicas.resize(m_pool->NumaNodeCount());
+            m_pool->Run([this](const WorkerInfo& worker) {
+                if (worker.indexInNode == 0) {
+                    m_topLevelReplicas[worker.numaNode] = m_scene.topLevel;
+                }
+            });
+        }
+
+        ResetAccumulation();
+    }
+
+    void Renderer::SetCamera(const CameraView& camera)
+    {
+        if (m_scene.source == nullptr) {
+            return;
+        }
+        CloseCheckpoint();
+        if (m_settings.reprojection.enabled) {
+            m_history.Reproject(*m_pool, m_scene, m_scene.topLevel, m_framebuffer, camera, m_settings.reprojection);
+        } else {
+            m_history.Clear();
+        }
+        m_scene.camera = camera;
+        ++m_cameraMoves;
+        m_primaryHits.Clear();
+        ClearSamples();
+    }
+
+    void Renderer::UpdateShading()
+    {
+        if (m_scene.source == nullptr) {
+            return;
+        }
+        CloseCheckpoint();
+        UpdateRtSceneShading(m_scene);
+        // Emission and texture use may have changed; traversal features have not, so cached hits stay valid.
+        m_tracePath = SelectTracePath(m_scene.features);
+        // Learned radiance no longer matches the lights and materials.
+        m_guiding.Reset(m_settings.guiding.enabled ? m_scene.bounds : Aabb{}, m_settings.guiding);
+        ResetAccumulation();
+    }
+
+    void Renderer::ResetAccumulation()
+    {
+        m_history.Clear();
+        m_directLighting.Clear();
+        ClearSamples();
+    }
+
+    void Renderer::ClearSamples()
+    {
+        m_framebuffer.Clear(*m_pool);
+        m_accumulatedSamples = 0;
+        m_checkpoint.Invalidate();
+    }
+
+    bool Renderer::OpenCheckpoint(const std::string& path)
+    {
+        CloseCheckpoint();
+        if (m_scene.source == nullptr) {
+            return false;
+        }
+
+        // Opening may load state into the framebuffer, which expects it cleared.
+        ResetAccumulation();
+        bool resumed = false;
+        if (!m_checkpoint.Open(path, CheckpointKey(), m_tiles, m_framebuffer, resumed)) {
+            return false;
+        }
+        if (resumed) {
+            m_accumulatedSamples = m_framebuffer.MinSampleCount();
+        }
+        return true;
+    }
+
+    void Renderer::CloseCheckpoint()
+    {
+        if (m_checkpoint.IsOpen()) {
+            m_checkpoint.Flush(true);
+            m_checkpoint.Close();
+        }
+    }
+
+    // Everything the accumulated samples depend on: image settings and the flattened scene. Mesh accels
+    // contribute their content keys, so out-of-core arrays are not paged in.
+    std::uint64_t Renderer::CheckpointKey() const
+    {
+        Hasher hasher;
+        hasher.Add(m_settings.width);
+        hasher.Add(m_settings.height);
+        hasher.Add(m_settings.maxDepth);
+        hasher.Add(SampleSeed());
+        hasher.Add(m_settings.environmentRadiance);
+        hasher.Add(m_framebuffer.Aovs());
+
+        for (const MeshAccel& meshAccel : m_scene.meshAccels) {
+            hasher.Add(meshAccel.key);
+        }
+        for (const Instance& instance : m_scene.topLevel.instances) {
+            hasher.Add(instance.objectToWorld);
+            hasher.Add(instance.meshAccelIndex);
+            hasher.Add(instance.nodeIndex);
+        }
+        for (std::uint32_t materialIndex = 0; materialIndex < m_scene.source->materials.size(); ++materialIndex) {
+            const BsdfParams params = GetBsdfParams(*m_scene.source, materialIndex);
+            hasher.Add(params.baseColor);
+            hasher.Add(params.emission);
+            hasher.Add(params.metallic);
+            hasher.Add(params.alpha);
+        }
+        for (const PunctualLight& light : m_scene.lights) {
+            hasher.Add(light.type);
+            hasher.Add(light.position);
+            hasher.Add(light.direction);
+            hasher.Add(light.intensity);
+            hasher.Add(light.range);
+            hasher.Add(light.cosInnerCone);
+            hasher.Add(light.cosOuterCone);
+        }
+        hasher.Add(m_scene.camera.cameraToWorld);
+        hasher.Add(m_scene.camera.verticalFovRadians);
+        return hasher.Value();
+    }
+
+    const TopLevelAccel& Renderer::TopLevelForNode(std::uint32_t numaNode) const
+    {
+        return numaNode < m_topLevelReplicas.size() ? m_topLevelReplicas[numaNode] : m_scene.topLevel;
+    }
+
+    void Renderer::RenderSamples(std::uint32_t samplesPerPixel)
+    {
+        if (samplesPerPixel == 0 || m_scene.source == nullptr) {
+            return;
+        }
+
+        const std::uint32_t targetSamples = m_accumulatedSamples + samplesPerPixel;
+        const Tile cropRect = CropRect(m_settings.crop, m_settings.width, m_settings.height);
+        std::vector<bool> active(m_tiles.size());
+        for (std::size_t tileIndex = 0; tileIndex < m_tiles.size(); ++tileIndex) {
+            const Tile clipped = ClipTile(m_tiles[tileIndex], cropRect);
+            active[tileIndex] = clipped.x0 != clipped.x1;
+        }
+
+        GuidingField* guiding = m_settings.guiding.enabled ? &m_guiding : nullptr;
+        m_scheduler.Reset(m_tiles, m_pool->NumaNodeCount(), active);
+        m_pool->Run([&](const WorkerInfo& worker) {
+            const TopLevelAccel& topLevel = TopLevelForNode(worker.numaNode);
+            const bool prefetch = m_scene.outOfCore && m_settings.accelStorage.tilePrefetchBytes != 0;
+            std::uint32_t tileIndex = 0;
+            std::uint32_t nextTileIndex = 0;
+            while (m_scheduler.Next(worker.numaNode, tileIndex)) {
+                // Let the OS page in geometry for the tile likely to come next while this one renders.
+                if (prefetch && m_scheduler.Peek(worker.numaNode, nextTileIndex)) {
+                    PrefetchTile(ClipTile(m_tiles[nextTileIndex], cropRect), topLevel);
+                }
+                RenderTile(ClipTile(m_tiles[tileIndex], cropRect), topLevel, targetSamples, 0, guiding);
+                m_checkpoint.SaveTile(tileIndex, m_framebuffer);
+            }
+        });
+        m_accumulatedSamples = targetSamples;
+        if (guiding != nullptr) {
+            m_guiding.Update(*m_pool, samplesPerPixel);
+        }
+
+        // Only schedules write-back; rendering continues while the OS writes the pages.
+        if (m_checkpoint.IsOpen()) {
+            m_checkpoint.Flush(false);
+        }
+    }
+
+    void Renderer::SetTilePriority(const TilePriority& priority)
+    {
+        // Kept in the settings so a later resize orders its new tiles the same way. Workers only read the
+        // scheduler, never this field.
+        m_settings.tilePriority = priority;
+        m_scheduler.SetPriority(m_tiles, m_settings.width, m_settings.height, priority);
+    }
+
+    void Renderer::SetCropWindow(const CropWindow& crop)
+    {
+        m_settings.crop = crop;
+    }
+
+    void Renderer::RenderRegions(std::span<const Tile> regions, std::uint32_t firstSample, std::uint32_t sampleCount)
+    {
+        if (m_scene.source == nullptr) {
+            return;
+        }
+
+        std::atomic<std::size_t> nextRegion{ 0 };
+        m_pool->Run([&](const WorkerInfo& worker) {
+            const TopLevelAccel& topLevel = TopLevelForNode(worker.numaNode);
+            for (std::size_t regionIndex = nextRegion++; regionIndex < regions.size(); regionIndex = nextRegion++) {
+                m_framebuffer.ClearRegion(regions[regionIndex]);
+                RenderTile(regions[regionIndex], topLevel, sampleCount, firstSample, nullptr);
+            }
+        });
+    }
+
+    RenderOutput Renderer::RenderDirectLighting()
+    {
+        RenderOutput output;
+        output.width = m_settings.width;
+        output.height = m_settings.height;
+        if (m_scene.source == nullptr) {
+            output.radiance.assign(static_cast<std::size_t>(output.width) * output.height * 3, 0.0f);
+            return output;
+        }
+        m_directLighting.RenderFrame(*m_pool, m_scene, m_scene.topLevel, output.width, output.height, ToVec3(m_settings.environmentRadiance), m_settings.seed,
+            m_settings.directLighting, output.radiance);
+        return output;
+    }
+
+    RenderOutput Renderer::RenderTraversalHeatmap(HeatmapMetric metric, std::uint32_t samplesPerPixel, float maxValue)
+    {
+        RenderOutput output;
+        output.width = m_settings.width;
+        output.height = m_settings.height;
+        const TraversalHeatmap heatmap = TraceTraversalHeatmap(*m_pool, m_scene, m_scene.topLevel, output.width, output.height, samplesPerPixel);
+        output.radiance = FalseColor(heatmap.Values(metric), maxValue);
+        return output;
+    }
+
+    void Renderer::RenderTile(const Tile& tile, const TopLevelAccel& topLevel, std::uint32_t targetSamples, std::uint32_t sampleIndexOffset, GuidingField* guiding)
+    {
+        IntegratorSettings integrator;
+        integrator.maxDepth = m_settings.maxDepth;
+        integrator.environmentRadiance = ToVec3(m_settings.environmentRadiance);
+        integrator.guiding = guiding;
+
+        const float invWidth = 1.0f / static_cast<float>(m_settings.width);
+        const float invHeight = 1.0f / static_cast<float>(m_settings.height);
+        const float aspect = static_cast<float>(m_settings.width) * invHeight;
+        const bool writeAovs = m_framebuffer.Aovs() != 0;
+
+        for (std::uint32_t y = tile.y0; y < tile.y1; ++y) {
+            for (std::uint32_t x = tile.x0; x < tile.x1; ++x) {
+                // Sample indices continue from the pixel's own count, so resumed pixels draw fresh samples.
+                const std::uint32_t firstSample = m_framebuffer.SampleCount(x, y);
+                if (firstSample >= targetSamples) {
+                    continue;
+                }
+                const std::uint32_t sampleCount = targetSamples - firstSample;
+                const std::uint64_t pixelIndex = static_cast<std::uint64_t>(y) * m_settings.width + x;
+                PixelSamples samples;
+                samples.count = sampleCount;
+                for (std::uint32_t s = 0; s < sampleCount; ++s) {
+                    const std::uint32_t sampleIndex = sampleIndexOffset + firstSample + s;
+                    Sampler sampler(SampleSeed(), pixelIndex, sampleIndex);
+                    const float filmX = (static_cast<float>(x) + sampler.Next1D()) * invWidth;
+                    const float filmY = (static_cast<float>(y) + sampler.Next1D()) * invHeight;
+                    const Ray ray = GenerateCameraRay(m_scene.camera, filmX, filmY, aspect);
+                    // The film position is still drawn for cached hits, so the rest of the path sees the same
+                    // random numbers as when it was traced.
+                    const Hit* cachedPrimary = m_primaryHits.Find(x, y, sampleIndex);
+                    Hit* tracedPrimary = cachedPrimary == nullptr ? m_primaryHits.Slot(x, y, sampleIndex) : nullptr;
+                    PathFeatures features;
+                    const Vec3 radiance = m_tracePath(
+                        m_scene, topLevel, ray, sampler, integrator, writeAovs ? &features : nullptr, cachedPrimary, tracedPrimary);
+                    if (tracedPrimary != nullptr) {
+                        m_primaryHits.Commit(x, y);
+                    }
+                    samples.radianceSum += radiance;
+                    samples.luminanceSquaredSum += Luminance(radiance) * Luminance(radiance);
+                    if (writeAovs) {
+                        samples.features.albedo += features.albedo;
+                        samples.features.normal += features.normal;
+                        samples.features.depth += features.depth;
+                        if (s == 0) {
+                            samples.features.nodeIndex = features.nodeIndex;
+                            samples.features.materialIndex = features.materialIndex;
+                        }
+                    }
+                }
+                m_framebuffer.AddSamples(x, y, samples);
+            }
+        }
+    }
+
+    // Probe the top level with a few camera rays spread over the tile and prefetch the accels of the
+    // instances whose bounds they cross, nearest first. The probes do not descend into the accels, so
+    // they never wait for geometry pages themselves.
+    void Renderer::PrefetchTile(const Tile& tile, const TopLevelAccel& topLevel) const
+    {
+        constexpr std::uint32_t ProbesPerAxis = 3;
+        const float invWidth = 1.0f / static_cast<float>(m_settings.width);
+        const float invHeight = 1.0f / static_cast<float>(m_settings.height);
+        const float aspect = static_cast<float>(m_settings.width) * invHeight;
+
+        std::vector<std::uint32_t> accels;
+        for (std::uint32_t py = 0; py < ProbesPerAxis; ++py) {
+            for (std::uint32_t px = 0; px < ProbesPerAxis; ++px) {
+                const float filmX = (static_cast<float>(tile.x0) + static_cast<float>(tile.x1 - tile.x0) * (px + 0.5f) / ProbesPerAxis) * invWidth;
+                const float filmY = (static_cast<float>(tile.y0) + static_cast<float>(tile.y1 - tile.y0) * (py + 0.5f) / ProbesPerAxis) * invHeight;
+                const Ray ray = GenerateCameraRay(m_scene.camera, filmX, filmY, aspect);
+                float tMax = ray.tMax;
+                detail::TraverseBvh(topLevel.bvh, ray.origin, SafeInverse(ray.direction), ray.tMin, tMax, [&](std::uint32_t first, std::uint32_t count, float&) {
+                    for (std::uint32_t i = first; i < first + count; ++i) {
+                        const std::uint32_t accelIndex = topLevel.instances[topLevel.bvh.primIndices[i]].meshAccelIndex;
+                        if (std::find(accels.begin(), accels.end(), accelIndex) == accels.end()) {
+                            accels.push_back(accelIndex);
+                        }
+                    }
+                    return false;
+                });
+            }
+        }
+
+        std::size_t budget = m_settings.accelStorage.tilePrefetchBytes;
+        for (std::size_t i = 0; i < accels.size() && budget != 0; ++i) {
+            budget -= PrefetchMeshAccel(m_scene.meshAccels[accels[i]], budget);
+        }
+    }
+
+    bool Renderer::IntersectRays(std::span<const Ray> rays, std::span<Hit> hits)
+    {
+        return cpu_rt::IntersectRays(*m_pool, m_scene, m_scene.topLevel, rays, hits);
+    }
+
+    bool Renderer::OccludedRays(std::span<const Ray> rays, std::span<std::uint64_t> occluded)
+    {
+        return cpu_rt::OccludedRays(*m_pool, m_scene, m_scene.topLevel, rays, occluded);
+    }
+
+    bool Renderer::BakeVertices(std::uint32_t nodeIndex, const BakeSettings& settings, BakeResult& result)
+    {
+        return cpu_rt::BakeVertices(*m_pool, m_scene, m_scene.topLevel, nodeIndex, settings, result);
+    }
+
+    bool Renderer::BakeTexels(std::uint32_t nodeIndex, std::uint32_t width, std::uint32_t height, const BakeSettings& settings, BakeResult& result)
+    {
+        return cpu_rt::BakeTexels(*m_pool, m_scene, m_scene.topLevel, nodeIndex, width, height, settings, result);
+    }
+
+    RenderOutput Renderer::Resolve() const
+    {
+        RenderOutput output;
+        output.width = m_settings.width;
+        output.height = m_settings.height;
+        output.radiance = m_framebuffer.Resolve();
+        m_history.Apply(m_framebuffer, output.radiance);
+        for (std::uint32_t plane = 0; plane < static_cast<std::uint32_t>(AovPlane::Count); ++plane) {
+            output.aovPlanes[plane] = m_framebuffer.ResolvePlane(static_cast<AovPlane>(plane));
+        }
+        output.nodeIds = m_framebuffer.ResolveNodeIds();
+        output.materialIds = m_framebuffer.ResolveMaterialIds();
+        return output;
+    }
+
+    RenderOutput Renderer::ResolveDenoised(const DenoiseSettings& settings)
+    {
+        RenderOutput output = Resolve();
+        const std::size_t pixelCount = static_cast<std::size_t>(output.width) * output.height;
+
+        std::vector<float> color[3];
+        for (int c = 0; c < 3; ++c) {
+            color[c].resize(pixelCount);
+            for (std::size_t p = 0; p < pixelCount; ++p) {
+                color[c][p] = output.radiance[p * 3 + c];
+            }
+        }
+        std::vector<float> variance = m_framebuffer.ResolveVariance();
+        m_history.ScaleVariance(m_framebuffer, variance);
+
+        DenoiseImage image;
+        image.width = output.width;
+        image.height = output.height;
+        image.variance = variance;
+        for (int c = 0; c < 3; ++c) {
+            image.color[c] = color[c];
+            image.albedo[c] = output.aovPlanes[static_cast<std::size_t>(AovPlane::AlbedoR) + c];
+            image.normal[c] = output.aovPlanes[static_cast<std::size_t>(AovPlane::NormalX) + c];
+        }
+        image.depth = output.Plane(AovPlane::Depth);
+        Denoise(*m_pool, image, settings);
+
+        for (int c = 0; c < 3; ++c) {
+            for (std::size_t p = 0; p < pixelCount; ++p) {
+                output.radiance[p * 3 + c] = color[c][p];
+            }
+        }
+        return output;
+    }
+
+    RenderOutput Render(const scene_core::Scene& scene, const RenderSettings& settings)
     {
-        (void)scene;
+        Renderer renderer(settings);
+        renderer.SetScene(scene);
+        if (settings.guiding.enabled) {
+            for (std::uint32_t pass = 1; renderer.GetAccumulatedSamples() < settings.samplesPerPixel; pass *= 2) {
+                renderer.RenderSamples(std::min(pass, settings.samplesPerPixel - renderer.GetAccumulatedSamples()));
+            }
+        } else {
+            renderer.RenderSamples(settings.samplesPerPixel);
+        }
+        return settings.denoise ? renderer.ResolveDenoised(settings.denoiser) : renderer.Resolve();
     }
 }
@@ -1,8 +1,194 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <span>
+#include <vector>
+
 #include "../scene-core/scene.h"
+#include "cpu_rt_bake.h"
+#include "cpu_rt_checkpoint.h"
+#include "cpu_rt_denoise.h"
+#include "cpu_rt_diagnostics.h"
+#include "cpu_rt_framebuffer.h"
+#include "cpu_rt_hit_cache.h"
+#include "cpu_rt_integrator.h"
+#include "cpu_rt_mesh_merge.h"
+#include "cpu_rt_query.h"
+#include "cpu_rt_reprojection.h"
+#include "cpu_rt_restir.h"
+#include "cpu_rt_scene.h"
+#include "cpu_rt_threading.h"
+#include "cpu_rt_tiles.h"
 
 namespace cpu_rt
 {
-    void Render(const scene_core::Scene& scene);
+    struct RenderSettings
+    {
+        std::uint32_t width = 1280;
+        std::uint32_t height = 720;
+        std::uint32_t tileSize = 32;
+        // Initial tile order within each pass; Renderer::SetTilePriority() changes it mid-render.
+        TilePriority tilePriority;
+        // Only tiles overlapping the crop window are rendered, clipped to it.
+        CropWindow crop;
+        std::uint32_t samplesPerPixel = 16;
+        std::uint32_t maxDepth = 5;
+        std::uint64_t seed = 0;
+        // Camera samples per pixel whose primary hits are kept for UpdateShading(), at most 255; 0 disables
+        // the cache. Costs 20 bytes per cached sample.
+        std::uint32_t primaryHitCacheSamples = 0;
+        std::array<float, 3> environmentRadiance = { 0.0f, 0.0f, 0.0f };
+        // AOVs written from the camera paths of the main render.
+        AovFlags aovs = 0;
+        // Denoise the result of Render(); implies the albedo, normal and depth AOVs.
+        bool denoise = false;
+        DenoiseSettings denoiser;
+        ReprojectionSettings reprojection;
+        GuidingSettings guiding;
+        // Used by RenderDirectLighting().
+        ReservoirSettings directLighting;
+        ThreadingSettings threading;
+        BvhBuildSettings bvh;
+        AccelStorageSettings accelStorage;
+    };
+
+    struct RenderOutput
+    {
+        std::uint32_t width = 0;
+        std::uint32_t height = 0;
+        // Linear RGB, row-major, 3 floats per pixel.
+        std::vector<float> radiance;
+        // Planar AOVs, one row-major buffer per channel; empty unless requested in RenderSettings::aovs.
+        std::array<std::vector<float>, static_cast<std::size_t>(AovPlane::Count)> aovPlanes;
+        std::vector<std::uint32_t> nodeIds;
+        std::vector<std::uint32_t> materialIds;
+
+        const std::vector<float>& Plane(AovPlane plane) const { return aovPlanes[static_cast<std::size_t>(plane)]; }
+    };
+
+    // Progressive tile renderer. Owns the worker pool, the acceleration structures and the accumulation buffer.
+    class Renderer
+    {
+    public:
+        explicit Renderer(const RenderSettings& settings);
+        ~Renderer();
+
+        Renderer(const Renderer&) = delete;
+        Renderer& operator=(const Renderer&) = delete;
+
+        const RenderSettings& GetSettings() const { return m_settings; }
+        WorkerPool& GetWorkerPool() { return *m_pool; }
+        const RtScene& GetRtScene() const { return m_scene; }
+        const std::vector<Tile>& GetTiles() const { return m_tiles; }
+        Framebuffer& GetFramebuffer() { return m_framebuffer; }
+
+        // Build acceleration structures for the scene and reset accumulation. Closes the checkpoint.
+        // The scene must stay alive and unmodified while it is set on the renderer.
+        void SetScene(const scene_core::Scene& scene);
+
+        // Change the image size; the scene and its acceleration structures are kept. Discards all samples
+        // and closes the checkpoint.
+        void SetResolution(std::uint32_t width, std::uint32_t height);
+
+        // Move the camera for interactive navigation; the scene itself stays as it is. With reprojection
+        // enabled the accumulated image is warped to the new view and blended with the samples rendered
+        // from there on, otherwise accumulation restarts. Closes the checkpoint.
+        void SetCamera(const CameraView& camera);
+
+        // Pick up edits of material parameters and of light colors, intensities, ranges and cones in the
+        // scene passed to SetScene(). Geometry, transforms, alpha masking, the set of lights and the camera
+        // must be unchanged. Restarts accumulation; samples covered by the primary hit cache are shaded
+        // from their cached hits without tracing camera rays. Closes the checkpoint.
+        void UpdateShading();
+
+        // Mirror the accumulation state into a memory-mapped file, updated as tiles finish.
+        // If the file holds state of the same scene and image settings, accumulation resumes from it.
+        // Call after SetScene(); returns false if the file cannot be created.
+        bool OpenCheckpoint(const std::string& path);
+        // Flush the checkpoint to disk and close it.
+        void CloseCheckpoint();
+
+        // Bring every pixel in the crop window to GetAccumulatedSamples() + samplesPerPixel samples.
+        // With guiding enabled, each call is one training pass: its paths record into the guiding field,
+        // which is refined afterwards and guides the next call.
+        void RenderSamples(std::uint32_t samplesPerPixel);
+
+        // Reorder the tiles not started yet and keep the order for later passes and resizes. Safe to call
+        // from another thread while RenderSamples() runs, e.g. when the viewer moves the point of interest.
+        void SetTilePriority(const TilePriority& priority);
+        // Takes effect with the next RenderSamples() call. Pixels outside the window keep their samples and
+        // catch up when a later pass covers them.
+        void SetCropWindow(const CropWindow& crop);
+        // Replace the accumulation of each region with sample indices [firstSample, firstSample + sampleCount).
+        // Used by distributed workers, whose regions are merged on the coordinator. Not guided, so a region
+        // renders the same on every worker.
+        void RenderRegions(std::span<const Tile> regions, std::uint32_t firstSample, std::uint32_t sampleCount);
+
+        // One frame of first-hit emission plus direct lighting from the punctual lights, by reservoir
+        // resampling (see ReservoirDirectLighting), for interactive previews of scenes with many lights.
+        // Independent of the accumulation buffer; reuses the reservoirs of the previous call, also across
+        // SetCamera(). No indirect light, and misses see the environment radiance.
+        RenderOutput RenderDirectLighting();
+
+        // Debug view of traversal cost: the chosen count of the camera rays per pixel, false-colored from
+        // black through blue and green to red at maxValue (0: the image maximum). See TraceTraversalHeatmap().
+        RenderOutput RenderTraversalHeatmap(HeatmapMetric metric, std::uint32_t samplesPerPixel = 1, float maxValue = 0.0f);
+
+        // Discard all samples, including reprojected history and reused light reservoirs.
+        void ResetAccumulation();
+        std::uint32_t GetAccumulatedSamples() const { return m_accumulatedSamples; }
+
+        // Batched ray queries against the scene on the renderer's workers (see IntersectRays() and
+        // OccludedRays() in cpu_rt_query.h). Must not overlap RenderSamples() or other calls using the pool.
+        bool IntersectRays(std::span<const Ray> rays, std::span<Hit> hits);
+        bool OccludedRays(std::span<const Ray> rays, std::span<std::uint64_t> occluded);
+
+        // Bake occlusion and irradiance of a node's mesh on the renderer's workers, per vertex or into a
+        // lightmap (see BakeVertices() and BakeTexels() in cpu_rt_bake.h). Same restrictions as the queries.
+        bool BakeVertices(std::uint32_t nodeIndex, const BakeSettings& settings, BakeResult& result);
+        bool BakeTexels(std::uint32_t nodeIndex, std::uint32_t width, std::uint32_t height, const BakeSettings& settings, BakeResult& result);
+
+        RenderOutput Resolve() const;
+        // Resolve and run the a-trous denoiser, guided by the albedo, normal and depth AOVs when they are collected.
+        RenderOutput ResolveDenoised(const DenoiseSettings& settings);
+
+    private:
+        void AllocateFramebuffer();
+        const TopLevelAccel& TopLevelForNode(std::uint32_t numaNode) const;
+        void RenderTile(const Tile& tile, const TopLevelAccel& topLevel, std::uint32_t targetSamples, std::uint32_t sampleIndexOffset, GuidingField* guiding);
+        void PrefetchTile(const Tile& tile, const TopLevelAccel& topLevel) const;
+        std::uint64_t CheckpointKey() const;
+        void ClearSamples();
+        // Differs per camera position, so history and new samples of a pixel are uncorrelated.
+        std::uint64_t SampleSeed() const { return m_settings.seed + m_cameraMoves * 0x9e3779b97f4a7c15ull; }
+
+        RenderSettings m_settings;
+        std::unique_ptr<WorkerPool> m_pool;
+        std::vector<Tile> m_tiles;
+        TileScheduler m_scheduler;
+        Framebuffer m_framebuffer;
+
+        RtScene m_scene;
+        // Integrator kernel specialized for the features of m_scene.
+        TracePathFn m_tracePath = nullptr;
+        // Per-NUMA-node copies of m_scene.topLevel, first touched on their node. Empty when replication is off.
+        std::vector<TopLevelAccel> m_topLevelReplicas;
+        // Pixels may be ahead of this after resuming from a checkpoint written mid-pass.
+        std::uint32_t m_accumulatedSamples = 0;
+        Checkpoint m_checkpoint;
+        TemporalHistory m_history;
+        // Valid for the current scene geometry, camera and SampleSeed().
+        PrimaryHitCache m_primaryHits;
+        // Incident radiance learned from earlier passes; view independent, so it survives camera moves.
+        GuidingField m_guiding;
+        ReservoirDirectLighting m_directLighting;
+        std::uint64_t m_cameraMoves = 0;
+    };
+
+    // One-shot render of settings.samplesPerPixel samples. With guiding enabled, the samples are split
+    // into passes of 1, 2, 4, ... samples per pixel, so each pass learns from twice the samples before it.
+    RenderOutput Render(const scene_core::Scene& scene, const RenderSettings& settings = {});
 }
@@ -0,0 +1,303 @@
+#include "cpu_rt_accel_file.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <span>
+#include <system_error>
+#include <vector>
+
+namespace cpu_rt
+{
+    namespace
+    {
+        constexpr char RecordMagic[8] = { 'C', 'P', 'U', 'R', 'T', 'B', 'L', 'S' };
+        constexpr std::uint32_t RecordVersion = 2;
+        constexpr std::uint64_t ArrayAlignment = 64;
+
+        struct RecordHeader
+        {
+            char magic[8];
+            std::uint32_t version;
+            std::uint32_t meshIndex;
+            std::uint32_t submeshIndex;
+            std::uint32_t shapeGroupIndex;
+            std::uint64_t nodeCount;
+            std::uint64_t triangleCount;
+            std::uint64_t shapeCount;
+            std::uint64_t primRefCount;
+            std::uint64_t key;
+        };
+        static_assert(sizeof(RecordHeader) == ArrayAlignment);
+
+        // Byte offsets of the arrays from the start of the record.
+        struct RecordLayout
+        {
+            std::uint64_t nodes = 0;
+            std::uint64_t triangles = 0;
+            std::uint64_t primRefs = 0;
+            std::uint64_t shapes = 0;
+            std::uint64_t materialIndices = 0;
+            std::uint64_t triangleIds = 0;
+            std::uint64_t size = 0;
+        };
+
+        std::filesystem::path CachePath(const std::string& directory, std::uint64_t key)
+        {
+            char name[32];
+            std::snprintf(name, sizeof(name), "%016llx.blas", static_cast<unsigned long long>(key));
+            return std::filesystem::path(directory) / name;
+        }
+
+        std::uint64_t AlignUp(std::uint64_t value, std::uint64_t alignment)
+        {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+        RecordLayout ComputeLayout(const RecordHeader& header)
+        {
+            RecordLayout layout;
+            std::uint64_t offset = sizeof(RecordHeader);
+            auto place = [&](std::uint64_t count, std::uint64_t elementSize) {
+                const std::uint64_t start = AlignUp(offset, ArrayAlignment);
+                offset = start + count * elementSize;
+                return start;
+            };
+            layout.nodes = place(header.nodeCount, sizeof(BvhNode));
+            layout.triangles = place(header.triangleCount, sizeof(Triangle));
+            layout.primRefs = place(header.primRefCount, sizeof(std::uint32_t));
+            layout.shapes = place(header.shapeCount, sizeof(AnalyticShape));
+            layout.materialIndices = place(header.triangleCount, sizeof(std::uint32_t));
+            layout.triangleIds = place(header.triangleCount, sizeof(std::uint32_t));
+            layout.size = AlignUp(offset, ArrayAlignment);
+            return layout;
+        }
+
+        // Check everything traversal indexes without bounds checks: the children and leaf range of every node
+        // reachable from the root, nesting within the traversal stack and every primitive reference. Reads the
+        // node and reference arrays once.
+        bool IsTraversable(std::span<const BvhNode> nodes, std::span<const std::uint32_t> primRefs, std::uint64_t triangleCount,
+            std::uint64_t shapeCount)
+        {
+            // Without references, leaf slots are triangle indices.
+            if (primRefs.empty() && shapeCount != 0) {
+                return false;
+            }
+            for (const std::uint32_t ref : primRefs) {
+                if ((ref & AnalyticPrimBit) != 0 ? (ref & ~AnalyticPrimBit) >= shapeCount : ref >= triangleCount) {
+                    return false;
+                }
+            }
+            if (nodes.empty()) {
+                return true;
+            }
+
+            // In a tree every node has one parent, which also rules out cycles. Padding nodes are never reached.
+            const std::uint64_t leafSlots = primRefs.empty() ? triangleCount : primRefs.size();
+            std::vector<bool> reached(nodes.size(), false);
+            struct Entry
+            {
+                std::uint64_t nodeIndex;
+                std::uint32_t depth;
+            };
+            std::vector<Entry> stack = { { 0, 0 } };
+            reached[0] = true;
+            while (!stack.empty()) {
+                const Entry entry = stack.back();
+                stack.pop_back();
+                const BvhNode& node = nodes[entry.nodeIndex];
+                if (node.IsLeaf()) {
+                    if (std::uint64_t(node.leftOrFirst) + node.primCount > leafSlots) {
+                        return false;
+                    }
+                    continue;
+                }
+                const std::uint64_t left = node.leftOrFirst;
+                if (left + 1 >= nodes.size() || entry.depth + 1 >= MaxTraversalDepth || reached[left] || reached[left + 1]) {
+                    return false;
+                }
+                reached[left] = true;
+                reached[left + 1] = true;
+                stack.push_back({ left, entry.depth + 1 });
+                stack.push_back({ left + 1, entry.depth + 1 });
+            }
+            return true;
+        }
+    }
+
+    bool AccelFileWriter::Open(const std::string& path)
+    {
+        m_stream.open(path, std::ios::binary | std::ios::trunc);
+        m_size = 0;
+        return m_stream.is_open();
+    }
+
+    bool AccelFileWriter::PadTo(std::uint64_t offset)
+    {
+        static const char zeros[AccelFilePageSize] = {};
+        while (m_size < offset) {
+            const std::uint64_t count = std::min<std::uint64_t>(offset - m_size, sizeof(zeros));
+            m_stream.write(zeros, static_cast<std::streamsize>(count));
+            m_size += count;
+        }
+        return m_stream.good();
+    }
+
+    bool AccelFileWriter::Append(const MeshAccel& accel, std::uint64_t& recordOffset, std::uint64_t key)
+    {
+        if (!m_stream.is_open()) {
+            return false;
+        }
+
+        RecordHeader header{};
+        std::memcpy(header.magic, RecordMagic, sizeof(header.magic));
+        header.version = RecordVersion;
+        header.meshIndex = accel.meshIndex;
+        header.submeshIndex = accel.submeshIndex;
+        header.shapeGroupIndex = accel.shapeGroupIndex;
+        header.nodeCount = accel.bvh.nodes.size();
+        header.triangleCount = accel.triangles.size();
+        header.shapeCount = accel.shapes.size();
+        header.primRefCount = accel.primRefs.size();
+        header.key = key;
+
+        // Small records share a page with their predecessors; larger ones get page-aligned node clusters.
+        std::span<const BvhNode> nodes(accel.bvh.nodes);
+        std::vector<BvhNode> clustered;
+        std::uint64_t start = AlignUp(m_size, ArrayAlignment);
+        const std::uint64_t pageEnd = (start / AccelFilePageSize + 1) * AccelFilePageSize;
+        if (start + ComputeLayout(header).size > pageEnd) {
+            start = AlignUp(m_size, AccelFilePageSize);
+            constexpr std::uint32_t nodesPerPage = AccelFilePageSize / sizeof(BvhNode);
+            constexpr std::uint32_t firstPageNodes = (AccelFilePageSize - sizeof(RecordHeader)) / sizeof(BvhNode);
+            clustered = ClusterBvhNodes(nodes, nodesPerPage, firstPageNodes);
+            nodes = clustered;
+            header.nodeCount = nodes.size();
+        }
+        const RecordLayout layout = ComputeLayout(header);
+
+        auto writeArray = [&](std::uint64_t offset, const void* data, std::size_t bytes) {
+            if (PadTo(start + offset)) {
+                m_stream.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+                m_size += bytes;
+            }
+        };
+        writeArray(0, &header, sizeof(header));
+        writeArray(layout.nodes, nodes.data(), nodes.size_bytes());
+        writeArray(layout.triangles, accel.triangles.data(), accel.triangles.size() * sizeof(Triangle));
+        writeArray(layout.primRefs, accel.primRefs.data(), accel.primRefs.size() * sizeof(std::uint32_t));
+        writeArray(layout.shapes, accel.shapes.data(), accel.shapes.size() * sizeof(AnalyticShape));
+        writeArray(layout.materialIndices, accel.materialIndices.data(), accel.materialIndices.size() * sizeof(std::uint32_t));
+        writeArray(layout.triangleIds, accel.triangleIds.data(), accel.triangleIds.size() * sizeof(std::uint32_t));
+        if (!PadTo(start + layout.size)) {
+            return false;
+        }
+
+        recordOffset = start;
+        return true;
+    }
+
+    bool AccelFileWriter::Close()
+    {
+        m_stream.flush();
+        const bool ok = m_stream.good();
+        m_stream.close();
+        return ok && !m_stream.fail();
+    }
+
+    bool MapMeshAccel(const std::shared_ptr<const MappedFile>& file, std::uint64_t recordOffset, MeshAccel& accel, std::uint64_t key)
+    {
+        if (!file || !file->IsOpen() || recordOffset % ArrayAlignment != 0 || recordOffset > file->Size() ||
+            file->Size() - recordOffset < sizeof(RecordHeader)) {
+            return false;
+        }
+        RecordHeader header;
+        std::memcpy(&header, file->Data() + recordOffset, sizeof(header));
+        if (std::memcmp(header.magic, RecordMagic, sizeof(header.magic)) != 0 || header.version != RecordVersion || header.key != key) {
+            return false;
+        }
+        // Bound the counts before the layout multiplies them.
+        const std::uint64_t available = file->Size() - recordOffset;
+        if (header.nodeCount > available / sizeof(BvhNode) || header.triangleCount > available / sizeof(Triangle) ||
+            header.shapeCount > available / sizeof(AnalyticShape) || header.primRefCount > available / sizeof(std::uint32_t)) {
+            return false;
+        }
+        const RecordLayout layout = ComputeLayout(header);
+        if (layout.size > available) {
+            return false;
+        }
+
+        const std::size_t base = static_cast<std::size_t>(recordOffset);
+        const std::size_t triangleCount = static_cast<std::size_t>(header.triangleCount);
+        MappedArray<BvhNode> nodes(file, base + layout.nodes, static_cast<std::size_t>(header.nodeCount));
+        MappedArray<std::uint32_t> primRefs(file, base + layout.primRefs, static_cast<std::size_t>(header.primRefCount));
+        if (!IsTraversable(std::span<const BvhNode>(nodes), std::span<const std::uint32_t>(primRefs), header.triangleCount, header.shapeCount)) {
+            return false;
+        }
+        accel.meshIndex = header.meshIndex;
+        accel.submeshIndex = header.submeshIndex;
+        accel.shapeGroupIndex = header.shapeGroupIndex;
+        accel.key = header.key;
+        accel.bvh.nodes = std::move(nodes);
+        accel.bvh.primIndices.clear();
+        accel.triangles = MappedArray<Triangle>(file, base + layout.triangles, triangleCount);
+        accel.primRefs = std::move(primRefs);
+        accel.shapes = MappedArray<AnalyticShape>(file, base + layout.shapes, static_cast<std::size_t>(header.shapeCount));
+        accel.materialIndices = MappedArray<std::uint32_t>(file, base + layout.materialIndices, triangleCount);
+        accel.triangleIds = MappedArray<std::uint32_t>(file, base + layout.triangleIds, triangleCount);
+        return true;
+    }
+
+    bool LoadCachedMeshAccel(const std::string& directory, std::uint64_t key, MeshAccel& accel)
+    {
+        auto file = std::make_shared<MappedFile>();
+        return file->Open(CachePath(directory, key).string(), MappedFile::Mode::ReadOnly) && MapMeshAccel(file, 0, accel, key);
+    }
+
+    bool StoreCachedMeshAccel(const std::string& directory, std::uint64_t key, MeshAccel& accel)
+    {
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        const std::filesystem::path path = CachePath(directory, key);
+
+        // Write under a unique name and rename, so concurrent runs never map a partial file.
+        std::filesystem::path temporary = path;
+        std::string suffix = ".";
+        suffix += std::to_string(std::random_device{}());
+        suffix += ".tmp";
+        temporary += suffix;
+        AccelFileWriter writer;
+        std::uint64_t recordOffset = 0;
+        const bool written = writer.Open(temporary.string()) && writer.Append(accel, recordOffset, key);
+        if (!writer.Close() || !written) {
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+        std::filesystem::rename(temporary, path, error);
+        if (error) {
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+
+        MeshAccel mapped;
+        if (!LoadCachedMeshAccel(directory, key, mapped)) {
+            return false;
+        }
+        mapped.meshIndex = accel.meshIndex;
+        mapped.submeshIndex = accel.submeshIndex;
+        mapped.shapeGroupIndex = accel.shapeGroupIndex;
+        accel = std::move(mapped);
+        return true;
+    }
+
+    std::size_t PrefetchMeshAccel(const MeshAccel& accel, std::size_t maxBytes)
+    {
+        std::size_t bytes = accel.bvh.nodes.Prefetch(maxBytes);
+        bytes += accel.triangles.Prefetch(maxBytes - bytes);
+        bytes += accel.primRefs.Prefetch(maxBytes - bytes);
+        bytes += accel.shapes.Prefetch(maxBytes - bytes);
+        return bytes;
+    }
+}
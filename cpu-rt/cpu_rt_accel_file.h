@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "cpu_rt_mapped_file.h"
+#include "cpu_rt_scene.h"
+
+namespace cpu_rt
+{
+    // Bottom-level accels in a file, for memory mapping. Each accel is one record: a header followed by its
+    // arrays in host byte order, 64-byte aligned, BVH nodes and the arrays traversal reads first. Records
+    // that do not fit the rest of the current page start on a page boundary and store their nodes in
+    // page-sized clusters of connected subtrees (ClusterBvhNodes()), so a ray touches few pages.
+    inline constexpr std::size_t AccelFilePageSize = 4096;
+
+    class AccelFileWriter
+    {
+    public:
+        // Create or truncate the file.
+        bool Open(const std::string& path);
+        // Append the accel as a record; recordOffset receives its position for MapMeshAccel().
+        bool Append(const MeshAccel& accel, std::uint64_t& recordOffset, std::uint64_t key = 0);
+        // Returns false if any write failed.
+        bool Close();
+
+    private:
+        bool PadTo(std::uint64_t offset);
+
+        std::ofstream m_stream;
+        std::uint64_t m_size = 0;
+    };
+
+    // Point the accel at the record at recordOffset of a mapped accel file. Fails on truncated or foreign data,
+    // if the record was written with another key and if a node or primitive reference indexes out of range or
+    // the tree nests deeper than traversal supports, so a corrupt record is never traversed.
+    bool MapMeshAccel(const std::shared_ptr<const MappedFile>& file, std::uint64_t recordOffset, MeshAccel& accel, std::uint64_t key = 0);
+
+    // BVH cache: a directory of single-record accel files named after a key that hashes all build inputs,
+    // shared between runs and processes.
+    // Map the accel cached under key. Fails if there is none or it does not match.
+    bool LoadCachedMeshAccel(const std::string& directory, std::uint64_t key, MeshAccel& accel);
+    // Store the accel under key, creating the directory if needed, and on success replace its arrays by a
+    // mapping of the cache file. On failure the accel is left as it was.
+    bool StoreCachedMeshAccel(const std::string& directory, std::uint64_t key, MeshAccel& accel);
+
+    // Prefetch the mapped arrays traversal reads, BVH nodes first, up to maxBytes in total.
+    // Returns the number of bytes requested.
+    std::size_t PrefetchMeshAccel(const MeshAccel& accel, std::size_t maxBytes);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+#include "../scene-core/scene.h"
+#include "cpu_rt_math.h"
+
+namespace cpu_rt
+{
+    // Auxiliary output variables written from the camera paths of the main render.
+    enum AovFlagBits : std::uint32_t
+    {
+        AovAlbedo = 1u << 0,
+        AovNormal = 1u << 1,
+        AovDepth = 1u << 2,
+        AovNodeId = 1u << 3,
+        AovMaterialId = 1u << 4,
+    };
+    using AovFlags = std::uint32_t;
+
+    // AOVs the denoiser reads.
+    inline constexpr AovFlags DenoiseAovs = AovAlbedo | AovNormal | AovDepth;
+
+    // Averaged float channels, one plane each.
+    enum class AovPlane : std::uint32_t
+    {
+        AlbedoR,
+        AlbedoG,
+        AlbedoB,
+        NormalX,
+        NormalY,
+        NormalZ,
+        Depth,
+        Count,
+    };
+
+    // First-hit values of one camera path, or their sums over several samples.
+    struct PathFeatures
+    {
+        Vec3 albedo;
+        Vec3 normal;
+        // Distance along the camera ray, 0 for a miss.
+        float depth = 0.0f;
+        // scene_core::Node and MaterialPBR indices of the first hit, InvalidIndex for a miss.
+        std::uint32_t nodeIndex = scene_core::InvalidIndex;
+        std::uint32_t materialIndex = scene_core::InvalidIndex;
+    };
+
+    // Samples of one pixel gathered by a worker before they are added to the framebuffer.
+    struct PixelSamples
+    {
+        Vec3 radianceSum;
+        float luminanceSquaredSum = 0.0f;
+        std::uint32_t count = 0;
+        // Float features are summed; the IDs are those of the first sample.
+        PathFeatures features;
+    };
+}
@@ -0,0 +1,157 @@
+#include "cpu_rt_arena.h"
+
+#include <algorithm>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace cpu_rt
+{
+    namespace
+    {
+        std::size_t AlignUp(std::size_t value, std::size_t alignment)
+        {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+    }
+
+    AccelArena::AccelArena(std::size_t blockSize)
+        : m_blockSize(AlignUp(std::max(blockSize, HugePageSize), HugePageSize))
+    {
+    }
+
+    AccelArena::~AccelArena()
+    {
+        for (const Block& block : m_blocks) {
+            FreeBlock(block);
+        }
+    }
+
+    void* AccelArena::Allocate(std::size_t bytes, std::size_t alignment)
+    {
+        if (bytes == 0) {
+            bytes = 1;
+        }
+        std::lock_guard lock(m_mutex);
+
+        // Large arrays get a block of their own, so the rest of the current block is not abandoned.
+        if (bytes > m_blockSize / 2) {
+            Block block;
+            if (!AllocateBlock(bytes, block)) {
+                return nullptr;
+            }
+            m_blocks.push_back(block);
+            m_usedBytes += bytes;
+            return block.base;
+        }
+
+        std::size_t offset = AlignUp(m_bumpOffset, alignment);
+        if (m_bumpBase == nullptr || offset + bytes > m_bumpSize) {
+            Block block;
+            if (!AllocateBlock(m_blockSize, block)) {
+                return nullptr;
+            }
+            m_blocks.push_back(block);
+            m_bumpBase = block.base;
+            m_bumpSize = block.size;
+            offset = 0;
+        }
+        m_bumpOffset = offset + bytes;
+        m_usedBytes += bytes;
+        return m_bumpBase + offset;
+    }
+
+    std::size_t AccelArena::ReservedBytes() const
+    {
+        std::lock_guard lock(m_mutex);
+        std::size_t bytes = 0;
+        for (const Block& block : m_blocks) {
+            bytes += block.size;
+        }
+        return bytes;
+    }
+
+    std::size_t AccelArena::UsedBytes() const
+    {
+        std::lock_guard lock(m_mutex);
+        return m_usedBytes;
+    }
+
+    std::size_t AccelArena::ExplicitHugePageBytes() const
+    {
+        std::lock_guard lock(m_mutex);
+        std::size_t bytes = 0;
+        for (const Block& block : m_blocks) {
+            bytes += block.explicitHugePages ? block.size : 0;
+        }
+        return bytes;
+    }
+
+    // Reserve a block of at least minBytes, rounded up to whole huge pages.
+    bool AccelArena::AllocateBlock(std::size_t minBytes, Block& block)
+    {
+        block.size = AlignUp(minBytes, HugePageSize);
+#if defined(_WIN32)
+        // Large pages need SeLockMemoryPrivilege; without it the call fails and regular pages are used.
+        const std::size_t largePage = GetLargePageMinimum();
+        if (largePage != 0) {
+            const std::size_t size = AlignUp(block.size, largePage);
+            block.mapping = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if (block.mapping != nullptr) {
+                block.size = size;
+                block.mappingSize = size;
+                block.explicitHugePages = true;
+            }
+        }
+        if (block.mapping == nullptr) {
+            block.mapping = VirtualAlloc(nullptr, block.size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+            block.mappingSize = block.size;
+        }
+        if (block.mapping == nullptr) {
+            return false;
+        }
+        block.base = static_cast<std::byte*>(block.mapping);
+#else
+#if defined(MAP_HUGETLB)
+        // Succeeds only if huge pages are reserved (vm.nr_hugepages); they are never swapped or split.
+        void* hugeMapping = ::mmap(nullptr, block.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (hugeMapping != MAP_FAILED) {
+            block.mapping = hugeMapping;
+            block.mappingSize = block.size;
+            block.base = static_cast<std::byte*>(hugeMapping);
+            block.explicitHugePages = true;
+        }
+#endif
+        if (block.mapping == nullptr) {
+            // Over-allocate so the block can start on a huge page boundary, which THP needs.
+            const std::size_t mappingSize = block.size + HugePageSize;
+            void* mapping = ::mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mapping == MAP_FAILED) {
+                return false;
+            }
+            block.mapping = mapping;
+            block.mappingSize = mappingSize;
+            block.base = reinterpret_cast<std::byte*>(AlignUp(reinterpret_cast<std::uintptr_t>(mapping), HugePageSize));
+#if defined(MADV_HUGEPAGE)
+            ::madvise(block.base, block.size, MADV_HUGEPAGE);
+#endif
+        }
+#endif
+        return true;
+    }
+
+    void AccelArena::FreeBlock(const Block& block)
+    {
+#if defined(_WIN32)
+        VirtualFree(block.mapping, 0, MEM_RELEASE);
+#else
+        ::munmap(block.mapping, block.mappingSize);
+#endif
+    }
+}
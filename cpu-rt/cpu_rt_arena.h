@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+namespace cpu_rt
+{
+    // Bump allocator for acceleration-structure arrays. Memory comes from large blocks aligned to 2 MiB
+    // that are backed by huge pages where the OS allows: explicit huge pages (MAP_HUGETLB, MEM_LARGE_PAGES)
+    // if some are reserved, otherwise transparent huge pages (MADV_HUGEPAGE). Random traversal over a
+    // large scene then needs one TLB entry per 2 MiB instead of per 4 KiB. Nothing is freed individually;
+    // all blocks are released together when the arena is destroyed. Allocation is thread-safe.
+    class AccelArena
+    {
+    public:
+        static constexpr std::size_t HugePageSize = std::size_t(2) << 20;
+
+        // Allocations larger than half a block get a block of their own.
+        explicit AccelArena(std::size_t blockSize = std::size_t(32) << 20);
+        ~AccelArena();
+
+        AccelArena(const AccelArena&) = delete;
+        AccelArena& operator=(const AccelArena&) = delete;
+
+        // Uninitialized memory, or nullptr if the OS is out of memory.
+        void* Allocate(std::size_t bytes, std::size_t alignment = 64);
+
+        // Copy of the values in the arena; empty if values is empty or allocation fails.
+        template<typename T>
+        std::span<const T> Copy(std::span<const T> values)
+        {
+            if (values.empty()) {
+                return {};
+            }
+            void* memory = Allocate(values.size_bytes(), alignof(T) > 64 ? alignof(T) : 64);
+            if (memory == nullptr) {
+                return {};
+            }
+            std::memcpy(memory, values.data(), values.size_bytes());
+            return { static_cast<const T*>(memory), values.size() };
+        }
+
+        // Bytes reserved from the OS, bytes handed out, and the part of the reservation in explicit huge pages.
+        std::size_t ReservedBytes() const;
+        std::size_t UsedBytes() const;
+        std::size_t ExplicitHugePageBytes() const;
+
+    private:
+        struct Block
+        {
+            std::byte* base = nullptr;
+            std::size_t size = 0;
+            // Start of the mapping, which may precede base by the alignment padding.
+            void* mapping = nullptr;
+            std::size_t mappingSize = 0;
+            bool explicitHugePages = false;
+        };
+
+        static bool AllocateBlock(std::size_t minBytes, Block& block);
+        static void FreeBlock(const Block& block);
+
+        std::size_t m_blockSize = 0;
+        mutable std::mutex m_mutex;
+        std::vector<Block> m_blocks;
+        // Block that small allocations are bumped from.
+        std::byte* m_bumpBase = nullptr;
+        std::size_t m_bumpSize = 0;
+        std::size_t m_bumpOffset = 0;
+        std::size_t m_usedBytes = 0;
+    };
+}
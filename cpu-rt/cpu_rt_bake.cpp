@@ -0,0 +1,450 @@
+#include "cpu_rt_bake.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <fstream>
+#include <span>
+
+#include "cpu_rt_integrator.h"
+#include "cpu_rt_query.h"
+#include "cpu_rt_sampler.h"
+
+namespace cpu_rt
+{
+    namespace
+    {
+        // World-space surface point to bake; the hemisphere is around normal, rays leave along geometricNormal's side.
+        struct BakePoint
+        {
+            Vec3 position;
+            Vec3 normal;
+            Vec3 geometricNormal;
+            bool valid = false;
+        };
+
+        // Ranges a node reference draws, like the bottom-level accel build.
+        std::vector<scene_core::Submesh> ReferencedRanges(const scene_core::Mesh& mesh, std::uint32_t submeshIndex)
+        {
+            if (submeshIndex != InvalidIndex) {
+                return submeshIndex < mesh.submeshes.size() ? std::vector<scene_core::Submesh>{ mesh.submeshes[submeshIndex] } : std::vector<scene_core::Submesh>{};
+            }
+            if (!mesh.submeshes.empty()) {
+                return mesh.submeshes;
+            }
+            return { { InvalidIndex, 0, static_cast<std::uint32_t>(mesh.indices.size()) } };
+        }
+
+        Affine3 NodeToWorld(const scene_core::Scene& scene, std::uint32_t nodeIndex)
+        {
+            std::vector<std::uint32_t> traversalOrder;
+            return ComputeWorldTransforms(scene, traversalOrder)[nodeIndex];
+        }
+
+        Vec3 MeshPosition(const scene_core::Mesh& mesh, std::uint32_t index)
+        {
+            const float* p = &mesh.vertexStreams.positions[3 * index];
+            return { p[0], p[1], p[2] };
+        }
+
+        // Object-space vertex normals from the mesh, or area-weighted face normals if it has none.
+        std::vector<Vec3> VertexNormals(const scene_core::Mesh& mesh)
+        {
+            const std::size_t vertexCount = mesh.vertexStreams.positions.size() / 3;
+            std::vector<Vec3> normals(vertexCount);
+            if (mesh.vertexStreams.normals.size() == vertexCount * 3) {
+                for (std::size_t i = 0; i < vertexCount; ++i) {
+                    const float* n = &mesh.vertexStreams.normals[3 * i];
+                    normals[i] = Vec3(n[0], n[1], n[2]);
+                }
+                return normals;
+            }
+            for (std::size_t first = 0; first + 3 <= mesh.indices.size(); first += 3) {
+                const std::uint32_t i0 = mesh.indices[first + 0];
+                const std::uint32_t i1 = mesh.indices[first + 1];
+                const std::uint32_t i2 = mesh.indices[first + 2];
+                if (i0 >= vertexCount || i1 >= vertexCount || i2 >= vertexCount) {
+                    continue;
+                }
+                const Vec3 p0 = MeshPosition(mesh, i0);
+                const Vec3 faceNormal = Cross(MeshPosition(mesh, i1) - p0, MeshPosition(mesh, i2) - p0);
+                normals[i0] += faceNormal;
+                normals[i1] += faceNormal;
+                normals[i2] += faceNormal;
+            }
+            return normals;
+        }
+
+        // World-space normal of an object-space one; invalid if it has no length.
+        bool TransformNormal(const Affine3& worldToObject, const Vec3& normal, Vec3& result)
+        {
+            const Vec3 n = worldToObject.TransformNormalByInverse(normal);
+            if (!(Length(n) > 0.0f)) {
+                return false;
+            }
+            result = Normalize(n);
+            return true;
+        }
+
+        // Occlusion and irradiance of the points, batch by batch: hemisphere rays of consecutive points go
+        // to one closest-hit query, which gives the occlusion and starts the irradiance paths, then the
+        // shadow rays of all punctual lights go to one occlusion query.
+        void BakePoints(WorkerPool& pool, const RtScene& scene, const TopLevelAccel& topLevel, std::span<const BakePoint> points,
+            const BakeSettings& settings, std::vector<float>& ambientOcclusion, std::vector<float>& irradiance)
+        {
+            const std::size_t samples = std::max(settings.samplesPerPoint, 1u);
+            const std::size_t lightCount = settings.irradiance ? scene.lights.size() : 0;
+            ambientOcclusion.assign(points.size(), 0.0f);
+            irradiance.assign(settings.irradiance ? points.size() * 3 : 0, 0.0f);
+            const TracePathFn tracePath = settings.irradiance ? SelectTracePath(scene.features) : nullptr;
+            IntegratorSettings integrator;
+            integrator.maxDepth = settings.maxDepth;
+            integrator.environmentRadiance = ToVec3(settings.environmentRadiance);
+
+            const std::size_t pointsPerBatch = std::max<std::size_t>(settings.batchRays / std::max(samples, lightCount), 1);
+            std::vector<Ray> rays;
+            std::vector<Hit> hits;
+            std::vector<Vec3> lightContributions;
+            std::vector<std::uint64_t> occluded;
+            for (std::size_t first = 0; first < points.size(); first += pointsPerBatch) {
+                const std::size_t count = std::min(pointsPerBatch, points.size() - first);
+
+                // Cosine-distributed directions; the same sampler continues along the path of each ray.
+                auto hemisphereRay = [&](const BakePoint& point, Sampler& sampler) {
+                    const float u0 = sampler.Next1D();
+                    const float u1 = sampler.Next1D();
+                    Vec3 t, b;
+                    BuildOrthonormalBasis(point.normal, t, b);
+                    const float r = std::sqrt(u0);
+                    const float phi = 2.0f * Pi * u1;
+                    Ray ray;
+                    ray.direction = t * (r * std::cos(phi)) + b * (r * std::sin(phi)) + point.normal * std::sqrt(std::max(0.0f, 1.0f - u0));
+                    ray.origin = OffsetRayOrigin(point.position, point.geometricNormal, ray.direction);
+                    return ray;
+                };
+                rays.resize(count * samples);
+                hits.resize(count * samples);
+                ParallelFor(pool, count, [&](std::size_t i) {
+                    const BakePoint& point = points[first + i];
+                    for (std::size_t s = 0; s < samples; ++s) {
+                        Ray& ray = rays[i * samples + s];
+                        if (point.valid) {
+                            Sampler sampler(settings.seed, first + i, s);
+                            ray = hemisphereRay(point, sampler);
+                        } else {
+                            ray = Ray{};
+                            ray.tMax = 0.0f;
+                        }
+                    }
+                });
+                IntersectRays(pool, scene, topLevel, rays, hits);
+
+                ParallelFor(pool, count, [&](std::size_t i) {
+                    const BakePoint& point = points[first + i];
+                    if (!point.valid) {
+                        return;
+                    }
+                    std::uint32_t unoccluded = 0;
+                    Vec3 radiance;
+                    for (std::size_t s = 0; s < samples; ++s) {
+                        const Hit& hit = hits[i * samples + s];
+                        if (!hit.IsValid() || hit.t > settings.occlusionDistance) {
+                            unoccluded++;
+                        }
+                        if (tracePath != nullptr) {
+                            // Replay the direction draw so the path continues the ray's random sequence.
+                            Sampler sampler(settings.seed, first + i, s);
+                            const Ray ray = hemisphereRay(point, sampler);
+                            radiance += tracePath(scene, topLevel, ray, sampler, integrator, nullptr, &hit, nullptr);
+                        }
+                    }
+                    ambientOcclusion[first + i] = static_cast<float>(unoccluded) / static_cast<float>(samples);
+                    if (tracePath != nullptr) {
+                        // Irradiance is pi times the mean radiance of cosine-distributed directions.
+                        const Vec3 e = radiance * (Pi / static_cast<float>(samples));
+                        irradiance[(first + i) * 3 + 0] = e.x;
+                        irradiance[(first + i) * 3 + 1] = e.y;
+                        irradiance[(first + i) * 3 + 2] = e.z;
+                    }
+                });
+
+                if (lightCount == 0) {
+                    continue;
+                }
+                rays.resize(count * lightCount);
+                lightContributions.resize(count * lightCount);
+                occluded.resize(OcclusionMaskWords(rays.size()));
+                ParallelFor(pool, count, [&](std::size_t i) {
+                    const BakePoint& point = points[first + i];
+                    for (std::size_t light = 0; light < lightCount; ++light) {
+                        Ray& ray = rays[i * lightCount + light];
+                        Vec3& contribution = lightContributions[i * lightCount + light];
+                        ray = Ray{};
+                        ray.tMax = 0.0f;
+                        contribution = Vec3();
+                        if (!point.valid) {
+                            continue;
+                        }
+                        Vec3 wi;
+                        float distance = 0.0f;
+                        const Vec3 li = SamplePunctualLight(scene.lights[light], point.position, wi, distance);
+                        const float cosine = Dot(point.normal, wi);
+                        if (MaxComponent(li) <= 0.0f || cosine <= 0.0f) {
+                            continue;
+                        }
+                        ray.origin = OffsetRayOrigin(point.position, point.geometricNormal, wi);
+                        ray.direction = wi;
+                        ray.tMax = distance == Infinity ? Infinity : distance * (1.0f - 1e-4f);
+                        contribution = li * cosine;
+                    }
+                });
+                OccludedRays(pool, scene, topLevel, rays, occluded);
+                ParallelFor(pool, count, [&](std::size_t i) {
+                    for (std::size_t light = 0; light < lightCount; ++light) {
+                        const std::size_t ray = i * lightCount + light;
+                        if ((occluded[ray / 64] >> (ray % 64) & 1) == 0) {
+                            irradiance[(first + i) * 3 + 0] += lightContributions[ray].x;
+                            irradiance[(first + i) * 3 + 1] += lightContributions[ray].y;
+                            irradiance[(first + i) * 3 + 2] += lightContributions[ray].z;
+                        }
+                    }
+                });
+            }
+        }
+
+        // Fill uncovered texels next to filled ones with the mean of those neighbors, once per iteration.
+        void DilateTexels(BakeResult& result, std::uint32_t iterations)
+        {
+            const std::uint32_t width = result.width;
+            const std::uint32_t height = result.height;
+            std::vector<std::uint8_t> filled = result.covered;
+            std::vector<std::uint8_t> next;
+            for (std::uint32_t iteration = 0; iteration < iterations; ++iteration) {
+                next = filled;
+                for (std::uint32_t y = 0; y < height; ++y) {
+                    for (std::uint32_t x = 0; x < width; ++x) {
+                        const std::size_t texel = static_cast<std::size_t>(y) * width + x;
+                        if (filled[texel]) {
+                            continue;
+                        }
+                        float ao = 0.0f;
+                        Vec3 e;
+                        std::uint32_t neighbors = 0;
+                        for (std::uint32_t ny = y > 0 ? y - 1 : 0; ny <= std::min(y + 1, height - 1); ++ny) {
+                            for (std::uint32_t nx = x > 0 ? x - 1 : 0; nx <= std::min(x + 1, width - 1); ++nx) {
+                                const std::size_t neighbor = static_cast<std::size_t>(ny) * width + nx;
+                                if (!filled[neighbor]) {
+                                    continue;
+                                }
+                                ao += result.ambientOcclusion[neighbor];
+                                if (!result.irradiance.empty()) {
+                                    e += Vec3(result.irradiance[neighbor * 3 + 0], result.irradiance[neighbor * 3 + 1], result.irradiance[neighbor * 3 + 2]);
+                                }
+                                neighbors++;
+                            }
+                        }
+                        if (neighbors == 0) {
+                            continue;
+                        }
+                        const float scale = 1.0f / static_cast<float>(neighbors);
+                        result.ambientOcclusion[texel] = ao * scale;
+                        if (!result.irradiance.empty()) {
+                            result.irradiance[texel * 3 + 0] = e.x * scale;
+                            result.irradiance[texel * 3 + 1] = e.y * scale;
+                            result.irradiance[texel * 3 + 2] = e.z * scale;
+                        }
+                        next[texel] = 1;
+                    }
+                }
+                std::swap(filled, next);
+            }
+        }
+
+        bool WritePfm(const std::string& path, std::uint32_t width, std::uint32_t height, std::uint32_t channels, const std::vector<float>& values)
+        {
+            std::ofstream file(path, std::ios::binary);
+            if (!file) {
+                return false;
+            }
+            // A negative scale marks little-endian data.
+            file << (channels == 3 ? "PF" : "Pf") << '\n' << width << ' ' << height << '\n' << (std::endian::native == std::endian::little ? "-1.0" : "1.0") << '\n';
+            const std::size_t rowFloats = static_cast<std::size_t>(width) * channels;
+            for (std::uint32_t row = height; row-- > 0;) {
+                file.write(reinterpret_cast<const char*>(values.data() + row * rowFloats), static_cast<std::streamsize>(rowFloats * sizeof(float)));
+            }
+            return static_cast<bool>(file);
+        }
+    }
+
+    bool BakeVertices(WorkerPool& pool, const RtScene& scene, const TopLevelAccel& topLevel, std::uint32_t nodeIndex, const BakeSettings& settings,
+        BakeResult& result)
+    {
+        result = {};
+        const scene_core::Scene& source = *scene.source;
+        if (nodeIndex >= source.nodes.size() || source.nodes[nodeIndex].mesh.meshIndex >= source.meshes.size()) {
+            return false;
+        }
+        const scene_core::Mesh& mesh = source.meshes[source.nodes[nodeIndex].mesh.meshIndex];
+        const Affine3 objectToWorld = NodeToWorld(source, nodeIndex);
+        const Affine3 worldToObject = Inverse(objectToWorld);
+
+        const std::vector<Vec3> normals = VertexNormals(mesh);
+        std::vector<BakePoint> points(normals.size());
+        for (std::uint32_t i = 0; i < points.size(); ++i) {
+            BakePoint& point = points[i];
+            point.position = objectToWorld.TransformPoint(MeshPosition(mesh, i));
+            point.valid = TransformNormal(worldToObject, normals[i], point.normal);
+            point.geometricNormal = point.normal;
+        }
+        BakePoints(pool, scene, topLevel, points, settings, result.ambientOcclusion, result.irradiance);
+        return true;
+    }
+
+    bool BakeTexels(WorkerPool& pool, const RtScene& scene, const TopLevelAccel& topLevel, std::uint32_t nodeIndex, std::uint32_t width,
+        std::uint32_t height, const BakeSettings& settings, BakeResult& result)
+    {
+        result = {};
+        const scene_core::Scene& source = *scene.source;
+        if (nodeIndex >= source.nodes.size() || source.nodes[nodeIndex].mesh.meshIndex >= source.meshes.size()) {
+            return false;
+        }
+        const scene_core::MeshRef& ref = source.nodes[nodeIndex].mesh;
+        const scene_core::Mesh& mesh = source.meshes[ref.meshIndex];
+        const std::size_t vertexCount = mesh.vertexStreams.positions.size() / 3;
+        const std::vector<float>& texcoords = mesh.vertexStreams.texcoords1.size() == vertexCount * 2 ? mesh.vertexStreams.texcoords1 : mesh.vertexStreams.texcoords0;
+        if (vertexCount == 0 || texcoords.size() != vertexCount * 2) {
+            return false;
+        }
+        const Affine3 objectToWorld = NodeToWorld(source, nodeIndex);
+        const Affine3 worldToObject = Inverse(objectToWorld);
+        const bool hasNormals = mesh.vertexStreams.normals.size() == vertexCount * 3;
+
+        result.width = width;
+        result.height = height;
+        result.covered.assign(static_cast<std::size_t>(width) * height, 0);
+
+        // Rasterize the triangles in texture space; a texel covered twice keeps the last triangle.
+        std::vector<BakePoint> points;
+        std::vector<std::size_t> texels;
+        std::vector<std::uint32_t> pointOfTexel(result.covered.size(), InvalidIndex);
+        for (const scene_core::Submesh& range : ReferencedRanges(mesh, ref.submeshIndex)) {
+            const std::uint32_t end = std::min<std::uint32_t>(range.indexOffset + range.indexCount, static_cast<std::uint32_t>(mesh.indices.size()));
+            for (std::uint32_t first = range.indexOffset; first + 3 <= end; first += 3) {
+                const std::uint32_t index[3] = { mesh.indices[first + 0], mesh.indices[first + 1], mesh.indices[first + 2] };
+                if (index[0] >= vertexCount || index[1] >= vertexCount || index[2] >= vertexCount) {
+                    continue;
+                }
+                // Texel centers at integer coordinates.
+                float tx[3], ty[3];
+                for (int k = 0; k < 3; ++k) {
+                    tx[k] = texcoords[2 * index[k] + 0] * static_cast<float>(width) - 0.5f;
+                    ty[k] = texcoords[2 * index[k] + 1] * static_cast<float>(height) - 0.5f;
+                }
+                const float area = (tx[1] - tx[0]) * (ty[2] - ty[0]) - (tx[2] - tx[0]) * (ty[1] - ty[0]);
+                if (area == 0.0f) {
+                    continue;
+                }
+                const Vec3 p0 = MeshPosition(mesh, index[0]);
+                const Vec3 p1 = MeshPosition(mesh, index[1]);
+                const Vec3 p2 = MeshPosition(mesh, index[2]);
+                Vec3 geometricNormal;
+                if (!TransformNormal(worldToObject, Cross(p1 - p0, p2 - p0), geometricNormal)) {
+                    continue;
+                }
+
+                const int x0 = std::max(0, static_cast<int>(std::ceil(std::min({ tx[0], tx[1], tx[2] }))));
+                const int x1 = std::min(static_cast<int>(width) - 1, static_cast<int>(std::floor(std::max({ tx[0], tx[1], tx[2] }))));
+                const int y0 = std::max(0, static_cast<int>(std::ceil(std::min({ ty[0], ty[1], ty[2] }))));
+                const int y1 = std::min(static_cast<int>(height) - 1, static_cast<int>(std::floor(std::max({ ty[0], ty[1], ty[2] }))));
+                for (int y = y0; y <= y1; ++y) {
+                    for (int x = x0; x <= x1; ++x) {
+                        const float px = static_cast<float>(x);
+                        const float py = static_cast<float>(y);
+                        const float b1 = ((px - tx[0]) * (ty[2] - ty[0]) - (tx[2] - tx[0]) * (py - ty[0])) / area;
+                        const float b2 = ((tx[1] - tx[0]) * (py - ty[0]) - (px - tx[0]) * (ty[1] - ty[0])) / area;
+                        const float b0 = 1.0f - b1 - b2;
+                        if (b0 < 0.0f || b1 < 0.0f || b2 < 0.0f) {
+                            continue;
+                        }
+                        BakePoint point;
+                        point.position = objectToWorld.TransformPoint(p0 * b0 + p1 * b1 + p2 * b2);
+                        point.geometricNormal = geometricNormal;
+                        point.normal = geometricNormal;
+                        point.valid = true;
+                        if (hasNormals) {
+                            Vec3 n;
+                            for (int k = 0; k < 3; ++k) {
+                                const float* vn = &mesh.vertexStreams.normals[3 * index[k]];
+                                n += Vec3(vn[0], vn[1], vn[2]) * (k == 0 ? b0 : k == 1 ? b1 : b2);
+                            }
+                            point.valid = TransformNormal(worldToObject, n, point.normal);
+                            // Keep rays on the side the vertex normals face.
+                            if (Dot(point.geometricNormal, point.normal) < 0.0f) {
+                                point.geometricNormal = -point.geometricNormal;
+                            }
+                        }
+                        const std::size_t texel = static_cast<std::size_t>(y) * width + static_cast<std::size_t>(x);
+                        if (pointOfTexel[texel] == InvalidIndex) {
+                            pointOfTexel[texel] = static_cast<std::uint32_t>(points.size());
+                            points.push_back(point);
+                            texels.push_back(texel);
+                        } else {
+                            points[pointOfTexel[texel]] = point;
+                        }
+                    }
+                }
+            }
+        }
+
+        std::vector<float> ambientOcclusion;
+        std::vector<float> irradiance;
+        BakePoints(pool, scene, topLevel, points, settings, ambientOcclusion, irradiance);
+        result.ambientOcclusion.assign(result.covered.size(), 0.0f);
+        result.irradiance.assign(irradiance.empty() ? 0 : result.covered.size() * 3, 0.0f);
+        for (std::size_t i = 0; i < points.size(); ++i) {
+            const std::size_t texel = texels[i];
+            result.covered[texel] = points[i].valid ? 1 : 0;
+            result.ambientOcclusion[texel] = ambientOcclusion[i];
+            if (!irradiance.empty()) {
+                std::copy_n(&irradiance[i * 3], 3, &result.irradiance[texel * 3]);
+            }
+        }
+        DilateTexels(result, settings.dilation);
+        return true;
+    }
+
+    std::vector<float> PackBakeRgba(const BakeResult& result)
+    {
+        std::vector<float> rgba(result.ambientOcclusion.size() * 4, 0.0f);
+        for (std::size_t i = 0; i < result.ambientOcclusion.size(); ++i) {
+            if (!result.irradiance.empty()) {
+                std::copy_n(&result.irradiance[i * 3], 3, &rgba[i * 4]);
+            }
+            rgba[i * 4 + 3] = result.ambientOcclusion[i];
+        }
+        return rgba;
+    }
+
+    bool StoreVertexBake(const BakeResult& result, scene_core::Mesh& mesh, bool overwrite)
+    {
+        if (result.width != 0 || result.ambientOcclusion.size() != mesh.vertexStreams.positions.size() / 3) {
+            return false;
+        }
+        if (!mesh.vertexStreams.colors.empty() && !overwrite) {
+            return false;
+        }
+        mesh.vertexStreams.colors = PackBakeRgba(result);
+        return true;
+    }
+
+    bool WriteTexelBake(const std::string& basePath, const BakeResult& result)
+    {
+        if (result.width == 0 || result.height == 0) {
+            return false;
+        }
+        if (!result.irradiance.empty() && !WritePfm(basePath + "_irradiance.pfm", result.width, result.height, 3, result.irradiance)) {
+            return false;
+        }
+        return WritePfm(basePath + "_ao.pfm", result.width, result.height, 1, result.ambientOcclusion);
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../scene-core/scene.h"
+#include "cpu_rt_scene.h"
+#include "cpu_rt_threading.h"
+
+namespace cpu_rt
+{
+    struct BakeSettings
+    {
+        // Cosine-distributed hemisphere rays per vertex or texel, shared by occlusion and irradiance.
+        std::uint32_t samplesPerPoint = 64;
+        // Hemisphere rays hitting geometry within this distance count as occluded.
+        float occlusionDistance = Infinity;
+        // Also bake irradiance: the hemisphere rays continue as paths of up to maxDepth bounces, and every
+        // punctual light is shadow-tested once per point. Otherwise only occlusion is baked.
+        bool irradiance = true;
+        std::uint32_t maxDepth = 4;
+        std::array<float, 3> environmentRadiance = { 0.0f, 0.0f, 0.0f };
+        std::uint64_t seed = 0;
+        // Rays per batched query. A batch holds the rays of consecutive vertices, or of the texels of
+        // consecutive triangles, of one mesh, so neighboring rays start close together and traverse the
+        // same nodes.
+        std::size_t batchRays = std::size_t(1) << 20;
+        // Texel bakes: uncovered texels next to covered ones are filled from their neighbors this many
+        // times, so bilinear filtering at chart edges does not blend in black.
+        std::uint32_t dilation = 2;
+    };
+
+    struct BakeResult
+    {
+        // Texel bakes only; vertex bakes leave both 0.
+        std::uint32_t width = 0;
+        std::uint32_t height = 0;
+        // One entry per vertex, or per texel row-major with v = 0 in the first row.
+        // Fraction of unoccluded hemisphere rays.
+        std::vector<float> ambientOcclusion;
+        // World-space RGB irradiance; empty if not baked.
+        std::vector<float> irradiance;
+        // Texel bakes: 1 where a triangle covers the texel center, 0 where the value is dilated or empty.
+        std::vector<std::uint8_t> covered;
+    };
+
+    // Bake every vertex of the mesh a node references, placed by the node's world transform, with the
+    // hemisphere around the vertex normal (area-weighted face normals if the mesh has none). Returns false
+    // if the node references no mesh.
+    bool BakeVertices(WorkerPool& pool, const RtScene& scene, const TopLevelAccel& topLevel, std::uint32_t nodeIndex, const BakeSettings& settings,
+        BakeResult& result);
+
+    // Bake a width x height lightmap of the triangles a node draws, rasterized in texcoords1 (texcoords0 if
+    // the mesh has no second set). Returns false if the node references no mesh with texture coordinates.
+    bool BakeTexels(WorkerPool& pool, const RtScene& scene, const TopLevelAccel& topLevel, std::uint32_t nodeIndex, std::uint32_t width,
+        std::uint32_t height, const BakeSettings& settings, BakeResult& result);
+
+    // Irradiance RGB and occlusion in alpha per vertex or texel (RGB 0 if irradiance was not baked).
+    std::vector<float> PackBakeRgba(const BakeResult& result);
+
+    // Write a vertex bake into the mesh's colors stream as PackBakeRgba(). Returns false if the vertex
+    // counts differ, or if the mesh already has colors and overwrite is not set. Bakes are in world space
+    // for one node, so a mesh drawn by several nodes stores the result of the node that was baked.
+    bool StoreVertexBake(const BakeResult& result, scene_core::Mesh& mesh, bool overwrite = false);
+
+    // Write a texel bake as two float images, <basePath>_irradiance.pfm (RGB) and <basePath>_ao.pfm
+    // (grayscale), bottom row first as PFM requires. Returns false if a file cannot be written.
+    bool WriteTexelBake(const std::string& basePath, const BakeResult& result);
+}
@@ -0,0 +1,201 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "pbrt_loader.h"
+#include "cpu_rt_benchmark.h"
+#include "cpu_rt_diagnostics.h"
+#include "cpu_rt_isa.h"
+#include "cpu_rt_mesh_merge.h"
+
+namespace
+{
+    void AppendSphere(scene_core::Mesh& mesh, float cx, float cy, float cz, float radius, std::uint32_t rings)
+    {
+        const std::uint32_t base = static_cast<std::uint32_t>(mesh.vertexStreams.positions.size() / 3);
+        const std::uint32_t segments = 2 * rings;
+        for (std::uint32_t i = 0; i <= rings; ++i) {
+            const float theta = 3.14159265f * static_cast<float>(i) / static_cast<float>(rings);
+            for (std::uint32_t j = 0; j <= segments; ++j) {
+                const float phi = 6.28318531f * static_cast<float>(j) / static_cast<float>(segments);
+                const float n[3] = { std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi) };
+                mesh.vertexStreams.positions.insert(mesh.vertexStreams.positions.end(), { cx + radius * n[0], cy + radius * n[1], cz + radius * n[2] });
+                mesh.vertexStreams.normals.insert(mesh.vertexStreams.normals.end(), { n[0], n[1], n[2] });
+            }
+        }
+        for (std::uint32_t i = 0; i < rings; ++i) {
+            for (std::uint32_t j = 0; j < segments; ++j) {
+                const std::uint32_t a = base + i * (segments + 1) + j;
+                const std::uint32_t b = a + segments + 1;
+                mesh.indices.insert(mesh.indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+            }
+        }
+    }
+
+    void AppendWall(scene_core::Mesh& mesh, float halfSize, float z)
+    {
+        const std::uint32_t base = static_cast<std::uint32_t>(mesh.vertexStreams.positions.size() / 3);
+        mesh.vertexStreams.positions.insert(mesh.vertexStreams.positions.end(),
+            { -halfSize, -halfSize, z, halfSize, -halfSize, z, halfSize, halfSize, z, -halfSize, halfSize, z });
+        for (int i = 0; i < 4; ++i) {
+            mesh.vertexStreams.normals.insert(mesh.vertexStreams.normals.end(), { 0.0f, 0.0f, 1.0f });
+        }
+        mesh.indices.insert(mesh.indices.end(), { base, base + 1, base + 2, base, base + 2, base + 3 });
+    }
+
+    // Grid of tessellated spheres, one mesh each, in front of a wall. Used without a scene file.
+    scene_core::Scene MakeBuiltinScene()
+    {
+        constexpr std::uint32_t GridSize = 8;
+        scene_core::Scene scene;
+        scene.name = "builtin";
+        scene_core::MaterialPBR diffuse;
+        diffuse.metallicFactor = 0.0f;
+        scene.materials.push_back(diffuse);
+        scene_core::MaterialPBR metal;
+        metal.metallicFactor = 1.0f;
+        metal.roughnessFactor = 0.3f;
+        scene.materials.push_back(metal);
+
+        scene_core::Node root;
+        scene.nodes.push_back(root);
+        for (std::uint32_t i = 0; i <= GridSize * GridSize; ++i) {
+            scene_core::Mesh mesh;
+            if (i < GridSize * GridSize) {
+                const float x = static_cast<float>(i % GridSize) - 0.5f * (GridSize - 1);
+                const float y = static_cast<float>(i / GridSize) - 0.5f * (GridSize - 1);
+                AppendSphere(mesh, x, y, 0.0f, 0.45f, 32);
+            } else {
+                AppendWall(mesh, 0.5f * GridSize, -1.0f);
+            }
+            mesh.submeshes.push_back({ i % 2, 0, static_cast<std::uint32_t>(mesh.indices.size()) });
+            scene.meshes.push_back(std::move(mesh));
+
+            scene_core::Node node;
+            node.mesh = { i, scene_core::InvalidIndex };
+            scene.nodes[0].children.push_back(static_cast<std::uint32_t>(scene.nodes.size()));
+            scene.nodes.push_back(node);
+        }
+
+        scene_core::Light light;
+        light.intensity = 3.0f;
+        scene.lights.push_back(light);
+        scene_core::Node lightNode;
+        lightNode.lightIndex = 0;
+        lightNode.localTransform.rotation = { 0.2f, -0.2f, 0.0f, 0.96f };
+        scene.nodes[0].children.push_back(static_cast<std::uint32_t>(scene.nodes.size()));
+        scene.nodes.push_back(lightNode);
+        scene.rootNode = 0;
+        return scene;
+    }
+
+    void PrintUsage(const char* program)
+    {
+        std::fprintf(stderr,
+            "usage: %s [scene.pbrt] [options]\n"
+            "  Without a scene a built-in grid of tessellated spheres is rendered.\n"
+            "  --threads N,M,...         thread counts to measure (default: 1 to the logical CPU count)\n"
+            "  --pin                     pin each worker to one logical CPU\n"
+            "  --order os|physical|smt   CPU order: OS numbering, physical cores first, or SMT siblings first\n"
+            "  --size WxH                image size (default 640x360)\n"
+            "  --spp N                   samples per pixel per render (default 4)\n"
+            "  --repeat N                runs per step, the fastest counts (default 3)\n"
+            "  --isa NAME                kernel instruction set: baseline, sse4.2, avx2 or avx512 (default: best supported)\n"
+            "  --perf                    collect hardware counters per thread (Linux perf events)\n"
+            "  --merge-meshes            merge small single-use meshes by material before building accels\n"
+            "  --bvh-report              build the scene once and report BVH quality per accel instead\n"
+            "  --json                    write JSON instead of CSV\n",
+            program);
+    }
+}
+
+// Thread-scaling benchmark, or BVH quality report; writes the report to stdout.
+int main(int argc, char** argv)
+{
+    cpu_rt::ScalingBenchmarkSettings settings;
+    settings.render.width = 640;
+    settings.render.height = 360;
+    settings.render.samplesPerPixel = 4;
+    const char* scenePath = nullptr;
+    bool json = false;
+    bool bvhReport = false;
+    bool mergeMeshes = false;
+    for (int i = 1; i < argc; ++i) {
+        const bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--threads") == 0 && hasValue) {
+            for (char* token = std::strtok(argv[++i], ","); token != nullptr; token = std::strtok(nullptr, ",")) {
+                settings.threadCounts.push_back(static_cast<std::uint32_t>(std::strtoul(token, nullptr, 10)));
+            }
+        } else if (std::strcmp(argv[i], "--pin") == 0) {
+            settings.render.threading.pinThreads = true;
+        } else if (std::strcmp(argv[i], "--order") == 0 && hasValue) {
+            const std::string order = argv[++i];
+            if (order == "physical") {
+                settings.render.threading.cpuOrder = cpu_rt::CpuOrder::PhysicalCoresFirst;
+            } else if (order == "smt") {
+                settings.render.threading.cpuOrder = cpu_rt::CpuOrder::SmtSiblingsFirst;
+            } else if (order != "os") {
+                PrintUsage(argv[0]);
+                return 2;
+            }
+        } else if (std::strcmp(argv[i], "--size") == 0 && hasValue) {
+            if (std::sscanf(argv[++i], "%ux%u", &settings.render.width, &settings.render.height) != 2) {
+                PrintUsage(argv[0]);
+                return 2;
+            }
+        } else if (std::strcmp(argv[i], "--spp") == 0 && hasValue) {
+            settings.render.samplesPerPixel = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--repeat") == 0 && hasValue) {
+            settings.repetitions = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--isa") == 0 && hasValue) {
+            cpu_rt::Isa isa = cpu_rt::Isa::Baseline;
+            if (!cpu_rt::ParseIsa(argv[++i], isa)) {
+                PrintUsage(argv[0]);
+                return 2;
+            }
+            if (isa > cpu_rt::DetectIsa()) {
+                std::fprintf(stderr, "%s is not supported by this CPU, using %s\n", cpu_rt::IsaName(isa), cpu_rt::IsaName(cpu_rt::DetectIsa()));
+            }
+            cpu_rt::SetIsaOverride(isa);
+        } else if (std::strcmp(argv[i], "--perf") == 0) {
+            settings.perfCounters = true;
+        } else if (std::strcmp(argv[i], "--merge-meshes") == 0) {
+            mergeMeshes = true;
+        } else if (std::strcmp(argv[i], "--bvh-report") == 0) {
+            bvhReport = true;
+        } else if (std::strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (argv[i][0] != '-' && scenePath == nullptr) {
+            scenePath = argv[i];
+        } else {
+            PrintUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    scene_core::Scene scene = scenePath != nullptr ? scene_io_pbrt::LoadSceneFromPbrt(scenePath) : MakeBuiltinScene();
+    if (mergeMeshes) {
+        scene = cpu_rt::MergeSmallMeshes(scene);
+    }
+    if (bvhReport) {
+        const cpu_rt::RtScene rtScene = cpu_rt::BuildRtScene(scene, settings.render.bvh, settings.render.accelStorage);
+        const cpu_rt::SceneBvhReport report = cpu_rt::AnalyzeSceneBvhs(rtScene, settings.render.bvh);
+        if (json) {
+            cpu_rt::WriteBvhReportJson(std::cout, report);
+        } else {
+            cpu_rt::WriteBvhReportCsv(std::cout, report);
+        }
+        return 0;
+    }
+
+    const cpu_rt::ScalingReport report = cpu_rt::RunScalingBenchmark(scene, settings);
+    if (json) {
+        cpu_rt::WriteScalingJson(std::cout, report);
+    } else {
+        cpu_rt::WriteScalingCsv(std::cout, report);
+    }
+    return 0;
+}
@@ -0,0 +1,233 @@
+#include "cpu_rt_benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <limits>
+
+#include "cpu_rt_traversal.h"
+
+namespace cpu_rt
+{
+    namespace
+    {
+        double SecondsSince(std::chrono::steady_clock::time_point start)
+        {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        void WriteNormalizedCsv(std::ostream& out, const PerfCounts& counts, std::uint64_t divisor)
+        {
+            for (std::size_t e = 0; e < PerfEventCount; ++e) {
+                out << ',';
+                if (counts.valid[e] && divisor != 0) {
+                    out << static_cast<double>(counts.values[e]) / static_cast<double>(divisor);
+                }
+            }
+        }
+
+        // Events that could not be counted are null.
+        void WriteCountsJson(std::ostream& out, const PerfCounts& counts, std::uint64_t divisor)
+        {
+            out << "{ ";
+            for (std::size_t e = 0; e < PerfEventCount; ++e) {
+                out << (e == 0 ? "\"" : ", \"") << PerfEventName(static_cast<PerfEvent>(e)) << "\": ";
+                if (counts.valid[e] && divisor != 0) {
+                    out << static_cast<double>(counts.values[e]) / static_cast<double>(divisor);
+                } else {
+                    out << "null";
+                }
+            }
+            out << " }";
+        }
+
+        const char* CpuOrderName(CpuOrder order)
+        {
+            switch (order) {
+            case CpuOrder::PhysicalCoresFirst:
+                return "physical";
+            case CpuOrder::SmtSiblingsFirst:
+                return "smt";
+            default:
+                return "os";
+            }
+        }
+    }
+
+    ScalingReport RunScalingBenchmark(const scene_core::Scene& scene, const ScalingBenchmarkSettings& settings)
+    {
+        const CpuTopology topology = CpuTopology::Detect();
+        ScalingReport report;
+        report.logicalCpuCount = static_cast<std::uint32_t>(topology.cpus.size());
+        report.physicalCoreCount = topology.PhysicalCoreCount();
+        report.numaNodeCount = topology.numaNodeCount;
+        report.isa = ActiveIsa();
+        report.threading = settings.render.threading;
+        report.perfCounters = settings.perfCounters;
+
+        std::vector<std::uint32_t> threadCounts = settings.threadCounts;
+        if (threadCounts.empty()) {
+            for (std::uint32_t count = 1; count <= report.logicalCpuCount; ++count) {
+                threadCounts.push_back(count);
+            }
+        }
+
+        const Tile crop = CropRect(settings.render.crop, settings.render.width, settings.render.height);
+        report.samplesPerRender = static_cast<std::uint64_t>(crop.x1 - crop.x0) * (crop.y1 - crop.y0) * settings.render.samplesPerPixel;
+        const std::uint32_t repetitions = std::max(1u, settings.repetitions);
+
+        for (std::uint32_t threadCount : threadCounts) {
+            RenderSettings render = settings.render;
+            render.threading.threadCount = std::max(1u, threadCount);
+            Renderer renderer(render);
+
+            ScalingStep step;
+            WorkerPool& pool = renderer.GetWorkerPool();
+            const std::uint32_t workerCount = pool.WorkerCount();
+            step.threadCount = workerCount;
+            step.buildSeconds = std::numeric_limits<double>::infinity();
+            step.renderSeconds = std::numeric_limits<double>::infinity();
+
+            // Counters belong to the thread that opens them.
+            PerfCounterSet buildCounters;
+            std::vector<PerfCounterSet> workerCounters(workerCount);
+            if (settings.perfCounters) {
+                buildCounters.Open();
+                pool.Run([&](const WorkerInfo& worker) { workerCounters[worker.index].Open(); });
+            }
+
+            for (std::uint32_t run = 0; run < repetitions; ++run) {
+                buildCounters.Start();
+                const auto start = std::chrono::steady_clock::now();
+                renderer.SetScene(scene);
+                const double seconds = SecondsSince(start);
+                const PerfCounts counts = buildCounters.Stop();
+                if (seconds < step.buildSeconds) {
+                    step.buildSeconds = seconds;
+                    step.buildCounters = counts;
+                }
+            }
+
+            std::vector<std::uint64_t> raysBefore(workerCount);
+            std::vector<std::uint64_t> rays(workerCount);
+            std::vector<PerfCounts> counts(workerCount);
+            for (std::uint32_t run = 0; run < repetitions; ++run) {
+                renderer.ResetAccumulation();
+                pool.Run([&](const WorkerInfo& worker) {
+                    raysBefore[worker.index] = TracedRayCount();
+                    workerCounters[worker.index].Start();
+                });
+                const auto start = std::chrono::steady_clock::now();
+                renderer.RenderSamples(render.samplesPerPixel);
+                const double seconds = SecondsSince(start);
+                pool.Run([&](const WorkerInfo& worker) {
+                    counts[worker.index] = workerCounters[worker.index].Stop();
+                    rays[worker.index] = TracedRayCount() - raysBefore[worker.index];
+                });
+                if (seconds < step.renderSeconds) {
+                    step.renderSeconds = seconds;
+                    step.workerCounters = counts;
+                    step.workerRays = rays;
+                }
+            }
+
+            step.renderCounters.valid.fill(true);
+            for (std::uint32_t i = 0; i < workerCount; ++i) {
+                step.renderCounters += step.workerCounters[i];
+                step.rays += step.workerRays[i];
+            }
+
+            report.primitiveCount = 0;
+            for (const MeshAccel& accel : renderer.GetRtScene().meshAccels) {
+                report.primitiveCount += accel.triangles.size() + accel.shapes.size();
+            }
+            step.buildPrimitivesPerSecond = static_cast<double>(report.primitiveCount) / std::max(step.buildSeconds, 1e-9);
+            step.samplesPerSecond = static_cast<double>(report.samplesPerRender) / std::max(step.renderSeconds, 1e-9);
+            step.raysPerSecond = static_cast<double>(step.rays) / std::max(step.renderSeconds, 1e-9);
+            report.steps.push_back(step);
+        }
+
+        // Efficiency is per-thread throughput against the first step, which is usually the serial one.
+        if (!report.steps.empty()) {
+            const ScalingStep& base = report.steps.front();
+            for (ScalingStep& step : report.steps) {
+                const double threadRatio = static_cast<double>(base.threadCount) / static_cast<double>(step.threadCount);
+                step.buildEfficiency = step.buildPrimitivesPerSecond / std::max(base.buildPrimitivesPerSecond, 1e-30) * threadRatio;
+                step.renderEfficiency = step.samplesPerSecond / std::max(base.samplesPerSecond, 1e-30) * threadRatio;
+            }
+        }
+        return report;
+    }
+
+    void WriteScalingCsv(std::ostream& out, const ScalingReport& report)
+    {
+        out << "threads,build_seconds,render_seconds,build_prims_per_second,samples_per_second,rays_per_second,build_efficiency,render_efficiency";
+        if (report.perfCounters) {
+            for (std::size_t e = 0; e < PerfEventCount; ++e) {
+                out << ",build_" << PerfEventName(static_cast<PerfEvent>(e)) << "_per_prim";
+            }
+            for (std::size_t e = 0; e < PerfEventCount; ++e) {
+                out << ",render_" << PerfEventName(static_cast<PerfEvent>(e)) << "_per_ray";
+            }
+        }
+        out << '\n' << std::setprecision(6);
+        for (const ScalingStep& step : report.steps) {
+            out << step.threadCount << ',' << step.buildSeconds << ',' << step.renderSeconds << ','
+                << step.buildPrimitivesPerSecond << ',' << step.samplesPerSecond << ',' << step.raysPerSecond << ','
+                << step.buildEfficiency << ',' << step.renderEfficiency;
+            if (report.perfCounters) {
+                WriteNormalizedCsv(out, step.buildCounters, report.primitiveCount);
+                WriteNormalizedCsv(out, step.renderCounters, step.rays);
+            }
+            out << '\n';
+        }
+    }
+
+    void WriteScalingJson(std::ostream& out, const ScalingReport& report)
+    {
+        out << std::setprecision(6);
+        out << "{\n";
+        out << "  \"logicalCpus\": " << report.logicalCpuCount << ",\n";
+        out << "  \"physicalCores\": " << report.physicalCoreCount << ",\n";
+        out << "  \"numaNodes\": " << report.numaNodeCount << ",\n";
+        out << "  \"isa\": \"" << IsaName(report.isa) << "\",\n";
+        out << "  \"pinThreads\": " << (report.threading.pinThreads ? "true" : "false") << ",\n";
+        out << "  \"cpuOrder\": \"" << CpuOrderName(report.threading.cpuOrder) << "\",\n";
+        out << "  \"primitives\": " << report.primitiveCount << ",\n";
+        out << "  \"samplesPerRender\": " << report.samplesPerRender << ",\n";
+        out << "  \"steps\": [";
+        for (std::size_t i = 0; i < report.steps.size(); ++i) {
+            const ScalingStep& step = report.steps[i];
+            out << (i == 0 ? "\n" : ",\n");
+            out << "    { \"threads\": " << step.threadCount
+                << ", \"buildSeconds\": " << step.buildSeconds
+                << ", \"renderSeconds\": " << step.renderSeconds
+                << ", \"buildPrimsPerSecond\": " << step.buildPrimitivesPerSecond
+                << ", \"samplesPerSecond\": " << step.samplesPerSecond
+                << ", \"rays\": " << step.rays
+                << ", \"raysPerSecond\": " << step.raysPerSecond
+                << ", \"buildEfficiency\": " << step.buildEfficiency
+                << ", \"renderEfficiency\": " << step.renderEfficiency;
+            if (report.perfCounters) {
+                out << ",\n      \"buildCounters\": ";
+                WriteCountsJson(out, step.buildCounters, 1);
+                out << ",\n      \"buildCountersPerPrim\": ";
+                WriteCountsJson(out, step.buildCounters, report.primitiveCount);
+                out << ",\n      \"renderCounters\": ";
+                WriteCountsJson(out, step.renderCounters, 1);
+                out << ",\n      \"renderCountersPerRay\": ";
+                WriteCountsJson(out, step.renderCounters, step.rays);
+                out << ",\n      \"workers\": [";
+                for (std::size_t w = 0; w < step.workerCounters.size(); ++w) {
+                    out << (w == 0 ? "\n" : ",\n") << "        { \"rays\": " << step.workerRays[w] << ", \"counters\": ";
+                    WriteCountsJson(out, step.workerCounters[w], 1);
+                    out << " }";
+                }
+                out << "\n      ]\n    }";
+            } else {
+                out << " }";
+            }
+        }
+        out << "\n  ]\n}\n";
+    }
+}
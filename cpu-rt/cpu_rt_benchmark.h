@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "../scene-core/scene.h"
+#include "cpu_rt.h"
+#include "cpu_rt_isa.h"
+#include "cpu_rt_perf_counters.h"
+
+namespace cpu_rt
+{
+    struct ScalingBenchmarkSettings
+    {
+        // Image, sample count and threading options of every step; threading.threadCount is set per step.
+        RenderSettings render;
+        // Thread counts to measure. Empty sweeps every count from 1 to the number of logical CPUs.
+        std::vector<std::uint32_t> threadCounts;
+        // Each step reports the fastest of this many runs.
+        std::uint32_t repetitions = 3;
+        // Collect hardware counters per thread (Linux perf events); steps keep the counts of their fastest runs.
+        bool perfCounters = false;
+    };
+
+    struct ScalingStep
+    {
+        std::uint32_t threadCount = 0;
+        double buildSeconds = 0.0;
+        double renderSeconds = 0.0;
+        // Primitives (triangles and shapes) per second of Renderer::SetScene().
+        double buildPrimitivesPerSecond = 0.0;
+        // Camera samples per second of Renderer::RenderSamples().
+        double samplesPerSecond = 0.0;
+        // Intersect() and Occluded() calls of the render, e.g. camera, bounce and shadow rays.
+        std::uint64_t rays = 0;
+        double raysPerSecond = 0.0;
+        // Throughput per thread relative to the first step; 1 is linear scaling.
+        double buildEfficiency = 0.0;
+        double renderEfficiency = 0.0;
+
+        // With ScalingBenchmarkSettings::perfCounters. The build runs on the calling thread.
+        PerfCounts buildCounters;
+        // Sum over the workers, and per worker with the rays each traced.
+        PerfCounts renderCounters;
+        std::vector<PerfCounts> workerCounters;
+        std::vector<std::uint64_t> workerRays;
+    };
+
+    struct ScalingReport
+    {
+        std::uint32_t logicalCpuCount = 0;
+        std::uint32_t physicalCoreCount = 0;
+        std::uint32_t numaNodeCount = 0;
+        // Instruction set the kernels ran with.
+        Isa isa = Isa::Baseline;
+        ThreadingSettings threading;
+        std::uint64_t primitiveCount = 0;
+        std::uint64_t samplesPerRender = 0;
+        bool perfCounters = false;
+        std::vector<ScalingStep> steps;
+    };
+
+    // Build and render the scene once per thread count, each step with a fresh Renderer and worker pool.
+    ScalingReport RunScalingBenchmark(const scene_core::Scene& scene, const ScalingBenchmarkSettings& settings);
+
+    // One row per step. With counters, each event is reported per build primitive and per render ray;
+    // fields of events that could not be counted are empty.
+    void WriteScalingCsv(std::ostream& out, const ScalingReport& report);
+    // The machine and settings, and the steps as an array. Counters are reported in total, normalized and per worker.
+    void WriteScalingJson(std::ostream& out, const ScalingReport& report);
+}
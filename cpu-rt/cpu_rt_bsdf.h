@@ -0,0 +1,112 @@
+#pragma once
+
+#include "../scene-core/scene.h"
+#include "cpu_rt_math.h"
+
+namespace cpu_rt
+{
+    // Metallic-roughness BSDF: Lambert diffuse plus GGX specular with Smith shadowing and Schlick Fresnel.
+    struct BsdfParams
+    {
+        Vec3 baseColor = Vec3(0.8f);
+        Vec3 emission;
+        float metallic = 0.0f;
+        // GGX alpha (roughness squared), clamped away from zero.
+        float alpha = 1.0f;
+    };
+
+    inline BsdfParams MakeBsdfParams(const scene_core::MaterialPBR& material)
+    {
+        BsdfParams params;
+        params.baseColor = ToVec3(material.baseColorFactor);
+        params.emission = ToVec3(material.emissiveFactor);
+        params.metallic = std::clamp(material.metallicFactor, 0.0f, 1.0f);
+        const float roughness = std::clamp(material.roughnessFactor, 0.0f, 1.0f);
+        params.alpha = std::max(roughness * roughness, 1e-3f);
+        return params;
+    }
+
+    // Probability of sampling the specular lobe.
+    inline float SpecularSampleProbability(const BsdfParams& params)
+    {
+        return 0.25f + 0.75f * params.metallic;
+    }
+
+    inline float GgxD(float nDotH, float alpha)
+    {
+        const float a2 = alpha * alpha;
+        const float d = nDotH * nDotH * (a2 - 1.0f) + 1.0f;
+        return a2 / (Pi * d * d);
+    }
+
+    inline float SmithG1(float nDotV, float alpha)
+    {
+        const float a2 = alpha * alpha;
+        return 2.0f * nDotV / (nDotV + std::sqrt(a2 + (1.0f - a2) * nDotV * nDotV));
+    }
+
+    inline Vec3 SchlickFresnel(const Vec3& f0, float vDotH)
+    {
+        const float m = std::clamp(1.0f - vDotH, 0.0f, 1.0f);
+        const float m2 = m * m;
+        return f0 + (Vec3(1.0f) - f0) * (m2 * m2 * m);
+    }
+
+    // Evaluate f(wo, wi) and the sampling pdf of wi. All directions are unit vectors pointing away from the surface.
+    inline Vec3 EvaluateBsdf(const BsdfParams& params, const Vec3& n, const Vec3& wo, const Vec3& wi, float& pdf)
+    {
+        pdf = 0.0f;
+        const float nDotL = Dot(n, wi);
+        const float nDotV = Dot(n, wo);
+        if (nDotL <= 0.0f || nDotV <= 0.0f) {
+            return {};
+        }
+
+        const Vec3 h = Normalize(wo + wi);
+        const float nDotH = std::max(Dot(n, h), 0.0f);
+        const float vDotH = std::max(Dot(wo, h), 1e-6f);
+
+        const Vec3 f0 = Lerp(Vec3(0.04f), params.baseColor, params.metallic);
+        const float d = GgxD(nDotH, params.alpha);
+        const float g = SmithG1(nDotV, params.alpha) * SmithG1(nDotL, params.alpha);
+        const Vec3 specular = SchlickFresnel(f0, vDotH) * (d * g / (4.0f * nDotL * nDotV));
+        const Vec3 diffuse = params.baseColor * ((1.0f - params.metallic) * InvPi);
+
+        const float pSpec = SpecularSampleProbability(params);
+        pdf = pSpec * d * nDotH / (4.0f * vDotH) + (1.0f - pSpec) * nDotL * InvPi;
+        return diffuse + specular;
+    }
+
+    struct BsdfSample
+    {
+        Vec3 wi;
+        // f * cos / pdf.
+        Vec3 weight;
+        float pdf = 0.0f;
+    };
+
+    inline bool SampleBsdf(const BsdfParams& params, const Vec3& n, const Vec3& wo, float uLobe, float u0, float u1, BsdfSample& sample)
+    {
+        Vec3 t, b;
+        BuildOrthonormalBasis(n, t, b);
+
+        const float phi = 2.0f * Pi * u1;
+        if (uLobe < SpecularSampleProbability(params)) {
+            const float a2 = params.alpha * params.alpha;
+            const float cosTheta = std::sqrt((1.0f - u0) / (1.0f + (a2 - 1.0f) * u0));
+            const float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+            const Vec3 h = t * (sinTheta * std::cos(phi)) + b * (sinTheta * std::sin(phi)) + n * cosTheta;
+            sample.wi = h * (2.0f * Dot(wo, h)) - wo;
+        } else {
+            const float r = std::sqrt(u0);
+            sample.wi = t * (r * std::cos(phi)) + b * (r * std::sin(phi)) + n * std::sqrt(std::max(0.0f, 1.0f - u0));
+        }
+
+        const Vec3 f = EvaluateBsdf(params, n, wo, sample.wi, sample.pdf);
+        if (sample.pdf <= 0.0f) {
+            return false;
+        }
+        sample.weight = f * (Dot(n, sample.wi) / sample.pdf);
+        return true;
+    }
+}
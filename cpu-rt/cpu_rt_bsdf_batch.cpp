@@ -0,0 +1,306 @@
+#include "cpu_rt_bsdf_batch.h"
+
+#include "cpu_rt_isa.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CPU_RT_BSDF_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace cpu_rt
+{
+    namespace
+    {
+#if CPU_RT_BSDF_SSE2
+        struct V3
+        {
+            __m128 x;
+            __m128 y;
+            __m128 z;
+        };
+
+        inline V3 Load(const Vec3Batch& v, std::uint32_t i)
+        {
+            return { _mm_load_ps(v.x + i), _mm_load_ps(v.y + i), _mm_load_ps(v.z + i) };
+        }
+
+        inline void Store(Vec3Batch& v, std::uint32_t i, const V3& a)
+        {
+            _mm_store_ps(v.x + i, a.x);
+            _mm_store_ps(v.y + i, a.y);
+            _mm_store_ps(v.z + i, a.z);
+        }
+
+        inline V3 Add(const V3& a, const V3& b) { return { _mm_add_ps(a.x, b.x), _mm_add_ps(a.y, b.y), _mm_add_ps(a.z, b.z) }; }
+        inline V3 Sub(const V3& a, const V3& b) { return { _mm_sub_ps(a.x, b.x), _mm_sub_ps(a.y, b.y), _mm_sub_ps(a.z, b.z) }; }
+        inline V3 Mul(const V3& a, __m128 s) { return { _mm_mul_ps(a.x, s), _mm_mul_ps(a.y, s), _mm_mul_ps(a.z, s) }; }
+
+        inline __m128 Dot(const V3& a, const V3& b)
+        {
+            return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)), _mm_mul_ps(a.z, b.z));
+        }
+
+        inline __m128 Select(__m128 mask, __m128 a, __m128 b)
+        {
+            return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+        }
+
+        inline V3 Select(__m128 mask, const V3& a, const V3& b)
+        {
+            return { Select(mask, a.x, b.x), Select(mask, a.y, b.y), Select(mask, a.z, b.z) };
+        }
+
+        // 1 / sqrt(x) from the hardware estimate and one Newton step, about 23 bits.
+        inline __m128 ReciprocalSqrt(__m128 x)
+        {
+            const __m128 r = _mm_rsqrt_ps(x);
+            const __m128 rrx = _mm_mul_ps(_mm_mul_ps(r, r), x);
+            return _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), r), _mm_sub_ps(_mm_set1_ps(3.0f), rrx));
+        }
+
+        // Sine and cosine of 2 pi u for u in [0, 1]: split into quarter turns, polynomials on [-pi/4, pi/4].
+        inline void SinCosTurns(__m128 u, __m128& s, __m128& c)
+        {
+            const __m128 quarters = _mm_mul_ps(u, _mm_set1_ps(4.0f));
+            const __m128i q = _mm_cvtps_epi32(quarters);
+            const __m128 r = _mm_mul_ps(_mm_sub_ps(quarters, _mm_cvtepi32_ps(q)), _mm_set1_ps(0.5f * Pi));
+            const __m128 r2 = _mm_mul_ps(r, r);
+
+            __m128 sr = _mm_set1_ps(-1.0f / 5040.0f);
+            sr = _mm_add_ps(_mm_mul_ps(sr, r2), _mm_set1_ps(1.0f / 120.0f));
+            sr = _mm_add_ps(_mm_mul_ps(sr, r2), _mm_set1_ps(-1.0f / 6.0f));
+            sr = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sr, r2), r), r);
+            __m128 cr = _mm_set1_ps(1.0f / 40320.0f);
+            cr = _mm_add_ps(_mm_mul_ps(cr, r2), _mm_set1_ps(-1.0f / 720.0f));
+            cr = _mm_add_ps(_mm_mul_ps(cr, r2), _mm_set1_ps(1.0f / 24.0f));
+            cr = _mm_add_ps(_mm_mul_ps(cr, r2), _mm_set1_ps(-0.5f));
+            cr = _mm_add_ps(_mm_mul_ps(cr, r2), _mm_set1_ps(1.0f));
+
+            // Odd quarters swap sine and cosine; the sine is negative in quarters 2 and 3, the cosine in 1 and 2.
+            const __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(q, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+            const __m128i sinSign = _mm_slli_epi32(_mm_and_si128(q, _mm_set1_epi32(2)), 30);
+            const __m128i cosSign = _mm_slli_epi32(_mm_and_si128(_mm_add_epi32(q, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30);
+            s = _mm_xor_ps(Select(swap, cr, sr), _mm_castsi128_ps(sinSign));
+            c = _mm_xor_ps(Select(swap, sr, cr), _mm_castsi128_ps(cosSign));
+        }
+
+        inline __m128 SmithG1(__m128 nDotV, __m128 a2)
+        {
+            const __m128 one = _mm_set1_ps(1.0f);
+            const __m128 root = _mm_sqrt_ps(_mm_add_ps(a2, _mm_mul_ps(_mm_sub_ps(one, a2), _mm_mul_ps(nDotV, nDotV))));
+            return _mm_div_ps(_mm_add_ps(nDotV, nDotV), _mm_add_ps(nDotV, root));
+        }
+
+        // EvaluateBsdf() for lanes [i, i + 4); zero f and pdf where either direction is below the surface.
+        inline V3 Evaluate4(const BsdfBatch& batch, std::uint32_t i, const V3& wi, __m128& pdf)
+        {
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 one = _mm_set1_ps(1.0f);
+            const V3 n = Load(batch.normal, i);
+            const V3 wo = Load(batch.wo, i);
+            const V3 baseColor = Load(batch.baseColor, i);
+            const __m128 metallic = _mm_load_ps(batch.metallic + i);
+            const __m128 alpha = _mm_load_ps(batch.alpha + i);
+
+            const __m128 nDotL = Dot(n, wi);
+            const __m128 nDotV = Dot(n, wo);
+            const __m128 valid = _mm_and_ps(_mm_cmpgt_ps(nDotL, zero), _mm_cmpgt_ps(nDotV, zero));
+
+            V3 h = Add(wo, wi);
+            h = Mul(h, ReciprocalSqrt(_mm_max_ps(Dot(h, h), _mm_set1_ps(1e-30f))));
+            const __m128 nDotH = _mm_max_ps(Dot(n, h), zero);
+            const __m128 vDotH = _mm_max_ps(Dot(wo, h), _mm_set1_ps(1e-6f));
+
+            const __m128 a2 = _mm_mul_ps(alpha, alpha);
+            const __m128 dd = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(nDotH, nDotH), _mm_sub_ps(a2, one)), one);
+            const __m128 d = _mm_div_ps(a2, _mm_mul_ps(_mm_set1_ps(Pi), _mm_mul_ps(dd, dd)));
+            const __m128 g = _mm_mul_ps(SmithG1(nDotV, a2), SmithG1(nDotL, a2));
+
+            // Schlick Fresnel with f0 = lerp(0.04, baseColor, metallic).
+            const __m128 m = _mm_min_ps(_mm_max_ps(_mm_sub_ps(one, vDotH), zero), one);
+            const __m128 m2 = _mm_mul_ps(m, m);
+            const __m128 m5 = _mm_mul_ps(_mm_mul_ps(m2, m2), m);
+            const __m128 f0Base = _mm_set1_ps(0.04f);
+            const V3 f0 = {
+                _mm_add_ps(f0Base, _mm_mul_ps(_mm_sub_ps(baseColor.x, f0Base), metallic)),
+                _mm_add_ps(f0Base, _mm_mul_ps(_mm_sub_ps(baseColor.y, f0Base), metallic)),
+                _mm_add_ps(f0Base, _mm_mul_ps(_mm_sub_ps(baseColor.z, f0Base), metallic)),
+            };
+            const V3 fresnel = {
+                _mm_add_ps(f0.x, _mm_mul_ps(_mm_sub_ps(one, f0.x), m5)),
+                _mm_add_ps(f0.y, _mm_mul_ps(_mm_sub_ps(one, f0.y), m5)),
+                _mm_add_ps(f0.z, _mm_mul_ps(_mm_sub_ps(one, f0.z), m5)),
+            };
+
+            const __m128 specularScale = _mm_div_ps(_mm_mul_ps(d, g), _mm_mul_ps(_mm_set1_ps(4.0f), _mm_mul_ps(nDotL, nDotV)));
+            const __m128 diffuseScale = _mm_mul_ps(_mm_sub_ps(one, metallic), _mm_set1_ps(InvPi));
+            const V3 f = Add(Mul(fresnel, specularScale), Mul(baseColor, diffuseScale));
+
+            const __m128 pSpec = _mm_add_ps(_mm_set1_ps(0.25f), _mm_mul_ps(_mm_set1_ps(0.75f), metallic));
+            const __m128 pdfSpec = _mm_div_ps(_mm_mul_ps(_mm_mul_ps(pSpec, d), nDotH), _mm_mul_ps(_mm_set1_ps(4.0f), vDotH));
+            const __m128 pdfDiffuse = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(one, pSpec), nDotL), _mm_set1_ps(InvPi));
+            pdf = _mm_and_ps(valid, _mm_add_ps(pdfSpec, pdfDiffuse));
+            return { _mm_and_ps(valid, f.x), _mm_and_ps(valid, f.y), _mm_and_ps(valid, f.z) };
+        }
+
+        inline void Sample4(const BsdfBatch& batch, std::uint32_t i, const float* uLobe, const float* u0, const float* u1, BsdfSampleBatch& result)
+        {
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 one = _mm_set1_ps(1.0f);
+            const V3 n = Load(batch.normal, i);
+            const V3 wo = Load(batch.wo, i);
+            const __m128 metallic = _mm_load_ps(batch.metallic + i);
+            const __m128 alpha = _mm_load_ps(batch.alpha + i);
+            const __m128 v0 = _mm_loadu_ps(u0 + i);
+
+            // Tangent frame of BuildOrthonormalBasis().
+            const __m128 sign = _mm_or_ps(_mm_and_ps(n.z, _mm_set1_ps(-0.0f)), one);
+            const __m128 a = _mm_div_ps(_mm_set1_ps(-1.0f), _mm_add_ps(sign, n.z));
+            const __m128 b = _mm_mul_ps(_mm_mul_ps(n.x, n.y), a);
+            const V3 t = {
+                _mm_add_ps(one, _mm_mul_ps(_mm_mul_ps(sign, _mm_mul_ps(n.x, n.x)), a)),
+                _mm_mul_ps(sign, b),
+                _mm_sub_ps(zero, _mm_mul_ps(sign, n.x)),
+            };
+            const V3 bt = { b, _mm_add_ps(sign, _mm_mul_ps(_mm_mul_ps(n.y, n.y), a)), _mm_sub_ps(zero, n.y) };
+
+            // Specular lanes sample a GGX half vector and reflect wo about it, diffuse lanes a cosine-weighted wi.
+            const __m128 pSpec = _mm_add_ps(_mm_set1_ps(0.25f), _mm_mul_ps(_mm_set1_ps(0.75f), metallic));
+            const __m128 specular = _mm_cmplt_ps(_mm_loadu_ps(uLobe + i), pSpec);
+            const __m128 a2 = _mm_mul_ps(alpha, alpha);
+            const __m128 cosSpec = _mm_sqrt_ps(_mm_div_ps(_mm_sub_ps(one, v0), _mm_add_ps(one, _mm_mul_ps(_mm_sub_ps(a2, one), v0))));
+            const __m128 sinSpec = _mm_sqrt_ps(_mm_max_ps(zero, _mm_sub_ps(one, _mm_mul_ps(cosSpec, cosSpec))));
+            const __m128 cosTheta = Select(specular, cosSpec, _mm_sqrt_ps(_mm_max_ps(zero, _mm_sub_ps(one, v0))));
+            const __m128 sinTheta = Select(specular, sinSpec, _mm_sqrt_ps(v0));
+
+            __m128 sinPhi;
+            __m128 cosPhi;
+            SinCosTurns(_mm_loadu_ps(u1 + i), sinPhi, cosPhi);
+            const V3 dir = Add(Add(Mul(t, _mm_mul_ps(sinTheta, cosPhi)), Mul(bt, _mm_mul_ps(sinTheta, sinPhi))), Mul(n, cosTheta));
+            const V3 reflected = Sub(Mul(dir, _mm_mul_ps(_mm_set1_ps(2.0f), Dot(wo, dir))), wo);
+            const V3 wi = Select(specular, reflected, dir);
+
+            __m128 pdf;
+            const V3 f = Evaluate4(batch, i, wi, pdf);
+            const __m128 valid = _mm_cmpgt_ps(pdf, zero);
+            // Guard the division of invalid lanes; their weight is masked to zero.
+            const __m128 scale = _mm_and_ps(valid, _mm_div_ps(Dot(n, wi), Select(valid, pdf, one)));
+            Store(result.wi, i, wi);
+            Store(result.weight, i, Mul(f, scale));
+            _mm_store_ps(result.pdf + i, pdf);
+            result.validMask |= static_cast<std::uint32_t>(_mm_movemask_ps(valid)) << i;
+        }
+#endif
+
+        inline void EvaluateBatch(const BsdfBatch& batch, const Vec3Batch& wi, BsdfEvalBatch& result)
+        {
+            std::uint32_t lane = 0;
+#if CPU_RT_BSDF_SSE2
+            for (; lane + 4 <= batch.count; lane += 4) {
+                __m128 pdf;
+                Store(result.f, lane, Evaluate4(batch, lane, Load(wi, lane), pdf));
+                _mm_store_ps(result.pdf + lane, pdf);
+            }
+#endif
+            for (; lane < batch.count; ++lane) {
+                BsdfParams params;
+                params.baseColor = batch.baseColor.Get(lane);
+                params.metallic = batch.metallic[lane];
+                params.alpha = batch.alpha[lane];
+                result.f.Set(lane, EvaluateBsdf(params, batch.normal.Get(lane), batch.wo.Get(lane), wi.Get(lane), result.pdf[lane]));
+            }
+        }
+
+        inline void SampleBatch(const BsdfBatch& batch, const float* uLobe, const float* u0, const float* u1, BsdfSampleBatch& result)
+        {
+            result.validMask = 0;
+            std::uint32_t lane = 0;
+#if CPU_RT_BSDF_SSE2
+            for (; lane + 4 <= batch.count; lane += 4) {
+                Sample4(batch, lane, uLobe, u0, u1, result);
+            }
+#endif
+            for (; lane < batch.count; ++lane) {
+                BsdfParams params;
+                params.baseColor = batch.baseColor.Get(lane);
+                params.metallic = batch.metallic[lane];
+                params.alpha = batch.alpha[lane];
+                BsdfSample sample;
+                if (SampleBsdf(params, batch.normal.Get(lane), batch.wo.Get(lane), uLobe[lane], u0[lane], u1[lane], sample)) {
+                    result.validMask |= 1u << lane;
+                } else {
+                    sample.weight = {};
+                }
+                result.wi.Set(lane, sample.wi);
+                result.weight.Set(lane, sample.weight);
+                result.pdf[lane] = sample.pdf;
+            }
+        }
+
+#if CPU_RT_ISA_DISPATCH
+        CPU_RT_TARGET_SSE42 void EvaluateBatchSse42(const BsdfBatch& batch, const Vec3Batch& wi, BsdfEvalBatch& result)
+        {
+            EvaluateBatch(batch, wi, result);
+        }
+
+        CPU_RT_TARGET_AVX2 void EvaluateBatchAvx2(const BsdfBatch& batch, const Vec3Batch& wi, BsdfEvalBatch& result)
+        {
+            EvaluateBatch(batch, wi, result);
+        }
+
+        CPU_RT_TARGET_AVX512 void EvaluateBatchAvx512(const BsdfBatch& batch, const Vec3Batch& wi, BsdfEvalBatch& result)
+        {
+            EvaluateBatch(batch, wi, result);
+        }
+
+        CPU_RT_TARGET_SSE42 void SampleBatchSse42(const BsdfBatch& batch, const float* uLobe, const float* u0, const float* u1, BsdfSampleBatch& result)
+        {
+            SampleBatch(batch, uLobe, u0, u1, result);
+        }
+
+        CPU_RT_TARGET_AVX2 void SampleBatchAvx2(const BsdfBatch& batch, const float* uLobe, const float* u0, const float* u1, BsdfSampleBatch& result)
+        {
+            SampleBatch(batch, uLobe, u0, u1, result);
+        }
+
+        CPU_RT_TARGET_AVX512 void SampleBatchAvx512(const BsdfBatch& batch, const float* uLobe, const float* u0, const float* u1, BsdfSampleBatch& result)
+        {
+            SampleBatch(batch, uLobe, u0, u1, result);
+        }
+#endif
+    }
+
+    void EvaluateBsdfBatch(const BsdfBatch& batch, const Vec3Batch& wi, BsdfEvalBatch& result)
+    {
+#if CPU_RT_ISA_DISPATCH
+        switch (ActiveIsa()) {
+        case Isa::Avx512:
+            return EvaluateBatchAvx512(batch, wi, result);
+        case Isa::Avx2:
+            return EvaluateBatchAvx2(batch, wi, result);
+        case Isa::Sse42:
+            return EvaluateBatchSse42(batch, wi, result);
+        default:
+            break;
+        }
+#endif
+        EvaluateBatch(batch, wi, result);
+    }
+
+    void SampleBsdfBatch(const BsdfBatch& batch, const float* uLobe, const float* u0, const float* u1, BsdfSampleBatch& result)
+    {
+#if CPU_RT_ISA_DISPATCH
+        switch (ActiveIsa()) {
+        case Isa::Avx512:
+            return SampleBatchAvx512(batch, uLobe, u0, u1, result);
+        case Isa::Avx2:
+            return SampleBatchAvx2(batch, uLobe, u0, u1, result);
+        case Isa::Sse42:
+            return SampleBatchSse42(batch, uLobe, u0, u1, result);
+        default:
+            break;
+        }
+#endif
+        SampleBatch(batch, uLobe, u0, u1, result);
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+
+#include "cpu_rt_bsdf.h"
+
+namespace cpu_rt
+{
+    // Lanes of one shading batch; a multiple of the widest SIMD width the batch kernels use.
+    inline constexpr std::uint32_t BsdfBatchSize = 16;
+
+    // Vectors of a batch, one array per component.
+    struct Vec3Batch
+    {
+        alignas(64) float x[BsdfBatchSize];
+        alignas(64) float y[BsdfBatchSize];
+        alignas(64) float z[BsdfBatchSize];
+
+        Vec3 Get(std::uint32_t lane) const { return { x[lane], y[lane], z[lane] }; }
+        void Set(std::uint32_t lane, const Vec3& v)
+        {
+            x[lane] = v.x;
+            y[lane] = v.y;
+            z[lane] = v.z;
+        }
+    };
+
+    // Shading points of up to BsdfBatchSize hits in SoA form: material, shading normal and outgoing
+    // direction per lane, in the conventions of EvaluateBsdf(). Lanes at and beyond count are ignored.
+    struct BsdfBatch
+    {
+        std::uint32_t count = 0;
+        Vec3Batch baseColor;
+        alignas(64) float metallic[BsdfBatchSize];
+        alignas(64) float alpha[BsdfBatchSize];
+        Vec3Batch normal;
+        Vec3Batch wo;
+
+        void Set(std::uint32_t lane, const BsdfParams& params, const Vec3& n, const Vec3& outgoing)
+        {
+            baseColor.Set(lane, params.baseColor);
+            metallic[lane] = params.metallic;
+            alpha[lane] = params.alpha;
+            normal.Set(lane, n);
+            wo.Set(lane, outgoing);
+        }
+    };
+
+    struct BsdfEvalBatch
+    {
+        Vec3Batch f;
+        alignas(64) float pdf[BsdfBatchSize];
+    };
+
+    struct BsdfSampleBatch
+    {
+        Vec3Batch wi;
+        // f * cos / pdf; zero for failed samples.
+        Vec3Batch weight;
+        alignas(64) float pdf[BsdfBatchSize];
+        // Bit per lane, set where a direction was sampled (SampleBsdf() returned true).
+        std::uint32_t validMask = 0;
+    };
+
+    // EvaluateBsdf() for every lane of the batch with incident directions wi.
+    // With SSE2 the lanes are processed four at a time. Normalization uses a refined reciprocal square
+    // root, whose error sharp GGX peaks amplify to relative differences of up to about 1e-3 from the scalar path.
+    void EvaluateBsdfBatch(const BsdfBatch& batch, const Vec3Batch& wi, BsdfEvalBatch& result);
+
+    // SampleBsdf() for every lane of the batch, with one (uLobe, u0, u1) triple per lane.
+    // With SSE2 the azimuth uses a polynomial sine and cosine accurate to about 1e-6.
+    void SampleBsdfBatch(const BsdfBatch& batch, const float* uLobe, const float* u0, const float* u1, BsdfSampleBatch& result);
+}
@@ -0,0 +1,226 @@
+#include "cpu_rt_bvh.h"
+
+#include <deque>
+#include <numeric>
+
+namespace cpu_rt
+{
+    namespace
+    {
+        struct BuildTask
+        {
+            std::uint32_t nodeIndex;
+            std::uint32_t begin;
+            std::uint32_t end;
+            std::uint32_t depth;
+        };
+
+        struct Bin
+        {
+            Aabb bounds;
+            std::uint32_t count = 0;
+        };
+
+        struct SplitCandidate
+        {
+            int axis = -1;
+            float position = 0.0f;
+            float cost = Infinity;
+        };
+
+        SplitCandidate FindBestSplit(
+            std::span<const Aabb> primBounds, std::span<const std::uint32_t> prims,
+            const Aabb& centroidBounds, const BvhBuildSettings& settings, std::vector<Bin>& bins,
+            std::vector<float>& rightAreas, std::vector<std::uint32_t>& rightCounts)
+        {
+            SplitCandidate best;
+            const std::uint32_t binCount = settings.binCount;
+            for (int axis = 0; axis < 3; ++axis) {
+                const float lo = centroidBounds.lo[axis];
+                const float extent = centroidBounds.hi[axis] - lo;
+                if (!(extent > 0.0f)) {
+                    continue;
+                }
+
+                std::fill(bins.begin(), bins.end(), Bin{});
+                const float scale = static_cast<float>(binCount) / extent;
+                for (std::uint32_t prim : prims) {
+                    const float c = primBounds[prim].Centroid()[axis];
+                    const std::uint32_t b = std::min(binCount - 1, static_cast<std::uint32_t>((c - lo) * scale));
+                    bins[b].bounds.Extend(primBounds[prim]);
+                    bins[b].count++;
+                }
+
+                // Sweep from the right to collect suffix areas and counts.
+                Aabb right;
+                std::uint32_t rightCount = 0;
+                for (std::uint32_t i = binCount - 1; i > 0; --i) {
+                    right.Extend(bins[i].bounds);
+                    rightCount += bins[i].count;
+                    rightAreas[i] = right.SurfaceArea();
+                    rightCounts[i] = rightCount;
+                }
+
+                Aabb left;
+                std::uint32_t leftCount = 0;
+                for (std::uint32_t i = 0; i + 1 < binCount; ++i) {
+                    left.Extend(bins[i].bounds);
+                    leftCount += bins[i].count;
+                    if (leftCount == 0 || rightCounts[i + 1] == 0) {
+                        continue;
+                    }
+                    const float cost = left.SurfaceArea() * leftCount + rightAreas[i + 1] * rightCounts[i + 1];
+                    if (cost < best.cost) {
+                        best.axis = axis;
+                        best.position = lo + extent * static_cast<float>(i + 1) / static_cast<float>(binCount);
+                        best.cost = cost;
+                    }
+                }
+            }
+            return best;
+        }
+    }
+
+    Bvh BuildBvh(std::span<const Aabb> primBounds, const BvhBuildSettings& settings)
+    {
+        Bvh bvh;
+        const std::uint32_t primCount = static_cast<std::uint32_t>(primBounds.size());
+        if (primCount == 0) {
+            return bvh;
+        }
+
+        bvh.primIndices.resize(primCount);
+        std::iota(bvh.primIndices.begin(), bvh.primIndices.end(), 0u);
+        std::vector<BvhNode> nodes;
+        nodes.reserve(2 * primCount / std::max(1u, settings.maxLeafSize) + 1);
+        nodes.emplace_back();
+
+        std::vector<Bin> bins(settings.binCount);
+        std::vector<float> rightAreas(settings.binCount);
+        std::vector<std::uint32_t> rightCounts(settings.binCount);
+
+        std::vector<BuildTask> stack;
+        stack.push_back({ 0, 0, primCount, 0 });
+        while (!stack.empty()) {
+            const BuildTask task = stack.back();
+            stack.pop_back();
+
+            Aabb bounds;
+            Aabb centroidBounds;
+            for (std::uint32_t i = task.begin; i < task.end; ++i) {
+                const Aabb& b = primBounds[bvh.primIndices[i]];
+                bounds.Extend(b);
+                centroidBounds.Extend(b.Centroid());
+            }
+
+            BvhNode& node = nodes[task.nodeIndex];
+            node.boundsMin = bounds.lo;
+            node.boundsMax = bounds.hi;
+
+            const std::uint32_t count = task.end - task.begin;
+            auto makeLeaf = [&]() {
+                node.leftOrFirst = task.begin;
+                node.primCount = count;
+            };
+            // Degenerate inputs, e.g. exponentially spaced primitives, can nest deeper than the traversal stack.
+            if (count <= 1 || task.depth + 1 >= MaxTraversalDepth) {
+                makeLeaf();
+                continue;
+            }
+
+            std::span<std::uint32_t> prims(bvh.primIndices.data() + task.begin, count);
+            const SplitCandidate split = FindBestSplit(primBounds, prims, centroidBounds, settings, bins, rightAreas, rightCounts);
+
+            std::uint32_t mid = task.begin;
+            if (split.axis >= 0) {
+                const float leafCost = settings.intersectionCost * static_cast<float>(count);
+                const float splitCost = settings.traversalCost +
+                    settings.intersectionCost * split.cost / std::max(bounds.SurfaceArea(), 1e-30f);
+                if (count <= settings.maxLeafSize && splitCost >= leafCost) {
+                    makeLeaf();
+                    continue;
+                }
+                auto it = std::partition(prims.begin(), prims.end(), [&](std::uint32_t prim) {
+                    return primBounds[prim].Centroid()[split.axis] < split.position;
+                });
+                mid = task.begin + static_cast<std::uint32_t>(it - prims.begin());
+            }
+            if (mid == task.begin || mid == task.end) {
+                // All centroids coincide: split by index unless the range already fits a leaf.
+                if (count <= settings.maxLeafSize) {
+                    makeLeaf();
+                    continue;
+                }
+                mid = task.begin + count / 2;
+            }
+
+            const std::uint32_t leftChild = static_cast<std::uint32_t>(nodes.size());
+            node.leftOrFirst = leftChild;
+            node.primCount = 0;
+            nodes.emplace_back();
+            nodes.emplace_back();
+            stack.push_back({ leftChild + 1, mid, task.end, task.depth + 1 });
+            stack.push_back({ leftChild, task.begin, mid, task.depth + 1 });
+        }
+
+        bvh.nodes = std::move(nodes);
+        return bvh;
+    }
+
+    std::vector<BvhNode> ClusterBvhNodes(std::span<const BvhNode> nodes, std::uint32_t nodesPerPage, std::uint32_t firstPageNodes)
+    {
+        std::vector<BvhNode> result;
+        if (nodes.empty()) {
+            return result;
+        }
+        result.reserve(nodes.size() + nodes.size() / 8 + 2);
+
+        // A sibling pair waiting for placement: its index in nodes and the parent slot in result.
+        struct PendingPair
+        {
+            std::uint32_t source;
+            std::uint32_t parent;
+        };
+        std::deque<PendingPair> cluster;
+        std::deque<PendingPair> deferred;
+        auto expand = [&](std::uint32_t slot) {
+            if (!result[slot].IsLeaf()) {
+                cluster.push_back({ result[slot].leftOrFirst, slot });
+            }
+        };
+
+        // The root is alone; pad after it so that pairs are even-aligned.
+        result.push_back(nodes[0]);
+        result.emplace_back();
+        std::uint32_t pageRoom = firstPageNodes > 2 ? firstPageNodes - 2 : 0;
+        expand(0);
+        for (;;) {
+            while (!cluster.empty()) {
+                const PendingPair pair = cluster.front();
+                cluster.pop_front();
+                if (pageRoom < 2) {
+                    deferred.push_back(pair);
+                    continue;
+                }
+                const std::uint32_t slot = static_cast<std::uint32_t>(result.size());
+                result.push_back(nodes[pair.source]);
+                result.push_back(nodes[pair.source + 1]);
+                result[pair.parent].leftOrFirst = slot;
+                pageRoom -= 2;
+                expand(slot);
+                expand(slot + 1);
+            }
+            if (deferred.empty()) {
+                break;
+            }
+            // Subtrees that did not fit start the next cluster; small ones share the rest of the page.
+            if (pageRoom < 2) {
+                result.resize(result.size() + pageRoom);
+                pageRoom = nodesPerPage;
+            }
+            cluster.push_back(deferred.front());
+            deferred.pop_front();
+        }
+        return result;
+    }
+}
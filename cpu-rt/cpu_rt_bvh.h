@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "cpu_rt_mapped_file.h"
+#include "cpu_rt_math.h"
+
+namespace cpu_rt
+{
+    // 32-byte BVH node. Interior nodes store their two children at leftOrFirst and leftOrFirst + 1,
+    // leaves store primCount primitives starting at leftOrFirst in Bvh::primIndices.
+    struct BvhNode
+    {
+        Vec3 boundsMin;
+        std::uint32_t leftOrFirst = 0;
+        Vec3 boundsMax;
+        std::uint32_t primCount = 0;
+
+        bool IsLeaf() const { return primCount != 0; }
+    };
+    static_assert(sizeof(BvhNode) == 32);
+
+    // Capacity of the fixed traversal stack. A ray pushes at most one node per interior node above its
+    // current one, so BuildBvh() turns ranges at depth MaxTraversalDepth - 1 into leaves, whatever their size.
+    inline constexpr std::uint32_t MaxTraversalDepth = 64;
+
+    struct Bvh
+    {
+        MappedArray<BvhNode> nodes;
+        std::vector<std::uint32_t> primIndices;
+
+        Aabb Bounds() const
+        {
+            return nodes.empty() ? Aabb{} : Aabb{ nodes[0].boundsMin, nodes[0].boundsMax };
+        }
+    };
+
+    struct BvhBuildSettings
+    {
+        std::uint32_t maxLeafSize = 4;
+        std::uint32_t binCount = 16;
+        float traversalCost = 1.0f;
+        float intersectionCost = 1.0f;
+    };
+
+    // Build a binned-SAH BVH over the given primitive bounds. No leaf is deeper than MaxTraversalDepth - 1.
+    Bvh BuildBvh(std::span<const Aabb> primBounds, const BvhBuildSettings& settings = {});
+
+    // Reorder nodes into clusters of nodesPerPage nodes (one memory page each) that hold connected subtrees,
+    // breadth-first from the cluster root, so a ray descending the tree touches few pages. The first cluster
+    // has room for firstPageNodes nodes. Sibling pairs start at even indices, so with 64-byte aligned
+    // storage both children share a cache line. Unused slots are filled with nodes no parent references.
+    std::vector<BvhNode> ClusterBvhNodes(std::span<const BvhNode> nodes, std::uint32_t nodesPerPage, std::uint32_t firstPageNodes);
+
+    // Slab test against a node; returns the entry distance or Infinity on a miss.
+    inline float IntersectNode(const BvhNode& node, const Vec3& origin, const Vec3& invDir, float tMin, float tMax)
+    {
+        const float tx0 = (node.boundsMin.x - origin.x) * invDir.x;
+        const float tx1 = (node.boundsMax.x - origin.x) * invDir.x;
+        const float ty0 = (node.boundsMin.y - origin.y) * invDir.y;
+        const float ty1 = (node.boundsMax.y - origin.y) * invDir.y;
+        const float tz0 = (node.boundsMin.z - origin.z) * invDir.z;
+        const float tz1 = (node.boundsMax.z - origin.z) * invDir.z;
+        const float tNear = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), tMin));
+        const float tFar = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), tMax));
+        return tNear <= tFar ? tNear : Infinity;
+    }
+
+    inline Vec3 SafeInverse(const Vec3& d)
+    {
+        constexpr float eps = 1e-20f;
+        return {
+            1.0f / (std::abs(d.x) > eps ? d.x : std::copysign(eps, d.x)),
+            1.0f / (std::abs(d.y) > eps ? d.y : std::copysign(eps, d.y)),
+            1.0f / (std::abs(d.z) > eps ? d.z : std::copysign(eps, d.z)),
+        };
+    }
+}
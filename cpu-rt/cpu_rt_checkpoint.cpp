@@ -0,0 +1,231 @@
+#include "cpu_rt_checkpoint.h"
+
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+#include "cpu_rt_hash.h"
+
+namespace cpu_rt
+{
+    namespace
+    {
+        constexpr char FileMagic[8] = { 'C', 'P', 'U', 'R', 'T', 'C', 'K', 'P' };
+        constexpr std::uint32_t FileVersion = 1;
+        constexpr std::uint32_t NoSlot = 0;
+        constexpr std::size_t SlotAlignment = 64;
+
+        struct FileHeader
+        {
+            char magic[8];
+            std::uint32_t version;
+            std::uint32_t tileCount;
+            std::uint32_t width;
+            std::uint32_t height;
+            std::uint32_t aovs;
+            std::uint32_t reserved;
+            std::uint64_t key;
+        };
+
+        struct TileRecord
+        {
+            std::uint32_t x0, y0, x1, y1;
+            // 1-based index of the slot holding the latest complete state, NoSlot if none.
+            std::uint32_t publishedSlot;
+            std::uint32_t reserved;
+            std::uint64_t slotOffset;
+            std::uint64_t slotBytes;
+            // Detects slots whose pages did not reach the disk before a power loss.
+            std::uint64_t slotHashes[2];
+        };
+
+        std::size_t AlignUp(std::size_t value, std::size_t alignment)
+        {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+        std::uint64_t HashSlot(const std::byte* data, std::size_t size)
+        {
+            Hasher hasher;
+            hasher.AddBytes(data, size);
+            return hasher.Value();
+        }
+
+        Tile RecordTile(const TileRecord& record)
+        {
+            return Tile{ record.x0, record.y0, record.x1, record.y1, 0 };
+        }
+
+        bool SameRect(const Tile& a, const Tile& b)
+        {
+            return a.x0 == b.x0 && a.y0 == b.y0 && a.x1 == b.x1 && a.y1 == b.y1;
+        }
+
+        FileHeader& Header(const MappedFile& file)
+        {
+            return *reinterpret_cast<FileHeader*>(file.Data());
+        }
+
+        TileRecord& Record(const MappedFile& file, std::uint32_t tileIndex)
+        {
+            return reinterpret_cast<TileRecord*>(file.Data() + sizeof(FileHeader))[tileIndex];
+        }
+    }
+
+    bool Checkpoint::Open(const std::string& path, std::uint64_t key, const std::vector<Tile>& tiles, Framebuffer& framebuffer, bool& resumed)
+    {
+        Close();
+        resumed = false;
+
+        bool sameTiles = false;
+        if (!Load(path, key, framebuffer, sameTiles, tiles)) {
+            return Create(path, key, tiles, framebuffer);
+        }
+        resumed = true;
+        if (sameTiles) {
+            m_tiles = tiles;
+            return true;
+        }
+
+        // The tile layout depends on the worker topology; rewrite the state in the current layout
+        // next to the old file and swap it in, so the old state survives until the new one is complete.
+        m_file.Close();
+        const std::string tempPath = path + ".tmp";
+        if (!Create(tempPath, key, tiles, framebuffer)) {
+            return false;
+        }
+        for (std::uint32_t tileIndex = 0; tileIndex < m_tiles.size(); ++tileIndex) {
+            SaveTile(tileIndex, framebuffer);
+        }
+        const bool flushed = m_file.Flush(true);
+        m_file.Close();
+
+        std::error_code error;
+        if (flushed) {
+            std::filesystem::rename(tempPath, path, error);
+        }
+        if (!flushed || error || !m_file.Open(path, MappedFile::Mode::ReadWrite)) {
+            m_tiles.clear();
+            return false;
+        }
+        return true;
+    }
+
+    void Checkpoint::Close()
+    {
+        m_file.Close();
+        m_tiles.clear();
+    }
+
+    bool Checkpoint::Create(const std::string& path, std::uint64_t key, const std::vector<Tile>& tiles, const Framebuffer& framebuffer)
+    {
+        const std::size_t recordsEnd = sizeof(FileHeader) + sizeof(TileRecord) * tiles.size();
+        std::size_t fileSize = AlignUp(recordsEnd, SlotAlignment);
+        for (const Tile& tile : tiles) {
+            fileSize += 2 * AlignUp(framebuffer.RegionStateBytes(tile), SlotAlignment);
+        }
+        if (!m_file.Open(path, MappedFile::Mode::Create, fileSize)) {
+            return false;
+        }
+
+        FileHeader& header = Header(m_file);
+        std::memcpy(header.magic, FileMagic, sizeof(FileMagic));
+        header.version = FileVersion;
+        header.tileCount = static_cast<std::uint32_t>(tiles.size());
+        header.width = framebuffer.Width();
+        header.height = framebuffer.Height();
+        header.aovs = framebuffer.Aovs();
+        header.reserved = 0;
+        header.key = key;
+
+        std::size_t offset = AlignUp(recordsEnd, SlotAlignment);
+        for (std::uint32_t tileIndex = 0; tileIndex < tiles.size(); ++tileIndex) {
+            const Tile& tile = tiles[tileIndex];
+            TileRecord& record = Record(m_file, tileIndex);
+            record = {};
+            record.x0 = tile.x0;
+            record.y0 = tile.y0;
+            record.x1 = tile.x1;
+            record.y1 = tile.y1;
+            record.slotOffset = offset;
+            record.slotBytes = framebuffer.RegionStateBytes(tile);
+            offset += 2 * AlignUp(record.slotBytes, SlotAlignment);
+        }
+        m_tiles = tiles;
+        return true;
+    }
+
+    bool Checkpoint::Load(const std::string& path, std::uint64_t key, Framebuffer& framebuffer, bool& sameTiles, const std::vector<Tile>& tiles)
+    {
+        if (!m_file.Open(path, MappedFile::Mode::ReadWrite)) {
+            return false;
+        }
+
+        // Validate everything before the framebuffer is touched.
+        const FileHeader& header = Header(m_file);
+        bool valid = m_file.Size() >= sizeof(FileHeader)
+            && std::memcmp(header.magic, FileMagic, sizeof(FileMagic)) == 0
+            && header.version == FileVersion
+            && header.key == key
+            && header.width == framebuffer.Width()
+            && header.height == framebuffer.Height()
+            && header.aovs == framebuffer.Aovs()
+            && sizeof(FileHeader) + sizeof(TileRecord) * static_cast<std::size_t>(header.tileCount) <= m_file.Size();
+        for (std::uint32_t tileIndex = 0; valid && tileIndex < header.tileCount; ++tileIndex) {
+            const TileRecord& record = Record(m_file, tileIndex);
+            const Tile tile = RecordTile(record);
+            valid = tile.x0 < tile.x1 && tile.x1 <= header.width
+                && tile.y0 < tile.y1 && tile.y1 <= header.height
+                && record.slotBytes == framebuffer.RegionStateBytes(tile)
+                && record.slotOffset + 2 * AlignUp(record.slotBytes, SlotAlignment) <= m_file.Size()
+                && record.publishedSlot <= 2;
+        }
+        if (!valid) {
+            m_file.Close();
+            return false;
+        }
+
+        sameTiles = header.tileCount == tiles.size();
+        for (std::uint32_t tileIndex = 0; tileIndex < header.tileCount; ++tileIndex) {
+            const TileRecord& record = Record(m_file, tileIndex);
+            sameTiles = sameTiles && SameRect(RecordTile(record), tiles[tileIndex]);
+            if (record.publishedSlot == NoSlot) {
+                continue;
+            }
+            // Fall back to the previous slot if the published one is torn.
+            const std::size_t slotStride = AlignUp(record.slotBytes, SlotAlignment);
+            for (std::uint32_t attempt = 0; attempt < 2; ++attempt) {
+                const std::uint32_t slot = (record.publishedSlot - 1) ^ attempt;
+                const std::byte* data = m_file.Data() + record.slotOffset + slot * slotStride;
+                if (HashSlot(data, record.slotBytes) == record.slotHashes[slot]) {
+                    framebuffer.LoadRegion(RecordTile(record), data);
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+
+    void Checkpoint::SaveTile(std::uint32_t tileIndex, const Framebuffer& framebuffer)
+    {
+        if (!m_file.IsOpen() || tileIndex >= m_tiles.size()) {
+            return;
+        }
+        TileRecord& record = Record(m_file, tileIndex);
+        std::atomic_ref<std::uint32_t> published(record.publishedSlot);
+        const std::uint32_t slot = published.load(std::memory_order_relaxed) == 1 ? 1 : 0;
+
+        std::byte* data = m_file.Data() + record.slotOffset + slot * AlignUp(record.slotBytes, SlotAlignment);
+        framebuffer.SaveRegion(m_tiles[tileIndex], data);
+        record.slotHashes[slot] = HashSlot(data, record.slotBytes);
+        published.store(slot + 1, std::memory_order_release);
+    }
+
+    void Checkpoint::Invalidate()
+    {
+        for (std::uint32_t tileIndex = 0; tileIndex < m_tiles.size(); ++tileIndex) {
+            std::atomic_ref<std::uint32_t>(Record(m_file, tileIndex).publishedSlot).store(NoSlot, std::memory_order_release);
+        }
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cpu_rt_framebuffer.h"
+#include "cpu_rt_mapped_file.h"
+#include "cpu_rt_tiles.h"
+
+namespace cpu_rt
+{
+    // Memory-mapped accumulation state of a progressive render.
+    // Every tile owns two slots in the file. A finished tile is copied into the slot that is not
+    // currently published and then published with a single 32-bit store, so a process killed at any
+    // point leaves each tile either at its previous or at its new state. Copies go to mapped memory
+    // only; write-back to disk is left to the OS and Flush().
+    // Sampler state is not stored: samples are keyed by (seed, pixel, sample index) and the
+    // per-pixel sample counts are part of the accumulation state.
+    class Checkpoint
+    {
+    public:
+        // Open path for the given framebuffer layout. If the file holds state written under the same
+        // key, it is loaded into framebuffer and resumed is set. Otherwise a new file is created.
+        bool Open(const std::string& path, std::uint64_t key, const std::vector<Tile>& tiles, Framebuffer& framebuffer, bool& resumed);
+        void Close();
+        bool IsOpen() const { return m_file.IsOpen(); }
+
+        // Copy a tile's current accumulation state. Safe to call concurrently for different tiles.
+        void SaveTile(std::uint32_t tileIndex, const Framebuffer& framebuffer);
+        // Mark every tile as empty, e.g. after the accumulation was reset.
+        void Invalidate();
+        bool Flush(bool wait) { return m_file.Flush(wait); }
+
+    private:
+        bool Create(const std::string& path, std::uint64_t key, const std::vector<Tile>& tiles, const Framebuffer& framebuffer);
+        bool Load(const std::string& path, std::uint64_t key, Framebuffer& framebuffer, bool& sameTiles, const std::vector<Tile>& tiles);
+
+        MappedFile m_file;
+        std::vector<Tile> m_tiles;
+    };
+}
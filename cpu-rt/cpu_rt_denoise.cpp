@@ -0,0 +1,296 @@
+#include "cpu_rt_denoise.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "cpu_rt_math.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CPU_RT_DENOISE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace cpu_rt
+{
+    namespace
+    {
+        // B3-spline taps indexed by |offset|.
+        constexpr float Kernel[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+        constexpr float DepthEpsilon = 1e-4f;
+        constexpr float VarianceEpsilon = 1e-8f;
+
+        struct Planes
+        {
+            float* color[3];
+            float* variance;
+        };
+
+        struct Guides
+        {
+            const float* albedo[3];
+            const float* normal[3];
+            const float* depth;
+        };
+
+        struct PassParams
+        {
+            int width;
+            int height;
+            int step;
+            float colorScale;
+            float albedoScale;
+            float normalScale;
+            float depthScale;
+            bool useVariance;
+        };
+
+        inline float PixelLuminance(const float* const color[3], std::size_t i)
+        {
+            return 0.2126f * color[0][i] + 0.7152f * color[1][i] + 0.0722f * color[2][i];
+        }
+
+        void FilterPixel(const Planes& src, const Planes& dst, const Guides& guides, const PassParams& pass, int x, int y)
+        {
+            const std::size_t p = static_cast<std::size_t>(y) * pass.width + x;
+            const float lumP = PixelLuminance(src.color, p);
+            const float colorScale = pass.useVariance ? pass.colorScale / (src.variance[p] + VarianceEpsilon) : pass.colorScale;
+            const float depthScale = pass.depthScale / std::max(guides.depth[p], DepthEpsilon);
+
+            float sumWeight = 0.0f;
+            float sumColor[3] = { 0.0f, 0.0f, 0.0f };
+            float sumVariance = 0.0f;
+            for (int dy = -2; dy <= 2; ++dy) {
+                const int qy = y + dy * pass.step;
+                if (qy < 0 || qy >= pass.height) {
+                    continue;
+                }
+                for (int dx = -2; dx <= 2; ++dx) {
+                    const int qx = x + dx * pass.step;
+                    if (qx < 0 || qx >= pass.width) {
+                        continue;
+                    }
+                    const std::size_t q = static_cast<std::size_t>(qy) * pass.width + qx;
+
+                    const float dl = lumP - PixelLuminance(src.color, q);
+                    float distance = dl * dl * colorScale;
+                    float albedoDistance = 0.0f;
+                    float normalDot = 0.0f;
+                    for (int c = 0; c < 3; ++c) {
+                        const float da = guides.albedo[c][p] - guides.albedo[c][q];
+                        albedoDistance += da * da;
+                        normalDot += guides.normal[c][p] * guides.normal[c][q];
+                    }
+                    distance += albedoDistance * pass.albedoScale;
+                    distance += std::max(0.0f, 1.0f - normalDot) * pass.normalScale;
+                    distance += std::abs(guides.depth[p] - guides.depth[q]) * depthScale;
+
+                    const float w = Kernel[std::abs(dx)] * Kernel[std::abs(dy)] * std::exp(-distance);
+                    sumWeight += w;
+                    for (int c = 0; c < 3; ++c) {
+                        sumColor[c] += w * src.color[c][q];
+                    }
+                    sumVariance += w * w * src.variance[q];
+                }
+            }
+
+            // The center tap always contributes, so sumWeight > 0.
+            const float invWeight = 1.0f / sumWeight;
+            for (int c = 0; c < 3; ++c) {
+                dst.color[c][p] = sumColor[c] * invWeight;
+            }
+            dst.variance[p] = sumVariance * invWeight * invWeight;
+        }
+
+#if CPU_RT_DENOISE_SSE2
+        // exp(x) for x <= 0: 2^(x log2 e) split into exponent bits and a degree-5 polynomial for the fraction.
+        inline __m128 FastExp(__m128 x)
+        {
+            x = _mm_max_ps(x, _mm_set1_ps(-87.0f));
+            const __m128 t = _mm_mul_ps(x, _mm_set1_ps(1.44269504f));
+            __m128i ti = _mm_cvttps_epi32(t);
+            __m128 tf = _mm_cvtepi32_ps(ti);
+            // Truncation rounds towards zero; step down for negative non-integers.
+            const __m128 adjust = _mm_and_ps(_mm_cmpgt_ps(tf, t), _mm_set1_ps(1.0f));
+            tf = _mm_sub_ps(tf, adjust);
+            ti = _mm_cvtps_epi32(tf);
+            const __m128 f = _mm_sub_ps(t, tf);
+
+            __m128 poly = _mm_set1_ps(1.33336e-3f);
+            poly = _mm_add_ps(_mm_mul_ps(poly, f), _mm_set1_ps(9.61813e-3f));
+            poly = _mm_add_ps(_mm_mul_ps(poly, f), _mm_set1_ps(5.55041e-2f));
+            poly = _mm_add_ps(_mm_mul_ps(poly, f), _mm_set1_ps(2.40227e-1f));
+            poly = _mm_add_ps(_mm_mul_ps(poly, f), _mm_set1_ps(6.93147e-1f));
+            poly = _mm_add_ps(_mm_mul_ps(poly, f), _mm_set1_ps(1.0f));
+
+            const __m128i bits = _mm_slli_epi32(_mm_add_epi32(ti, _mm_set1_epi32(127)), 23);
+            return _mm_mul_ps(poly, _mm_castsi128_ps(bits));
+        }
+
+        inline __m128 Luminance4(const float* const color[3], std::size_t i)
+        {
+            __m128 l = _mm_mul_ps(_mm_loadu_ps(color[0] + i), _mm_set1_ps(0.2126f));
+            l = _mm_add_ps(l, _mm_mul_ps(_mm_loadu_ps(color[1] + i), _mm_set1_ps(0.7152f)));
+            return _mm_add_ps(l, _mm_mul_ps(_mm_loadu_ps(color[2] + i), _mm_set1_ps(0.0722f)));
+        }
+
+        // Filter four horizontally adjacent pixels whose taps all lie inside the row.
+        void FilterPixels4(const Planes& src, const Planes& dst, const Guides& guides, const PassParams& pass, int x, int y)
+        {
+            const std::size_t p = static_cast<std::size_t>(y) * pass.width + x;
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 one = _mm_set1_ps(1.0f);
+            const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+            const __m128 lumP = Luminance4(src.color, p);
+            __m128 colorScale = _mm_set1_ps(pass.colorScale);
+            if (pass.useVariance) {
+                colorScale = _mm_div_ps(colorScale, _mm_add_ps(_mm_loadu_ps(src.variance + p), _mm_set1_ps(VarianceEpsilon)));
+            }
+            const __m128 depthP = _mm_loadu_ps(guides.depth + p);
+            const __m128 depthScale = _mm_div_ps(_mm_set1_ps(pass.depthScale), _mm_max_ps(depthP, _mm_set1_ps(DepthEpsilon)));
+            const __m128 albedoP[3] = { _mm_loadu_ps(guides.albedo[0] + p), _mm_loadu_ps(guides.albedo[1] + p), _mm_loadu_ps(guides.albedo[2] + p) };
+            const __m128 normalP[3] = { _mm_loadu_ps(guides.normal[0] + p), _mm_loadu_ps(guides.normal[1] + p), _mm_loadu_ps(guides.normal[2] + p) };
+            const __m128 albedoScale = _mm_set1_ps(pass.albedoScale);
+            const __m128 normalScale = _mm_set1_ps(pass.normalScale);
+
+            __m128 sumWeight = zero;
+            __m128 sumColor[3] = { zero, zero, zero };
+            __m128 sumVariance = zero;
+            for (int dy = -2; dy <= 2; ++dy) {
+                const int qy = y + dy * pass.step;
+                if (qy < 0 || qy >= pass.height) {
+                    continue;
+                }
+                for (int dx = -2; dx <= 2; ++dx) {
+                    const std::size_t q = static_cast<std::size_t>(qy) * pass.width + (x + dx * pass.step);
+
+                    const __m128 dl = _mm_sub_ps(lumP, Luminance4(src.color, q));
+                    __m128 distance = _mm_mul_ps(_mm_mul_ps(dl, dl), colorScale);
+
+                    __m128 albedoDistance = zero;
+                    __m128 normalDot = zero;
+                    for (int c = 0; c < 3; ++c) {
+                        const __m128 da = _mm_sub_ps(albedoP[c], _mm_loadu_ps(guides.albedo[c] + q));
+                        albedoDistance = _mm_add_ps(albedoDistance, _mm_mul_ps(da, da));
+                        normalDot = _mm_add_ps(normalDot, _mm_mul_ps(normalP[c], _mm_loadu_ps(guides.normal[c] + q)));
+                    }
+                    distance = _mm_add_ps(distance, _mm_mul_ps(albedoDistance, albedoScale));
+                    distance = _mm_add_ps(distance, _mm_mul_ps(_mm_max_ps(zero, _mm_sub_ps(one, normalDot)), normalScale));
+                    const __m128 dz = _mm_and_ps(_mm_sub_ps(depthP, _mm_loadu_ps(guides.depth + q)), absMask);
+                    distance = _mm_add_ps(distance, _mm_mul_ps(dz, depthScale));
+
+                    const __m128 w = _mm_mul_ps(_mm_set1_ps(Kernel[std::abs(dx)] * Kernel[std::abs(dy)]), FastExp(_mm_sub_ps(zero, distance)));
+                    sumWeight = _mm_add_ps(sumWeight, w);
+                    for (int c = 0; c < 3; ++c) {
+                        sumColor[c] = _mm_add_ps(sumColor[c], _mm_mul_ps(w, _mm_loadu_ps(src.color[c] + q)));
+                    }
+                    sumVariance = _mm_add_ps(sumVariance, _mm_mul_ps(_mm_mul_ps(w, w), _mm_loadu_ps(src.variance + q)));
+                }
+            }
+
+            const __m128 invWeight = _mm_div_ps(one, sumWeight);
+            for (int c = 0; c < 3; ++c) {
+                _mm_storeu_ps(dst.color[c] + p, _mm_mul_ps(sumColor[c], invWeight));
+            }
+            _mm_storeu_ps(dst.variance + p, _mm_mul_ps(sumVariance, _mm_mul_ps(invWeight, invWeight)));
+        }
+#endif
+
+        void FilterRow(const Planes& src, const Planes& dst, const Guides& guides, const PassParams& pass, int y)
+        {
+            int x = 0;
+#if CPU_RT_DENOISE_SSE2
+            // Vector blocks need every horizontal tap of all four lanes inside the row.
+            const int reach = 2 * pass.step;
+            for (; x < std::min(reach, pass.width); ++x) {
+                FilterPixel(src, dst, guides, pass, x, y);
+            }
+            for (; x + 3 + reach < pass.width; x += 4) {
+                FilterPixels4(src, dst, guides, pass, x, y);
+            }
+#endif
+            for (; x < pass.width; ++x) {
+                FilterPixel(src, dst, guides, pass, x, y);
+            }
+        }
+    }
+
+    void Denoise(WorkerPool& pool, const DenoiseImage& image, const DenoiseSettings& settings)
+    {
+        const std::size_t pixelCount = static_cast<std::size_t>(image.width) * image.height;
+        if (pixelCount == 0 || settings.iterations == 0) {
+            return;
+        }
+
+        // Missing guides are replaced by constant planes with their weight disabled.
+        const std::vector<float> zeros(pixelCount, 0.0f);
+        const std::vector<float> ones(pixelCount, 1.0f);
+        auto guide = [&](std::span<const float> plane, const std::vector<float>& fallback) {
+            return plane.size() >= pixelCount ? plane.data() : fallback.data();
+        };
+        const bool hasAlbedo = image.albedo[0].size() >= pixelCount && image.albedo[1].size() >= pixelCount && image.albedo[2].size() >= pixelCount;
+        const bool hasNormal = image.normal[0].size() >= pixelCount && image.normal[1].size() >= pixelCount && image.normal[2].size() >= pixelCount;
+        const bool hasDepth = image.depth.size() >= pixelCount;
+        const bool hasVariance = image.variance.size() >= pixelCount;
+
+        Guides guides;
+        for (int c = 0; c < 3; ++c) {
+            guides.albedo[c] = guide(image.albedo[c], ones);
+            guides.normal[c] = guide(image.normal[c], zeros);
+        }
+        guides.depth = guide(image.depth, zeros);
+        const bool demodulate = settings.demodulateAlbedo && hasAlbedo;
+
+        // Ping-pong working planes: color (optionally demodulated) and variance.
+        std::vector<float> storage[2][4];
+        Planes planes[2];
+        for (int i = 0; i < 2; ++i) {
+            for (int c = 0; c < 4; ++c) {
+                storage[i][c].resize(pixelCount);
+            }
+            planes[i] = { { storage[i][0].data(), storage[i][1].data(), storage[i][2].data() }, storage[i][3].data() };
+        }
+        // Pixels without albedo (misses, black materials) are filtered as plain radiance.
+        auto demodulationAlbedo = [&](int c, std::size_t p) {
+            return demodulate && guides.albedo[c][p] > 1e-3f ? guides.albedo[c][p] : 1.0f;
+        };
+        for (std::size_t p = 0; p < pixelCount; ++p) {
+            Vec3 albedo;
+            for (int c = 0; c < 3; ++c) {
+                albedo[c] = demodulationAlbedo(c, p);
+                planes[0].color[c][p] = image.color[c][p] / albedo[c];
+            }
+            const float albedoLuminance = Luminance(albedo);
+            planes[0].variance[p] = hasVariance ? image.variance[p] / (albedoLuminance * albedoLuminance) : 0.0f;
+        }
+
+        std::uint32_t src = 0;
+        for (std::uint32_t iteration = 0; iteration < settings.iterations; ++iteration) {
+            PassParams pass;
+            pass.width = static_cast<int>(image.width);
+            pass.height = static_cast<int>(image.height);
+            pass.step = 1 << iteration;
+            pass.colorScale = 1.0f / (settings.colorSigma * settings.colorSigma);
+            pass.albedoScale = hasAlbedo ? 1.0f / (settings.albedoSigma * settings.albedoSigma) : 0.0f;
+            pass.normalScale = hasNormal ? 1.0f / settings.normalSigma : 0.0f;
+            pass.depthScale = hasDepth ? 1.0f / (settings.depthSigma * static_cast<float>(pass.step)) : 0.0f;
+            pass.useVariance = hasVariance;
+            if (!hasVariance) {
+                pass.colorScale = 0.0f;
+            }
+
+            const Planes& srcPlanes = planes[src];
+            const Planes& dstPlanes = planes[src ^ 1];
+            ParallelRows(pool, static_cast<std::uint32_t>(pass.height),
+                [&](std::uint32_t y) { FilterRow(srcPlanes, dstPlanes, guides, pass, static_cast<int>(y)); });
+            src ^= 1;
+        }
+
+        for (std::size_t p = 0; p < pixelCount; ++p) {
+            for (int c = 0; c < 3; ++c) {
+                image.color[c][p] = planes[src].color[c][p] * demodulationAlbedo(c, p);
+            }
+        }
+    }
+}
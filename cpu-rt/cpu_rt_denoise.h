@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+#include "cpu_rt_threading.h"
+
+namespace cpu_rt
+{
+    struct DenoiseSettings
+    {
+        // Number of a-trous passes; pass i samples taps 2^i pixels apart.
+        std::uint32_t iterations = 5;
+        // Luminance edge-stopping scale, in standard deviations of the pixel estimate.
+        float colorSigma = 4.0f;
+        float albedoSigma = 0.1f;
+        // Tolerance on 1 - dot(n_p, n_q).
+        float normalSigma = 0.1f;
+        // Relative depth tolerance per pixel of tap distance.
+        float depthSigma = 0.02f;
+        // Filter irradiance (color / albedo) and multiply the albedo back afterwards, which keeps texture detail.
+        bool demodulateAlbedo = true;
+    };
+
+    // Inputs are planar float images of width * height pixels; color is filtered in place.
+    struct DenoiseImage
+    {
+        std::uint32_t width = 0;
+        std::uint32_t height = 0;
+        std::span<float> color[3];
+        // Luminance variance of the per-pixel mean; an empty span disables the luminance edge-stopping term.
+        std::span<const float> variance;
+        std::span<const float> albedo[3];
+        std::span<const float> normal[3];
+        std::span<const float> depth;
+    };
+
+    // Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) guided by albedo, normal and depth,
+    // with variance-scaled luminance weights as in SVGF. Rows are filtered in parallel on the pool.
+    void Denoise(WorkerPool& pool, const DenoiseImage& image, const DenoiseSettings& settings = {});
+}
@@ -0,0 +1,258 @@
+#include "cpu_rt_diagnostics.h"
+
+#include <algorithm>
+#include <array>
+#include <iomanip>
+
+#include "cpu_rt_sampler.h"
+#include "cpu_rt_traversal.h"
+
+namespace cpu_rt
+{
+    namespace
+    {
+        Aabb NodeBounds(const BvhNode& node)
+        {
+            return { node.boundsMin, node.boundsMax };
+        }
+
+        Aabb Intersection(const Aabb& a, const Aabb& b)
+        {
+            Aabb r = { Max(a.lo, b.lo), Min(a.hi, b.hi) };
+            if (r.lo.x > r.hi.x || r.lo.y > r.hi.y || r.lo.z > r.hi.z) {
+                return {};
+            }
+            return r;
+        }
+
+        void WriteCsvRow(std::ostream& out, const char* kind, const MeshAccelReport* mesh, const BvhQualityReport& bvh)
+        {
+            auto index = [&](std::uint32_t value) {
+                if (value != InvalidIndex) {
+                    out << value;
+                }
+                out << ',';
+            };
+            out << kind << ',';
+            index(mesh != nullptr ? mesh->meshAccelIndex : InvalidIndex);
+            index(mesh != nullptr ? mesh->meshIndex : InvalidIndex);
+            index(mesh != nullptr ? mesh->submeshIndex : InvalidIndex);
+            index(mesh != nullptr ? mesh->shapeGroupIndex : InvalidIndex);
+            out << (mesh != nullptr ? mesh->instanceCount : 1) << ',' << bvh.nodeCount << ',' << bvh.leafCount << ','
+                << bvh.primitiveCount << ',' << bvh.sahCost << ',' << bvh.averageLeafSize << ','
+                << (bvh.leafSizeHistogram.empty() ? 0 : bvh.leafSizeHistogram.size() - 1) << ',' << bvh.averageSiblingOverlap << ','
+                << bvh.overlapCost << ',' << bvh.minLeafDepth << ',' << bvh.maxLeafDepth << ',' << bvh.averageLeafDepth << '\n';
+        }
+
+        void WriteJson(std::ostream& out, const BvhQualityReport& bvh)
+        {
+            out << "\"nodes\": " << bvh.nodeCount
+                << ", \"leaves\": " << bvh.leafCount
+                << ", \"primitives\": " << bvh.primitiveCount
+                << ", \"sahCost\": " << bvh.sahCost
+                << ", \"averageLeafSize\": " << bvh.averageLeafSize
+                << ", \"averageSiblingOverlap\": " << bvh.averageSiblingOverlap
+                << ", \"overlapCost\": " << bvh.overlapCost
+                << ", \"minLeafDepth\": " << bvh.minLeafDepth
+                << ", \"maxLeafDepth\": " << bvh.maxLeafDepth
+                << ", \"averageLeafDepth\": " << bvh.averageLeafDepth
+                << ", \"leafSizeHistogram\": [";
+            for (std::size_t i = 0; i < bvh.leafSizeHistogram.size(); ++i) {
+                out << (i == 0 ? "" : ", ") << bvh.leafSizeHistogram[i];
+            }
+            out << "]";
+        }
+    }
+
+    TraversalHeatmap TraceTraversalHeatmap(WorkerPool& pool, const RtScene& scene, const TopLevelAccel& topLevel,
+        std::uint32_t width, std::uint32_t height, std::uint32_t samplesPerPixel)
+    {
+        TraversalHeatmap heatmap;
+        heatmap.width = width;
+        heatmap.height = height;
+        const std::size_t pixelCount = static_cast<std::size_t>(width) * height;
+        heatmap.nodeVisits.assign(pixelCount, 0.0f);
+        heatmap.primitiveTests.assign(pixelCount, 0.0f);
+        samplesPerPixel = std::max(samplesPerPixel, 1u);
+        const float aspect = static_cast<float>(width) / static_cast<float>(height);
+        const float invSamples = 1.0f / static_cast<float>(samplesPerPixel);
+
+        ParallelRows(pool, height, [&](std::uint32_t y) {
+            for (std::uint32_t x = 0; x < width; ++x) {
+                const std::size_t pixel = static_cast<std::size_t>(y) * width + x;
+                TraversalStats stats;
+                for (std::uint32_t s = 0; s < samplesPerPixel; ++s) {
+                    float jitterX = 0.5f;
+                    float jitterY = 0.5f;
+                    if (samplesPerPixel > 1) {
+                        Sampler sampler(0, pixel, s);
+                        jitterX = sampler.Next1D();
+                        jitterY = sampler.Next1D();
+                    }
+                    const Ray ray = GenerateCameraRay(scene.camera, (static_cast<float>(x) + jitterX) / static_cast<float>(width),
+                        (static_cast<float>(y) + jitterY) / static_cast<float>(height), aspect);
+                    Hit hit;
+                    IntersectCounted(scene, topLevel, ray, hit, stats);
+                }
+                heatmap.nodeVisits[pixel] = static_cast<float>(stats.nodeVisits) * invSamples;
+                heatmap.primitiveTests[pixel] = static_cast<float>(stats.primitiveTests) * invSamples;
+            }
+        });
+        return heatmap;
+    }
+
+    std::vector<float> FalseColor(std::span<const float> values, float maxValue)
+    {
+        static constexpr std::array<Vec3, 6> Ramp = {
+            Vec3(0.0f, 0.0f, 0.0f),
+            Vec3(0.0f, 0.0f, 1.0f),
+            Vec3(0.0f, 1.0f, 1.0f),
+            Vec3(0.0f, 1.0f, 0.0f),
+            Vec3(1.0f, 1.0f, 0.0f),
+            Vec3(1.0f, 0.0f, 0.0f),
+        };
+        if (maxValue <= 0.0f) {
+            for (float value : values) {
+                maxValue = std::max(maxValue, value);
+            }
+        }
+        const float scale = maxValue > 0.0f ? static_cast<float>(Ramp.size() - 1) / maxValue : 0.0f;
+
+        std::vector<float> rgb(values.size() * 3);
+        for (std::size_t i = 0; i < values.size(); ++i) {
+            const float position = std::clamp(values[i] * scale, 0.0f, static_cast<float>(Ramp.size() - 1));
+            const std::size_t segment = std::min(static_cast<std::size_t>(position), Ramp.size() - 2);
+            const float t = position - static_cast<float>(segment);
+            const Vec3 color = Ramp[segment] * (1.0f - t) + Ramp[segment + 1] * t;
+            rgb[i * 3 + 0] = color.x;
+            rgb[i * 3 + 1] = color.y;
+            rgb[i * 3 + 2] = color.z;
+        }
+        return rgb;
+    }
+
+    BvhQualityReport AnalyzeBvh(const Bvh& bvh, const BvhBuildSettings& costs)
+    {
+        BvhQualityReport report;
+        if (bvh.nodes.empty()) {
+            return report;
+        }
+        const float rootArea = NodeBounds(bvh.nodes[0]).SurfaceArea();
+        const float invRootArea = rootArea > 0.0f ? 1.0f / rootArea : 0.0f;
+
+        // Walk from the root; clustered layouts hold padding nodes that no parent references.
+        struct StackEntry
+        {
+            std::uint32_t nodeIndex;
+            std::uint32_t depth;
+        };
+        std::vector<StackEntry> stack = { { 0, 0 } };
+        double sahCost = 0.0;
+        double overlapSum = 0.0;
+        double overlapCost = 0.0;
+        std::uint64_t depthSum = 0;
+        report.minLeafDepth = ~0u;
+        while (!stack.empty()) {
+            const StackEntry entry = stack.back();
+            stack.pop_back();
+            const BvhNode& node = bvh.nodes[entry.nodeIndex];
+            const float relativeArea = NodeBounds(node).SurfaceArea() * invRootArea;
+            ++report.nodeCount;
+            if (node.IsLeaf()) {
+                ++report.leafCount;
+                report.primitiveCount += node.primCount;
+                sahCost += costs.intersectionCost * static_cast<double>(node.primCount) * relativeArea;
+                if (report.leafSizeHistogram.size() <= node.primCount) {
+                    report.leafSizeHistogram.resize(node.primCount + 1, 0);
+                }
+                ++report.leafSizeHistogram[node.primCount];
+                report.minLeafDepth = std::min(report.minLeafDepth, entry.depth);
+                report.maxLeafDepth = std::max(report.maxLeafDepth, entry.depth);
+                depthSum += entry.depth;
+                continue;
+            }
+            sahCost += costs.traversalCost * relativeArea;
+            const Aabb overlap = Intersection(NodeBounds(bvh.nodes[node.leftOrFirst]), NodeBounds(bvh.nodes[node.leftOrFirst + 1]));
+            const float parentArea = NodeBounds(node).SurfaceArea();
+            overlapSum += parentArea > 0.0f ? overlap.SurfaceArea() / parentArea : 0.0f;
+            overlapCost += overlap.SurfaceArea() * invRootArea;
+            stack.push_back({ node.leftOrFirst, entry.depth + 1 });
+            stack.push_back({ node.leftOrFirst + 1, entry.depth + 1 });
+        }
+
+        const std::uint32_t interiorCount = report.nodeCount - report.leafCount;
+        report.sahCost = static_cast<float>(sahCost);
+        report.averageLeafSize = static_cast<float>(static_cast<double>(report.primitiveCount) / report.leafCount);
+        report.averageSiblingOverlap = interiorCount > 0 ? static_cast<float>(overlapSum / interiorCount) : 0.0f;
+        report.overlapCost = static_cast<float>(overlapCost);
+        report.averageLeafDepth = static_cast<float>(static_cast<double>(depthSum) / report.leafCount);
+        return report;
+    }
+
+    SceneBvhReport AnalyzeSceneBvhs(const RtScene& scene, const BvhBuildSettings& costs)
+    {
+        SceneBvhReport report;
+        report.topLevel = AnalyzeBvh(scene.topLevel.bvh, costs);
+
+        std::vector<std::uint32_t> instanceCounts(scene.meshAccels.size(), 0);
+        for (const Instance& instance : scene.topLevel.instances) {
+            ++instanceCounts[instance.meshAccelIndex];
+        }
+        for (std::uint32_t i = 0; i < scene.meshAccels.size(); ++i) {
+            const MeshAccel& accel = scene.meshAccels[i];
+            if (accel.IsEmpty()) {
+                continue;
+            }
+            MeshAccelReport mesh;
+            mesh.meshAccelIndex = i;
+            mesh.meshIndex = accel.meshIndex;
+            mesh.submeshIndex = accel.submeshIndex;
+            mesh.shapeGroupIndex = accel.shapeGroupIndex;
+            mesh.instanceCount = instanceCounts[i];
+            mesh.bvh = AnalyzeBvh(accel.bvh, costs);
+            report.meshes.push_back(std::move(mesh));
+        }
+        std::stable_sort(report.meshes.begin(), report.meshes.end(),
+            [](const MeshAccelReport& a, const MeshAccelReport& b) { return a.bvh.sahCost > b.bvh.sahCost; });
+        return report;
+    }
+
+    void WriteBvhReportCsv(std::ostream& out, const SceneBvhReport& report)
+    {
+        out << "bvh,mesh_accel,mesh,submesh,shape_group,instances,nodes,leaves,primitives,sah_cost,average_leaf_size,max_leaf_size,"
+               "average_sibling_overlap,overlap_cost,min_leaf_depth,max_leaf_depth,average_leaf_depth\n"
+            << std::setprecision(6);
+        WriteCsvRow(out, "top_level", nullptr, report.topLevel);
+        for (const MeshAccelReport& mesh : report.meshes) {
+            WriteCsvRow(out, "mesh", &mesh, mesh.bvh);
+        }
+    }
+
+    void WriteBvhReportJson(std::ostream& out, const SceneBvhReport& report)
+    {
+        out << std::setprecision(6);
+        out << "{\n";
+        out << "  \"topLevel\": { ";
+        WriteJson(out, report.topLevel);
+        out << " },\n";
+        out << "  \"meshes\": [";
+        for (std::size_t i = 0; i < report.meshes.size(); ++i) {
+            const MeshAccelReport& mesh = report.meshes[i];
+            out << (i == 0 ? "\n" : ",\n");
+            out << "    { \"meshAccel\": " << mesh.meshAccelIndex;
+            if (mesh.meshIndex != InvalidIndex) {
+                out << ", \"mesh\": " << mesh.meshIndex;
+            }
+            if (mesh.submeshIndex != InvalidIndex) {
+                out << ", \"submesh\": " << mesh.submeshIndex;
+            }
+            if (mesh.shapeGroupIndex != InvalidIndex) {
+                out << ", \"shapeGroup\": " << mesh.shapeGroupIndex;
+            }
+            out << ", \"instances\": " << mesh.instanceCount << ",\n      ";
+            WriteJson(out, mesh.bvh);
+            out << " }";
+        }
+        out << "\n  ]\n}\n";
+    }
+}
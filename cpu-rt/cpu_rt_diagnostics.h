@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <span>
+#include <vector>
+
+#include "cpu_rt_bvh.h"
+#include "cpu_rt_scene.h"
+#include "cpu_rt_threading.h"
+
+namespace cpu_rt
+{
+    enum class HeatmapMetric : std::uint32_t
+    {
+        NodeVisits,
+        PrimitiveTests,
+    };
+
+    // Traversal work of the camera rays through each pixel, averaged over the pixel's rays.
+    struct TraversalHeatmap
+    {
+        std::uint32_t width = 0;
+        std::uint32_t height = 0;
+        // Row-major, one value per pixel.
+        std::vector<float> nodeVisits;
+        std::vector<float> primitiveTests;
+
+        const std::vector<float>& Values(HeatmapMetric metric) const { return metric == HeatmapMetric::NodeVisits ? nodeVisits : primitiveTests; }
+    };
+
+    // Closest-hit camera rays with traversal counting: through the pixel centers, or jittered within the
+    // pixels when samplesPerPixel is above 1. Camera rays only, so costs of secondary rays leaving a
+    // surface are not shown.
+    TraversalHeatmap TraceTraversalHeatmap(WorkerPool& pool, const RtScene& scene, const TopLevelAccel& topLevel,
+        std::uint32_t width, std::uint32_t height, std::uint32_t samplesPerPixel = 1);
+
+    // False-color RGB for per-pixel values: black at 0, then blue, cyan, green, yellow and red at maxValue
+    // and above. maxValue 0 uses the largest value.
+    std::vector<float> FalseColor(std::span<const float> values, float maxValue = 0.0f);
+
+    // Structure statistics of a built BVH, walked from the root.
+    struct BvhQualityReport
+    {
+        std::uint32_t nodeCount = 0;
+        std::uint32_t leafCount = 0;
+        // Primitive references in the leaves.
+        std::uint64_t primitiveCount = 0;
+        // Expected cost of a ray that hits the root bounds, in the units of the traversal and intersection
+        // costs: every node weighted by its surface area relative to the root.
+        float sahCost = 0.0f;
+        // leafSizeHistogram[n] is the number of leaves with n primitives.
+        std::vector<std::uint32_t> leafSizeHistogram;
+        float averageLeafSize = 0.0f;
+        // Surface area of the overlap of sibling bounds relative to their parent's, averaged over interior
+        // nodes; 0 when siblings are disjoint. Rays through the overlap have to visit both children.
+        float averageSiblingOverlap = 0.0f;
+        // Sum over interior nodes of the sibling overlap area relative to the root's: the expected number
+        // of extra child visits per ray caused by overlap.
+        float overlapCost = 0.0f;
+        std::uint32_t minLeafDepth = 0;
+        std::uint32_t maxLeafDepth = 0;
+        float averageLeafDepth = 0.0f;
+    };
+
+    BvhQualityReport AnalyzeBvh(const Bvh& bvh, const BvhBuildSettings& costs = {});
+
+    struct MeshAccelReport
+    {
+        std::uint32_t meshAccelIndex = InvalidIndex;
+        // Source of the accel: scene_core mesh and submesh, or shape group.
+        std::uint32_t meshIndex = InvalidIndex;
+        std::uint32_t submeshIndex = InvalidIndex;
+        std::uint32_t shapeGroupIndex = InvalidIndex;
+        // Instances of the accel in the top level.
+        std::uint32_t instanceCount = 0;
+        BvhQualityReport bvh;
+    };
+
+    struct SceneBvhReport
+    {
+        BvhQualityReport topLevel;
+        // One entry per non-empty mesh accel, most expensive SAH cost first.
+        std::vector<MeshAccelReport> meshes;
+    };
+
+    SceneBvhReport AnalyzeSceneBvhs(const RtScene& scene, const BvhBuildSettings& costs = {});
+
+    // One row per BVH, the top level first.
+    void WriteBvhReportCsv(std::ostream& out, const SceneBvhReport& report);
+    // The top level and the meshes as an array, with leaf size histograms.
+    void WriteBvhReportJson(std::ostream& out, const SceneBvhReport& report);
+}
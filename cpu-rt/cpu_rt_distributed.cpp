@@ -0,0 +1,403 @@
+#include "cpu_rt_distributed.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cpu_rt_serialize.h"
+#include "cpu_rt_socket.h"
+
+namespace cpu_rt
+{
+    namespace
+    {
+        // Messages are a header followed by size payload bytes, all in host byte order; coordinator and
+        // workers must share endianness.
+        constexpr std::uint32_t MessageMagic = 0x44545243; // "CRTD"
+        constexpr std::uint32_t ProtocolVersion = 1;
+        // Largest Setup payload a worker accepts, so a corrupt or foreign header cannot make it allocate
+        // without bound. Larger scenes fail on the coordinator before any worker connects.
+        constexpr std::uint64_t MaxSetupSize = std::uint64_t(4) << 30;
+
+        enum class MessageType : std::uint32_t
+        {
+            // Coordinator -> worker: render settings and the serialized scene.
+            Setup = 1,
+            // Worker -> coordinator: scene is built, with the worker's thread count.
+            Ready,
+            // Coordinator -> worker: sample range and tile rectangles.
+            Batch,
+            // Worker -> coordinator: Framebuffer::SaveRegion() state of each batch tile, in order.
+            Results,
+            // Coordinator -> worker: no more work.
+            Done,
+        };
+
+        struct MessageHeader
+        {
+            std::uint32_t magic;
+            MessageType type;
+            std::uint64_t size;
+        };
+
+        bool SendMessage(Socket& socket, MessageType type, const std::vector<std::byte>& payload)
+        {
+            const MessageHeader header{ MessageMagic, type, payload.size() };
+            return socket.SendAll(&header, sizeof(header)) && socket.SendAll(payload.data(), payload.size());
+        }
+
+        bool ReceiveMessage(Socket& socket, MessageType expected, std::uint64_t maxSize, std::vector<std::byte>& payload)
+        {
+            MessageHeader header{};
+            if (!socket.ReceiveAll(&header, sizeof(header)) || header.magic != MessageMagic || header.type != expected || header.size > maxSize) {
+                return false;
+            }
+            payload.resize(static_cast<std::size_t>(header.size));
+            return socket.ReceiveAll(payload.data(), payload.size());
+        }
+
+        // The parts of RenderSettings that affect sample values. Threading stays per process and
+        // denoising runs on the coordinator.
+        void WriteRenderSettings(ByteWriter& writer, const RenderSettings& settings, AovFlags aovs)
+        {
+            writer.Write(ProtocolVersion);
+            writer.Write(settings.width);
+            writer.Write(settings.height);
+            writer.Write(settings.maxDepth);
+            writer.Write(settings.seed);
+            writer.Write(settings.environmentRadiance);
+            writer.Write(aovs);
+            writer.Write(settings.bvh.maxLeafSize);
+            writer.Write(settings.bvh.binCount);
+            writer.Write(settings.bvh.traversalCost);
+            writer.Write(settings.bvh.intersectionCost);
+        }
+
+        bool ReadRenderSettings(ByteReader& reader, RenderSettings& settings)
+        {
+            std::uint32_t version = 0;
+            if (!reader.Read(version) || version != ProtocolVersion) {
+                return false;
+            }
+            reader.Read(settings.width);
+            reader.Read(settings.height);
+            reader.Read(settings.maxDepth);
+            reader.Read(settings.seed);
+            reader.Read(settings.environmentRadiance);
+            reader.Read(settings.aovs);
+            reader.Read(settings.bvh.maxLeafSize);
+            reader.Read(settings.bvh.binCount);
+            reader.Read(settings.bvh.traversalCost);
+            reader.Read(settings.bvh.intersectionCost);
+            settings.denoise = false;
+            return reader.Ok() && settings.width != 0 && settings.height != 0;
+        }
+
+        // Tiles waiting to be rendered. Tiles of a failed worker go back to the front of the queue.
+        class TileQueue
+        {
+        public:
+            explicit TileQueue(const std::vector<std::uint32_t>& tiles)
+                : m_pending(tiles.begin(), tiles.end())
+            {
+            }
+
+            // Blocks while other workers may still fail and return tiles. Returns false once everything is done.
+            bool Take(std::uint32_t maxCount, std::vector<std::uint32_t>& tiles)
+            {
+                std::unique_lock lock(m_mutex);
+                m_changed.wait(lock, [this] { return m_stopped || !m_pending.empty() || m_outstanding == 0; });
+                tiles.clear();
+                while (!m_stopped && !m_pending.empty() && tiles.size() < maxCount) {
+                    tiles.push_back(m_pending.front());
+                    m_pending.pop_front();
+                }
+                m_outstanding += static_cast<std::uint32_t>(tiles.size());
+                return !tiles.empty();
+            }
+
+            void Complete(std::uint32_t count)
+            {
+                std::lock_guard lock(m_mutex);
+                m_outstanding -= count;
+                m_changed.notify_all();
+            }
+
+            void Requeue(const std::vector<std::uint32_t>& tiles)
+            {
+                std::lock_guard lock(m_mutex);
+                m_pending.insert(m_pending.begin(), tiles.begin(), tiles.end());
+                m_outstanding -= static_cast<std::uint32_t>(tiles.size());
+                m_changed.notify_all();
+            }
+
+            void Stop()
+            {
+                std::lock_guard lock(m_mutex);
+                m_stopped = true;
+                m_changed.notify_all();
+            }
+
+            bool Finished()
+            {
+                std::lock_guard lock(m_mutex);
+                return m_pending.empty() && m_outstanding == 0;
+            }
+
+        private:
+            std::mutex m_mutex;
+            std::condition_variable m_changed;
+            std::deque<std::uint32_t> m_pending;
+            std::uint32_t m_outstanding = 0;
+            bool m_stopped = false;
+        };
+
+        struct CoordinatorState
+        {
+            const std::vector<std::byte>* setup = nullptr;
+            const std::vector<Tile>* tiles = nullptr;
+            Framebuffer* framebuffer = nullptr;
+            TileQueue* queue = nullptr;
+            std::uint32_t firstSample = 0;
+            std::uint32_t sampleCount = 0;
+            std::uint32_t tilesPerBatch = 0;
+            std::uint32_t batchTimeoutSeconds = 0;
+        };
+
+        // Runs on one coordinator thread per connected worker.
+        void ServeWorker(Socket socket, const CoordinatorState& state)
+        {
+            std::vector<std::byte> payload;
+            socket.SetReceiveTimeout(state.batchTimeoutSeconds);
+            if (!SendMessage(socket, MessageType::Setup, *state.setup) || !ReceiveMessage(socket, MessageType::Ready, 64, payload)) {
+                return;
+            }
+            ByteReader ready(payload);
+            std::uint32_t threadCount = 1;
+            ready.Read(threadCount);
+            const std::uint32_t batchSize = state.tilesPerBatch != 0 ? state.tilesPerBatch : std::max(threadCount, 1u);
+
+            std::vector<std::uint32_t> batch;
+            while (state.queue->Take(batchSize, batch)) {
+                ByteWriter writer;
+                writer.Write(state.firstSample);
+                writer.Write(state.sampleCount);
+                writer.Write(static_cast<std::uint32_t>(batch.size()));
+                std::uint64_t resultBytes = 0;
+                for (std::uint32_t tileIndex : batch) {
+                    const Tile& tile = (*state.tiles)[tileIndex];
+                    writer.Write(tile.x0);
+                    writer.Write(tile.y0);
+                    writer.Write(tile.x1);
+                    writer.Write(tile.y1);
+                    resultBytes += state.framebuffer->RegionStateBytes(tile);
+                }
+
+                if (!SendMessage(socket, MessageType::Batch, writer.Bytes())
+                    || !ReceiveMessage(socket, MessageType::Results, resultBytes, payload)
+                    || payload.size() != resultBytes) {
+                    state.queue->Requeue(batch);
+                    return;
+                }
+
+                // Batches never share tiles, so merging needs no lock.
+                const std::byte* src = payload.data();
+                for (std::uint32_t tileIndex : batch) {
+                    const Tile& tile = (*state.tiles)[tileIndex];
+                    state.framebuffer->MergeRegion(tile, src);
+                    src += state.framebuffer->RegionStateBytes(tile);
+                }
+                state.queue->Complete(static_cast<std::uint32_t>(batch.size()));
+            }
+            SendMessage(socket, MessageType::Done, {});
+        }
+    }
+
+    bool RenderDistributed(const scene_core::Scene& scene, const RenderSettings& settings, const DistributedSettings& distributed, RenderOutput& output)
+    {
+        Listener listener;
+        if (!listener.Listen(distributed.address)) {
+            return false;
+        }
+
+        // The local renderer only provides the tiles, the accumulation buffer and the denoiser.
+        Renderer renderer(settings);
+        Framebuffer& framebuffer = renderer.GetFramebuffer();
+
+        ByteWriter setup;
+        WriteRenderSettings(setup, settings, framebuffer.Aovs());
+        WriteScene(setup, scene);
+        if (setup.Bytes().size() > MaxSetupSize) {
+            return false;
+        }
+
+        // Tiles clipped to the crop window, handed out in priority order.
+        const Tile cropRect = CropRect(settings.crop, settings.width, settings.height);
+        std::vector<Tile> regions;
+        std::vector<std::uint32_t> order;
+        for (const Tile& tile : renderer.GetTiles()) {
+            const Tile clipped = ClipTile(tile, cropRect);
+            if (clipped.x0 != clipped.x1) {
+                order.push_back(static_cast<std::uint32_t>(regions.size()));
+                regions.push_back(clipped);
+            }
+        }
+        const std::vector<float> keys = TilePriorityKeys(regions, settings.width, settings.height, settings.tilePriority);
+        std::stable_sort(order.begin(), order.end(), [&keys](std::uint32_t a, std::uint32_t b) { return keys[a] < keys[b]; });
+
+        TileQueue queue(order);
+        CoordinatorState state;
+        state.setup = &setup.Bytes();
+        state.tiles = &regions;
+        state.framebuffer = &framebuffer;
+        state.queue = &queue;
+        state.sampleCount = settings.samplesPerPixel;
+        state.tilesPerBatch = distributed.tilesPerBatch;
+        state.batchTimeoutSeconds = distributed.batchTimeoutSeconds;
+
+        struct Connection
+        {
+            std::thread thread;
+            std::shared_ptr<std::atomic<bool>> finished;
+        };
+        std::list<Connection> connections;
+        auto lastConnected = std::chrono::steady_clock::now();
+
+        while (settings.samplesPerPixel != 0 && !queue.Finished()) {
+            connections.remove_if([](Connection& connection) {
+                if (!connection.finished->load()) {
+                    return false;
+                }
+                connection.thread.join();
+                return true;
+            });
+
+            if (!connections.empty()) {
+                lastConnected = std::chrono::steady_clock::now();
+            } else if (std::chrono::steady_clock::now() - lastConnected > std::chrono::seconds(distributed.idleTimeoutSeconds)) {
+                break;
+            }
+
+            if (connections.size() >= distributed.maxWorkers) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            Socket socket = listener.Accept(100);
+            if (!socket.IsValid()) {
+                continue;
+            }
+            Connection& connection = connections.emplace_back();
+            connection.finished = std::make_shared<std::atomic<bool>>(false);
+            connection.thread = std::thread([socket = std::move(socket), &state, finished = connection.finished]() mutable {
+                ServeWorker(std::move(socket), state);
+                finished->store(true);
+            });
+        }
+
+        queue.Stop();
+        for (Connection& connection : connections) {
+            connection.thread.join();
+        }
+        if (settings.samplesPerPixel != 0 && !queue.Finished()) {
+            return false;
+        }
+
+        output = settings.denoise ? renderer.ResolveDenoised(settings.denoiser) : renderer.Resolve();
+        return true;
+    }
+
+    bool RunRenderWorker(const std::string& address, const ThreadingSettings& threading)
+    {
+        Socket socket;
+        if (!socket.Connect(address)) {
+            return false;
+        }
+
+        std::vector<std::byte> payload;
+        if (!ReceiveMessage(socket, MessageType::Setup, MaxSetupSize, payload)) {
+            return false;
+        }
+        ByteReader reader(payload);
+        RenderSettings settings;
+        scene_core::Scene scene;
+        if (!ReadRenderSettings(reader, settings) || !ReadScene(reader, scene)) {
+            return false;
+        }
+        settings.threading = threading;
+
+        Renderer renderer(settings);
+        renderer.SetScene(scene);
+
+        ByteWriter ready;
+        ready.Write(renderer.GetWorkerPool().WorkerCount());
+        if (!SendMessage(socket, MessageType::Ready, ready.Bytes())) {
+            return false;
+        }
+
+        std::vector<Tile> regions;
+        std::vector<std::byte> results;
+        for (;;) {
+            MessageHeader header{};
+            if (!socket.ReceiveAll(&header, sizeof(header)) || header.magic != MessageMagic) {
+                return false;
+            }
+            if (header.type == MessageType::Done) {
+                return true;
+            }
+            if (header.type != MessageType::Batch || header.size > (1u << 30)) {
+                return false;
+            }
+            payload.resize(static_cast<std::size_t>(header.size));
+            if (!socket.ReceiveAll(payload.data(), payload.size())) {
+                return false;
+            }
+
+            ByteReader batch(payload);
+            std::uint32_t firstSample = 0;
+            std::uint32_t sampleCount = 0;
+            std::uint32_t regionCount = 0;
+            batch.Read(firstSample);
+            batch.Read(sampleCount);
+            if (!batch.Read(regionCount) || regionCount > batch.Remaining() / (4 * sizeof(std::uint32_t))) {
+                return false;
+            }
+            regions.resize(regionCount);
+            for (Tile& region : regions) {
+                batch.Read(region.x0);
+                batch.Read(region.y0);
+                batch.Read(region.x1);
+                batch.Read(region.y1);
+                region.numaNode = 0;
+                if (region.x0 >= region.x1 || region.x1 > settings.width || region.y0 >= region.y1 || region.y1 > settings.height) {
+                    return false;
+                }
+            }
+            if (!batch.Ok()) {
+                return false;
+            }
+
+            renderer.RenderRegions(regions, firstSample, sampleCount);
+
+            std::size_t resultBytes = 0;
+            for (const Tile& region : regions) {
+                resultBytes += renderer.GetFramebuffer().RegionStateBytes(region);
+            }
+            results.resize(resultBytes);
+            std::byte* dst = results.data();
+            for (const Tile& region : regions) {
+                renderer.GetFramebuffer().SaveRegion(region, dst);
+                dst += renderer.GetFramebuffer().RegionStateBytes(region);
+            }
+            if (!SendMessage(socket, MessageType::Results, results)) {
+                return false;
+            }
+        }
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "../scene-core/scene.h"
+#include "cpu_rt.h"
+
+namespace cpu_rt
+{
+    struct DistributedSettings
+    {
+        // "host:port" or "unix:/path" the coordinator listens on and workers connect to.
+        std::string address = "127.0.0.1:7878";
+        // Maximum number of workers connected at once. Workers may join, leave or reconnect during the render.
+        std::uint32_t maxWorkers = 64;
+        // Tiles per request; 0 sends one tile per worker thread.
+        std::uint32_t tilesPerBatch = 0;
+        // A worker that does not answer within this time is dropped and its tiles are handed to others.
+        std::uint32_t batchTimeoutSeconds = 600;
+        // Give up when no worker has been connected for this long.
+        std::uint32_t idleTimeoutSeconds = 60;
+    };
+
+    // Coordinator: serve settings.samplesPerPixel samples of every tile to worker processes and merge
+    // their sample buffers. The coordinator only renders through its workers; run a local worker to use
+    // its own CPUs. Returns false if the address cannot be bound, the serialized settings and scene exceed
+    // 4 GiB or workers stay away past the idle timeout.
+    bool RenderDistributed(const scene_core::Scene& scene, const RenderSettings& settings, const DistributedSettings& distributed, RenderOutput& output);
+
+    // Worker: connect to a coordinator, render the tiles it hands out and return when it is done.
+    bool RunRenderWorker(const std::string& address, const ThreadingSettings& threading);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+
+namespace cpu_rt
+{
+    // Scene features the render kernels are specialized on. A kernel compiled without a feature
+    // contains no code for it and must only run on scenes that do not use it.
+    enum SceneFeatureBits : std::uint32_t
+    {
+        // Some instance has a non-identity transform; without it rays are not transformed per instance.
+        SceneFeatureInstanceTransforms = 1u << 0,
+        // Analytic shapes in some BLAS; without it leaves hold triangles only.
+        SceneFeatureAnalyticShapes = 1u << 1,
+        // Some material references a texture, so texture coordinates are interpolated.
+        SceneFeatureTextures = 1u << 2,
+        // Some material emits light.
+        SceneFeatureEmission = 1u << 3,
+        // Punctual lights, sampled with next-event estimation.
+        SceneFeaturePunctualLights = 1u << 4,
+    };
+    using SceneFeatures = std::uint32_t;
+
+    inline constexpr SceneFeatures AllSceneFeatures = (1u << 5) - 1;
+    // Features that change ray traversal and surface reconstruction.
+    inline constexpr SceneFeatures TraversalFeatures = SceneFeatureInstanceTransforms | SceneFeatureAnalyticShapes;
+    inline constexpr SceneFeatures SurfaceFeatures = TraversalFeatures | SceneFeatureTextures;
+}
@@ -0,0 +1,315 @@
+#include "cpu_rt_framebuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace cpu_rt
+{
+    namespace
+    {
+        AovFlags AovOfPlane(AovPlane plane)
+        {
+            switch (plane) {
+            case AovPlane::AlbedoR:
+            case AovPlane::AlbedoG:
+            case AovPlane::AlbedoB:
+                return AovAlbedo;
+            case AovPlane::NormalX:
+            case AovPlane::NormalY:
+            case AovPlane::NormalZ:
+                return AovNormal;
+            case AovPlane::Depth:
+                return AovDepth;
+            default:
+                return 0;
+            }
+        }
+    }
+
+    void Framebuffer::Allocate(std::uint32_t width, std::uint32_t height, std::uint32_t tileSize, const std::vector<Tile>& tiles, AovFlags aovs,
+        WorkerPool& pool)
+    {
+        m_width = width;
+        m_height = height;
+        m_tileSize = std::max(1u, tileSize);
+        m_aovs = aovs;
+
+        // Uninitialized storage: no page is touched until Clear() runs on the owning workers.
+        const std::size_t pixelCount = PixelCount();
+        m_radiance = std::make_unique_for_overwrite<float[]>(pixelCount * 3);
+        m_luminanceSquares = std::make_unique_for_overwrite<float[]>(pixelCount);
+        m_sampleCounts = std::make_unique_for_overwrite<std::uint32_t[]>(pixelCount);
+        for (std::uint32_t plane = 0; plane < static_cast<std::uint32_t>(AovPlane::Count); ++plane) {
+            m_planes[plane].reset();
+            if (aovs & AovOfPlane(static_cast<AovPlane>(plane))) {
+                m_planes[plane] = std::make_unique_for_overwrite<float[]>(pixelCount);
+            }
+        }
+        m_nodeIds.reset();
+        if (aovs & AovNodeId) {
+            m_nodeIds = std::make_unique_for_overwrite<std::uint32_t[]>(pixelCount);
+        }
+        m_materialIds.reset();
+        if (aovs & AovMaterialId) {
+            m_materialIds = std::make_unique_for_overwrite<std::uint32_t[]>(pixelCount);
+        }
+
+        m_tiles = tiles;
+
+        Clear(pool);
+    }
+
+    void Framebuffer::Clear(WorkerPool& pool)
+    {
+        pool.Run([this, &pool](const WorkerInfo& worker) {
+            const std::uint32_t stride = pool.WorkersOnNode(worker.numaNode);
+            std::uint32_t tileInNode = 0;
+            for (const Tile& tile : m_tiles) {
+                if (tile.numaNode != worker.numaNode) {
+                    continue;
+                }
+                if (tileInNode++ % stride != worker.indexInNode) {
+                    continue;
+                }
+                // The tile's block is contiguous.
+                const std::size_t start = PixelIndex(tile.x0, tile.y0);
+                const std::size_t count = static_cast<std::size_t>(tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+                std::memset(&m_radiance[start * 3], 0, sizeof(float) * 3 * count);
+                std::memset(&m_luminanceSquares[start], 0, sizeof(float) * count);
+                std::memset(&m_sampleCounts[start], 0, sizeof(std::uint32_t) * count);
+                for (const std::unique_ptr<float[]>& plane : m_planes) {
+                    if (plane) {
+                        std::memset(&plane[start], 0, sizeof(float) * count);
+                    }
+                }
+                if (m_nodeIds) {
+                    std::fill_n(&m_nodeIds[start], count, scene_core::InvalidIndex);
+                }
+                if (m_materialIds) {
+                    std::fill_n(&m_materialIds[start], count, scene_core::InvalidIndex);
+                }
+            }
+        });
+    }
+
+    // Calls fn(regionPixel, pixel, count) for every run of pixels of a region row that lies within one
+    // tile, and so is contiguous in storage: regionPixel is the run's row-major index in the region,
+    // pixel its storage index.
+    template<typename Fn>
+    void Framebuffer::ForEachSpan(const Tile& region, Fn&& fn) const
+    {
+        const std::uint32_t regionWidth = region.x1 - region.x0;
+        for (std::uint32_t y = region.y0; y < region.y1; ++y) {
+            const std::size_t regionRow = static_cast<std::size_t>(y - region.y0) * regionWidth;
+            for (std::uint32_t x = region.x0; x < region.x1;) {
+                const std::uint32_t spanEnd = std::min(region.x1, x - x % m_tileSize + m_tileSize);
+                fn(regionRow + (x - region.x0), PixelIndex(x, y), spanEnd - x);
+                x = spanEnd;
+            }
+        }
+    }
+
+    void Framebuffer::ClearRegion(const Tile& region)
+    {
+        ForEachSpan(region, [&](std::size_t, std::size_t pixel, std::uint32_t count) {
+            std::fill_n(&m_radiance[pixel * 3], count * 3, 0.0f);
+            std::fill_n(&m_luminanceSquares[pixel], count, 0.0f);
+            std::fill_n(&m_sampleCounts[pixel], count, 0u);
+            for (const std::unique_ptr<float[]>& plane : m_planes) {
+                if (plane) {
+                    std::fill_n(&plane[pixel], count, 0.0f);
+                }
+            }
+            if (m_nodeIds) {
+                std::fill_n(&m_nodeIds[pixel], count, scene_core::InvalidIndex);
+            }
+            if (m_materialIds) {
+                std::fill_n(&m_materialIds[pixel], count, scene_core::InvalidIndex);
+            }
+        });
+    }
+
+    std::vector<float> Framebuffer::Resolve() const
+    {
+        std::vector<float> rgb(PixelCount() * 3);
+        ForEachSpan({ 0, 0, m_width, m_height }, [&](std::size_t linear, std::size_t pixel, std::uint32_t count) {
+            for (std::uint32_t i = 0; i < count; ++i) {
+                const std::uint32_t samples = m_sampleCounts[pixel + i];
+                const float scale = samples != 0 ? 1.0f / static_cast<float>(samples) : 0.0f;
+                for (std::uint32_t c = 0; c < 3; ++c) {
+                    rgb[(linear + i) * 3 + c] = m_radiance[(pixel + i) * 3 + c] * scale;
+                }
+            }
+        });
+        return rgb;
+    }
+
+    std::vector<float> Framebuffer::ResolveVariance() const
+    {
+        std::vector<float> variance(PixelCount(), 0.0f);
+        ForEachSpan({ 0, 0, m_width, m_height }, [&](std::size_t linear, std::size_t pixel, std::uint32_t count) {
+            for (std::uint32_t i = 0; i < count; ++i) {
+                const std::uint32_t samples = m_sampleCounts[pixel + i];
+                if (samples < 2) {
+                    continue;
+                }
+                const float* sum = &m_radiance[(pixel + i) * 3];
+                const float mean = Luminance(Vec3(sum[0], sum[1], sum[2])) / static_cast<float>(samples);
+                const float sampleVariance = std::max(0.0f, m_luminanceSquares[pixel + i] / static_cast<float>(samples) - mean * mean);
+                variance[linear + i] = sampleVariance / static_cast<float>(samples - 1);
+            }
+        });
+        return variance;
+    }
+
+    std::vector<float> Framebuffer::ResolvePlane(AovPlane plane) const
+    {
+        const std::unique_ptr<float[]>& src = m_planes[static_cast<std::size_t>(plane)];
+        if (!src) {
+            return {};
+        }
+        std::vector<float> values(PixelCount(), 0.0f);
+        ForEachSpan({ 0, 0, m_width, m_height }, [&](std::size_t linear, std::size_t pixel, std::uint32_t count) {
+            for (std::uint32_t i = 0; i < count; ++i) {
+                const std::uint32_t samples = m_sampleCounts[pixel + i];
+                values[linear + i] = samples != 0 ? src[pixel + i] / static_cast<float>(samples) : 0.0f;
+            }
+        });
+        return values;
+    }
+
+    std::vector<std::uint32_t> Framebuffer::ResolveNodeIds() const
+    {
+        if (!m_nodeIds) {
+            return {};
+        }
+        std::vector<std::uint32_t> ids(PixelCount());
+        ForEachSpan({ 0, 0, m_width, m_height }, [&](std::size_t linear, std::size_t pixel, std::uint32_t count) {
+            std::memcpy(&ids[linear], &m_nodeIds[pixel], sizeof(std::uint32_t) * count);
+        });
+        return ids;
+    }
+
+    std::vector<std::uint32_t> Framebuffer::ResolveMaterialIds() const
+    {
+        if (!m_materialIds) {
+            return {};
+        }
+        std::vector<std::uint32_t> ids(PixelCount());
+        ForEachSpan({ 0, 0, m_width, m_height }, [&](std::size_t linear, std::size_t pixel, std::uint32_t count) {
+            std::memcpy(&ids[linear], &m_materialIds[pixel], sizeof(std::uint32_t) * count);
+        });
+        return ids;
+    }
+
+    std::uint32_t Framebuffer::MinSampleCount() const
+    {
+        const std::size_t pixelCount = PixelCount();
+        return pixelCount != 0 ? *std::min_element(m_sampleCounts.get(), m_sampleCounts.get() + pixelCount) : 0;
+    }
+
+    // Calls fn(base, bytesPerPixel) for every allocated per-pixel array, in a fixed order.
+    template<typename Fn>
+    void Framebuffer::ForEachChannel(Fn&& fn) const
+    {
+        fn(reinterpret_cast<std::byte*>(m_radiance.get()), sizeof(float) * 3);
+        fn(reinterpret_cast<std::byte*>(m_luminanceSquares.get()), sizeof(float));
+        fn(reinterpret_cast<std::byte*>(m_sampleCounts.get()), sizeof(std::uint32_t));
+        for (const std::unique_ptr<float[]>& plane : m_planes) {
+            if (plane) {
+                fn(reinterpret_cast<std::byte*>(plane.get()), sizeof(float));
+            }
+        }
+        if (m_nodeIds) {
+            fn(reinterpret_cast<std::byte*>(m_nodeIds.get()), sizeof(std::uint32_t));
+        }
+        if (m_materialIds) {
+            fn(reinterpret_cast<std::byte*>(m_materialIds.get()), sizeof(std::uint32_t));
+        }
+    }
+
+    std::size_t Framebuffer::RegionStateBytes(const Tile& region) const
+    {
+        const std::size_t pixelCount = static_cast<std::size_t>(region.x1 - region.x0) * (region.y1 - region.y0);
+        std::size_t bytes = 0;
+        ForEachChannel([&](std::byte*, std::size_t pixelBytes) { bytes += pixelBytes * pixelCount; });
+        return bytes;
+    }
+
+    void Framebuffer::SaveRegion(const Tile& region, std::byte* dst) const
+    {
+        const std::size_t regionPixels = static_cast<std::size_t>(region.x1 - region.x0) * (region.y1 - region.y0);
+        ForEachChannel([&](const std::byte* base, std::size_t pixelBytes) {
+            ForEachSpan(region, [&](std::size_t regionPixel, std::size_t pixel, std::uint32_t count) {
+                std::memcpy(dst + regionPixel * pixelBytes, base + pixel * pixelBytes, count * pixelBytes);
+            });
+            dst += regionPixels * pixelBytes;
+        });
+    }
+
+    void Framebuffer::LoadRegion(const Tile& region, const std::byte* src)
+    {
+        const std::size_t regionPixels = static_cast<std::size_t>(region.x1 - region.x0) * (region.y1 - region.y0);
+        ForEachChannel([&](std::byte* base, std::size_t pixelBytes) {
+            ForEachSpan(region, [&](std::size_t regionPixel, std::size_t pixel, std::uint32_t count) {
+                std::memcpy(base + pixel * pixelBytes, src + regionPixel * pixelBytes, count * pixelBytes);
+            });
+            src += regionPixels * pixelBytes;
+        });
+    }
+
+    void Framebuffer::MergeRegion(const Tile& region, const std::byte* src)
+    {
+        const std::uint32_t regionWidth = region.x1 - region.x0;
+        const std::size_t regionPixels = static_cast<std::size_t>(regionWidth) * (region.y1 - region.y0);
+
+        // Same channel order as ForEachChannel(); sample counts are added last because the IDs depend on them.
+        auto nextChannel = [&](std::size_t pixelBytes) {
+            const std::byte* channel = src;
+            src += pixelBytes * regionPixels;
+            return channel;
+        };
+        auto addFloats = [&](float* dst, const std::byte* channel, std::uint32_t components) {
+            ForEachSpan(region, [&](std::size_t regionPixel, std::size_t pixel, std::uint32_t count) {
+                float* span = dst + pixel * components;
+                const std::byte* values = channel + regionPixel * components * sizeof(float);
+                for (std::uint32_t i = 0; i < count * components; ++i) {
+                    float value;
+                    std::memcpy(&value, values + i * sizeof(float), sizeof(float));
+                    span[i] += value;
+                }
+            });
+        };
+        auto mergeIds = [&](std::uint32_t* dst, const std::byte* channel) {
+            ForEachSpan(region, [&](std::size_t regionPixel, std::size_t pixel, std::uint32_t count) {
+                for (std::uint32_t i = 0; i < count; ++i) {
+                    if (m_sampleCounts[pixel + i] == 0) {
+                        std::memcpy(&dst[pixel + i], channel + (regionPixel + i) * sizeof(std::uint32_t), sizeof(std::uint32_t));
+                    }
+                }
+            });
+        };
+
+        addFloats(m_radiance.get(), nextChannel(sizeof(float) * 3), 3);
+        addFloats(m_luminanceSquares.get(), nextChannel(sizeof(float)), 1);
+        const std::byte* counts = nextChannel(sizeof(std::uint32_t));
+        for (const std::unique_ptr<float[]>& plane : m_planes) {
+            if (plane) {
+                addFloats(plane.get(), nextChannel(sizeof(float)), 1);
+            }
+        }
+        if (m_nodeIds) {
+            mergeIds(m_nodeIds.get(), nextChannel(sizeof(std::uint32_t)));
+        }
+        if (m_materialIds) {
+            mergeIds(m_materialIds.get(), nextChannel(sizeof(std::uint32_t)));
+        }
+        ForEachSpan(region, [&](std::size_t regionPixel, std::size_t pixel, std::uint32_t count) {
+            for (std::uint32_t i = 0; i < count; ++i) {
+                std::uint32_t samples;
+                std::memcpy(&samples, counts + (regionPixel + i) * sizeof(samples), sizeof(samples));
+                m_sampleCounts[pixel + i] += samples;
+            }
+        });
+    }
+}
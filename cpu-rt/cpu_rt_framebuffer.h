@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "cpu_rt_aov.h"
+#include "cpu_rt_math.h"
+#include "cpu_rt_tiles.h"
+
+namespace cpu_rt
+{
+    // Progressive accumulation buffer: per-pixel radiance sum, luminance second moment and sample count,
+    // plus optional planar AOVs.
+    // Pixels are stored tile-major on the render tile grid: every tile is one contiguous block, row-major
+    // within the tile, and tiles follow each other row of tiles by row of tiles. A worker rendering a
+    // 32x32 tile writes 4 KiB per float channel instead of 32 rows spread over the frame, and tiles
+    // rendered by different workers never share a cache line except at the ends of their blocks. The
+    // Resolve functions and the region state are row-major.
+    // Storage is allocated uninitialized and first touched by workers of the NUMA node that renders
+    // the corresponding tiles, so each tile lives in memory local to the socket writing it.
+    class Framebuffer
+    {
+    public:
+        // tiles must be the MakeTiles() grid of tileSize for the image size.
+        void Allocate(std::uint32_t width, std::uint32_t height, std::uint32_t tileSize, const std::vector<Tile>& tiles, AovFlags aovs,
+            WorkerPool& pool);
+        void Clear(WorkerPool& pool);
+
+        std::uint32_t Width() const { return m_width; }
+        std::uint32_t Height() const { return m_height; }
+        AovFlags Aovs() const { return m_aovs; }
+
+        void AddSamples(std::uint32_t x, std::uint32_t y, const PixelSamples& samples)
+        {
+            const std::size_t pixel = PixelIndex(x, y);
+            float* dst = &m_radiance[pixel * 3];
+            dst[0] += samples.radianceSum.x;
+            dst[1] += samples.radianceSum.y;
+            dst[2] += samples.radianceSum.z;
+            m_luminanceSquares[pixel] += samples.luminanceSquaredSum;
+
+            if (m_aovs & AovAlbedo) {
+                AddToPlane(AovPlane::AlbedoR, pixel, samples.features.albedo.x);
+                AddToPlane(AovPlane::AlbedoG, pixel, samples.features.albedo.y);
+                AddToPlane(AovPlane::AlbedoB, pixel, samples.features.albedo.z);
+            }
+            if (m_aovs & AovNormal) {
+                AddToPlane(AovPlane::NormalX, pixel, samples.features.normal.x);
+                AddToPlane(AovPlane::NormalY, pixel, samples.features.normal.y);
+                AddToPlane(AovPlane::NormalZ, pixel, samples.features.normal.z);
+            }
+            if (m_aovs & AovDepth) {
+                AddToPlane(AovPlane::Depth, pixel, samples.features.depth);
+            }
+            // IDs cannot be averaged; keep the ones from the pixel's first batch.
+            if (m_sampleCounts[pixel] == 0) {
+                if (m_nodeIds) {
+                    m_nodeIds[pixel] = samples.features.nodeIndex;
+                }
+                if (m_materialIds) {
+                    m_materialIds[pixel] = samples.features.materialIndex;
+                }
+            }
+            m_sampleCounts[pixel] += samples.count;
+        }
+
+        std::uint32_t SampleCount(std::uint32_t x, std::uint32_t y) const
+        {
+            return m_sampleCounts[PixelIndex(x, y)];
+        }
+
+        Vec3 Average(std::uint32_t x, std::uint32_t y) const
+        {
+            const std::size_t pixel = PixelIndex(x, y);
+            const std::uint32_t count = m_sampleCounts[pixel];
+            if (count == 0) {
+                return {};
+            }
+            const float* src = &m_radiance[pixel * 3];
+            return Vec3(src[0], src[1], src[2]) / static_cast<float>(count);
+        }
+
+        // Averaged linear RGB, row-major.
+        std::vector<float> Resolve() const;
+        // Luminance variance of each pixel's mean estimate.
+        std::vector<float> ResolveVariance() const;
+        // Averaged AOV plane; empty if the AOV is not collected.
+        std::vector<float> ResolvePlane(AovPlane plane) const;
+        // Per-pixel IDs, InvalidIndex where nothing was hit; empty if the AOV is not collected.
+        std::vector<std::uint32_t> ResolveNodeIds() const;
+        std::vector<std::uint32_t> ResolveMaterialIds() const;
+
+        // Smallest per-pixel sample count.
+        std::uint32_t MinSampleCount() const;
+
+        // Raw accumulation state of a rectangle, stored channel after channel, for checkpoints.
+        std::size_t RegionStateBytes(const Tile& region) const;
+        void SaveRegion(const Tile& region, std::byte* dst) const;
+        void LoadRegion(const Tile& region, const std::byte* src);
+        // Add a SaveRegion() buffer holding other samples of the same pixels.
+        void MergeRegion(const Tile& region, const std::byte* src);
+        void ClearRegion(const Tile& region);
+
+    private:
+        template<typename Fn>
+        void ForEachChannel(Fn&& fn) const;
+        template<typename Fn>
+        void ForEachSpan(const Tile& region, Fn&& fn) const;
+
+        // Tiles of the last row and column are cut to the image, so every stored pixel is a real one.
+        std::size_t PixelIndex(std::uint32_t x, std::uint32_t y) const
+        {
+            const std::uint32_t tileX = x - x % m_tileSize;
+            const std::uint32_t tileY = y - y % m_tileSize;
+            const std::uint32_t tileWidth = std::min(m_tileSize, m_width - tileX);
+            const std::uint32_t tileHeight = std::min(m_tileSize, m_height - tileY);
+            return static_cast<std::size_t>(tileY) * m_width + static_cast<std::size_t>(tileX) * tileHeight +
+                   static_cast<std::size_t>(y - tileY) * tileWidth + (x - tileX);
+        }
+        std::size_t PixelCount() const { return static_cast<std::size_t>(m_width) * m_height; }
+
+        void AddToPlane(AovPlane plane, std::size_t pixel, float value)
+        {
+            m_planes[static_cast<std::size_t>(plane)][pixel] += value;
+        }
+
+        std::uint32_t m_width = 0;
+        std::uint32_t m_height = 0;
+        std::uint32_t m_tileSize = 1;
+        AovFlags m_aovs = 0;
+        std::unique_ptr<float[]> m_radiance;
+        std::unique_ptr<float[]> m_luminanceSquares;
+        std::unique_ptr<std::uint32_t[]> m_sampleCounts;
+        // Only the planes of requested AOVs are allocated.
+        std::array<std::unique_ptr<float[]>, static_cast<std::size_t>(AovPlane::Count)> m_planes;
+        std::unique_ptr<std::uint32_t[]> m_nodeIds;
+        std::unique_ptr<std::uint32_t[]> m_materialIds;
+        // The render tiles, each with the NUMA node owning its block.
+        std::vector<Tile> m_tiles;
+    };
+}
@@ -0,0 +1,317 @@
+#include "cpu_rt_guiding.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <utility>
+
+namespace cpu_rt
+{
+    namespace
+    {
+        constexpr std::uint32_t NoNode = ~0u;
+        constexpr std::uint32_t InitialDirectionalDepth = 3;
+        // Guided vertices a cell needs in a pass before it trusts its variance estimates.
+        constexpr std::uint32_t MinFractionSamples = 256;
+
+        // Equal-area cylindrical mapping of the sphere onto the unit square: x = (cos theta + 1) / 2, y = phi / 2 pi.
+        void DirectionToSquare(const Vec3& direction, float& x, float& y)
+        {
+            x = std::clamp((direction.z + 1.0f) * 0.5f, 0.0f, 0x1.fffffep-1f);
+            float phi = std::atan2(direction.y, direction.x);
+            if (phi < 0.0f) {
+                phi += 2.0f * Pi;
+            }
+            y = std::clamp(phi * (0.5f * InvPi), 0.0f, 0x1.fffffep-1f);
+        }
+
+        Vec3 SquareToDirection(float x, float y)
+        {
+            const float cosTheta = 2.0f * x - 1.0f;
+            const float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+            const float phi = 2.0f * Pi * y;
+            return { sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta };
+        }
+
+        // Quadrant of a point in the unit square, rescaling the point to the quadrant.
+        std::uint32_t ChildQuadrant(float& x, float& y)
+        {
+            std::uint32_t quadrant = 0;
+            x *= 2.0f;
+            y *= 2.0f;
+            if (x >= 1.0f) {
+                x -= 1.0f;
+                quadrant |= 1;
+            }
+            if (y >= 1.0f) {
+                y -= 1.0f;
+                quadrant |= 2;
+            }
+            return quadrant;
+        }
+
+        // Pick the lower or upper part of [0, 1) with probability lower : upper and rescale u to that part.
+        bool ChooseUpper(float lower, float upper, float& u)
+        {
+            const float p = lower / (lower + upper);
+            if (u < p) {
+                u = std::min(u / p, 0x1.fffffep-1f);
+                return false;
+            }
+            u = std::min((u - p) / (1.0f - p), 0x1.fffffep-1f);
+            return true;
+        }
+    }
+
+    void GuidingField::Reset(const Aabb& bounds, const GuidingSettings& settings)
+    {
+        m_settings = settings;
+        m_nodes.clear();
+        m_leaves.clear();
+        m_iteration = 0;
+        if (bounds.IsEmpty()) {
+            return;
+        }
+        SpatialNode root;
+        root.bounds = bounds;
+        m_nodes.push_back(root);
+
+        // Start from a uniform 8x8 grid, so the first pass already learns roughly where light comes from.
+        SpatialLeaf& leaf = m_leaves.emplace_back();
+        leaf.bsdfFraction = std::clamp(settings.bsdfSamplingFraction, 0.0f, 1.0f);
+        for (std::uint32_t level = 1; level < InitialDirectionalDepth; ++level) {
+            const std::uint32_t levelEnd = static_cast<std::uint32_t>(leaf.recording.nodes.size());
+            for (std::uint32_t nodeIndex = levelEnd - (1u << (2 * (level - 1))); nodeIndex < levelEnd; ++nodeIndex) {
+                for (std::uint32_t quadrant = 0; quadrant < 4; ++quadrant) {
+                    leaf.recording.nodes[nodeIndex].children[quadrant] = static_cast<std::uint32_t>(leaf.recording.nodes.size());
+                    leaf.recording.nodes.emplace_back();
+                }
+            }
+        }
+    }
+
+    std::uint32_t GuidingField::Locate(const Vec3& p) const
+    {
+        if (m_nodes.empty()) {
+            return NoLeaf;
+        }
+        std::uint32_t nodeIndex = 0;
+        while (m_nodes[nodeIndex].firstChild != 0) {
+            const SpatialNode& node = m_nodes[nodeIndex];
+            nodeIndex = node.firstChild + (p[static_cast<int>(node.axis)] >= node.split ? 1 : 0);
+        }
+        return m_nodes[nodeIndex].leaf;
+    }
+
+    bool GuidingField::CanSample(std::uint32_t leaf) const
+    {
+        return leaf != NoLeaf && m_leaves[leaf].sampling.Total() > 0.0f;
+    }
+
+    // Descend by energy, choosing the column from u0 and the row from u1, so stratified numbers stay
+    // stratified. The density relative to uniform is 4 * energy / total per level.
+    Vec3 GuidingField::Sample(std::uint32_t leaf, float u0, float u1, float& pdf) const
+    {
+        const DirectionalTree& tree = m_leaves[leaf].sampling;
+        float density = 1.0f;
+        float originX = 0.0f;
+        float originY = 0.0f;
+        float size = 1.0f;
+        std::uint32_t nodeIndex = 0;
+        while (true) {
+            const QuadNode& node = tree.nodes[nodeIndex];
+            const float total = node.energy[0] + node.energy[1] + node.energy[2] + node.energy[3];
+            const bool right = ChooseUpper(node.energy[0] + node.energy[2], node.energy[1] + node.energy[3], u0);
+            const bool top = right ? ChooseUpper(node.energy[1], node.energy[3], u1) : ChooseUpper(node.energy[0], node.energy[2], u1);
+            const std::uint32_t quadrant = (right ? 1u : 0u) | (top ? 2u : 0u);
+            density *= 4.0f * node.energy[quadrant] / total;
+            size *= 0.5f;
+            originX += right ? size : 0.0f;
+            originY += top ? size : 0.0f;
+            if (node.children[quadrant] == 0) {
+                break;
+            }
+            nodeIndex = node.children[quadrant];
+        }
+        pdf = density * (0.25f * InvPi);
+        return SquareToDirection(originX + u0 * size, originY + u1 * size);
+    }
+
+    float GuidingField::Pdf(std::uint32_t leaf, const Vec3& direction) const
+    {
+        const DirectionalTree& tree = m_leaves[leaf].sampling;
+        float x = 0.0f;
+        float y = 0.0f;
+        DirectionToSquare(direction, x, y);
+        float density = 1.0f;
+        std::uint32_t nodeIndex = 0;
+        while (true) {
+            const QuadNode& node = tree.nodes[nodeIndex];
+            const float total = node.energy[0] + node.energy[1] + node.energy[2] + node.energy[3];
+            if (total <= 0.0f) {
+                return 0.0f;
+            }
+            const std::uint32_t quadrant = ChildQuadrant(x, y);
+            density *= 4.0f * node.energy[quadrant] / total;
+            if (node.children[quadrant] == 0 || density == 0.0f) {
+                break;
+            }
+            nodeIndex = node.children[quadrant];
+        }
+        return density * (0.25f * InvPi);
+    }
+
+    void GuidingField::Record(std::uint32_t leaf, const GuidingRecord& record)
+    {
+        SpatialLeaf& spatialLeaf = m_leaves[leaf];
+        std::atomic_ref<std::uint32_t>(spatialLeaf.recordCount).fetch_add(1, std::memory_order_relaxed);
+
+        // Monte Carlo estimate of the radiance integrated over each cell the direction falls into.
+        const float energy = record.radiance / record.pdf;
+        if (!std::isfinite(energy) || energy < 0.0f) {
+            return;
+        }
+
+        // With the vertex estimate c / p, the second moment under another mixture p' is E_p[c^2 / (p' p)].
+        if (record.guided && m_settings.learnBsdfSamplingFraction) {
+            std::atomic_ref<std::uint32_t>(spatialLeaf.guidedCount).fetch_add(1, std::memory_order_relaxed);
+            const float contribution = record.bsdfCos * record.radiance;
+            for (std::size_t i = 0; i < BsdfFractionCandidates.size() && contribution > 0.0f; ++i) {
+                const float fraction = BsdfFractionCandidates[i];
+                const float candidatePdf = fraction * record.bsdfPdf + (1.0f - fraction) * record.guidePdf;
+                const float moment = contribution * contribution / (candidatePdf * record.pdf);
+                if (std::isfinite(moment)) {
+                    std::atomic_ref<float>(spatialLeaf.secondMoments[i]).fetch_add(moment, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        if (energy == 0.0f) {
+            return;
+        }
+        float x = 0.0f;
+        float y = 0.0f;
+        DirectionToSquare(record.direction, x, y);
+        DirectionalTree& tree = spatialLeaf.recording;
+        std::uint32_t nodeIndex = 0;
+        while (true) {
+            QuadNode& node = tree.nodes[nodeIndex];
+            const std::uint32_t quadrant = ChildQuadrant(x, y);
+            std::atomic_ref<float>(node.energy[quadrant]).fetch_add(energy, std::memory_order_relaxed);
+            if (node.children[quadrant] == 0) {
+                break;
+            }
+            nodeIndex = node.children[quadrant];
+        }
+    }
+
+    void GuidingField::Update(WorkerPool& pool, std::uint32_t samplesPerPixel)
+    {
+        if (m_nodes.empty()) {
+            return;
+        }
+        ++m_iteration;
+
+        // Split busy cells first; both halves start from the parent's trees.
+        const std::uint32_t threshold = static_cast<std::uint32_t>(
+            std::min(static_cast<double>(m_settings.spatialSplitThreshold) * std::sqrt(static_cast<double>(samplesPerPixel)), 4.0e9));
+        const std::uint32_t nodeCount = static_cast<std::uint32_t>(m_nodes.size());
+        for (std::uint32_t nodeIndex = 0; nodeIndex < nodeCount; ++nodeIndex) {
+            if (m_nodes[nodeIndex].firstChild == 0) {
+                SplitSpatialNode(nodeIndex, m_leaves[m_nodes[nodeIndex].leaf].recordCount, threshold);
+            }
+        }
+
+        std::atomic<std::size_t> nextLeaf{ 0 };
+        pool.Run([&](const WorkerInfo&) {
+            for (std::size_t leafIndex = nextLeaf++; leafIndex < m_leaves.size(); leafIndex = nextLeaf++) {
+                SpatialLeaf& leaf = m_leaves[leafIndex];
+                // Cells nothing reached this pass keep sampling what they learned before.
+                if (leaf.recording.Total() > 0.0f) {
+                    leaf.sampling = leaf.recording;
+                }
+                leaf.recording = Refine(leaf.sampling, m_settings);
+                leaf.recordCount = 0;
+
+                if (leaf.guidedCount >= MinFractionSamples) {
+                    const auto best = std::min_element(leaf.secondMoments.begin(), leaf.secondMoments.end());
+                    leaf.bsdfFraction = BsdfFractionCandidates[static_cast<std::size_t>(best - leaf.secondMoments.begin())];
+                }
+                leaf.secondMoments = {};
+                leaf.guidedCount = 0;
+            }
+        });
+    }
+
+    // Halve the cell along its longest axis until each part is expected to hold at most threshold vertices.
+    void GuidingField::SplitSpatialNode(std::uint32_t nodeIndex, std::uint32_t recordCount, std::uint32_t threshold)
+    {
+        const Vec3 extent = m_nodes[nodeIndex].bounds.Extent();
+        if (recordCount <= threshold || MaxComponent(extent) <= 0.0f) {
+            return;
+        }
+        const std::uint32_t axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+        const std::uint32_t firstChild = static_cast<std::uint32_t>(m_nodes.size());
+
+        SpatialNode lower;
+        lower.bounds = m_nodes[nodeIndex].bounds;
+        lower.bounds.hi[static_cast<int>(axis)] = lower.bounds.Centroid()[static_cast<int>(axis)];
+        lower.leaf = m_nodes[nodeIndex].leaf;
+        SpatialNode upper;
+        upper.bounds = m_nodes[nodeIndex].bounds;
+        upper.bounds.lo[static_cast<int>(axis)] = lower.bounds.hi[static_cast<int>(axis)];
+        upper.leaf = static_cast<std::uint32_t>(m_leaves.size());
+
+        SpatialLeaf copy = m_leaves[lower.leaf];
+        m_leaves.push_back(std::move(copy));
+        m_nodes.push_back(lower);
+        m_nodes.push_back(upper);
+
+        SpatialNode& node = m_nodes[nodeIndex];
+        node.firstChild = firstChild;
+        node.axis = axis;
+        node.split = upper.bounds.lo[static_cast<int>(axis)];
+        SplitSpatialNode(firstChild, recordCount / 2, threshold);
+        SplitSpatialNode(firstChild + 1, recordCount / 2, threshold);
+    }
+
+    // Empty tree for the next pass: quadrants holding more than the split fraction of the energy are
+    // subdivided, those below it are collapsed. Quadrants the old tree did not subdivide pass a quarter
+    // of their energy to each new child.
+    GuidingField::DirectionalTree GuidingField::Refine(const DirectionalTree& tree, const GuidingSettings& settings)
+    {
+        DirectionalTree refined;
+        const float total = tree.Total();
+        if (!(total > 0.0f)) {
+            return refined;
+        }
+
+        struct Pending
+        {
+            std::uint32_t oldNode = NoNode;
+            std::uint32_t newNode = 0;
+            std::uint32_t depth = 1;
+            // Energy of the whole node when oldNode is NoNode.
+            float energy = 0.0f;
+        };
+        std::vector<Pending> stack = { Pending{ 0, 0, 1, total } };
+        while (!stack.empty()) {
+            const Pending pending = stack.back();
+            stack.pop_back();
+            for (std::uint32_t quadrant = 0; quadrant < 4; ++quadrant) {
+                const bool hasOld = pending.oldNode != NoNode;
+                const float energy = hasOld ? tree.nodes[pending.oldNode].energy[quadrant] : pending.energy * 0.25f;
+                if (pending.depth >= settings.maxDirectionalDepth || energy <= total * settings.directionalSplitFraction) {
+                    continue;
+                }
+                const std::uint32_t child = static_cast<std::uint32_t>(refined.nodes.size());
+                refined.nodes.emplace_back();
+                refined.nodes[pending.newNode].children[quadrant] = child;
+                const std::uint32_t oldChild = hasOld && tree.nodes[pending.oldNode].children[quadrant] != 0 ? tree.nodes[pending.oldNode].children[quadrant]
+                                                                                                             : NoNode;
+                stack.push_back(Pending{ oldChild, child, pending.depth + 1, energy });
+            }
+        }
+        return refined;
+    }
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "cpu_rt_bsdf.h"
+#include "cpu_rt_math.h"
+#include "cpu_rt_threading.h"
+
+namespace cpu_rt
+{
+    struct GuidingSettings
+    {
+        // Sample path directions partly from incident radiance learned in earlier RenderSamples() passes.
+        bool enabled = false;
+        // Probability of sampling the BSDF rather than the learned distribution at guided vertices. With
+        // learnBsdfSamplingFraction, only the starting value: after each pass every spatial cell switches to
+        // the candidate fraction whose estimated variance over the pass's vertices was lowest, and cells
+        // where guiding does not pay off fall back to BSDF sampling.
+        float bsdfSamplingFraction = 0.5f;
+        bool learnBsdfSamplingFraction = true;
+        // A spatial cell is split when it recorded more than this many path vertices, times the square root
+        // of the samples per pixel of the pass.
+        std::uint32_t spatialSplitThreshold = 12000;
+        // A directional cell is subdivided when it holds more than this fraction of its tree's energy.
+        float directionalSplitFraction = 0.01f;
+        std::uint32_t maxDirectionalDepth = 16;
+    };
+
+    // A sampled path direction and the incident radiance found along it.
+    struct GuidingRecord
+    {
+        Vec3 direction;
+        float radiance = 0.0f;
+        // Density the direction was drawn with, and its densities under BSDF and guided sampling alone.
+        float pdf = 0.0f;
+        float bsdfPdf = 0.0f;
+        float guidePdf = 0.0f;
+        // Luminance of f * cos at the vertex.
+        float bsdfCos = 0.0f;
+        // The leaf had a learned distribution when the direction was drawn, so guidePdf is known.
+        bool guided = false;
+    };
+
+    // Spatial-directional tree of incident radiance (practical path guiding, SD-tree): a binary tree over
+    // the scene bounds whose leaves hold a quadtree over the sphere of directions, in the equal-area
+    // cylindrical mapping (cos theta, phi). Each leaf keeps two quadtrees. Paths sample from the one
+    // learned in earlier passes and record into the other, which has fixed topology during a pass, so
+    // workers add to it with atomic float adds and no locks. Update() between passes makes the recorded
+    // tree the sampling tree and refines both trees where the recorded energy and vertex counts call for it.
+    class GuidingField
+    {
+    public:
+        static constexpr std::uint32_t NoLeaf = ~0u;
+
+        // Forget everything learned and cover the given bounds with one cell.
+        void Reset(const Aabb& bounds, const GuidingSettings& settings);
+        void Clear() { Reset(Aabb{}, GuidingSettings{}); }
+
+        // Spatial leaf containing p, or NoLeaf before Reset().
+        std::uint32_t Locate(const Vec3& p) const;
+        // Whether the leaf has a learned distribution to sample from.
+        bool CanSample(std::uint32_t leaf) const;
+        // Direction drawn from the learned distribution and its solid-angle pdf. Requires CanSample().
+        Vec3 Sample(std::uint32_t leaf, float u0, float u1, float& pdf) const;
+        float Pdf(std::uint32_t leaf, const Vec3& direction) const;
+        // Probability of BSDF sampling at vertices in the leaf, for SampleGuidedBsdf().
+        float BsdfSamplingFraction(std::uint32_t leaf) const { return m_leaves[leaf].bsdfFraction; }
+
+        // Add a path vertex of the current pass. Thread-safe and lock-free.
+        void Record(std::uint32_t leaf, const GuidingRecord& record);
+
+        // End of a pass of samplesPerPixel samples. Must not overlap sampling or recording.
+        void Update(WorkerPool& pool, std::uint32_t samplesPerPixel);
+
+        std::uint32_t SpatialLeafCount() const { return static_cast<std::uint32_t>(m_leaves.size()); }
+        // Number of training passes the sampling distributions come from.
+        std::uint32_t Iteration() const { return m_iteration; }
+
+        // Candidate BSDF sampling fractions a cell chooses from.
+        static constexpr std::array<float, 5> BsdfFractionCandidates = { 0.1f, 0.25f, 0.5f, 0.75f, 1.0f };
+
+    private:
+        // Quadrant energies and children of a directional node. Child 0 marks a quadrant without
+        // subdivision; node 0 is the root and never a child.
+        struct QuadNode
+        {
+            std::array<float, 4> energy = {};
+            std::array<std::uint32_t, 4> children = {};
+        };
+
+        struct DirectionalTree
+        {
+            std::vector<QuadNode> nodes = std::vector<QuadNode>(1);
+
+            float Total() const { return nodes[0].energy[0] + nodes[0].energy[1] + nodes[0].energy[2] + nodes[0].energy[3]; }
+        };
+
+        struct SpatialNode
+        {
+            Aabb bounds;
+            // Children are firstChild and firstChild + 1 when firstChild is not 0, split at split along axis.
+            std::uint32_t firstChild = 0;
+            std::uint32_t axis = 0;
+            float split = 0.0f;
+            std::uint32_t leaf = 0;
+        };
+
+        struct SpatialLeaf
+        {
+            DirectionalTree sampling;
+            DirectionalTree recording;
+            // Vertices recorded in the current pass.
+            std::uint32_t recordCount = 0;
+            float bsdfFraction = 0.5f;
+            // Second moment of the vertex estimate for each candidate fraction over the guided vertices of
+            // the current pass, estimated from the samples drawn with the current fraction.
+            std::array<float, BsdfFractionCandidates.size()> secondMoments = {};
+            std::uint32_t guidedCount = 0;
+        };
+
+        void SplitSpatialNode(std::uint32_t nodeIndex, std::uint32_t recordCount, std::uint32_t threshold);
+        static DirectionalTree Refine(const DirectionalTree& tree, const GuidingSettings& settings);
+
+        GuidingSettings m_settings;
+        std::vector<SpatialNode> m_nodes;
+        std::vector<SpatialLeaf> m_leaves;
+        std::uint32_t m_iteration = 0;
+    };
+
+    // One-sample mixture of BSDF sampling and the learned distribution of a leaf, drawn with probability
+    // guideProbability. sample.pdf is the mixture pdf and sample.weight uses it; bsdfPdf and guidePdf are
+    // the densities of the direction under either strategy alone.
+    inline bool SampleGuidedBsdf(const BsdfParams& params, const Vec3& n, const Vec3& wo, const GuidingField& field, std::uint32_t leaf,
+        float guideProbability, float uLobe, float u0, float u1, BsdfSample& sample, float& bsdfPdf, float& guidePdf)
+    {
+        Vec3 f;
+        bsdfPdf = 0.0f;
+        guidePdf = 0.0f;
+        if (uLobe < guideProbability) {
+            sample.wi = field.Sample(leaf, u0, u1, guidePdf);
+            f = EvaluateBsdf(params, n, wo, sample.wi, bsdfPdf);
+        } else {
+            // Reuse the lobe number, rescaled, so BSDF sampling needs no extra random numbers.
+            const float uBsdf = std::min((uLobe - guideProbability) / (1.0f - guideProbability), 0x1.fffffep-1f);
+            if (!SampleBsdf(params, n, wo, uBsdf, u0, u1, sample)) {
+                return false;
+            }
+            bsdfPdf = sample.pdf;
+            f = sample.weight * (sample.pdf / Dot(n, sample.wi));
+            guidePdf = field.Pdf(leaf, sample.wi);
+        }
+        sample.pdf = guideProbability * guidePdf + (1.0f - guideProbability) * bsdfPdf;
+        if (sample.pdf <= 0.0f || MaxComponent(f) <= 0.0f) {
+            return false;
+        }
+        sample.weight = f * (Dot(n, sample.wi) / sample.pdf);
+        return true;
+    }
+}
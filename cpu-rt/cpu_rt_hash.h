@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <type_traits>
+
+namespace cpu_rt
+{
+    // Incremental 64-bit FNV-1a, used to fingerprint scene content for files written by the renderer.
+    class Hasher
+    {
+    public:
+        void AddBytes(const void* data, std::size_t size)
+        {
+            const auto* bytes = static_cast<const std::uint8_t*>(data);
+            for (std::size_t i = 0; i < size; ++i) {
+                m_state = (m_state ^ bytes[i]) * 0x100000001b3ull;
+            }
+        }
+
+        // Only for types without padding bytes.
+        template<typename T>
+        void Add(const T& value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            AddBytes(&value, sizeof(T));
+        }
+
+        template<typename T>
+        void AddSpan(std::span<const T> values)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            Add(static_cast<std::uint64_t>(values.size()));
+            AddBytes(values.data(), values.size_bytes());
+        }
+
+        void AddString(std::string_view text)
+        {
+            Add(static_cast<std::uint64_t>(text.size()));
+            AddBytes(text.data(), text.size());
+        }
+
+        std::uint64_t Value() const { return m_state; }
+
+    private:
+        std::uint64_t m_state = 0xcbf29ce484222325ull;
+    };
+}
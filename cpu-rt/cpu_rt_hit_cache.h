@@ -0,0 +1,68 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "cpu_rt_scene.h"
+
+namespace cpu_rt
+{
+    // Primary hits of the first camera samples of every pixel. A sample's camera ray depends only on the
+    // seed, the pixel, the sample index and the camera, so while those and the geometry stay the same its
+    // hit can be reused by later renders that only change shading.
+    // A pixel is only touched by the worker rendering its tile, so recording needs no synchronization.
+    class PrimaryHitCache
+    {
+    public:
+        void Allocate(std::uint32_t width, std::uint32_t height, std::uint32_t samplesPerPixel)
+        {
+            m_width = width;
+            m_samplesPerPixel = std::min(samplesPerPixel, 255u);
+            const std::size_t pixelCount = static_cast<std::size_t>(width) * height;
+            m_hits = m_samplesPerPixel != 0 ? std::make_unique<Hit[]>(pixelCount * m_samplesPerPixel) : nullptr;
+            m_counts = m_samplesPerPixel != 0 ? std::make_unique<std::uint8_t[]>(pixelCount) : nullptr;
+            m_pixelCount = m_samplesPerPixel != 0 ? pixelCount : 0;
+        }
+
+        // Forget all hits, e.g. after the camera moved.
+        void Clear()
+        {
+            std::fill_n(m_counts.get(), m_pixelCount, std::uint8_t(0));
+        }
+
+        bool IsEnabled() const { return m_samplesPerPixel != 0; }
+
+        // Recorded hit of a sample, or nullptr if it has not been traced yet.
+        const Hit* Find(std::uint32_t x, std::uint32_t y, std::uint32_t sampleIndex) const
+        {
+            const std::size_t pixel = PixelIndex(x, y);
+            return m_pixelCount != 0 && sampleIndex < m_counts[pixel] ? &m_hits[pixel * m_samplesPerPixel + sampleIndex] : nullptr;
+        }
+
+        // Where to record the hit of a sample about to be traced, or nullptr if the cache does not keep it.
+        // Samples are recorded in index order; call Commit() once the hit is written.
+        Hit* Slot(std::uint32_t x, std::uint32_t y, std::uint32_t sampleIndex)
+        {
+            const std::size_t pixel = PixelIndex(x, y);
+            return m_pixelCount != 0 && sampleIndex == m_counts[pixel] && sampleIndex < m_samplesPerPixel ? &m_hits[pixel * m_samplesPerPixel + sampleIndex]
+                                                                                                           : nullptr;
+        }
+
+        void Commit(std::uint32_t x, std::uint32_t y)
+        {
+            ++m_counts[PixelIndex(x, y)];
+        }
+
+    private:
+        std::size_t PixelIndex(std::uint32_t x, std::uint32_t y) const { return static_cast<std::size_t>(y) * m_width + x; }
+
+        std::uint32_t m_width = 0;
+        std::uint32_t m_samplesPerPixel = 0;
+        std::size_t m_pixelCount = 0;
+        std::unique_ptr<Hit[]> m_hits;
+        // Recorded samples per pixel.
+        std::unique_ptr<std::uint8_t[]> m_counts;
+    };
+}
@@ -0,0 +1,266 @@
+#include "cpu_rt_integrator.h"
+
+#include <array>
+#include <span>
+#include <utility>
+
+#include "cpu_rt_isa.h"
+#include "cpu_rt_traversal.h"
+
+namespace cpu_rt
+{
+    BsdfParams GetBsdfParams(const scene_core::Scene& scene, std::uint32_t materialIndex)
+    {
+        if (materialIndex < scene.materials.size()) {
+            return MakeBsdfParams(scene.materials[materialIndex]);
+        }
+        return BsdfParams{};
+    }
+
+    Vec3 SamplePunctualLight(const PunctualLight& light, const Vec3& p, Vec3& wi, float& distance)
+    {
+        if (light.type == scene_core::LightType::Directional) {
+            wi = -light.direction;
+            distance = Infinity;
+            return light.intensity;
+        }
+
+        const Vec3 toLight = light.position - p;
+        const float dist2 = Dot(toLight, toLight);
+        if (dist2 <= 0.0f) {
+            return {};
+        }
+        distance = std::sqrt(dist2);
+        wi = toLight / distance;
+
+        // Smooth range window recommended by KHR_lights_punctual.
+        float attenuation = 1.0f / dist2;
+        if (light.range > 0.0f) {
+            const float ratio = distance / light.range;
+            const float window = std::clamp(1.0f - ratio * ratio * ratio * ratio, 0.0f, 1.0f);
+            attenuation *= window * window;
+        }
+
+        if (light.type == scene_core::LightType::Spot) {
+            const float cosAngle = Dot(light.direction, -wi);
+            const float scale = 1.0f / std::max(1e-4f, light.cosInnerCone - light.cosOuterCone);
+            const float t = std::clamp((cosAngle - light.cosOuterCone) * scale, 0.0f, 1.0f);
+            attenuation *= t * t;
+        }
+        return light.intensity * attenuation;
+    }
+
+    namespace
+    {
+        // Path vertices whose incident radiance is recorded into the guiding field.
+        constexpr std::uint32_t MaxGuidingVertices = 16;
+        // Near-specular lobes gain nothing from guiding and would waste its samples.
+        constexpr float MinGuidedAlpha = 0.05f;
+
+        struct GuidingVertex
+        {
+            std::uint32_t leaf = GuidingField::NoLeaf;
+            GuidingRecord record;
+            // Path throughput up to and including the scattering at this vertex, and the radiance
+            // gathered before leaving it along the sampled direction.
+            Vec3 throughput;
+            Vec3 radiance;
+        };
+
+        // Incident radiance at each vertex is what the path gathered after it, divided by the throughput there.
+        void RecordGuidingVertices(GuidingField& guiding, std::span<GuidingVertex> vertices, const Vec3& radiance)
+        {
+            for (GuidingVertex& vertex : vertices) {
+                const Vec3 gathered = radiance - vertex.radiance;
+                Vec3 incident;
+                for (int c = 0; c < 3; ++c) {
+                    incident[c] = vertex.throughput[c] > 0.0f ? gathered[c] / vertex.throughput[c] : 0.0f;
+                }
+                vertex.record.radiance = Luminance(incident);
+                guiding.Record(vertex.leaf, vertex.record);
+            }
+        }
+
+        template<SceneFeatures Features>
+        Vec3 TracePathKernel(
+            const RtScene& scene, const TopLevelAccel& topLevel, const Ray& cameraRay, Sampler& sampler, const IntegratorSettings& settings,
+            PathFeatures* firstHit, const Hit* cachedPrimary, Hit* tracedPrimary)
+        {
+            Vec3 radiance;
+            Vec3 throughput(1.0f);
+            Ray ray = cameraRay;
+            const float lightCount = static_cast<float>(scene.lights.size());
+            std::array<GuidingVertex, MaxGuidingVertices> guidingVertices;
+            std::uint32_t guidingVertexCount = 0;
+
+            for (std::uint32_t depth = 0; depth < settings.maxDepth; ++depth) {
+                Hit hit;
+                if (depth == 0 && cachedPrimary != nullptr) {
+                    hit = *cachedPrimary;
+                } else {
+                    Intersect<Features>(scene, topLevel, ray, hit);
+                    if (depth == 0 && tracedPrimary != nullptr) {
+                        *tracedPrimary = hit;
+                    }
+                }
+                if (!hit.IsValid()) {
+                    radiance += throughput * settings.environmentRadiance;
+                    break;
+                }
+
+                const SurfaceHit surface = MakeSurfaceHit<Features>(scene, topLevel, hit);
+                const BsdfParams bsdf = GetBsdfParams(*scene.source, surface.materialIndex);
+                const Vec3 wo = -Normalize(ray.direction);
+
+                // Two-sided shading: flip both normals towards the viewer.
+                Vec3 ng = surface.geometricNormal;
+                Vec3 ns = surface.shadingNormal;
+                if (Dot(ng, wo) < 0.0f) {
+                    ng = -ng;
+                }
+                if (Dot(ns, ng) < 0.0f) {
+                    ns = -ns;
+                }
+
+                if (depth == 0 && firstHit != nullptr) {
+                    firstHit->albedo = bsdf.baseColor;
+                    firstHit->normal = ns;
+                    firstHit->depth = hit.t;
+                    firstHit->nodeIndex = surface.nodeIndex;
+                    firstHit->materialIndex = surface.materialIndex;
+                }
+
+                if constexpr ((Features & SceneFeatureEmission) != 0) {
+                    radiance += throughput * bsdf.emission;
+                }
+
+                // Next-event estimation: one uniformly chosen punctual light.
+                if ((Features & SceneFeaturePunctualLights) != 0 && !scene.lights.empty()) {
+                    const std::uint32_t lightIndex = std::min(
+                        static_cast<std::uint32_t>(sampler.Next1D() * lightCount), static_cast<std::uint32_t>(scene.lights.size() - 1));
+                    Vec3 wi;
+                    float distance = 0.0f;
+                    const Vec3 li = SamplePunctualLight(scene.lights[lightIndex], surface.position, wi, distance);
+                    if (MaxComponent(li) > 0.0f && Dot(ng, wi) > 0.0f) {
+                        float pdf = 0.0f;
+                        const Vec3 f = EvaluateBsdf(bsdf, ns, wo, wi, pdf);
+                        if (MaxComponent(f) > 0.0f) {
+                            Ray shadowRay;
+                            shadowRay.origin = OffsetRayOrigin(surface.position, ng, wi);
+                            shadowRay.direction = wi;
+                            shadowRay.tMax = distance == Infinity ? Infinity : distance * (1.0f - 1e-4f);
+                            if (!Occluded<Features>(scene, topLevel, shadowRay)) {
+                                radiance += throughput * f * li * (Dot(ns, wi) * lightCount);
+                            }
+                        }
+                    }
+                }
+
+                BsdfSample sample;
+                const float uLobe = sampler.Next1D();
+                const float u0 = sampler.Next1D();
+                const float u1 = sampler.Next1D();
+                std::uint32_t guidingLeaf = GuidingField::NoLeaf;
+                GuidingRecord guidingRecord;
+                if (settings.guiding != nullptr && guidingVertexCount < MaxGuidingVertices) {
+                    guidingLeaf = settings.guiding->Locate(surface.position);
+                    guidingRecord.guided = bsdf.alpha >= MinGuidedAlpha && settings.guiding->CanSample(guidingLeaf);
+                }
+                // Leaves that learned to sample the BSDF alone still look up the guide pdf, so they keep
+                // estimating whether guiding would pay off.
+                const bool sampled = guidingRecord.guided
+                                         ? SampleGuidedBsdf(bsdf, ns, wo, *settings.guiding, guidingLeaf, 1.0f - settings.guiding->BsdfSamplingFraction(guidingLeaf),
+                                               uLobe, u0, u1, sample, guidingRecord.bsdfPdf, guidingRecord.guidePdf)
+                                         : SampleBsdf(bsdf, ns, wo, uLobe, u0, u1, sample);
+                if (!sampled || Dot(ng, sample.wi) <= 0.0f) {
+                    break;
+                }
+                throughput *= sample.weight;
+
+                // Russian roulette after the first few bounces.
+                if (depth >= 3) {
+                    const float survival = std::min(MaxComponent(throughput), 0.95f);
+                    if (sampler.Next1D() >= survival) {
+                        break;
+                    }
+                    throughput *= 1.0f / survival;
+                }
+
+                if (guidingLeaf != GuidingField::NoLeaf) {
+                    guidingRecord.direction = sample.wi;
+                    guidingRecord.pdf = sample.pdf;
+                    guidingRecord.bsdfCos = Luminance(sample.weight) * sample.pdf;
+                    guidingVertices[guidingVertexCount++] = GuidingVertex{ guidingLeaf, guidingRecord, throughput, radiance };
+                }
+
+                ray.origin = OffsetRayOrigin(surface.position, ng, sample.wi);
+                ray.direction = sample.wi;
+                ray.tMin = 0.0f;
+                ray.tMax = Infinity;
+            }
+            if (guidingVertexCount != 0) {
+                RecordGuidingVertices(*settings.guiding, std::span<GuidingVertex>(guidingVertices.data(), guidingVertexCount), radiance);
+            }
+            return radiance;
+        }
+
+#if CPU_RT_ISA_DISPATCH
+        template<SceneFeatures Features>
+        CPU_RT_TARGET_SSE42 Vec3 TracePathSse42(
+            const RtScene& scene, const TopLevelAccel& topLevel, const Ray& cameraRay, Sampler& sampler, const IntegratorSettings& settings,
+            PathFeatures* firstHit, const Hit* cachedPrimary, Hit* tracedPrimary)
+        {
+            return TracePathKernel<Features>(scene, topLevel, cameraRay, sampler, settings, firstHit, cachedPrimary, tracedPrimary);
+        }
+
+        template<SceneFeatures Features>
+        CPU_RT_TARGET_AVX2 Vec3 TracePathAvx2(
+            const RtScene& scene, const TopLevelAccel& topLevel, const Ray& cameraRay, Sampler& sampler, const IntegratorSettings& settings,
+            PathFeatures* firstHit, const Hit* cachedPrimary, Hit* tracedPrimary)
+        {
+            return TracePathKernel<Features>(scene, topLevel, cameraRay, sampler, settings, firstHit, cachedPrimary, tracedPrimary);
+        }
+
+        template<SceneFeatures Features>
+        CPU_RT_TARGET_AVX512 Vec3 TracePathAvx512(
+            const RtScene& scene, const TopLevelAccel& topLevel, const Ray& cameraRay, Sampler& sampler, const IntegratorSettings& settings,
+            PathFeatures* firstHit, const Hit* cachedPrimary, Hit* tracedPrimary)
+        {
+            return TracePathKernel<Features>(scene, topLevel, cameraRay, sampler, settings, firstHit, cachedPrimary, tracedPrimary);
+        }
+#endif
+
+        using TracePathKernelTable = std::array<TracePathFn, AllSceneFeatures + 1>;
+
+        template<std::size_t... Masks>
+        constexpr std::array<TracePathKernelTable, static_cast<std::size_t>(Isa::Count)> MakeTracePathKernels(std::index_sequence<Masks...>)
+        {
+#if CPU_RT_ISA_DISPATCH
+            return { {
+                { &TracePathKernel<static_cast<SceneFeatures>(Masks)>... },
+                { &TracePathSse42<static_cast<SceneFeatures>(Masks)>... },
+                { &TracePathAvx2<static_cast<SceneFeatures>(Masks)>... },
+                { &TracePathAvx512<static_cast<SceneFeatures>(Masks)>... },
+            } };
+#else
+            constexpr TracePathKernelTable baseline = { &TracePathKernel<static_cast<SceneFeatures>(Masks)>... };
+            return { { baseline, baseline, baseline, baseline } };
+#endif
+        }
+
+        // One kernel per instruction set and feature combination, indexed by Isa and the feature mask.
+        constexpr auto TracePathKernels = MakeTracePathKernels(std::make_index_sequence<AllSceneFeatures + 1>());
+    }
+
+    TracePathFn SelectTracePath(SceneFeatures features)
+    {
+        return TracePathKernels[static_cast<std::size_t>(ActiveIsa())][features & AllSceneFeatures];
+    }
+
+    Vec3 TracePath(
+        const RtScene& scene, const TopLevelAccel& topLevel, const Ray& cameraRay, Sampler& sampler, const IntegratorSettings& settings,
+        PathFeatures* firstHit, const Hit* cachedPrimary, Hit* tracedPrimary)
+    {
+        return SelectTracePath(scene.features)(scene, topLevel, cameraRay, sampler, settings, firstHit, cachedPrimary, tracedPrimary);
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+#include "cpu_rt_aov.h"
+#include "cpu_rt_bsdf.h"
+#include "cpu_rt_guiding.h"
+#include "cpu_rt_sampler.h"
+#include "cpu_rt_scene.h"
+
+namespace cpu_rt
+{
+    struct IntegratorSettings
+    {
+        std::uint32_t maxDepth = 5;
+        Vec3 environmentRadiance;
+        // Learned incident radiance that paths sample directions from and record into; optional.
+        GuidingField* guiding = nullptr;
+    };
+
+    // Material used by geometry without a valid material index.
+    BsdfParams GetBsdfParams(const scene_core::Scene& scene, std::uint32_t materialIndex);
+
+    // Incident light from a punctual light at point p. Returns the irradiance scale (intensity with
+    // distance and cone falloff applied), the direction towards the light and the distance to it.
+    Vec3 SamplePunctualLight(const PunctualLight& light, const Vec3& p, Vec3& wi, float& distance);
+
+    // A path starts from cachedPrimary instead of tracing the camera ray when it is given; a miss is a
+    // hit that is not valid. Otherwise the traced primary hit is stored in tracedPrimary, if given.
+    using TracePathFn = Vec3 (*)(
+        const RtScene& scene, const TopLevelAccel& topLevel, const Ray& cameraRay, Sampler& sampler, const IntegratorSettings& settings,
+        PathFeatures* firstHit, const Hit* cachedPrimary, Hit* tracedPrimary);
+
+    // TracePath() compiled for exactly the given scene features and for ActiveIsa(). Select once per scene
+    // and call the result per sample, so the hot loop carries no code for features the scene does not use.
+    TracePathFn SelectTracePath(SceneFeatures features);
+
+    // Unidirectional path tracer with next-event estimation for punctual lights. With settings.guiding,
+    // directions are drawn from a mixture of the BSDF and the learned distribution, and the radiance found
+    // along them is recorded back.
+    // Optionally reports the first-hit AOV values. Dispatches on scene.features.
+    Vec3 TracePath(
+        const RtScene& scene, const TopLevelAccel& topLevel, const Ray& cameraRay, Sampler& sampler, const IntegratorSettings& settings,
+        PathFeatures* firstHit = nullptr, const Hit* cachedPrimary = nullptr, Hit* tracedPrimary = nullptr);
+}
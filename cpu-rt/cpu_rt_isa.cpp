@@ -0,0 +1,121 @@
+#include "cpu_rt_isa.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+
+#if CPU_RT_ISA_DISPATCH
+#include <cpuid.h>
+#endif
+
+namespace cpu_rt
+{
+    namespace
+    {
+        constexpr std::uint32_t NoOverride = ~0u;
+        std::atomic<std::uint32_t> g_isaOverride{ NoOverride };
+
+#if CPU_RT_ISA_DISPATCH
+        // XCR0: which register states the OS saves on context switches.
+        std::uint64_t ReadXcr0()
+        {
+            std::uint32_t eax = 0;
+            std::uint32_t edx = 0;
+            __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+            return (static_cast<std::uint64_t>(edx) << 32) | eax;
+        }
+
+        Isa QueryIsa()
+        {
+            unsigned int eax = 0;
+            unsigned int ebx = 0;
+            unsigned int ecx = 0;
+            unsigned int edx = 0;
+            if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+                return Isa::Baseline;
+            }
+            const bool sse42 = (ecx & bit_SSE4_2) != 0 && (ecx & bit_POPCNT) != 0;
+            const bool fma = (ecx & bit_FMA) != 0;
+            const bool osxsave = (ecx & bit_OSXSAVE) != 0;
+            if (!sse42) {
+                return Isa::Baseline;
+            }
+            if (!osxsave || !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+                return Isa::Sse42;
+            }
+
+            const std::uint64_t xcr0 = ReadXcr0();
+            // SSE and AVX state; AVX-512 also needs the opmask and both halves of the upper registers.
+            const bool avxState = (xcr0 & 0x6) == 0x6;
+            const bool avx512State = (xcr0 & 0xe6) == 0xe6;
+            const bool avx2 = avxState && fma && (ebx & bit_AVX2) != 0 && (ebx & bit_BMI) != 0 && (ebx & bit_BMI2) != 0;
+            const bool avx512 = avx2 && avx512State && (ebx & bit_AVX512F) != 0 && (ebx & bit_AVX512VL) != 0 && (ebx & bit_AVX512BW) != 0 &&
+                                (ebx & bit_AVX512DQ) != 0;
+            return avx512 ? Isa::Avx512 : avx2 ? Isa::Avx2 : Isa::Sse42;
+        }
+#else
+        Isa QueryIsa()
+        {
+            return Isa::Baseline;
+        }
+#endif
+
+        Isa EnvironmentIsa(Isa detected)
+        {
+            const char* value = std::getenv("CPU_RT_ISA");
+            Isa isa = detected;
+            if (value == nullptr || !ParseIsa(value, isa)) {
+                return detected;
+            }
+            return std::min(isa, detected);
+        }
+    }
+
+    Isa DetectIsa()
+    {
+        static const Isa detected = QueryIsa();
+        return detected;
+    }
+
+    Isa ActiveIsa()
+    {
+        static const Isa fromEnvironment = EnvironmentIsa(DetectIsa());
+        const std::uint32_t isaOverride = g_isaOverride.load(std::memory_order_relaxed);
+        return isaOverride != NoOverride ? std::min(static_cast<Isa>(isaOverride), DetectIsa()) : fromEnvironment;
+    }
+
+    void SetIsaOverride(Isa isa)
+    {
+        g_isaOverride.store(static_cast<std::uint32_t>(isa), std::memory_order_relaxed);
+    }
+
+    void ClearIsaOverride()
+    {
+        g_isaOverride.store(NoOverride, std::memory_order_relaxed);
+    }
+
+    const char* IsaName(Isa isa)
+    {
+        switch (isa) {
+        case Isa::Sse42:
+            return "sse4.2";
+        case Isa::Avx2:
+            return "avx2";
+        case Isa::Avx512:
+            return "avx512";
+        default:
+            return "baseline";
+        }
+    }
+
+    bool ParseIsa(std::string_view name, Isa& isa)
+    {
+        for (std::uint32_t i = 0; i < static_cast<std::uint32_t>(Isa::Count); ++i) {
+            if (name == IsaName(static_cast<Isa>(i))) {
+                isa = static_cast<Isa>(i);
+                return true;
+            }
+        }
+        return false;
+    }
+}
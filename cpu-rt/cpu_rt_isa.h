@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// Attributes for kernel entry points compiled for one instruction set. flatten inlines everything the
+// entry point calls, so the whole kernel uses that instruction set. Functions emitted out of line keep
+// the baseline, so the copies shared with other code still run on any x86-64 CPU.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CPU_RT_ISA_DISPATCH 1
+#define CPU_RT_TARGET_SSE42 __attribute__((target("sse4.2,popcnt"), flatten))
+#define CPU_RT_TARGET_AVX2 __attribute__((target("avx2,fma,bmi,bmi2,popcnt"), flatten))
+#define CPU_RT_TARGET_AVX512 __attribute__((target("avx512f,avx512vl,avx512bw,avx512dq,avx2,fma,bmi,bmi2,popcnt"), flatten))
+#endif
+
+namespace cpu_rt
+{
+    // Instruction sets the hot kernels are compiled for, in increasing order.
+    enum class Isa : std::uint32_t
+    {
+        // Whatever the build targets, SSE2 on x86-64.
+        Baseline,
+        Sse42,
+        // AVX2 with FMA and BMI2.
+        Avx2,
+        // AVX-512 F, VL, BW and DQ.
+        Avx512,
+        Count,
+    };
+
+    // Best instruction set the CPU reports through CPUID and whose register state the OS saves (XGETBV).
+    // Baseline on other architectures and compilers without per-function targets.
+    Isa DetectIsa();
+
+    // Instruction set the kernels are selected for: DetectIsa(), lowered by the CPU_RT_ISA environment
+    // variable ("baseline", "sse4.2", "avx2" or "avx512") or by SetIsaOverride(). Never above DetectIsa().
+    Isa ActiveIsa();
+
+    // Process-wide override for benchmarking. Renderers pick it up with their next SetScene(); batched
+    // queries with their next call.
+    void SetIsaOverride(Isa isa);
+    void ClearIsaOverride();
+
+    const char* IsaName(Isa isa);
+    bool ParseIsa(std::string_view name, Isa& isa);
+}
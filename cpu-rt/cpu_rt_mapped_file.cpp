@@ -0,0 +1,195 @@
+#include "cpu_rt_mapped_file.h"
+
+#include <algorithm>
+#include <utility>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cpu_rt
+{
+    MappedFile::~MappedFile()
+    {
+        Close();
+    }
+
+    MappedFile::MappedFile(MappedFile&& other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+    MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+    {
+        if (this != &other) {
+            Close();
+            m_data = std::exchange(other.m_data, nullptr);
+            m_size = std::exchange(other.m_size, 0);
+#if defined(_WIN32)
+            m_file = std::exchange(other.m_file, nullptr);
+            m_mapping = std::exchange(other.m_mapping, nullptr);
+#endif
+        }
+        return *this;
+    }
+
+#if defined(_WIN32)
+    bool MappedFile::Open(const std::string& path, Mode mode, std::size_t size)
+    {
+        Close();
+
+        const bool writable = mode != Mode::ReadOnly;
+        HANDLE file = CreateFileA(path.c_str(),
+            writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
+            FILE_SHARE_READ, nullptr,
+            mode == Mode::Create ? CREATE_ALWAYS : OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        LARGE_INTEGER fileSize{};
+        if (mode == Mode::Create) {
+            fileSize.QuadPart = static_cast<LONGLONG>(size);
+            if (!SetFilePointerEx(file, fileSize, nullptr, FILE_BEGIN) || !SetEndOfFile(file)) {
+                CloseHandle(file);
+                return false;
+            }
+        } else if (!GetFileSizeEx(file, &fileSize)) {
+            CloseHandle(file);
+            return false;
+        }
+        if (fileSize.QuadPart == 0) {
+            CloseHandle(file);
+            return false;
+        }
+
+        HANDLE mapping = CreateFileMappingA(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+        void* view = mapping ? MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (view == nullptr) {
+            if (mapping) {
+                CloseHandle(mapping);
+            }
+            CloseHandle(file);
+            return false;
+        }
+
+        m_file = file;
+        m_mapping = mapping;
+        m_data = static_cast<std::byte*>(view);
+        m_size = static_cast<std::size_t>(fileSize.QuadPart);
+        return true;
+    }
+
+    void MappedFile::Close()
+    {
+        if (m_data) {
+            UnmapViewOfFile(m_data);
+        }
+        if (m_mapping) {
+            CloseHandle(static_cast<HANDLE>(m_mapping));
+        }
+        if (m_file) {
+            CloseHandle(static_cast<HANDLE>(m_file));
+        }
+        m_data = nullptr;
+        m_size = 0;
+        m_mapping = nullptr;
+        m_file = nullptr;
+    }
+
+    bool MappedFile::Flush(bool wait)
+    {
+        if (!m_data || !FlushViewOfFile(m_data, 0)) {
+            return false;
+        }
+        return !wait || FlushFileBuffers(static_cast<HANDLE>(m_file));
+    }
+
+    void MappedFile::Prefetch(std::size_t offset, std::size_t size) const
+    {
+        if (!m_data || offset >= m_size) {
+            return;
+        }
+        WIN32_MEMORY_RANGE_ENTRY range;
+        range.VirtualAddress = m_data + offset;
+        range.NumberOfBytes = std::min(size, m_size - offset);
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+    }
+#else
+    bool MappedFile::Open(const std::string& path, Mode mode, std::size_t size)
+    {
+        Close();
+
+        const int flags = mode == Mode::ReadOnly ? O_RDONLY : (mode == Mode::Create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR);
+        const int fd = ::open(path.c_str(), flags, 0644);
+        if (fd < 0) {
+            return false;
+        }
+
+        if (mode == Mode::Create) {
+            if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+                ::close(fd);
+                return false;
+            }
+        } else {
+            struct stat st{};
+            if (::fstat(fd, &st) != 0) {
+                ::close(fd);
+                return false;
+            }
+            size = static_cast<std::size_t>(st.st_size);
+        }
+        if (size == 0) {
+            ::close(fd);
+            return false;
+        }
+
+        const int prot = mode == Mode::ReadOnly ? PROT_READ : (PROT_READ | PROT_WRITE);
+        void* data = ::mmap(nullptr, size, prot, MAP_SHARED, fd, 0);
+        // The mapping keeps the file referenced; the descriptor is not needed, so many files can stay mapped.
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            return false;
+        }
+
+        m_data = static_cast<std::byte*>(data);
+        m_size = size;
+        return true;
+    }
+
+    void MappedFile::Close()
+    {
+        if (m_data) {
+            ::munmap(m_data, m_size);
+        }
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    bool MappedFile::Flush(bool wait)
+    {
+        return m_data && ::msync(m_data, m_size, wait ? MS_SYNC : MS_ASYNC) == 0;
+    }
+
+    void MappedFile::Prefetch(std::size_t offset, std::size_t size) const
+    {
+        if (!m_data || offset >= m_size) {
+            return;
+        }
+        // madvise() wants a page-aligned start.
+        const std::size_t pageSize = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        const std::size_t begin = offset / pageSize * pageSize;
+        const std::size_t end = offset + std::min(size, m_size - offset);
+        ::madvise(m_data + begin, end - begin, MADV_WILLNEED);
+    }
+#endif
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cpu_rt
+{
+    // Shared read-write or read-only memory mapping of a whole file.
+    class MappedFile
+    {
+    public:
+        enum class Mode
+        {
+            ReadOnly,
+            // Open an existing file for writing; fails if it does not exist.
+            ReadWrite,
+            // Create or truncate the file to the requested size.
+            Create,
+        };
+
+        MappedFile() = default;
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        MappedFile(MappedFile&& other) noexcept;
+        MappedFile& operator=(MappedFile&& other) noexcept;
+
+        // size is only used by Mode::Create.
+        bool Open(const std::string& path, Mode mode, std::size_t size = 0);
+        void Close();
+
+        // Schedule write-back of dirty pages. With wait, block until they reached the file.
+        bool Flush(bool wait);
+
+        // Ask the OS to start reading the given byte range in the background. Only a hint.
+        void Prefetch(std::size_t offset, std::size_t size) const;
+
+        bool IsOpen() const { return m_data != nullptr; }
+        std::byte* Data() const { return m_data; }
+        std::size_t Size() const { return m_size; }
+
+    private:
+        std::byte* m_data = nullptr;
+        std::size_t m_size = 0;
+#if defined(_WIN32)
+        void* m_file = nullptr;
+        void* m_mapping = nullptr;
+#endif
+    };
+
+    // Read-only array whose elements are either owned or live in a mapped file, which the array keeps open,
+    // or in other shared memory such as an AccelArena, which the array keeps alive.
+    // Acceleration structures are built into owned arrays and may be moved to a file or an arena afterwards.
+    template<typename T>
+    class MappedArray
+    {
+    public:
+        MappedArray() = default;
+
+        MappedArray(std::vector<T> values)
+            : m_owned(std::move(values)), m_data(m_owned.data()), m_size(m_owned.size())
+        {
+        }
+
+        // count elements at a byte offset in the file; the caller checks bounds and alignment.
+        MappedArray(std::shared_ptr<const MappedFile> file, std::size_t offset, std::size_t count)
+            : m_file(std::move(file)), m_size(count)
+        {
+            m_data = reinterpret_cast<const T*>(m_file->Data() + offset);
+        }
+
+        // Elements in memory that stays valid while owner lives; copies of the array share it.
+        MappedArray(std::shared_ptr<const void> owner, std::span<const T> values)
+            : m_owner(std::move(owner)), m_data(values.data()), m_size(values.size())
+        {
+        }
+
+        MappedArray(const MappedArray& other)
+            : m_owned(other.m_owned), m_file(other.m_file), m_owner(other.m_owner), m_size(other.m_size)
+        {
+            m_data = m_file || m_owner ? other.m_data : m_owned.data();
+        }
+
+        MappedArray(MappedArray&& other) noexcept
+            : m_owned(std::move(other.m_owned)), m_file(std::move(other.m_file)), m_owner(std::move(other.m_owner)),
+              m_data(std::exchange(other.m_data, nullptr)), m_size(std::exchange(other.m_size, 0))
+        {
+        }
+
+        MappedArray& operator=(const MappedArray& other)
+        {
+            return *this = MappedArray(other);
+        }
+
+        MappedArray& operator=(MappedArray&& other) noexcept
+        {
+            if (this != &other) {
+                m_owned = std::move(other.m_owned);
+                m_file = std::move(other.m_file);
+                m_owner = std::move(other.m_owner);
+                m_data = std::exchange(other.m_data, nullptr);
+                m_size = std::exchange(other.m_size, 0);
+            }
+            return *this;
+        }
+
+        const T& operator[](std::size_t index) const { return m_data[index]; }
+        const T* data() const { return m_data; }
+        std::size_t size() const { return m_size; }
+        bool empty() const { return m_size == 0; }
+        const T* begin() const { return m_data; }
+        const T* end() const { return m_data + m_size; }
+
+        bool IsMapped() const { return m_file != nullptr; }
+
+        // Prefetch up to maxBytes from the start of a mapped array. Returns the number of bytes requested.
+        std::size_t Prefetch(std::size_t maxBytes) const
+        {
+            if (!m_file) {
+                return 0;
+            }
+            const std::size_t bytes = std::min(m_size * sizeof(T), maxBytes);
+            if (bytes == 0) {
+                return 0;
+            }
+            m_file->Prefetch(static_cast<std::size_t>(reinterpret_cast<const std::byte*>(m_data) - m_file->Data()), bytes);
+            return bytes;
+        }
+
+    private:
+        std::vector<T> m_owned;
+        std::shared_ptr<const MappedFile> m_file;
+        std::shared_ptr<const void> m_owner;
+        const T* m_data = nullptr;
+        std::size_t m_size = 0;
+    };
+}
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+namespace cpu_rt
+{
+    inline constexpr float Pi = 3.14159265358979323846f;
+    inline constexpr float InvPi = 1.0f / Pi;
+    inline constexpr float Infinity = std::numeric_limits<float>::infinity();
+
+    struct Vec3
+    {
+        float x = 0.0f;
+        float y = 0.0f;
+        float z = 0.0f;
+
+        constexpr Vec3() = default;
+        constexpr Vec3(float x_, float y_, float z_) : x(x_), y(y_), z(z_) {}
+        constexpr explicit Vec3(float s) : x(s), y(s), z(s) {}
+
+        float operator[](int i) const { return (&x)[i]; }
+        float& operator[](int i) { return (&x)[i]; }
+
+        Vec3& operator+=(const Vec3& v) { x += v.x; y += v.y; z += v.z; return *this; }
+        Vec3& operator-=(const Vec3& v) { x -= v.x; y -= v.y; z -= v.z; return *this; }
+        Vec3& operator*=(const Vec3& v) { x *= v.x; y *= v.y; z *= v.z; return *this; }
+        Vec3& operator*=(float s) { x *= s; y *= s; z *= s; return *this; }
+    };
+
+    inline Vec3 operator+(const Vec3& a, const Vec3& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+    inline Vec3 operator-(const Vec3& a, const Vec3& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+    inline Vec3 operator*(const Vec3& a, const Vec3& b) { return { a.x * b.x, a.y * b.y, a.z * b.z }; }
+    inline Vec3 operator/(const Vec3& a, const Vec3& b) { return { a.x / b.x, a.y / b.y, a.z / b.z }; }
+    inline Vec3 operator*(const Vec3& a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+    inline Vec3 operator*(float s, const Vec3& a) { return { a.x * s, a.y * s, a.z * s }; }
+    inline Vec3 operator/(const Vec3& a, float s) { return a * (1.0f / s); }
+    inline Vec3 operator-(const Vec3& a) { return { -a.x, -a.y, -a.z }; }
+
+    inline float Dot(const Vec3& a, const Vec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    inline Vec3 Cross(const Vec3& a, const Vec3& b)
+    {
+        return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+    }
+    inline float Length(const Vec3& v) { return std::sqrt(Dot(v, v)); }
+    inline Vec3 Normalize(const Vec3& v)
+    {
+        const float len = Length(v);
+        return len > 0.0f ? v / len : Vec3(0.0f, 0.0f, 1.0f);
+    }
+    inline Vec3 Min(const Vec3& a, const Vec3& b) { return { std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z) }; }
+    inline Vec3 Max(const Vec3& a, const Vec3& b) { return { std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z) }; }
+    inline float MaxComponent(const Vec3& v) { return std::max(v.x, std::max(v.y, v.z)); }
+    inline float Luminance(const Vec3& c) { return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z; }
+    inline Vec3 Lerp(const Vec3& a, const Vec3& b, float t) { return a + (b - a) * t; }
+
+    inline Vec3 ToVec3(const std::array<float, 3>& a) { return { a[0], a[1], a[2] }; }
+    inline Vec3 ToVec3(const std::array<float, 4>& a) { return { a[0], a[1], a[2] }; }
+
+    // Build a tangent frame around a unit normal (Duff et al. 2017).
+    inline void BuildOrthonormalBasis(const Vec3& n, Vec3& tangent, Vec3& bitangent)
+    {
+        const float sign = std::copysign(1.0f, n.z);
+        const float a = -1.0f / (sign + n.z);
+        const float b = n.x * n.y * a;
+        tangent = { 1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x };
+        bitangent = { b, sign + n.y * n.y * a, -n.y };
+    }
+
+    // Row-major 3x4 affine matrix.
+    struct Affine3
+    {
+        std::array<float, 12> m = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f };
+
+        Vec3 TransformPoint(const Vec3& p) const
+        {
+            return {
+                m[0] * p.x + m[1] * p.y + m[2] * p.z + m[3],
+                m[4] * p.x + m[5] * p.y + m[6] * p.z + m[7],
+                m[8] * p.x + m[9] * p.y + m[10] * p.z + m[11],
+            };
+        }
+
+        Vec3 TransformVector(const Vec3& v) const
+        {
+            return {
+                m[0] * v.x + m[1] * v.y + m[2] * v.z,
+                m[4] * v.x + m[5] * v.y + m[6] * v.z,
+                m[8] * v.x + m[9] * v.y + m[10] * v.z,
+            };
+        }
+
+        // Transform a normal given the inverse of the matrix that transforms points.
+        Vec3 TransformNormalByInverse(const Vec3& n) const
+        {
+            return {
+                m[0] * n.x + m[4] * n.y + m[8] * n.z,
+                m[1] * n.x + m[5] * n.y + m[9] * n.z,
+                m[2] * n.x + m[6] * n.y + m[10] * n.z,
+            };
+        }
+    };
+
+    inline Affine3 operator*(const Affine3& a, const Affine3& b)
+    {
+        Affine3 r;
+        for (int row = 0; row < 3; ++row) {
+            const float* ar = &a.m[row * 4];
+            for (int col = 0; col < 4; ++col) {
+                float v = ar[0] * b.m[col] + ar[1] * b.m[4 + col] + ar[2] * b.m[8 + col];
+                if (col == 3) {
+                    v += ar[3];
+                }
+                r.m[row * 4 + col] = v;
+            }
+        }
+        return r;
+    }
+
+    inline Affine3 Inverse(const Affine3& a)
+    {
+        const auto& m = a.m;
+        const float det =
+            m[0] * (m[5] * m[10] - m[6] * m[9]) -
+            m[1] * (m[4] * m[10] - m[6] * m[8]) +
+            m[2] * (m[4] * m[9] - m[5] * m[8]);
+        const float invDet = det != 0.0f ? 1.0f / det : 0.0f;
+
+        Affine3 r;
+        r.m[0] = (m[5] * m[10] - m[6] * m[9]) * invDet;
+        r.m[1] = (m[2] * m[9] - m[1] * m[10]) * invDet;
+        r.m[2] = (m[1] * m[6] - m[2] * m[5]) * invDet;
+        r.m[4] = (m[6] * m[8] - m[4] * m[10]) * invDet;
+        r.m[5] = (m[0] * m[10] - m[2] * m[8]) * invDet;
+        r.m[6] = (m[2] * m[4] - m[0] * m[6]) * invDet;
+        r.m[8] = (m[4] * m[9] - m[5] * m[8]) * invDet;
+        r.m[9] = (m[1] * m[8] - m[0] * m[9]) * invDet;
+        r.m[10] = (m[0] * m[5] - m[1] * m[4]) * invDet;
+        const Vec3 t = { m[3], m[7], m[11] };
+        r.m[3] = -(r.m[0] * t.x + r.m[1] * t.y + r.m[2] * t.z);
+        r.m[7] = -(r.m[4] * t.x + r.m[5] * t.y + r.m[6] * t.z);
+        r.m[11] = -(r.m[8] * t.x + r.m[9] * t.y + r.m[10] * t.z);
+        return r;
+    }
+
+    // Compose translation * rotation (unit quaternion xyzw) * scale.
+    inline Affine3 MakeAffine(const std::array<float, 3>& t, const std::array<float, 4>& q, const std::array<float, 3>& s)
+    {
+        const float x = q[0], y = q[1], z = q[2], w = q[3];
+        Affine3 r;
+        r.m[0] = (1.0f - 2.0f * (y * y + z * z)) * s[0];
+        r.m[1] = (2.0f * (x * y - z * w)) * s[1];
+        r.m[2] = (2.0f * (x * z + y * w)) * s[2];
+        r.m[3] = t[0];
+        r.m[4] = (2.0f * (x * y + z * w)) * s[0];
+        r.m[5] = (1.0f - 2.0f * (x * x + z * z)) * s[1];
+        r.m[6] = (2.0f * (y * z - x * w)) * s[2];
+        r.m[7] = t[1];
+        r.m[8] = (2.0f * (x * z - y * w)) * s[0];
+        r.m[9] = (2.0f * (y * z + x * w)) * s[1];
+        r.m[10] = (1.0f - 2.0f * (x * x + y * y)) * s[2];
+        r.m[11] = t[2];
+        return r;
+    }
+
+    struct Aabb
+    {
+        Vec3 lo = Vec3(Infinity);
+        Vec3 hi = Vec3(-Infinity);
+
+        void Extend(const Vec3& p) { lo = Min(lo, p); hi = Max(hi, p); }
+        void Extend(const Aabb& b) { lo = Min(lo, b.lo); hi = Max(hi, b.hi); }
+        bool IsEmpty() const { return lo.x > hi.x; }
+        Vec3 Centroid() const { return (lo + hi) * 0.5f; }
+        Vec3 Extent() const { return hi - lo; }
+
+        float SurfaceArea() const
+        {
+            if (IsEmpty()) {
+                return 0.0f;
+            }
+            const Vec3 e = Extent();
+            return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+        }
+    };
+
+    inline Aabb TransformAabb(const Affine3& xf, const Aabb& b)
+    {
+        Aabb r;
+        if (b.IsEmpty()) {
+            return r;
+        }
+        for (int corner = 0; corner < 8; ++corner) {
+            const Vec3 p = {
+                (corner & 1) ? b.hi.x : b.lo.x,
+                (corner & 2) ? b.hi.y : b.lo.y,
+                (corner & 4) ? b.hi.z : b.lo.z,
+            };
+            r.Extend(xf.TransformPoint(p));
+        }
+        return r;
+    }
+
+    struct Ray
+    {
+        Vec3 origin;
+        float tMin = 0.0f;
+        Vec3 direction = { 0.0f, 0.0f, -1.0f };
+        float tMax = Infinity;
+    };
+
+    // Offset a ray origin along the geometric normal to escape self-intersection.
+    inline Vec3 OffsetRayOrigin(const Vec3& p, const Vec3& n, const Vec3& w)
+    {
+        const float scale = 1e-4f * std::max(1.0f, MaxComponent(Max(p, -p)));
+        return p + n * (Dot(n, w) >= 0.0f ? scale : -scale);
+    }
+}
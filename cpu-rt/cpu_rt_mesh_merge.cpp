@@ -0,0 +1,218 @@
+#include "cpu_rt_mesh_merge.h"
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include "cpu_rt_scene.h"
+
+namespace cpu_rt
+{
+    namespace
+    {
+        // Components per vertex of a stream, or 0 if the stream is absent or does not match the vertex count.
+        std::uint32_t StreamStride(const std::vector<float>& stream, std::size_t vertexCount, std::uint32_t minStride, std::uint32_t maxStride)
+        {
+            for (std::uint32_t stride = minStride; stride <= maxStride && vertexCount != 0; ++stride) {
+                if (stream.size() == vertexCount * stride) {
+                    return stride;
+                }
+            }
+            return 0;
+        }
+
+        float Determinant(const Affine3& a)
+        {
+            const std::array<float, 12>& m = a.m;
+            return m[0] * (m[5] * m[10] - m[6] * m[9]) - m[1] * (m[4] * m[10] - m[6] * m[8]) + m[2] * (m[4] * m[9] - m[5] * m[8]);
+        }
+
+        // Submesh ranges a node reference draws, like the bottom-level accel build.
+        std::vector<scene_core::Submesh> ReferencedRanges(const scene_core::Mesh& mesh, std::uint32_t submeshIndex)
+        {
+            if (submeshIndex != InvalidIndex) {
+                return submeshIndex < mesh.submeshes.size() ? std::vector<scene_core::Submesh>{ mesh.submeshes[submeshIndex] } : std::vector<scene_core::Submesh>{};
+            }
+            if (!mesh.submeshes.empty()) {
+                return mesh.submeshes;
+            }
+            return { { InvalidIndex, 0, static_cast<std::uint32_t>(mesh.indices.size()) } };
+        }
+
+        bool IsIdentity(const scene_core::Transform& transform)
+        {
+            const scene_core::Transform identity;
+            return transform.translation == identity.translation && transform.rotation == identity.rotation && transform.scale == identity.scale;
+        }
+
+        // Merged meshes are keyed by material and stream layout, so every vertex of a merged mesh has the same streams.
+        using MergeKey = std::tuple<std::uint32_t, std::uint32_t, std::uint32_t, std::uint32_t, std::uint32_t, std::uint32_t>;
+    }
+
+    scene_core::Scene MergeSmallMeshes(const scene_core::Scene& scene, const MeshMergeSettings& settings, MeshMergeStats* stats)
+    {
+        MeshMergeStats merged;
+        scene_core::Scene result = scene;
+        const std::uint32_t meshCount = static_cast<std::uint32_t>(scene.meshes.size());
+
+        std::vector<std::uint32_t> references(meshCount, 0);
+        for (const scene_core::Node& node : scene.nodes) {
+            if (node.mesh.meshIndex < meshCount) {
+                references[node.mesh.meshIndex]++;
+            }
+        }
+
+        std::vector<std::uint32_t> traversalOrder;
+        const std::vector<Affine3> world = ComputeWorldTransforms(scene, traversalOrder);
+
+        std::vector<bool> meshMerged(meshCount, false);
+        std::map<MergeKey, std::uint32_t> meshByKey;
+        std::vector<scene_core::Mesh> mergedMeshes;
+        std::vector<std::uint32_t> remap;
+        for (const std::uint32_t nodeIndex : traversalOrder) {
+            const scene_core::MeshRef& ref = scene.nodes[nodeIndex].mesh;
+            if (ref.meshIndex >= meshCount || references[ref.meshIndex] != 1) {
+                continue;
+            }
+            const scene_core::Mesh& mesh = scene.meshes[ref.meshIndex];
+            const std::vector<scene_core::Submesh> ranges = ReferencedRanges(mesh, ref.submeshIndex);
+            std::uint64_t triangleCount = 0;
+            for (const scene_core::Submesh& range : ranges) {
+                triangleCount += range.indexCount / 3;
+            }
+            const Affine3& objectToWorld = world[nodeIndex];
+            const float determinant = Determinant(objectToWorld);
+            if (triangleCount > settings.maxTriangles || determinant == 0.0f) {
+                continue;
+            }
+
+            const scene_core::VertexStreams& src = mesh.vertexStreams;
+            const std::size_t vertexCount = src.positions.size() / 3;
+            const std::uint32_t normalStride = StreamStride(src.normals, vertexCount, 3, 3);
+            const std::uint32_t tangentStride = StreamStride(src.tangents, vertexCount, 3, 4);
+            const std::uint32_t texcoord0Stride = StreamStride(src.texcoords0, vertexCount, 2, 3);
+            const std::uint32_t texcoord1Stride = StreamStride(src.texcoords1, vertexCount, 2, 3);
+            const std::uint32_t colorStride = StreamStride(src.colors, vertexCount, 3, 4);
+            const Affine3 worldToObject = Inverse(objectToWorld);
+            const bool flipWinding = determinant < 0.0f;
+
+            for (const scene_core::Submesh& range : ranges) {
+                const MergeKey key{ range.materialIndex, normalStride, tangentStride, texcoord0Stride, texcoord1Stride, colorStride };
+                auto it = meshByKey.find(key);
+                if (it == meshByKey.end()) {
+                    it = meshByKey.emplace(key, static_cast<std::uint32_t>(mergedMeshes.size())).first;
+                    scene_core::Mesh& created = mergedMeshes.emplace_back();
+                    created.name = "merged";
+                    if (range.materialIndex < scene.materials.size() && !scene.materials[range.materialIndex].name.empty()) {
+                        created.name += ":" + scene.materials[range.materialIndex].name;
+                    }
+                    created.submeshes.push_back({ range.materialIndex, 0, 0 });
+                }
+                scene_core::Mesh& dst = mergedMeshes[it->second];
+                scene_core::VertexStreams& streams = dst.vertexStreams;
+
+                // Copy each vertex the range uses once, transformed to world space.
+                remap.assign(vertexCount, InvalidIndex);
+                auto vertex = [&](std::uint32_t index) {
+                    if (remap[index] != InvalidIndex) {
+                        return remap[index];
+                    }
+                    remap[index] = static_cast<std::uint32_t>(streams.positions.size() / 3);
+                    const Vec3 p = objectToWorld.TransformPoint({ src.positions[3 * index + 0], src.positions[3 * index + 1], src.positions[3 * index + 2] });
+                    streams.positions.insert(streams.positions.end(), { p.x, p.y, p.z });
+                    if (normalStride != 0) {
+                        const float* n = &src.normals[3 * index];
+                        const Vec3 normal = Normalize(worldToObject.TransformNormalByInverse({ n[0], n[1], n[2] }));
+                        streams.normals.insert(streams.normals.end(), { normal.x, normal.y, normal.z });
+                    }
+                    if (tangentStride != 0) {
+                        const float* t = &src.tangents[tangentStride * index];
+                        const Vec3 tangent = Normalize(objectToWorld.TransformVector({ t[0], t[1], t[2] }));
+                        streams.tangents.insert(streams.tangents.end(), { tangent.x, tangent.y, tangent.z });
+                        // The bitangent sign flips with the handedness of the transform.
+                        if (tangentStride == 4) {
+                            streams.tangents.push_back(flipWinding ? -t[3] : t[3]);
+                        }
+                    }
+                    streams.texcoords0.insert(streams.texcoords0.end(), src.texcoords0.begin() + texcoord0Stride * index,
+                        src.texcoords0.begin() + texcoord0Stride * (index + 1));
+                    streams.texcoords1.insert(streams.texcoords1.end(), src.texcoords1.begin() + texcoord1Stride * index,
+                        src.texcoords1.begin() + texcoord1Stride * (index + 1));
+                    streams.colors.insert(streams.colors.end(), src.colors.begin() + colorStride * index, src.colors.begin() + colorStride * (index + 1));
+                    return remap[index];
+                };
+
+                const std::uint32_t end = std::min<std::uint32_t>(range.indexOffset + range.indexCount, static_cast<std::uint32_t>(mesh.indices.size()));
+                for (std::uint32_t first = range.indexOffset; first + 3 <= end; first += 3) {
+                    const std::uint32_t i0 = mesh.indices[first + 0];
+                    const std::uint32_t i1 = mesh.indices[first + 1];
+                    const std::uint32_t i2 = mesh.indices[first + 2];
+                    if (i0 >= vertexCount || i1 >= vertexCount || i2 >= vertexCount) {
+                        continue;
+                    }
+                    const std::uint32_t v0 = vertex(i0);
+                    const std::uint32_t v1 = vertex(i1);
+                    const std::uint32_t v2 = vertex(i2);
+                    if (flipWinding) {
+                        dst.indices.insert(dst.indices.end(), { v0, v2, v1 });
+                    } else {
+                        dst.indices.insert(dst.indices.end(), { v0, v1, v2 });
+                    }
+                    merged.mergedTriangles++;
+                }
+                dst.submeshes[0].indexCount = static_cast<std::uint32_t>(dst.indices.size());
+            }
+            meshMerged[ref.meshIndex] = true;
+            result.nodes[nodeIndex].mesh = {};
+            merged.mergedReferences++;
+        }
+
+        if (merged.mergedReferences != 0) {
+            // Drop the merged source meshes and renumber the rest.
+            std::vector<std::uint32_t> newMeshIndex(meshCount, InvalidIndex);
+            std::vector<scene_core::Mesh> meshes;
+            for (std::uint32_t meshIndex = 0; meshIndex < meshCount; ++meshIndex) {
+                if (!meshMerged[meshIndex]) {
+                    newMeshIndex[meshIndex] = static_cast<std::uint32_t>(meshes.size());
+                    meshes.push_back(std::move(result.meshes[meshIndex]));
+                }
+            }
+            for (scene_core::Node& node : result.nodes) {
+                if (node.mesh.meshIndex < meshCount) {
+                    node.mesh.meshIndex = newMeshIndex[node.mesh.meshIndex];
+                }
+            }
+
+            // One identity node per merged mesh, under the root when its transform is the identity, otherwise
+            // next to it under a new root. Without a root node every node that is no child is a root already.
+            std::vector<std::uint32_t> mergedNodes;
+            for (scene_core::Mesh& mesh : mergedMeshes) {
+                scene_core::Node node;
+                node.name = mesh.name;
+                node.mesh.meshIndex = static_cast<std::uint32_t>(meshes.size());
+                mergedNodes.push_back(static_cast<std::uint32_t>(result.nodes.size()));
+                result.nodes.push_back(std::move(node));
+                meshes.push_back(std::move(mesh));
+            }
+            result.meshes = std::move(meshes);
+            if (result.rootNode < scene.nodes.size()) {
+                if (!IsIdentity(result.nodes[result.rootNode].localTransform)) {
+                    scene_core::Node root;
+                    root.name = "root";
+                    root.children.push_back(result.rootNode);
+                    result.rootNode = static_cast<std::uint32_t>(result.nodes.size());
+                    result.nodes.push_back(std::move(root));
+                }
+                std::vector<std::uint32_t>& children = result.nodes[result.rootNode].children;
+                children.insert(children.end(), mergedNodes.begin(), mergedNodes.end());
+            }
+            merged.mergedMeshes = static_cast<std::uint32_t>(mergedNodes.size());
+        }
+
+        if (stats != nullptr) {
+            *stats = merged;
+        }
+        return result;
+    }
+}
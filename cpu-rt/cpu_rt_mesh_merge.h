@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+#include "../scene-core/scene.h"
+
+namespace cpu_rt
+{
+    struct MeshMergeSettings
+    {
+        // Meshes whose referenced triangles exceed this keep their own node, accel and draw.
+        std::uint32_t maxTriangles = 4096;
+    };
+
+    struct MeshMergeStats
+    {
+        // Node mesh references baked into merged meshes.
+        std::uint32_t mergedReferences = 0;
+        std::uint64_t mergedTriangles = 0;
+        // Meshes created, one per material and vertex stream layout.
+        std::uint32_t mergedMeshes = 0;
+    };
+
+    // Static-geometry pass for scenes made of many small meshes that each belong to one node: the world
+    // transform of such a node is baked into its mesh's vertices, and the triangles of all of them are
+    // merged into one mesh per material (and per set of vertex streams), each placed by a new node with an
+    // identity transform. The scene then needs one top-level instance and one draw per material instead
+    // of one per mesh.
+    // Meshes referenced by more than one node stay instanced, as do larger meshes and nodes outside the
+    // hierarchy. Merged-away nodes keep their place in the hierarchy, their children, lights and cameras;
+    // only their mesh reference is cleared, so node IDs of merged geometry report the new nodes. Source
+    // meshes that are no longer referenced are removed. Negative-determinant transforms flip the triangle
+    // winding and tangent signs, so shading matches the instanced scene.
+    scene_core::Scene MergeSmallMeshes(const scene_core::Scene& scene, const MeshMergeSettings& settings = {}, MeshMergeStats* stats = nullptr);
+}
@@ -0,0 +1,189 @@
+#include "cpu_rt_perf_counters.h"
+
+#include <utility>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace cpu_rt
+{
+    namespace
+    {
+#if defined(__linux__)
+        constexpr std::uint64_t CacheReadMiss(std::uint64_t cache)
+        {
+            return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        }
+
+        int OpenEvent(PerfEvent event)
+        {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            switch (event) {
+            case PerfEvent::Cycles:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_CPU_CYCLES;
+                break;
+            case PerfEvent::Instructions:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+                break;
+            case PerfEvent::LlcMisses:
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = CacheReadMiss(PERF_COUNT_HW_CACHE_LL);
+                break;
+            case PerfEvent::BranchMisses:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+                break;
+            case PerfEvent::DtlbMisses:
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = CacheReadMiss(PERF_COUNT_HW_CACHE_DTLB);
+                break;
+            default:
+                return -1;
+            }
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            return static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#endif
+    }
+
+    const char* PerfEventName(PerfEvent event)
+    {
+        switch (event) {
+        case PerfEvent::Cycles:
+            return "cycles";
+        case PerfEvent::Instructions:
+            return "instructions";
+        case PerfEvent::LlcMisses:
+            return "llc_misses";
+        case PerfEvent::BranchMisses:
+            return "branch_misses";
+        case PerfEvent::DtlbMisses:
+            return "dtlb_misses";
+        default:
+            return "unknown";
+        }
+    }
+
+    PerfCounts& PerfCounts::operator+=(const PerfCounts& other)
+    {
+        for (std::size_t i = 0; i < PerfEventCount; ++i) {
+            values[i] += other.values[i];
+            valid[i] = valid[i] && other.valid[i];
+        }
+        return *this;
+    }
+
+    PerfCounterSet::~PerfCounterSet()
+    {
+        Close();
+    }
+
+    PerfCounterSet::PerfCounterSet(PerfCounterSet&& other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+    PerfCounterSet& PerfCounterSet::operator=(PerfCounterSet&& other) noexcept
+    {
+        if (this != &other) {
+            Close();
+            m_fds = std::exchange(other.m_fds, { -1, -1, -1, -1, -1 });
+        }
+        return *this;
+    }
+
+    bool PerfCounterSet::IsOpen() const
+    {
+        for (int fd : m_fds) {
+            if (fd >= 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+#if defined(__linux__)
+    bool PerfCounterSet::Open()
+    {
+        Close();
+        for (std::size_t i = 0; i < PerfEventCount; ++i) {
+            m_fds[i] = OpenEvent(static_cast<PerfEvent>(i));
+        }
+        return IsOpen();
+    }
+
+    void PerfCounterSet::Close()
+    {
+        for (int& fd : m_fds) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            fd = -1;
+        }
+    }
+
+    void PerfCounterSet::Start()
+    {
+        for (int fd : m_fds) {
+            if (fd >= 0) {
+                ::ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+
+    PerfCounts PerfCounterSet::Stop()
+    {
+        PerfCounts counts;
+        for (std::size_t i = 0; i < PerfEventCount; ++i) {
+            if (m_fds[i] < 0) {
+                continue;
+            }
+            ::ioctl(m_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            // value, time enabled, time running
+            std::uint64_t data[3] = {};
+            if (::read(m_fds[i], data, sizeof(data)) != static_cast<ssize_t>(sizeof(data))) {
+                continue;
+            }
+            if (data[2] == 0 && data[1] != 0) {
+                // Enabled but never scheduled on the PMU.
+                continue;
+            }
+            if (data[2] != 0 && data[2] < data[1]) {
+                data[0] = static_cast<std::uint64_t>(static_cast<double>(data[0]) * static_cast<double>(data[1]) / static_cast<double>(data[2]));
+            }
+            counts.values[i] = data[0];
+            counts.valid[i] = true;
+        }
+        return counts;
+    }
+#else
+    bool PerfCounterSet::Open()
+    {
+        return false;
+    }
+
+    void PerfCounterSet::Close()
+    {
+    }
+
+    void PerfCounterSet::Start()
+    {
+    }
+
+    PerfCounts PerfCounterSet::Stop()
+    {
+        return {};
+    }
+#endif
+}
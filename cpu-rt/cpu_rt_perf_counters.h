@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace cpu_rt
+{
+    enum class PerfEvent : std::uint32_t
+    {
+        Cycles,
+        Instructions,
+        LlcMisses,
+        BranchMisses,
+        DtlbMisses,
+        Count,
+    };
+
+    inline constexpr std::size_t PerfEventCount = static_cast<std::size_t>(PerfEvent::Count);
+
+    const char* PerfEventName(PerfEvent event);
+
+    struct PerfCounts
+    {
+        std::array<std::uint64_t, PerfEventCount> values = {};
+        // Events that could not be counted stay invalid and zero.
+        std::array<bool, PerfEventCount> valid = {};
+
+        std::uint64_t Value(PerfEvent event) const { return values[static_cast<std::size_t>(event)]; }
+        bool IsValid(PerfEvent event) const { return valid[static_cast<std::size_t>(event)]; }
+
+        // Sums the values; an event stays valid only if it is valid in both.
+        PerfCounts& operator+=(const PerfCounts& other);
+    };
+
+    // Hardware counters of the thread that opened them, through perf_event_open() on Linux. Only user-space
+    // events are counted, which the default perf_event_paranoid level allows. Multiplexed counts are scaled
+    // to the full running time. Elsewhere Open() fails.
+    class PerfCounterSet
+    {
+    public:
+        PerfCounterSet() = default;
+        ~PerfCounterSet();
+
+        PerfCounterSet(const PerfCounterSet&) = delete;
+        PerfCounterSet& operator=(const PerfCounterSet&) = delete;
+        PerfCounterSet(PerfCounterSet&& other) noexcept;
+        PerfCounterSet& operator=(PerfCounterSet&& other) noexcept;
+
+        // Open the counters for the calling thread. Events the CPU or kernel lacks are skipped; returns false
+        // if none could be opened.
+        bool Open();
+        void Close();
+        bool IsOpen() const;
+
+        // Reset and enable the counters.
+        void Start();
+        // Disable the counters and read them.
+        PerfCounts Stop();
+
+    private:
+        std::array<int, PerfEventCount> m_fds = { -1, -1, -1, -1, -1 };
+    };
+}
@@ -0,0 +1,255 @@
+#include "cpu_rt_preview.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace cpu_rt
+{
+    namespace
+    {
+        // Internal resolutions are multiples of 1 / ScaleSteps of the output size.
+        constexpr std::uint32_t ScaleSteps = 16;
+        // A higher resolution is only chosen if it leaves this much of the budget unused, so the
+        // resolution does not flip between two levels every frame.
+        constexpr double GrowHeadroom = 0.85;
+        // Weight of the newest measurement in the smoothed costs.
+        constexpr double CostSmoothing = 0.5;
+
+        double MillisecondsSince(std::chrono::steady_clock::time_point start)
+        {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        double Smooth(double previous, double sample)
+        {
+            return previous > 0.0 ? previous + CostSmoothing * (sample - previous) : sample;
+        }
+    }
+
+    std::vector<float> UpscaleEdgeAware(WorkerPool& pool, const RtScene& scene, const TopLevelAccel& topLevel, const std::vector<float>& lowRadiance,
+        const ViewGeometry& low, std::uint32_t width, std::uint32_t height)
+    {
+        std::vector<float> result(static_cast<std::size_t>(width) * height * 3, 0.0f);
+        const Vec3 origin = low.camera.cameraToWorld.TransformPoint({});
+        const float aspect = static_cast<float>(width) / static_cast<float>(height);
+        const float scaleX = static_cast<float>(low.width) / static_cast<float>(width);
+        const float scaleY = static_cast<float>(low.height) / static_cast<float>(height);
+        auto lowColor = [&](std::size_t source) {
+            return Vec3(lowRadiance[source * 3 + 0], lowRadiance[source * 3 + 1], lowRadiance[source * 3 + 2]);
+        };
+        // Whether two first hits lie on the same smooth surface, seen from a point at the given distance.
+        auto sameSurface = [&](std::size_t a, std::size_t b) {
+            if (low.nodeIds[a] != low.nodeIds[b]) {
+                return false;
+            }
+            if (low.nodeIds[a] == InvalidIndex) {
+                return true;
+            }
+            const float tolerance = 0.01f * Length(low.positions[a] - origin);
+            return Dot(low.normals[a], low.normals[b]) > 0.95f && std::abs(Dot(low.positions[b] - low.positions[a], low.normals[a])) < tolerance;
+        };
+
+        ParallelRows(pool, height, [&](std::uint32_t y) {
+            for (std::uint32_t x = 0; x < width; ++x) {
+                const std::size_t pixel = static_cast<std::size_t>(y) * width + x;
+                const float lx = std::clamp((static_cast<float>(x) + 0.5f) * scaleX - 0.5f, 0.0f, static_cast<float>(low.width - 1));
+                const float ly = std::clamp((static_cast<float>(y) + 0.5f) * scaleY - 0.5f, 0.0f, static_cast<float>(low.height - 1));
+                const std::uint32_t x0 = static_cast<std::uint32_t>(lx);
+                const std::uint32_t y0 = static_cast<std::uint32_t>(ly);
+                const std::uint32_t x1 = std::min(x0 + 1, low.width - 1);
+                const std::uint32_t y1 = std::min(y0 + 1, low.height - 1);
+                const std::size_t taps[4] = {
+                    static_cast<std::size_t>(y0) * low.width + x0,
+                    static_cast<std::size_t>(y0) * low.width + x1,
+                    static_cast<std::size_t>(y1) * low.width + x0,
+                    static_cast<std::size_t>(y1) * low.width + x1,
+                };
+
+                Vec3 value;
+                if (sameSurface(taps[0], taps[1]) && sameSurface(taps[0], taps[2]) && sameSurface(taps[0], taps[3])) {
+                    // Interior of a surface: bilinear.
+                    const float ax = lx - static_cast<float>(x0);
+                    const float ay = ly - static_cast<float>(y0);
+                    value = Lerp(Lerp(lowColor(taps[0]), lowColor(taps[1]), ax), Lerp(lowColor(taps[2]), lowColor(taps[3]), ax), ay);
+                } else {
+                    // Edge: trace this pixel's first hit and weight a 4x4 tent footprint by how well each
+                    // low-resolution hit matches it.
+                    const Ray ray = GenerateCameraRay(low.camera, (static_cast<float>(x) + 0.5f) / static_cast<float>(width),
+                        (static_cast<float>(y) + 0.5f) / static_cast<float>(height), aspect);
+                    Hit hit;
+                    std::uint32_t nodeIndex = InvalidIndex;
+                    Vec3 position, normal;
+                    if (Intersect(scene, topLevel, ray, hit)) {
+                        const SurfaceHit surface = MakeSurfaceHit(scene, topLevel, hit);
+                        nodeIndex = surface.nodeIndex;
+                        position = surface.position;
+                        normal = surface.geometricNormal;
+                    }
+                    const float planeScale = 1.0f / (0.01f * Length(position - origin) + 1e-6f);
+
+                    Vec3 sum;
+                    float weightSum = 0.0f;
+                    const int cx = static_cast<int>(x0);
+                    const int cy = static_cast<int>(y0);
+                    for (int ty = std::max(cy - 1, 0); ty <= std::min(cy + 2, static_cast<int>(low.height) - 1); ++ty) {
+                        for (int tx = std::max(cx - 1, 0); tx <= std::min(cx + 2, static_cast<int>(low.width) - 1); ++tx) {
+                            const float spatial = std::max(0.0f, 1.0f - 0.5f * std::abs(static_cast<float>(tx) - lx)) *
+                                std::max(0.0f, 1.0f - 0.5f * std::abs(static_cast<float>(ty) - ly));
+                            const std::size_t source = static_cast<std::size_t>(ty) * low.width + static_cast<std::size_t>(tx);
+                            if (spatial <= 0.0f || low.nodeIds[source] != nodeIndex) {
+                                continue;
+                            }
+                            float weight = spatial;
+                            if (nodeIndex != InvalidIndex) {
+                                const float cosine = std::max(0.0f, Dot(low.normals[source], normal));
+                                const float cosine2 = cosine * cosine;
+                                const float planeDistance = Dot(low.positions[source] - position, normal) * planeScale;
+                                weight *= cosine2 * cosine2 * cosine2 * cosine2 / (1.0f + planeDistance * planeDistance);
+                            }
+                            sum += lowColor(source) * weight;
+                            weightSum += weight;
+                        }
+                    }
+                    // No matching surface nearby (features thinner than a low-resolution pixel): nearest pixel.
+                    const std::size_t nearest = static_cast<std::size_t>(std::lround(ly)) * low.width + static_cast<std::size_t>(std::lround(lx));
+                    value = weightSum > 1e-6f ? sum / weightSum : lowColor(nearest);
+                }
+                result[pixel * 3 + 0] = value.x;
+                result[pixel * 3 + 1] = value.y;
+                result[pixel * 3 + 2] = value.z;
+            }
+        });
+        return result;
+    }
+
+    PreviewRenderer::PreviewRenderer(const RenderSettings& settings, const PreviewSettings& preview)
+        : m_settings(preview)
+        , m_outputWidth(settings.width)
+        , m_outputHeight(settings.height)
+        , m_renderer(settings)
+    {
+        m_scaleSteps = ScaleSteps;
+    }
+
+    void PreviewRenderer::SetScene(const scene_core::Scene& scene)
+    {
+        m_renderer.SetScene(scene);
+        m_cameraMoved = true;
+        m_previewRadiance.clear();
+    }
+
+    void PreviewRenderer::SetCamera(const CameraView& camera)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        m_renderer.SetCamera(camera);
+        m_cameraMoved = true;
+        m_cameraMs = MillisecondsSince(start);
+    }
+
+    std::uint32_t PreviewRenderer::ScaledPixelCount(std::uint32_t scaleSteps) const
+    {
+        const std::uint32_t width = std::max(1u, m_outputWidth * scaleSteps / ScaleSteps);
+        const std::uint32_t height = std::max(1u, m_outputHeight * scaleSteps / ScaleSteps);
+        return width * height;
+    }
+
+    void PreviewRenderer::ChooseFrameSettings(bool still, std::uint32_t& scaleSteps, std::uint32_t& samples) const
+    {
+        const std::uint32_t minSteps = std::clamp(
+            static_cast<std::uint32_t>(std::ceil(m_settings.minResolutionScale * static_cast<float>(ScaleSteps))), 1u, ScaleSteps);
+        const std::uint32_t maxSamples = std::max(1u, m_settings.maxSamplesPerFrame);
+        if (m_nsPerSample <= 0.0) {
+            // Nothing measured yet: start cheap.
+            scaleSteps = still ? ScaleSteps : minSteps;
+            samples = 1;
+            return;
+        }
+
+        // Reprojection in SetCamera() is part of the frame.
+        const double budgetNs = (static_cast<double>(m_settings.targetFrameMs) - (still ? 0.0 : m_cameraMs)) * 1e6;
+        auto samplesFitting = [&](std::uint32_t steps, double budget) {
+            return budget / (m_nsPerSample * static_cast<double>(ScaledPixelCount(steps)));
+        };
+
+        // A still camera refines at full resolution; the frame takes at least one pass over the image.
+        scaleSteps = ScaleSteps;
+        if (!still) {
+            scaleSteps = minSteps;
+            for (std::uint32_t steps = ScaleSteps; steps > minSteps; --steps) {
+                // Reduced resolutions pay for the upscale out of the same budget.
+                const double budget = steps == ScaleSteps ? budgetNs : std::max(budgetNs - m_upscaleMs * 1e6, 0.25 * budgetNs);
+                const double headroom = steps > m_scaleSteps ? GrowHeadroom : 1.0;
+                if (samplesFitting(steps, budget * headroom) >= 1.0) {
+                    scaleSteps = steps;
+                    break;
+                }
+            }
+        }
+        const double budget = scaleSteps == ScaleSteps ? budgetNs : std::max(budgetNs - m_upscaleMs * 1e6, 0.25 * budgetNs);
+        samples = std::clamp(static_cast<std::uint32_t>(samplesFitting(scaleSteps, budget)), 1u, maxSamples);
+    }
+
+    RenderOutput PreviewRenderer::RenderFrame()
+    {
+        const auto frameStart = std::chrono::steady_clock::now();
+        const bool still = !m_cameraMoved;
+        m_cameraMoved = false;
+        if (still) {
+            m_cameraMs = 0.0;
+        }
+        if (m_settings.directLightingOnly) {
+            m_renderer.SetResolution(m_outputWidth, m_outputHeight);
+            RenderOutput output = m_renderer.RenderDirectLighting();
+            m_scaleSteps = ScaleSteps;
+            m_scale = 1.0f;
+            m_samplesPerFrame = 1;
+            m_frameMs = m_cameraMs + MillisecondsSince(frameStart);
+            return output;
+        }
+
+        std::uint32_t scaleSteps = ScaleSteps;
+        std::uint32_t samples = 1;
+        ChooseFrameSettings(still, scaleSteps, samples);
+        m_scaleSteps = scaleSteps;
+        const std::uint32_t width = std::max(1u, m_outputWidth * m_scaleSteps / ScaleSteps);
+        const std::uint32_t height = std::max(1u, m_outputHeight * m_scaleSteps / ScaleSteps);
+        m_renderer.SetResolution(width, height);
+
+        const auto renderStart = std::chrono::steady_clock::now();
+        m_renderer.RenderSamples(samples);
+        const double renderMs = MillisecondsSince(renderStart);
+        m_nsPerSample = Smooth(m_nsPerSample, renderMs * 1e6 / (static_cast<double>(width) * height * samples));
+
+        RenderOutput output = m_renderer.Resolve();
+        if (m_scaleSteps == ScaleSteps) {
+            // Keep showing the sharper-looking preview until the refinement has as many samples per pixel.
+            if (!m_previewRadiance.empty() && static_cast<float>(m_renderer.GetAccumulatedSamples()) < m_previewSamplesPerPixel) {
+                output.radiance = m_previewRadiance;
+            } else {
+                m_previewRadiance.clear();
+            }
+        } else {
+            const auto upscaleStart = std::chrono::steady_clock::now();
+            const RtScene& scene = m_renderer.GetRtScene();
+            WorkerPool& pool = m_renderer.GetWorkerPool();
+            const ViewGeometry low = TraceViewGeometry(pool, scene, scene.topLevel, scene.camera, width, height);
+
+            RenderOutput upscaled;
+            upscaled.width = m_outputWidth;
+            upscaled.height = m_outputHeight;
+            upscaled.radiance = UpscaleEdgeAware(pool, scene, scene.topLevel, output.radiance, low, m_outputWidth, m_outputHeight);
+            output = std::move(upscaled);
+            m_upscaleMs = Smooth(m_upscaleMs, MillisecondsSince(upscaleStart));
+
+            m_previewRadiance = output.radiance;
+            m_previewSamplesPerPixel = static_cast<float>(m_renderer.GetAccumulatedSamples()) * static_cast<float>(width * height) /
+                static_cast<float>(m_outputWidth * m_outputHeight);
+        }
+
+        m_scale = static_cast<float>(m_scaleSteps) / static_cast<float>(ScaleSteps);
+        m_samplesPerFrame = samples;
+        m_frameMs = m_cameraMs + MillisecondsSince(frameStart);
+        return output;
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "../scene-core/scene.h"
+#include "cpu_rt.h"
+#include "cpu_rt_reprojection.h"
+
+namespace cpu_rt
+{
+    struct PreviewSettings
+    {
+        // Frame time the controller aims for, in milliseconds.
+        float targetFrameMs = 33.0f;
+        // Lower bound of the internal resolution while the camera moves, per axis, relative to the output.
+        float minResolutionScale = 0.25f;
+        std::uint32_t maxSamplesPerFrame = 16;
+        // Show only first-hit emission and direct light, at full resolution, resampled from the lights with
+        // reservoir reuse across frames (Renderer::RenderDirectLighting()). For scenes with many lights,
+        // where path-traced previews stay noisy; the frame-time controller is not used.
+        bool directLightingOnly = false;
+    };
+
+    // Edge-aware upscale of a low-resolution image to width x height, guided by first-hit geometry.
+    // Where the surrounding low-resolution pixels show one smooth surface the result is bilinear. Elsewhere
+    // the output pixel traces its own first hit and averages nearby low-resolution pixels weighted by how well
+    // their hits match it (same node, similar normal, close to its surface plane), which keeps edges sharp.
+    std::vector<float> UpscaleEdgeAware(WorkerPool& pool, const RtScene& scene, const TopLevelAccel& topLevel, const std::vector<float>& lowRadiance,
+        const ViewGeometry& low, std::uint32_t width, std::uint32_t height);
+
+    // Interactive renderer that holds a frame-time budget. While the camera moves, every frame renders at
+    // a reduced internal resolution and sample count chosen from the measured cost of earlier frames and
+    // is upscaled to the output resolution. When the camera stops, rendering continues progressively at
+    // full resolution, which replaces the preview once it holds at least as many samples per output pixel.
+    class PreviewRenderer
+    {
+    public:
+        // settings.width and height are the output resolution.
+        PreviewRenderer(const RenderSettings& settings, const PreviewSettings& preview = {});
+
+        // The scene must stay alive and unmodified while it is set.
+        void SetScene(const scene_core::Scene& scene);
+        void SetCamera(const CameraView& camera);
+        const CameraView& GetCamera() const { return m_renderer.GetRtScene().camera; }
+
+        // Render one frame and return it at the output resolution (radiance only).
+        RenderOutput RenderFrame();
+
+        // Statistics of the last frame; the frame time includes the SetCamera() call before it.
+        float GetResolutionScale() const { return m_scale; }
+        std::uint32_t GetSamplesPerFrame() const { return m_samplesPerFrame; }
+        double GetFrameMilliseconds() const { return m_frameMs; }
+
+    private:
+        void ChooseFrameSettings(bool still, std::uint32_t& scaleSteps, std::uint32_t& samples) const;
+        std::uint32_t ScaledPixelCount(std::uint32_t scaleSteps) const;
+
+        PreviewSettings m_settings;
+        std::uint32_t m_outputWidth = 0;
+        std::uint32_t m_outputHeight = 0;
+        Renderer m_renderer;
+
+        bool m_cameraMoved = true;
+        // Internal resolution in steps of 1 / ScaleSteps of the output, per axis.
+        std::uint32_t m_scaleSteps = 0;
+        // Smoothed cost of one sample of one pixel and of the upscale pass.
+        double m_nsPerSample = 0.0;
+        double m_upscaleMs = 0.0;
+        // Time spent in the last SetCamera(), reprojecting the accumulated image.
+        double m_cameraMs = 0.0;
+
+        // Last upscaled frame, shown until the full-resolution refinement has caught up with it.
+        std::vector<float> m_previewRadiance;
+        float m_previewSamplesPerPixel = 0.0f;
+
+        float m_scale = 1.0f;
+        std::uint32_t m_samplesPerFrame = 0;
+        double m_frameMs = 0.0;
+    };
+}
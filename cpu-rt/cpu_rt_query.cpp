@@ -0,0 +1,165 @@
+#include "cpu_rt_query.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <utility>
+
+#include "cpu_rt_isa.h"
+#include "cpu_rt_traversal.h"
+
+namespace cpu_rt
+{
+    namespace
+    {
+        static_assert(RayQueryChunkSize % 64 == 0, "chunks must cover whole occlusion mask words");
+
+        template<SceneFeatures Features>
+        void IntersectChunk(const RtScene& scene, const TopLevelAccel& topLevel, std::span<const Ray> rays, std::span<Hit> hits)
+        {
+            for (std::size_t i = 0; i < rays.size(); ++i) {
+                hits[i] = Hit{};
+                Intersect<Features>(scene, topLevel, rays[i], hits[i]);
+            }
+        }
+
+        // Writes the mask words of a chunk that starts at a multiple of 64 rays.
+        template<SceneFeatures Features>
+        void OccludedChunk(const RtScene& scene, const TopLevelAccel& topLevel, std::span<const Ray> rays, std::span<std::uint64_t> occluded)
+        {
+            for (std::size_t word = 0; word * 64 < rays.size(); ++word) {
+                std::uint64_t bits = 0;
+                const std::size_t end = std::min(rays.size(), word * 64 + 64);
+                for (std::size_t i = word * 64; i < end; ++i) {
+                    if (Occluded<Features>(scene, topLevel, rays[i])) {
+                        bits |= std::uint64_t(1) << (i % 64);
+                    }
+                }
+                occluded[word] = bits;
+            }
+        }
+
+#if CPU_RT_ISA_DISPATCH
+        template<SceneFeatures Features>
+        CPU_RT_TARGET_SSE42 void IntersectChunkSse42(const RtScene& scene, const TopLevelAccel& topLevel, std::span<const Ray> rays, std::span<Hit> hits)
+        {
+            IntersectChunk<Features>(scene, topLevel, rays, hits);
+        }
+
+        template<SceneFeatures Features>
+        CPU_RT_TARGET_AVX2 void IntersectChunkAvx2(const RtScene& scene, const TopLevelAccel& topLevel, std::span<const Ray> rays, std::span<Hit> hits)
+        {
+            IntersectChunk<Features>(scene, topLevel, rays, hits);
+        }
+
+        template<SceneFeatures Features>
+        CPU_RT_TARGET_AVX512 void IntersectChunkAvx512(const RtScene& scene, const TopLevelAccel& topLevel, std::span<const Ray> rays, std::span<Hit> hits)
+        {
+            IntersectChunk<Features>(scene, topLevel, rays, hits);
+        }
+
+        template<SceneFeatures Features>
+        CPU_RT_TARGET_SSE42 void OccludedChunkSse42(
+            const RtScene& scene, const TopLevelAccel& topLevel, std::span<const Ray> rays, std::span<std::uint64_t> occluded)
+        {
+            OccludedChunk<Features>(scene, topLevel, rays, occluded);
+        }
+
+        template<SceneFeatures Features>
+        CPU_RT_TARGET_AVX2 void OccludedChunkAvx2(
+            const RtScene& scene, const TopLevelAccel& topLevel, std::span<const Ray> rays, std::span<std::uint64_t> occluded)
+        {
+            OccludedChunk<Features>(scene, topLevel, rays, occluded);
+        }
+
+        template<SceneFeatures Features>
+        CPU_RT_TARGET_AVX512 void OccludedChunkAvx512(
+            const RtScene& scene, const TopLevelAccel& topLevel, std::span<const Ray> rays, std::span<std::uint64_t> occluded)
+        {
+            OccludedChunk<Features>(scene, topLevel, rays, occluded);
+        }
+#endif
+
+        using IntersectChunkFn = void (*)(const RtScene&, const TopLevelAccel&, std::span<const Ray>, std::span<Hit>);
+        using OccludedChunkFn = void (*)(const RtScene&, const TopLevelAccel&, std::span<const Ray>, std::span<std::uint64_t>);
+        constexpr std::size_t IsaCount = static_cast<std::size_t>(Isa::Count);
+
+        // Only the traversal features change tracing, so one kernel per instruction set and combination of them.
+        template<std::size_t... Masks>
+        constexpr std::array<std::array<IntersectChunkFn, sizeof...(Masks)>, IsaCount> MakeIntersectKernels(std::index_sequence<Masks...>)
+        {
+#if CPU_RT_ISA_DISPATCH
+            return { {
+                { &IntersectChunk<static_cast<SceneFeatures>(Masks) & TraversalFeatures>... },
+                { &IntersectChunkSse42<static_cast<SceneFeatures>(Masks) & TraversalFeatures>... },
+                { &IntersectChunkAvx2<static_cast<SceneFeatures>(Masks) & TraversalFeatures>... },
+                { &IntersectChunkAvx512<static_cast<SceneFeatures>(Masks) & TraversalFeatures>... },
+            } };
+#else
+            constexpr std::array<IntersectChunkFn, sizeof...(Masks)> baseline = { &IntersectChunk<static_cast<SceneFeatures>(Masks) & TraversalFeatures>... };
+            return { { baseline, baseline, baseline, baseline } };
+#endif
+        }
+
+        template<std::size_t... Masks>
+        constexpr std::array<std::array<OccludedChunkFn, sizeof...(Masks)>, IsaCount> MakeOccludedKernels(std::index_sequence<Masks...>)
+        {
+#if CPU_RT_ISA_DISPATCH
+            return { {
+                { &OccludedChunk<static_cast<SceneFeatures>(Masks) & TraversalFeatures>... },
+                { &OccludedChunkSse42<static_cast<SceneFeatures>(Masks) & TraversalFeatures>... },
+                { &OccludedChunkAvx2<static_cast<SceneFeatures>(Masks) & TraversalFeatures>... },
+                { &OccludedChunkAvx512<static_cast<SceneFeatures>(Masks) & TraversalFeatures>... },
+            } };
+#else
+            constexpr std::array<OccludedChunkFn, sizeof...(Masks)> baseline = { &OccludedChunk<static_cast<SceneFeatures>(Masks) & TraversalFeatures>... };
+            return { { baseline, baseline, baseline, baseline } };
+#endif
+        }
+
+        constexpr auto IntersectKernels = MakeIntersectKernels(std::make_index_sequence<TraversalFeatures + 1>());
+        constexpr auto OccludedKernels = MakeOccludedKernels(std::make_index_sequence<TraversalFeatures + 1>());
+
+        // Call fn(first, count) for every chunk of rayCount rays, spread over the pool.
+        template<typename Fn>
+        void ForEachChunk(WorkerPool& pool, std::size_t rayCount, Fn&& fn)
+        {
+            if (rayCount <= RayQueryChunkSize) {
+                fn(std::size_t(0), rayCount);
+                return;
+            }
+            const std::size_t chunkCount = (rayCount + RayQueryChunkSize - 1) / RayQueryChunkSize;
+            std::atomic<std::size_t> nextChunk{ 0 };
+            pool.Run([&](const WorkerInfo&) {
+                for (std::size_t chunk = nextChunk++; chunk < chunkCount; chunk = nextChunk++) {
+                    const std::size_t first = chunk * RayQueryChunkSize;
+                    fn(first, std::min(RayQueryChunkSize, rayCount - first));
+                }
+            });
+        }
+    }
+
+    bool IntersectRays(WorkerPool& pool, const RtScene& scene, const TopLevelAccel& topLevel, std::span<const Ray> rays, std::span<Hit> hits)
+    {
+        if (hits.size() < rays.size()) {
+            return false;
+        }
+        const IntersectChunkFn kernel = IntersectKernels[static_cast<std::size_t>(ActiveIsa())][scene.features & TraversalFeatures];
+        ForEachChunk(pool, rays.size(), [&](std::size_t first, std::size_t count) {
+            kernel(scene, topLevel, rays.subspan(first, count), hits.subspan(first, count));
+        });
+        return true;
+    }
+
+    bool OccludedRays(WorkerPool& pool, const RtScene& scene, const TopLevelAccel& topLevel, std::span<const Ray> rays, std::span<std::uint64_t> occluded)
+    {
+        if (occluded.size() < OcclusionMaskWords(rays.size())) {
+            return false;
+        }
+        const OccludedChunkFn kernel = OccludedKernels[static_cast<std::size_t>(ActiveIsa())][scene.features & TraversalFeatures];
+        ForEachChunk(pool, rays.size(), [&](std::size_t first, std::size_t count) {
+            kernel(scene, topLevel, rays.subspan(first, count), occluded.subspan(first / 64, OcclusionMaskWords(count)));
+        });
+        return true;
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "../scene-core/scene.h"
+#include "cpu_rt_scene.h"
+#include "cpu_rt_threading.h"
+
+namespace cpu_rt
+{
+    // Rays per unit of work in the batched queries. Workers take consecutive chunks, so rays that are
+    // neighbours in the batch are traced together by one thread.
+    inline constexpr std::size_t RayQueryChunkSize = 256;
+
+    // Closest hit of every ray within its [tMin, tMax], traced in parallel on the pool with the kernel
+    // specialized for the scene. hits[i] receives the hit of rays[i], or an invalid Hit for a miss.
+    // Batches of at most one chunk run on the calling thread. Returns false if hits is smaller than rays.
+    bool IntersectRays(WorkerPool& pool, const RtScene& scene, const TopLevelAccel& topLevel, std::span<const Ray> rays, std::span<Hit> hits);
+
+    // Any hit of every ray within its [tMin, tMax]. Bit i % 64 of occluded[i / 64] is set if rays[i] is
+    // occluded; unused bits of the last word are cleared. Returns false if occluded holds fewer than
+    // OcclusionMaskWords(rays.size()) words.
+    bool OccludedRays(WorkerPool& pool, const RtScene& scene, const TopLevelAccel& topLevel, std::span<const Ray> rays, std::span<std::uint64_t> occluded);
+
+    inline std::size_t OcclusionMaskWords(std::size_t rayCount)
+    {
+        return (rayCount + 63) / 64;
+    }
+}
@@ -0,0 +1,188 @@
+#include "cpu_rt_reprojection.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace cpu_rt
+{
+    namespace
+    {
+        Ray PixelCenterRay(const CameraView& camera, std::uint32_t x, std::uint32_t y, std::uint32_t width, std::uint32_t height)
+        {
+            const float filmX = (static_cast<float>(x) + 0.5f) / static_cast<float>(width);
+            const float filmY = (static_cast<float>(y) + 0.5f) / static_cast<float>(height);
+            return GenerateCameraRay(camera, filmX, filmY, static_cast<float>(width) / static_cast<float>(height));
+        }
+    }
+
+    ViewGeometry TraceViewGeometry(WorkerPool& pool, const RtScene& scene, const TopLevelAccel& topLevel,
+        const CameraView& camera, std::uint32_t width, std::uint32_t height)
+    {
+        ViewGeometry view;
+        view.camera = camera;
+        view.width = width;
+        view.height = height;
+        const std::size_t pixelCount = static_cast<std::size_t>(width) * height;
+        view.positions.resize(pixelCount);
+        view.normals.resize(pixelCount);
+        view.nodeIds.resize(pixelCount, InvalidIndex);
+
+        ParallelRows(pool, height, [&](std::uint32_t y) {
+            for (std::uint32_t x = 0; x < width; ++x) {
+                const std::size_t pixel = static_cast<std::size_t>(y) * width + x;
+                const Ray ray = PixelCenterRay(camera, x, y, width, height);
+                Hit hit;
+                if (!Intersect(scene, topLevel, ray, hit)) {
+                    continue;
+                }
+                const SurfaceHit surface = MakeSurfaceHit(scene, topLevel, hit);
+                view.positions[pixel] = surface.position;
+                view.normals[pixel] = surface.geometricNormal;
+                view.nodeIds[pixel] = surface.nodeIndex;
+            }
+        });
+        return view;
+    }
+
+    void TemporalHistory::Clear()
+    {
+        m_view = {};
+        m_radiance.clear();
+        m_weights.clear();
+    }
+
+    void TemporalHistory::Reproject(WorkerPool& pool, const RtScene& scene, const TopLevelAccel& topLevel, const Framebuffer& framebuffer,
+        const CameraView& nextCamera, const ReprojectionSettings& settings)
+    {
+        const std::uint32_t width = framebuffer.Width();
+        const std::uint32_t height = framebuffer.Height();
+        if (m_view.IsEmpty()) {
+            m_view = TraceViewGeometry(pool, scene, topLevel, scene.camera, width, height);
+        }
+
+        // Current estimate of every pixel and its weight, before warping.
+        std::vector<float> radiance = framebuffer.Resolve();
+        Apply(framebuffer, radiance);
+        std::vector<float> weights(static_cast<std::size_t>(width) * height);
+        for (std::uint32_t y = 0; y < height; ++y) {
+            for (std::uint32_t x = 0; x < width; ++x) {
+                const std::size_t pixel = static_cast<std::size_t>(y) * width + x;
+                weights[pixel] = static_cast<float>(framebuffer.SampleCount(x, y)) + (m_weights.empty() ? 0.0f : m_weights[pixel]);
+            }
+        }
+
+        ViewGeometry next = TraceViewGeometry(pool, scene, topLevel, nextCamera, width, height);
+        m_radiance.assign(radiance.size(), 0.0f);
+        m_weights.assign(weights.size(), 0.0f);
+
+        const ViewGeometry& previous = m_view;
+        const Affine3 worldToPrevious = Inverse(previous.camera.cameraToWorld);
+        const Vec3 previousOrigin = previous.camera.cameraToWorld.TransformPoint({});
+        const float aspect = static_cast<float>(width) / static_cast<float>(height);
+
+        ParallelRows(pool, height, [&](std::uint32_t y) {
+            for (std::uint32_t x = 0; x < width; ++x) {
+                const std::size_t pixel = static_cast<std::size_t>(y) * width + x;
+                const std::uint32_t nodeIndex = next.nodeIds[pixel];
+                const Vec3 position = next.positions[pixel];
+                const Vec3 normal = next.normals[pixel];
+
+                // Motion: where the surface (or, for a miss, the direction) seen by this pixel was on the previous film.
+                Vec3 previousDirection;
+                if (nodeIndex == InvalidIndex) {
+                    previousDirection = worldToPrevious.TransformVector(PixelCenterRay(nextCamera, x, y, width, height).direction);
+                } else {
+                    previousDirection = worldToPrevious.TransformPoint(position);
+                }
+                float filmX, filmY;
+                if (!CameraDirectionToFilm(previous.camera, previousDirection, aspect, filmX, filmY)) {
+                    continue;
+                }
+                const float tolerance = settings.planeTolerance * Length(position - previousOrigin);
+
+                // Bilinear fetch over the history pixels that show the same surface.
+                const float px = filmX * static_cast<float>(width) - 0.5f;
+                const float py = filmY * static_cast<float>(height) - 0.5f;
+                const float fx = std::floor(px);
+                const float fy = std::floor(py);
+                const float ax = px - fx;
+                const float ay = py - fy;
+                Vec3 radianceSum;
+                float weightSum = 0.0f;
+                float filterSum = 0.0f;
+                for (int tap = 0; tap < 4; ++tap) {
+                    const float tx = fx + static_cast<float>(tap & 1);
+                    const float ty = fy + static_cast<float>(tap >> 1);
+                    if (tx < 0.0f || ty < 0.0f || tx >= static_cast<float>(width) || ty >= static_cast<float>(height)) {
+                        continue;
+                    }
+                    const float filter = ((tap & 1) ? ax : 1.0f - ax) * ((tap >> 1) ? ay : 1.0f - ay);
+                    const std::size_t source = static_cast<std::size_t>(ty) * width + static_cast<std::size_t>(tx);
+                    if (filter <= 0.0f || previous.nodeIds[source] != nodeIndex) {
+                        continue;
+                    }
+                    if (nodeIndex != InvalidIndex) {
+                        if (Dot(previous.normals[source], normal) < settings.minNormalCosine ||
+                            std::abs(Dot(previous.positions[source] - position, normal)) > tolerance) {
+                            continue;
+                        }
+                    }
+                    const float weight = filter * weights[source];
+                    radianceSum += Vec3(radiance[source * 3 + 0], radiance[source * 3 + 1], radiance[source * 3 + 2]) * weight;
+                    weightSum += weight;
+                    filterSum += filter;
+                }
+                if (weightSum <= 0.0f || filterSum < 1e-3f) {
+                    continue;
+                }
+
+                const Vec3 warped = radianceSum / weightSum;
+                m_radiance[pixel * 3 + 0] = warped.x;
+                m_radiance[pixel * 3 + 1] = warped.y;
+                m_radiance[pixel * 3 + 2] = warped.z;
+                m_weights[pixel] = std::min(weightSum / filterSum, settings.maxHistorySamples);
+            }
+        });
+
+        m_view = std::move(next);
+    }
+
+    void TemporalHistory::Apply(const Framebuffer& framebuffer, std::vector<float>& radiance) const
+    {
+        if (m_weights.empty()) {
+            return;
+        }
+        for (std::uint32_t y = 0; y < framebuffer.Height(); ++y) {
+            for (std::uint32_t x = 0; x < framebuffer.Width(); ++x) {
+                const std::size_t pixel = static_cast<std::size_t>(y) * framebuffer.Width() + x;
+                const float historyWeight = m_weights[pixel];
+                if (historyWeight <= 0.0f) {
+                    continue;
+                }
+                const float count = static_cast<float>(framebuffer.SampleCount(x, y));
+                const float invTotal = 1.0f / (count + historyWeight);
+                for (int c = 0; c < 3; ++c) {
+                    float& value = radiance[pixel * 3 + c];
+                    value = (value * count + m_radiance[pixel * 3 + c] * historyWeight) * invTotal;
+                }
+            }
+        }
+    }
+
+    void TemporalHistory::ScaleVariance(const Framebuffer& framebuffer, std::vector<float>& variance) const
+    {
+        if (m_weights.empty()) {
+            return;
+        }
+        for (std::uint32_t y = 0; y < framebuffer.Height(); ++y) {
+            for (std::uint32_t x = 0; x < framebuffer.Width(); ++x) {
+                const std::size_t pixel = static_cast<std::size_t>(y) * framebuffer.Width() + x;
+                const float count = static_cast<float>(framebuffer.SampleCount(x, y));
+                const float scale = count / (count + m_weights[pixel]);
+                if (count > 0.0f) {
+                    variance[pixel] *= scale * scale;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "cpu_rt_framebuffer.h"
+#include "cpu_rt_scene.h"
+#include "cpu_rt_threading.h"
+
+namespace cpu_rt
+{
+    struct ReprojectionSettings
+    {
+        // Warp the accumulated image to the new view in Renderer::SetCamera() instead of discarding it.
+        bool enabled = true;
+        // Cap on the weight of reprojected history, in samples. Lower values follow view-dependent
+        // shading (glossy reflections) faster and leave more noise.
+        float maxHistorySamples = 32.0f;
+        // Distance of a history point from the current surface plane, relative to the distance from
+        // the camera, above which it counts as disoccluded.
+        float planeTolerance = 0.02f;
+        // Minimum cosine between history and current geometric normals.
+        float minNormalCosine = 0.9f;
+    };
+
+    // First hit through each pixel center of a view; matches pixels between two camera positions.
+    struct ViewGeometry
+    {
+        CameraView camera;
+        std::uint32_t width = 0;
+        std::uint32_t height = 0;
+        std::vector<Vec3> positions;
+        std::vector<Vec3> normals;
+        // scene_core::Node of the hit, InvalidIndex for a miss.
+        std::vector<std::uint32_t> nodeIds;
+
+        bool IsEmpty() const { return nodeIds.empty(); }
+    };
+
+    ViewGeometry TraceViewGeometry(WorkerPool& pool, const RtScene& scene, const TopLevelAccel& topLevel,
+        const CameraView& camera, std::uint32_t width, std::uint32_t height);
+
+    // Converged radiance of earlier views, warped to the current one, with a per-pixel weight in samples.
+    // Resolved pixels blend it with the samples of the current view: (sum + weight * history) / (count + weight),
+    // so new samples take over as they accumulate.
+    class TemporalHistory
+    {
+    public:
+        void Clear();
+
+        // Fold the framebuffer into the history and warp it from the current camera of the scene to the next one.
+        // Motion is derived per pixel from the hit positions of both views, so only the camera may move.
+        // Pixels without a matching surface in the previous view (disocclusions, new screen area) get no history.
+        void Reproject(WorkerPool& pool, const RtScene& scene, const TopLevelAccel& topLevel, const Framebuffer& framebuffer,
+            const CameraView& nextCamera, const ReprojectionSettings& settings);
+
+        // Blend the history into resolved radiance.
+        void Apply(const Framebuffer& framebuffer, std::vector<float>& radiance) const;
+        // Turn the variance of the sample mean into that of the blended mean, treating history as noise-free.
+        void ScaleVariance(const Framebuffer& framebuffer, std::vector<float>& variance) const;
+
+    private:
+        // Geometry of the view the history is aligned with; traced lazily for the first move.
+        ViewGeometry m_view;
+        // Linear RGB, 3 floats per pixel.
+        std::vector<float> m_radiance;
+        std::vector<float> m_weights;
+    };
+}
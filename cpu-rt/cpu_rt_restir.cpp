@@ -0,0 +1,228 @@
+#include "cpu_rt_restir.h"
+
+#include <algorithm>
+#include <cmath>
+#include <span>
+#include <utility>
+
+#include "cpu_rt_integrator.h"
+#include "cpu_rt_sampler.h"
+
+namespace cpu_rt
+{
+    void ReservoirDirectLighting::Clear()
+    {
+        m_width = 0;
+        m_height = 0;
+        m_previousSurfaces.clear();
+        m_previousReservoirs.clear();
+    }
+
+    void ReservoirDirectLighting::RenderFrame(WorkerPool& pool, const RtScene& scene, const TopLevelAccel& topLevel, std::uint32_t width,
+        std::uint32_t height, const Vec3& environmentRadiance, std::uint64_t seed, const ReservoirSettings& settings, std::vector<float>& radiance)
+    {
+        const std::size_t pixelCount = static_cast<std::size_t>(width) * height;
+        if (width != m_width || height != m_height) {
+            m_previousSurfaces.clear();
+            m_previousReservoirs.clear();
+        }
+        m_width = width;
+        m_height = height;
+        m_surfaces.assign(pixelCount, Surface{});
+        m_temporal.assign(pixelCount, Reservoir{});
+        radiance.assign(pixelCount * 3, 0.0f);
+
+        const std::uint32_t lightCount = static_cast<std::uint32_t>(scene.lights.size());
+        const std::uint32_t candidates = std::max(settings.initialCandidates, 1u);
+        const float aspect = static_cast<float>(width) / static_cast<float>(height);
+        const bool temporal = settings.temporalReuse && !m_previousReservoirs.empty();
+        const Affine3 worldToPrevious = Inverse(m_previousCamera.cameraToWorld);
+
+        // Unshadowed contribution of a light at a surface; its luminance is the target function.
+        auto contribution = [&](const Surface& surface, std::uint32_t lightIndex, Vec3& wi, float& distance) {
+            const Vec3 li = SamplePunctualLight(scene.lights[lightIndex], surface.position, wi, distance);
+            if (MaxComponent(li) <= 0.0f || Dot(surface.geometricNormal, wi) <= 0.0f) {
+                return Vec3();
+            }
+            float pdf = 0.0f;
+            return EvaluateBsdf(surface.bsdf, surface.shadingNormal, surface.wo, wi, pdf) * li * Dot(surface.shadingNormal, wi);
+        };
+        auto target = [&](const Surface& surface, std::uint32_t lightIndex) {
+            Vec3 wi;
+            float distance = 0.0f;
+            return Luminance(contribution(surface, lightIndex, wi, distance));
+        };
+        // Weighted reservoir sampling: keep the light with probability weight / weightSum.
+        auto update = [](Reservoir& reservoir, std::uint32_t lightIndex, float weight, float count, float u) {
+            reservoir.weightSum += weight;
+            reservoir.count += count;
+            if (weight > 0.0f && u * reservoir.weightSum < weight) {
+                reservoir.lightIndex = lightIndex;
+                return true;
+            }
+            return false;
+        };
+        // Whether a neighbor's surface is close enough to share reservoirs with.
+        auto similar = [&](const Surface& a, const Surface& b) {
+            return b.IsValid() && Dot(a.geometricNormal, b.geometricNormal) >= settings.minNormalCosine &&
+                   std::abs(Dot(b.position - a.position, a.geometricNormal)) <= settings.planeTolerance * a.distance;
+        };
+        // Merge the reservoirs of several surfaces into one for the receiving surface, the first input. Each
+        // input's light is weighted by the balance heuristic over the candidate counts and targets of all
+        // input surfaces (generalized RIS), so lights that are bright here but dim where they were drawn
+        // do not turn into fireflies, and a light all inputs agree on keeps an exact weight.
+        auto combine = [&](std::span<const Surface* const> surfaces, std::span<const Reservoir* const> inputs, Sampler& sampler) {
+            const Surface& receiver = *surfaces[0];
+            Reservoir combined;
+            float chosenTarget = 0.0f;
+            for (std::size_t i = 0; i < inputs.size(); ++i) {
+                const Reservoir& input = *inputs[i];
+                float inputTarget = 0.0f;
+                float misWeight = 0.0f;
+                if (input.lightIndex != InvalidIndex && input.weight > 0.0f) {
+                    inputTarget = target(receiver, input.lightIndex);
+                    float targetSum = 0.0f;
+                    float sourceTarget = 0.0f;
+                    for (std::size_t j = 0; j < inputs.size(); ++j) {
+                        const float jTarget = j == 0 ? inputTarget : target(*surfaces[j], input.lightIndex);
+                        targetSum += inputs[j]->count * jTarget;
+                        if (j == i) {
+                            sourceTarget = jTarget;
+                        }
+                    }
+                    misWeight = targetSum > 0.0f ? input.count * sourceTarget / targetSum : 0.0f;
+                }
+                if (update(combined, input.lightIndex, misWeight * inputTarget * input.weight, input.count, sampler.Next1D())) {
+                    chosenTarget = inputTarget;
+                }
+            }
+            combined.weight = chosenTarget > 0.0f ? combined.weightSum / chosenTarget : 0.0f;
+            return combined;
+        };
+
+        // Camera rays, initial candidates and temporal reuse.
+        ParallelRows(pool, height, [&](std::uint32_t y) {
+            for (std::uint32_t x = 0; x < width; ++x) {
+                const std::size_t pixel = static_cast<std::size_t>(y) * width + x;
+                const Ray ray = GenerateCameraRay(scene.camera, (static_cast<float>(x) + 0.5f) / static_cast<float>(width),
+                    (static_cast<float>(y) + 0.5f) / static_cast<float>(height), aspect);
+                Hit hit;
+                if (!Intersect(scene, topLevel, ray, hit)) {
+                    continue;
+                }
+                const SurfaceHit surfaceHit = MakeSurfaceHit(scene, topLevel, hit);
+                Surface& surface = m_surfaces[pixel];
+                surface.position = surfaceHit.position;
+                surface.wo = -ray.direction;
+                // Two-sided shading: flip both normals towards the viewer.
+                surface.geometricNormal = Dot(surfaceHit.geometricNormal, surface.wo) < 0.0f ? -surfaceHit.geometricNormal : surfaceHit.geometricNormal;
+                surface.shadingNormal = Dot(surfaceHit.shadingNormal, surface.geometricNormal) < 0.0f ? -surfaceHit.shadingNormal : surfaceHit.shadingNormal;
+                surface.bsdf = GetBsdfParams(*scene.source, surfaceHit.materialIndex);
+                surface.distance = hit.t;
+                surface.nodeIndex = surfaceHit.nodeIndex;
+                if (lightCount == 0) {
+                    continue;
+                }
+
+                // Resampled importance sampling over uniformly drawn lights.
+                Sampler sampler(seed, pixel, m_frameIndex * 2);
+                Reservoir initial;
+                float chosenTarget = 0.0f;
+                for (std::uint32_t c = 0; c < candidates; ++c) {
+                    const std::uint32_t lightIndex = std::min(static_cast<std::uint32_t>(sampler.Next1D() * static_cast<float>(lightCount)), lightCount - 1);
+                    const float candidateTarget = target(surface, lightIndex);
+                    if (update(initial, lightIndex, candidateTarget * static_cast<float>(lightCount), 1.0f, sampler.Next1D())) {
+                        chosenTarget = candidateTarget;
+                    }
+                }
+                initial.weight = chosenTarget > 0.0f ? initial.weightSum / (initial.count * chosenTarget) : 0.0f;
+                m_temporal[pixel] = initial;
+                if (!temporal) {
+                    continue;
+                }
+
+                // The reservoir of the pixel that saw this point in the previous frame, if it saw the same surface.
+                float filmX, filmY;
+                if (!CameraDirectionToFilm(m_previousCamera, worldToPrevious.TransformPoint(surface.position), aspect, filmX, filmY)) {
+                    continue;
+                }
+                const float px = std::floor(filmX * static_cast<float>(width));
+                const float py = std::floor(filmY * static_cast<float>(height));
+                if (px < 0.0f || py < 0.0f || px >= static_cast<float>(width) || py >= static_cast<float>(height)) {
+                    continue;
+                }
+                const std::size_t source = static_cast<std::size_t>(py) * width + static_cast<std::size_t>(px);
+                const Surface& previousSurface = m_previousSurfaces[source];
+                if (previousSurface.nodeIndex != surface.nodeIndex || !similar(surface, previousSurface)) {
+                    continue;
+                }
+                Reservoir previous = m_previousReservoirs[source];
+                previous.count = std::min(previous.count, settings.maxTemporalHistory * static_cast<float>(candidates));
+                const Surface* surfaces[2] = { &surface, &previousSurface };
+                const Reservoir* inputs[2] = { &initial, &previous };
+                m_temporal[pixel] = combine(surfaces, inputs, sampler);
+            }
+        });
+
+        // Spatial reuse, then one shadow ray for the light each pixel ends up with.
+        ParallelRows(pool, height, [&](std::uint32_t y) {
+            std::vector<const Surface*> surfaces;
+            std::vector<const Reservoir*> inputs;
+            for (std::uint32_t x = 0; x < width; ++x) {
+                const std::size_t pixel = static_cast<std::size_t>(y) * width + x;
+                const Surface& surface = m_surfaces[pixel];
+                if (!surface.IsValid()) {
+                    radiance[pixel * 3 + 0] = environmentRadiance.x;
+                    radiance[pixel * 3 + 1] = environmentRadiance.y;
+                    radiance[pixel * 3 + 2] = environmentRadiance.z;
+                    continue;
+                }
+
+                Sampler sampler(seed, pixel, m_frameIndex * 2 + 1);
+                surfaces.assign(1, &surface);
+                inputs.assign(1, &m_temporal[pixel]);
+                for (std::uint32_t n = 0; n < settings.spatialNeighbors && lightCount != 0; ++n) {
+                    const float radius = settings.spatialRadius * std::sqrt(sampler.Next1D());
+                    const float angle = 2.0f * Pi * sampler.Next1D();
+                    const int nx = static_cast<int>(x) + static_cast<int>(std::lround(radius * std::cos(angle)));
+                    const int ny = static_cast<int>(y) + static_cast<int>(std::lround(radius * std::sin(angle)));
+                    if (nx < 0 || ny < 0 || nx >= static_cast<int>(width) || ny >= static_cast<int>(height)) {
+                        continue;
+                    }
+                    const std::size_t neighbor = static_cast<std::size_t>(ny) * width + static_cast<std::size_t>(nx);
+                    if (neighbor == pixel || !similar(surface, m_surfaces[neighbor])) {
+                        continue;
+                    }
+                    surfaces.push_back(&m_surfaces[neighbor]);
+                    inputs.push_back(&m_temporal[neighbor]);
+                }
+                const Reservoir reservoir = inputs.size() > 1 ? combine(surfaces, inputs, sampler) : m_temporal[pixel];
+
+                Vec3 value = surface.bsdf.emission;
+                if (reservoir.lightIndex != InvalidIndex && reservoir.weight > 0.0f) {
+                    Vec3 wi;
+                    float distance = 0.0f;
+                    const Vec3 unshadowed = contribution(surface, reservoir.lightIndex, wi, distance);
+                    Ray shadowRay;
+                    shadowRay.origin = OffsetRayOrigin(surface.position, surface.geometricNormal, wi);
+                    shadowRay.direction = wi;
+                    shadowRay.tMax = distance == Infinity ? Infinity : distance * (1.0f - 1e-4f);
+                    if (MaxComponent(unshadowed) > 0.0f && !Occluded(scene, topLevel, shadowRay)) {
+                        value += unshadowed * reservoir.weight;
+                    } else if (m_temporal[pixel].lightIndex == reservoir.lightIndex) {
+                        // The pixel's own reservoir goes on to the next frame; do not pass on a light known to be occluded.
+                        m_temporal[pixel].weight = 0.0f;
+                    }
+                }
+                radiance[pixel * 3 + 0] = value.x;
+                radiance[pixel * 3 + 1] = value.y;
+                radiance[pixel * 3 + 2] = value.z;
+            }
+        });
+
+        std::swap(m_previousSurfaces, m_surfaces);
+        std::swap(m_previousReservoirs, m_temporal);
+        m_previousCamera = scene.camera;
+        ++m_frameIndex;
+    }
+}
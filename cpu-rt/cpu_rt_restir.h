@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "cpu_rt_bsdf.h"
+#include "cpu_rt_scene.h"
+#include "cpu_rt_threading.h"
+
+namespace cpu_rt
+{
+    struct ReservoirSettings
+    {
+        // Lights drawn uniformly per pixel and frame as resampling candidates; they cost no rays.
+        std::uint32_t initialCandidates = 32;
+        // Merge the reservoir the pixel's surface had in the previous frame, found by reprojection.
+        bool temporalReuse = true;
+        // Cap on the candidates a reservoir carries over from earlier frames, in multiples of
+        // initialCandidates. Lower values react faster to moving lights and occluders.
+        float maxTemporalHistory = 20.0f;
+        // Merge the reservoirs of random neighbors within spatialRadius pixels that see a similar surface.
+        std::uint32_t spatialNeighbors = 4;
+        float spatialRadius = 16.0f;
+        // Neighbor surfaces must face within this cosine and lie within this fraction of the camera
+        // distance from the pixel's surface plane.
+        float minNormalCosine = 0.9f;
+        float planeTolerance = 0.05f;
+    };
+
+    // Direct lighting from punctual lights by reservoir resampling (ReSTIR): every pixel picks a light by
+    // resampled importance sampling over many candidates, weighted by their unshadowed contribution,
+    // then merges the reservoir of its surface in the previous frame and those of similar neighbors, so
+    // it effectively chooses from the candidates of many pixels and frames. Only the light finally chosen
+    // is shadow-tested: one camera ray and one shadow ray per pixel and frame. Merged reservoirs are
+    // weighted by the balance heuristic over the targets at their surfaces. Only the temporal reservoirs
+    // are carried to the next frame; feeding back the spatial results correlates neighbors over time and
+    // darkens the image. A pixel's own light found occluded keeps its candidate count with zero weight,
+    // which darkens penumbrae slightly; maxTemporalHistory bounds it.
+    class ReservoirDirectLighting
+    {
+    public:
+        // Forget the previous frame, e.g. after scene, light or resolution changes.
+        void Clear();
+
+        // Render the first-hit emission plus direct lighting of one frame into radiance (RGB, row-major).
+        // Misses see environmentRadiance. Temporal reuse applies if the previous frame had the same size.
+        void RenderFrame(WorkerPool& pool, const RtScene& scene, const TopLevelAccel& topLevel, std::uint32_t width, std::uint32_t height,
+            const Vec3& environmentRadiance, std::uint64_t seed, const ReservoirSettings& settings, std::vector<float>& radiance);
+
+        std::uint64_t FrameIndex() const { return m_frameIndex; }
+
+    private:
+        struct Reservoir
+        {
+            std::uint32_t lightIndex = InvalidIndex;
+            float weightSum = 0.0f;
+            // Candidates represented, fractional after history clamping.
+            float count = 0.0f;
+            // Unbiased contribution weight of lightIndex.
+            float weight = 0.0f;
+        };
+
+        // First hit of a pixel's center ray.
+        struct Surface
+        {
+            Vec3 position;
+            Vec3 geometricNormal;
+            Vec3 shadingNormal;
+            Vec3 wo;
+            BsdfParams bsdf;
+            float distance = 0.0f;
+            std::uint32_t nodeIndex = InvalidIndex;
+
+            bool IsValid() const { return nodeIndex != InvalidIndex; }
+        };
+
+        std::uint32_t m_width = 0;
+        std::uint32_t m_height = 0;
+        std::uint64_t m_frameIndex = 0;
+        CameraView m_previousCamera;
+        std::vector<Surface> m_previousSurfaces;
+        std::vector<Reservoir> m_previousReservoirs;
+        // Scratch of the current frame.
+        std::vector<Surface> m_surfaces;
+        std::vector<Reservoir> m_temporal;
+    };
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+
+namespace cpu_rt
+{
+    inline std::uint64_t MixBits(std::uint64_t v)
+    {
+        v ^= v >> 31;
+        v *= 0x7fb5d329728ea185ull;
+        v ^= v >> 27;
+        v *= 0x81dadef4bc2dd44dull;
+        v ^= v >> 33;
+        return v;
+    }
+
+    // PCG32 random number generator.
+    // A sampler is fully determined by (seed, pixel, sample index), so progressive renders can be
+    // resumed or split across workers without carrying any generator state between samples.
+    class Sampler
+    {
+    public:
+        Sampler(std::uint64_t seed, std::uint64_t pixelIndex, std::uint64_t sampleIndex)
+        {
+            m_state = 0;
+            m_inc = (MixBits(pixelIndex ^ (seed << 1)) << 1) | 1u;
+            NextUint();
+            m_state += MixBits(sampleIndex + 0x9e3779b97f4a7c15ull * (seed + 1));
+            NextUint();
+        }
+
+        std::uint32_t NextUint()
+        {
+            const std::uint64_t old = m_state;
+            m_state = old * 6364136223846793005ull + m_inc;
+            const std::uint32_t xorShifted = static_cast<std::uint32_t>(((old >> 18u) ^ old) >> 27u);
+            const std::uint32_t rot = static_cast<std::uint32_t>(old >> 59u);
+            return (xorShifted >> rot) | (xorShifted << ((~rot + 1u) & 31));
+        }
+
+        // Uniform float in [0, 1).
+        float Next1D()
+        {
+            return static_cast<float>(NextUint() >> 8) * 0x1p-24f;
+        }
+
+    private:
+        std::uint64_t m_state = 0;
+        std::uint64_t m_inc = 1;
+    };
+}
@@ -0,0 +1,520 @@
+#include "cpu_rt_scene.h"
+
+#include <map>
+#include <memory>
+#include <span>
+#include <tuple>
+#include <utility>
+
+#include "cpu_rt_accel_file.h"
+#include "cpu_rt_hash.h"
+#include "cpu_rt_traversal.h"
+
+namespace cpu_rt
+{
+    namespace
+    {
+        bool IsAlphaCulled(const scene_core::Scene& scene, std::uint32_t materialIndex)
+        {
+            // Without texture decoding the alpha is constant per material, so masked-out
+            // geometry is dropped once here instead of being tested on every hit.
+            if (materialIndex >= scene.materials.size()) {
+                return false;
+            }
+            const scene_core::MaterialPBR& material = scene.materials[materialIndex];
+            return material.alphaMasked && material.baseColorFactor[3] < material.alphaCutoff;
+        }
+
+        template<typename T>
+        void MoveToArena(AccelArena& arena, const std::shared_ptr<const void>& owner, MappedArray<T>& array)
+        {
+            const std::span<const T> copy = arena.Copy(std::span<const T>(array.data(), array.size()));
+            if (!copy.empty()) {
+                array = MappedArray<T>(owner, copy);
+            }
+        }
+
+        // Copy the arrays of an in-memory accel into the arena, freeing each heap array right after its copy.
+        // An array the arena has no room for stays on the heap.
+        void MoveToArena(AccelArena& arena, const std::shared_ptr<const void>& owner, MeshAccel& accel)
+        {
+            MoveToArena(arena, owner, accel.bvh.nodes);
+            MoveToArena(arena, owner, accel.triangles);
+            MoveToArena(arena, owner, accel.triangleIds);
+            MoveToArena(arena, owner, accel.materialIndices);
+            MoveToArena(arena, owner, accel.shapes);
+            MoveToArena(arena, owner, accel.primRefs);
+        }
+
+        MeshAccel BuildMeshAccel(const scene_core::Scene& scene, std::uint32_t meshIndex, std::uint32_t submeshIndex, std::uint32_t shapeGroupIndex, const BvhBuildSettings& buildSettings)
+        {
+            MeshAccel accel;
+            accel.meshIndex = meshIndex;
+            accel.submeshIndex = submeshIndex;
+            accel.shapeGroupIndex = shapeGroupIndex;
+
+            std::vector<Triangle> triangles;
+            std::vector<std::uint32_t> triangleIds;
+            std::vector<std::uint32_t> materials;
+            std::vector<Aabb> bounds;
+            if (meshIndex < scene.meshes.size()) {
+                const scene_core::Mesh& mesh = scene.meshes[meshIndex];
+                std::vector<scene_core::Submesh> ranges;
+                if (submeshIndex != InvalidIndex) {
+                    if (submeshIndex < mesh.submeshes.size()) {
+                        ranges.push_back(mesh.submeshes[submeshIndex]);
+                    }
+                } else if (!mesh.submeshes.empty()) {
+                    ranges = mesh.submeshes;
+                } else {
+                    ranges.push_back({ InvalidIndex, 0, static_cast<std::uint32_t>(mesh.indices.size()) });
+                }
+
+                const std::vector<float>& positions = mesh.vertexStreams.positions;
+                const std::size_t vertexCount = positions.size() / 3;
+                auto position = [&](std::uint32_t index) {
+                    return Vec3(positions[3 * index + 0], positions[3 * index + 1], positions[3 * index + 2]);
+                };
+
+                for (const scene_core::Submesh& range : ranges) {
+                    if (IsAlphaCulled(scene, range.materialIndex)) {
+                        continue;
+                    }
+                    const std::uint32_t end = std::min<std::uint32_t>(range.indexOffset + range.indexCount, static_cast<std::uint32_t>(mesh.indices.size()));
+                    for (std::uint32_t first = range.indexOffset; first + 3 <= end; first += 3) {
+                        const std::uint32_t i0 = mesh.indices[first + 0];
+                        const std::uint32_t i1 = mesh.indices[first + 1];
+                        const std::uint32_t i2 = mesh.indices[first + 2];
+                        if (i0 >= vertexCount || i1 >= vertexCount || i2 >= vertexCount) {
+                            continue;
+                        }
+                        const Vec3 p0 = position(i0);
+                        const Vec3 p1 = position(i1);
+                        const Vec3 p2 = position(i2);
+                        triangles.push_back({ p0, p1 - p0, p2 - p0 });
+                        triangleIds.push_back(first / 3);
+                        materials.push_back(range.materialIndex);
+                        Aabb b;
+                        b.Extend(p0);
+                        b.Extend(p1);
+                        b.Extend(p2);
+                        bounds.push_back(b);
+                    }
+                }
+            }
+
+            // Shapes follow the triangles in the build input.
+            std::vector<AnalyticShape> shapes;
+            if (shapeGroupIndex < scene.shapeGroups.size()) {
+                const std::vector<scene_core::Shape>& groupShapes = scene.shapeGroups[shapeGroupIndex].shapes;
+                for (std::uint32_t shapeId = 0; shapeId < groupShapes.size(); ++shapeId) {
+                    const AnalyticShape shape = MakeAnalyticShape(groupShapes[shapeId], shapeId);
+                    if (IsDegenerate(shape) || IsAlphaCulled(scene, shape.materialIndex)) {
+                        continue;
+                    }
+                    shapes.push_back(shape);
+                    bounds.push_back(ShapeBounds(shape));
+                }
+            }
+
+            accel.bvh = BuildBvh(bounds, buildSettings);
+
+            // Reorder primitive data into leaf order so leaves index the arrays directly.
+            const std::uint32_t triangleCount = static_cast<std::uint32_t>(triangles.size());
+            std::vector<Triangle> leafTriangles;
+            std::vector<std::uint32_t> leafTriangleIds;
+            std::vector<std::uint32_t> leafMaterials;
+            std::vector<AnalyticShape> leafShapes;
+            std::vector<std::uint32_t> primRefs;
+            leafTriangles.reserve(triangles.size());
+            leafTriangleIds.reserve(triangles.size());
+            leafMaterials.reserve(triangles.size());
+            leafShapes.reserve(shapes.size());
+            if (!shapes.empty()) {
+                primRefs.reserve(accel.bvh.primIndices.size());
+            }
+            for (const std::uint32_t src : accel.bvh.primIndices) {
+                if (src < triangleCount) {
+                    if (!shapes.empty()) {
+                        primRefs.push_back(static_cast<std::uint32_t>(leafTriangles.size()));
+                    }
+                    leafTriangles.push_back(triangles[src]);
+                    leafTriangleIds.push_back(triangleIds[src]);
+                    leafMaterials.push_back(materials[src]);
+                } else {
+                    primRefs.push_back(static_cast<std::uint32_t>(leafShapes.size()) | AnalyticPrimBit);
+                    leafShapes.push_back(shapes[src - triangleCount]);
+                }
+            }
+            accel.triangles = std::move(leafTriangles);
+            accel.triangleIds = std::move(leafTriangleIds);
+            accel.materialIndices = std::move(leafMaterials);
+            accel.shapes = std::move(leafShapes);
+            accel.primRefs = std::move(primRefs);
+            accel.bvh.primIndices.clear();
+            accel.bvh.primIndices.shrink_to_fit();
+            return accel;
+        }
+
+        PunctualLight MakePunctualLight(const scene_core::Light& light, const Affine3& world, std::uint32_t nodeIndex)
+        {
+            PunctualLight result;
+            result.type = light.type;
+            result.position = world.TransformPoint({});
+            result.direction = Normalize(world.TransformVector({ 0.0f, 0.0f, -1.0f }));
+            result.intensity = ToVec3(light.color) * light.intensity;
+            result.range = light.range;
+            result.cosInnerCone = std::cos(light.innerConeAngleRadians);
+            result.cosOuterCone = std::cos(light.outerConeAngleRadians);
+            result.nodeIndex = nodeIndex;
+            return result;
+        }
+
+        // Position of an accel in the out-of-core file; NoRecord for accels not written there.
+        constexpr std::uint64_t NoRecord = ~std::uint64_t(0);
+
+        bool MapAccelFile(const std::string& path, const std::vector<std::uint64_t>& recordOffsets, std::vector<MeshAccel>& accels)
+        {
+            auto file = std::make_shared<MappedFile>();
+            if (recordOffsets.size() != accels.size() || !file->Open(path, MappedFile::Mode::ReadOnly)) {
+                return false;
+            }
+            for (std::size_t i = 0; i < accels.size(); ++i) {
+                if (recordOffsets[i] != NoRecord && !MapMeshAccel(file, recordOffsets[i], accels[i], accels[i].key)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        std::uint64_t MeshContentHash(const scene_core::Mesh& mesh)
+        {
+            Hasher hasher;
+            hasher.AddSpan(std::span<const float>(mesh.vertexStreams.positions));
+            hasher.AddSpan(std::span<const std::uint32_t>(mesh.indices));
+            return hasher.Value();
+        }
+
+        // Hits look up the mesh's indices by triangle ID, so a cached accel must not point past the mesh.
+        bool TriangleIdsInRange(const scene_core::Scene& scene, std::uint32_t meshIndex, const MeshAccel& accel)
+        {
+            const std::size_t triangleCount = meshIndex < scene.meshes.size() ? scene.meshes[meshIndex].indices.size() / 3 : 0;
+            for (const std::uint32_t id : accel.triangleIds) {
+                if (id >= triangleCount) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // BVH cache key over everything BuildMeshAccel() reads; meshHash is MeshContentHash() of the mesh.
+        std::uint64_t MeshAccelKey(const scene_core::Scene& scene, std::uint64_t meshHash, std::uint32_t meshIndex, std::uint32_t submeshIndex,
+            std::uint32_t shapeGroupIndex, const BvhBuildSettings& buildSettings)
+        {
+            Hasher hasher;
+            hasher.Add(buildSettings.maxLeafSize);
+            hasher.Add(buildSettings.binCount);
+            hasher.Add(buildSettings.traversalCost);
+            hasher.Add(buildSettings.intersectionCost);
+            if (meshIndex < scene.meshes.size()) {
+                hasher.Add(meshHash);
+                hasher.Add(submeshIndex);
+                const std::vector<scene_core::Submesh>& submeshes = scene.meshes[meshIndex].submeshes;
+                hasher.Add(static_cast<std::uint64_t>(submeshes.size()));
+                for (const scene_core::Submesh& range : submeshes) {
+                    hasher.Add(range);
+                    hasher.Add(IsAlphaCulled(scene, range.materialIndex));
+                }
+            } else {
+                hasher.Add(InvalidIndex);
+            }
+            if (shapeGroupIndex < scene.shapeGroups.size()) {
+                const std::vector<scene_core::Shape>& shapes = scene.shapeGroups[shapeGroupIndex].shapes;
+                hasher.Add(static_cast<std::uint64_t>(shapes.size()));
+                for (const scene_core::Shape& shape : shapes) {
+                    hasher.Add(shape);
+                    hasher.Add(IsAlphaCulled(scene, shape.materialIndex));
+                }
+            } else {
+                hasher.Add(InvalidIndex);
+            }
+            return hasher.Value();
+        }
+
+        SceneFeatures ScanSceneFeatures(const RtScene& rtScene)
+        {
+            const scene_core::Scene& scene = *rtScene.source;
+            SceneFeatures features = 0;
+            const Affine3 identity;
+            for (const Instance& instance : rtScene.topLevel.instances) {
+                if (instance.objectToWorld.m != identity.m) {
+                    features |= SceneFeatureInstanceTransforms;
+                }
+            }
+            for (const MeshAccel& accel : rtScene.meshAccels) {
+                if (!accel.shapes.empty()) {
+                    features |= SceneFeatureAnalyticShapes;
+                }
+            }
+            for (const scene_core::MaterialPBR& material : scene.materials) {
+                if (material.baseColorTextureIndex != InvalidIndex || material.normalTextureIndex != InvalidIndex ||
+                    material.emissiveTextureIndex != InvalidIndex) {
+                    features |= SceneFeatureTextures;
+                }
+                if (MaxComponent(ToVec3(material.emissiveFactor)) > 0.0f) {
+                    features |= SceneFeatureEmission;
+                }
+            }
+            if (!rtScene.lights.empty()) {
+                features |= SceneFeaturePunctualLights;
+            }
+            return features;
+        }
+
+        CameraView MakeDefaultCamera(const Aabb& bounds)
+        {
+            CameraView camera;
+            if (bounds.IsEmpty()) {
+                return camera;
+            }
+            const Vec3 center = bounds.Centroid();
+            const float radius = 0.5f * Length(bounds.Extent());
+            const float distance = radius / std::tan(0.5f * camera.verticalFovRadians) * 1.1f;
+            camera.cameraToWorld.m[3] = center.x;
+            camera.cameraToWorld.m[7] = center.y;
+            camera.cameraToWorld.m[11] = center.z + std::max(distance, 1e-3f);
+            return camera;
+        }
+    }
+
+    std::vector<Affine3> ComputeWorldTransforms(const scene_core::Scene& scene, std::vector<std::uint32_t>& traversalOrder)
+    {
+        const std::size_t nodeCount = scene.nodes.size();
+        std::vector<Affine3> world(nodeCount);
+
+        std::vector<std::uint32_t> roots;
+        if (scene.rootNode < nodeCount) {
+            roots.push_back(scene.rootNode);
+        } else {
+            std::vector<bool> isChild(nodeCount, false);
+            for (const scene_core::Node& node : scene.nodes) {
+                for (std::uint32_t child : node.children) {
+                    if (child < nodeCount) {
+                        isChild[child] = true;
+                    }
+                }
+            }
+            for (std::uint32_t i = 0; i < nodeCount; ++i) {
+                if (!isChild[i]) {
+                    roots.push_back(i);
+                }
+            }
+        }
+
+        std::vector<bool> visited(nodeCount, false);
+        std::vector<std::pair<std::uint32_t, Affine3>> stack;
+        for (auto it = roots.rbegin(); it != roots.rend(); ++it) {
+            stack.push_back({ *it, Affine3{} });
+        }
+        while (!stack.empty()) {
+            auto [nodeIndex, parent] = stack.back();
+            stack.pop_back();
+            if (visited[nodeIndex]) {
+                continue;
+            }
+            visited[nodeIndex] = true;
+            traversalOrder.push_back(nodeIndex);
+
+            const scene_core::Node& node = scene.nodes[nodeIndex];
+            const scene_core::Transform& local = node.localTransform;
+            world[nodeIndex] = parent * MakeAffine(local.translation, local.rotation, local.scale);
+            for (auto child = node.children.rbegin(); child != node.children.rend(); ++child) {
+                if (*child < nodeCount) {
+                    stack.push_back({ *child, world[nodeIndex] });
+                }
+            }
+        }
+        return world;
+    }
+
+    RtScene BuildRtScene(const scene_core::Scene& scene, const BvhBuildSettings& buildSettings, const AccelStorageSettings& storage)
+    {
+        RtScene result;
+        result.source = &scene;
+
+        // Out of core, each accel moves to the file as soon as it is built, so only one is in memory at a time.
+        AccelFileWriter accelFile;
+        bool outOfCore = !storage.outOfCorePath.empty() && accelFile.Open(storage.outOfCorePath);
+        std::vector<std::uint64_t> recordOffsets;
+
+        // Content hashes of the meshes, computed on first use.
+        std::map<std::uint32_t, std::uint64_t> meshHashes;
+        auto accelKey = [&](std::uint32_t meshIndex, std::uint32_t submeshIndex, std::uint32_t shapeGroupIndex) {
+            std::uint64_t meshHash = 0;
+            if (meshIndex < scene.meshes.size()) {
+                auto it = meshHashes.find(meshIndex);
+                if (it == meshHashes.end()) {
+                    it = meshHashes.emplace(meshIndex, MeshContentHash(scene.meshes[meshIndex])).first;
+                }
+                meshHash = it->second;
+            }
+            return MeshAccelKey(scene, meshHash, meshIndex, submeshIndex, shapeGroupIndex, buildSettings);
+        };
+        auto loadOrBuild = [&](std::uint32_t meshIndex, std::uint32_t submeshIndex, std::uint32_t shapeGroupIndex) {
+            const std::uint64_t key = accelKey(meshIndex, submeshIndex, shapeGroupIndex);
+            MeshAccel accel;
+            if (!storage.cacheDirectory.empty() && LoadCachedMeshAccel(storage.cacheDirectory, key, accel) && TriangleIdsInRange(scene, meshIndex, accel)) {
+                // The cached accel may have been built for equal geometry elsewhere in the scene.
+                accel.meshIndex = meshIndex;
+                accel.submeshIndex = submeshIndex;
+                accel.shapeGroupIndex = shapeGroupIndex;
+                return accel;
+            }
+            accel = BuildMeshAccel(scene, meshIndex, submeshIndex, shapeGroupIndex, buildSettings);
+            accel.key = key;
+            if (!storage.cacheDirectory.empty()) {
+                StoreCachedMeshAccel(storage.cacheDirectory, key, accel);
+            }
+            return accel;
+        };
+
+        // Accels that stay in memory move to the arena as soon as they are built, so at most one of them is
+        // on the heap at a time. Traversal of the top-level BVH is cheap and it is copied per NUMA node, so
+        // it stays on the heap.
+        const std::shared_ptr<AccelArena> arena = storage.useArena ? std::make_shared<AccelArena>() : nullptr;
+        auto keepInMemory = [&](MeshAccel& accel) {
+            if (arena && !accel.bvh.nodes.IsMapped()) {
+                MoveToArena(*arena, arena, accel);
+            }
+        };
+
+        std::vector<std::uint32_t> traversalOrder;
+        const std::vector<Affine3> world = ComputeWorldTransforms(scene, traversalOrder);
+
+        std::map<std::tuple<std::uint32_t, std::uint32_t, std::uint32_t>, std::uint32_t> accelByGeometry;
+        bool hasCamera = false;
+        for (std::uint32_t nodeIndex : traversalOrder) {
+            const scene_core::Node& node = scene.nodes[nodeIndex];
+
+            const bool hasMesh = node.mesh.meshIndex < scene.meshes.size();
+            const bool hasShapes = node.shapeGroupIndex < scene.shapeGroups.size();
+            if (hasMesh || hasShapes) {
+                // A node's mesh and shapes share one accel, so its leaves may mix both.
+                const auto key = std::make_tuple(
+                    hasMesh ? node.mesh.meshIndex : InvalidIndex,
+                    hasMesh ? node.mesh.submeshIndex : InvalidIndex,
+                    hasShapes ? node.shapeGroupIndex : InvalidIndex);
+                auto it = accelByGeometry.find(key);
+                if (it == accelByGeometry.end()) {
+                    it = accelByGeometry.emplace(key, static_cast<std::uint32_t>(result.meshAccels.size())).first;
+                    result.meshAccels.push_back(loadOrBuild(std::get<0>(key), std::get<1>(key), std::get<2>(key)));
+                    MeshAccel& accel = result.meshAccels.back();
+                    recordOffsets.push_back(NoRecord);
+                    // Accels mapped from the cache are out of core already.
+                    if (outOfCore && !accel.bvh.nodes.IsMapped()) {
+                        outOfCore = accelFile.Append(accel, recordOffsets.back(), accel.key);
+                        if (outOfCore) {
+                            const std::uint64_t contentKey = accel.key;
+                            accel = {};
+                            accel.key = contentKey;
+                        }
+                    }
+                    if (!outOfCore) {
+                        keepInMemory(accel);
+                    }
+                }
+                // Instances of empty accels are removed once all accels are in place.
+                Instance instance;
+                instance.objectToWorld = world[nodeIndex];
+                instance.worldToObject = Inverse(world[nodeIndex]);
+                instance.meshAccelIndex = it->second;
+                instance.nodeIndex = nodeIndex;
+                result.topLevel.instances.push_back(instance);
+            }
+
+            if (node.lightIndex < scene.lights.size()) {
+                result.lights.push_back(MakePunctualLight(scene.lights[node.lightIndex], world[nodeIndex], nodeIndex));
+            }
+
+            if (!hasCamera && node.cameraIndex < scene.cameras.size()) {
+                result.camera.cameraToWorld = world[nodeIndex];
+                result.camera.verticalFovRadians = scene.cameras[node.cameraIndex].verticalFovRadians;
+                hasCamera = true;
+            }
+        }
+
+        if (!storage.outOfCorePath.empty()) {
+            outOfCore = accelFile.Close() && MapAccelFile(storage.outOfCorePath, recordOffsets, result.meshAccels);
+            if (!outOfCore) {
+                // Rebuild in memory whatever was written before the file failed.
+                for (const auto& [key, accelIndex] : accelByGeometry) {
+                    MeshAccel& accel = result.meshAccels[accelIndex];
+                    if (!accel.bvh.nodes.IsMapped() && accel.bvh.nodes.empty()) {
+                        accel = BuildMeshAccel(scene, std::get<0>(key), std::get<1>(key), std::get<2>(key), buildSettings);
+                        accel.key = accelKey(std::get<0>(key), std::get<1>(key), std::get<2>(key));
+                        keepInMemory(accel);
+                    }
+                }
+            }
+        }
+        for (const MeshAccel& accel : result.meshAccels) {
+            result.outOfCore = result.outOfCore || accel.bvh.nodes.IsMapped();
+        }
+        if (arena && arena->UsedBytes() != 0) {
+            result.accelArena = arena;
+        }
+        std::erase_if(result.topLevel.instances, [&](const Instance& instance) {
+            return result.meshAccels[instance.meshAccelIndex].IsEmpty();
+        });
+
+        std::vector<Aabb> instanceBounds;
+        instanceBounds.reserve(result.topLevel.instances.size());
+        for (const Instance& instance : result.topLevel.instances) {
+            instanceBounds.push_back(TransformAabb(instance.objectToWorld, result.meshAccels[instance.meshAccelIndex].bvh.Bounds()));
+            result.bounds.Extend(instanceBounds.back());
+        }
+        BvhBuildSettings topLevelSettings = buildSettings;
+        topLevelSettings.maxLeafSize = 1;
+        result.topLevel.bvh = BuildBvh(instanceBounds, topLevelSettings);
+
+        if (!hasCamera) {
+            result.camera = MakeDefaultCamera(result.bounds);
+        }
+        result.features = ScanSceneFeatures(result);
+        return result;
+    }
+
+    void UpdateRtSceneShading(RtScene& rtScene)
+    {
+        const scene_core::Scene& scene = *rtScene.source;
+        for (PunctualLight& light : rtScene.lights) {
+            const std::uint32_t lightIndex = scene.nodes[light.nodeIndex].lightIndex;
+            if (lightIndex >= scene.lights.size()) {
+                light.intensity = {};
+                continue;
+            }
+            // Transforms are unchanged, so the world-space frame of the light is kept.
+            const Vec3 position = light.position;
+            const Vec3 direction = light.direction;
+            light = MakePunctualLight(scene.lights[lightIndex], Affine3(), light.nodeIndex);
+            light.position = position;
+            light.direction = direction;
+        }
+        rtScene.features = ScanSceneFeatures(rtScene);
+    }
+
+    bool Intersect(const RtScene& scene, const TopLevelAccel& topLevel, const Ray& ray, Hit& hit)
+    {
+        return Intersect<AllSceneFeatures>(scene, topLevel, ray, hit);
+    }
+
+    bool Occluded(const RtScene& scene, const TopLevelAccel& topLevel, const Ray& ray)
+    {
+        return Occluded<AllSceneFeatures>(scene, topLevel, ray);
+    }
+
+    SurfaceHit MakeSurfaceHit(const RtScene& scene, const TopLevelAccel& topLevel, const Hit& hit)
+    {
+        return MakeSurfaceHit<AllSceneFeatures>(scene, topLevel, hit);
+    }
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../scene-core/scene.h"
+#include "cpu_rt_arena.h"
+#include "cpu_rt_bvh.h"
+#include "cpu_rt_features.h"
+#include "cpu_rt_math.h"
+#include "cpu_rt_shapes.h"
+
+namespace cpu_rt
+{
+    using scene_core::InvalidIndex;
+
+    // Triangle with precomputed edges for Moller-Trumbore.
+    struct Triangle
+    {
+        Vec3 v0;
+        Vec3 e1;
+        Vec3 e2;
+    };
+
+    // Set in a primitive reference for entries of MeshAccel::shapes.
+    inline constexpr std::uint32_t AnalyticPrimBit = 0x80000000u;
+
+    // Bottom-level acceleration structure for the geometry of a node: a scene_core::MeshRef and/or a
+    // scene_core::ShapeGroup, in object space. Triangles and analytic shapes share the BVH and its leaves.
+    // Primitive arrays are stored in BVH leaf order and bvh.primIndices is empty. The arrays are owned, or
+    // mapped from a file for out-of-core scenes (see AccelStorageSettings). Leaves of triangle-only
+    // accels index the triangle arrays directly; otherwise primRefs maps each leaf slot to a triangle
+    // index or to a shape index with AnalyticPrimBit set.
+    struct MeshAccel
+    {
+        std::uint32_t meshIndex = InvalidIndex;
+        std::uint32_t submeshIndex = InvalidIndex;
+        std::uint32_t shapeGroupIndex = InvalidIndex;
+        // Hash of everything the accel was built from (geometry, alpha culling, build settings), also the
+        // BVH cache key. Identifies the contents without reading the arrays, which may be mapped from disk.
+        std::uint64_t key = 0;
+        Bvh bvh;
+        MappedArray<Triangle> triangles;
+        // Triangle index into scene_core::Mesh::indices (first index at 3 * id).
+        MappedArray<std::uint32_t> triangleIds;
+        MappedArray<std::uint32_t> materialIndices;
+        MappedArray<AnalyticShape> shapes;
+        MappedArray<std::uint32_t> primRefs;
+
+        std::uint32_t PrimRef(std::uint32_t leafSlot) const { return primRefs.empty() ? leafSlot : primRefs[leafSlot]; }
+        bool IsEmpty() const { return triangles.empty() && shapes.empty(); }
+    };
+
+    struct Instance
+    {
+        Affine3 objectToWorld;
+        Affine3 worldToObject;
+        std::uint32_t meshAccelIndex = InvalidIndex;
+        std::uint32_t nodeIndex = InvalidIndex;
+    };
+
+    // Top-level acceleration structure over instances, in world space.
+    struct TopLevelAccel
+    {
+        Bvh bvh;
+        std::vector<Instance> instances;
+    };
+
+    struct PunctualLight
+    {
+        scene_core::LightType type = scene_core::LightType::Directional;
+        Vec3 position;
+        // Direction the light travels in (world space).
+        Vec3 direction = { 0.0f, 0.0f, -1.0f };
+        // color * intensity.
+        Vec3 intensity = Vec3(1.0f);
+        float range = 0.0f;
+        float cosInnerCone = 1.0f;
+        float cosOuterCone = 0.0f;
+        std::uint32_t nodeIndex = InvalidIndex;
+    };
+
+    // Camera looking down -Z in its local frame, +Y up.
+    struct CameraView
+    {
+        Affine3 cameraToWorld;
+        float verticalFovRadians = 0.78539816339f;
+    };
+
+    // Primary ray through a film position given in [0, 1]^2, origin at the top-left corner.
+    inline Ray GenerateCameraRay(const CameraView& camera, float filmX, float filmY, float aspect)
+    {
+        const float tanHalfFov = std::tan(0.5f * camera.verticalFovRadians);
+        const Vec3 d = {
+            (2.0f * filmX - 1.0f) * tanHalfFov * aspect,
+            (1.0f - 2.0f * filmY) * tanHalfFov,
+            -1.0f,
+        };
+        Ray ray;
+        ray.origin = camera.cameraToWorld.TransformPoint({});
+        ray.direction = Normalize(camera.cameraToWorld.TransformVector(d));
+        return ray;
+    }
+
+    // Film position hit by a camera-space direction, the inverse of GenerateCameraRay().
+    // Returns false for directions that do not point in front of the camera.
+    inline bool CameraDirectionToFilm(const CameraView& camera, const Vec3& d, float aspect, float& filmX, float& filmY)
+    {
+        if (!(d.z < 0.0f)) {
+            return false;
+        }
+        const float tanHalfFov = std::tan(0.5f * camera.verticalFovRadians);
+        filmX = 0.5f * (d.x / (-d.z * tanHalfFov * aspect) + 1.0f);
+        filmY = 0.5f * (1.0f - d.y / (-d.z * tanHalfFov));
+        return true;
+    }
+
+    struct Hit
+    {
+        float t = Infinity;
+        float u = 0.0f;
+        float v = 0.0f;
+        std::uint32_t instanceIndex = InvalidIndex;
+        // MeshAccel primitive reference: triangle index, or shape index with AnalyticPrimBit set.
+        std::uint32_t primIndex = InvalidIndex;
+
+        bool IsValid() const { return instanceIndex != InvalidIndex; }
+    };
+
+    struct SurfaceHit
+    {
+        Vec3 position;
+        Vec3 geometricNormal;
+        Vec3 shadingNormal;
+        float texcoord[2] = { 0.0f, 0.0f };
+        std::uint32_t materialIndex = InvalidIndex;
+        std::uint32_t nodeIndex = InvalidIndex;
+    };
+
+    // Render-ready view of a scene_core::Scene: world-space instances over shared per-geometry BVHs,
+    // world-space punctual lights and the active camera.
+    // Shading reads vertex attributes from the source scene, which must outlive this object.
+    struct RtScene
+    {
+        const scene_core::Scene* source = nullptr;
+        std::vector<MeshAccel> meshAccels;
+        TopLevelAccel topLevel;
+        std::vector<PunctualLight> lights;
+        CameraView camera;
+        Aabb bounds;
+        // Features used by this scene; selects the specialized render kernels.
+        SceneFeatures features = AllSceneFeatures;
+        // Some bottom-level accels are mapped from files, the out-of-core file or the BVH cache.
+        bool outOfCore = false;
+        // Holds the in-memory bottom-level accel arrays when AccelStorageSettings::useArena is set.
+        std::shared_ptr<const AccelArena> accelArena;
+    };
+
+    struct AccelStorageSettings
+    {
+        // When set, each bottom-level accel is written to this file right after it is built and rendering
+        // reads a read-only mapping of it, so geometry is paged in on demand and can be evicted again under
+        // memory pressure. The file is overwritten and must stay in place while the scene is in use. If it
+        // cannot be written, the accels are kept in memory.
+        std::string outOfCorePath;
+        // When set, accels are cached in this directory under a hash of their build inputs (vertex positions,
+        // indices, submesh ranges, shapes, alpha culling and BVH settings) and later runs map unchanged ones
+        // from there instead of rebuilding them. Cached accels are read from the cache files directly.
+        std::string cacheDirectory;
+        // Upper bound of geometry the renderer asks the OS to read ahead for the next tile; 0 disables it.
+        std::size_t tilePrefetchBytes = std::size_t(64) << 20;
+        // Move the bottom-level accels that stay in memory into one huge-page backed AccelArena as each is
+        // built, which is released as a whole with the scene. Otherwise each array is a separate heap allocation.
+        bool useArena = true;
+    };
+
+    // Object-to-world transform of every node, walking the hierarchy from Scene::rootNode, or from every
+    // node that is no child if there is no root. traversalOrder receives the reached nodes in depth-first
+    // order; nodes not reached keep the identity.
+    std::vector<Affine3> ComputeWorldTransforms(const scene_core::Scene& scene, std::vector<std::uint32_t>& traversalOrder);
+
+    RtScene BuildRtScene(const scene_core::Scene& scene, const BvhBuildSettings& buildSettings = {}, const AccelStorageSettings& storage = {});
+
+    // Re-read light colors, intensities, ranges and cones and the material-dependent scene features after
+    // edits of the source scene that leave geometry, transforms, alpha masking and the set of lights as they are.
+    void UpdateRtSceneShading(RtScene& rtScene);
+
+    // Closest hit along the ray within [tMin, tMax].
+    bool Intersect(const RtScene& scene, const TopLevelAccel& topLevel, const Ray& ray, Hit& hit);
+
+    // Any hit along the ray within [tMin, tMax].
+    bool Occluded(const RtScene& scene, const TopLevelAccel& topLevel, const Ray& ray);
+
+    SurfaceHit MakeSurfaceHit(const RtScene& scene, const TopLevelAccel& topLevel, const Hit& hit);
+}
@@ -0,0 +1,559 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "cpu_rt.h"
+#include "cpu_rt_accel_file.h"
+#include "cpu_rt_distributed.h"
+#include "cpu_rt_serialize.h"
+
+namespace
+{
+    void AppendSphere(scene_core::Mesh& mesh, float cx, float cy, float cz, float radius, std::uint32_t rings)
+    {
+        const std::uint32_t base = static_cast<std::uint32_t>(mesh.vertexStreams.positions.size() / 3);
+        const std::uint32_t segments = 2 * rings;
+        for (std::uint32_t i = 0; i <= rings; ++i) {
+            const float theta = 3.14159265f * static_cast<float>(i) / static_cast<float>(rings);
+            for (std::uint32_t j = 0; j <= segments; ++j) {
+                const float phi = 6.28318531f * static_cast<float>(j) / static_cast<float>(segments);
+                const float n[3] = { std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi) };
+                mesh.vertexStreams.positions.insert(mesh.vertexStreams.positions.end(), { cx + radius * n[0], cy + radius * n[1], cz + radius * n[2] });
+                mesh.vertexStreams.normals.insert(mesh.vertexStreams.normals.end(), { n[0], n[1], n[2] });
+            }
+        }
+        for (std::uint32_t i = 0; i < rings; ++i) {
+            for (std::uint32_t j = 0; j < segments; ++j) {
+                const std::uint32_t a = base + i * (segments + 1) + j;
+                const std::uint32_t b = a + segments + 1;
+                mesh.indices.insert(mesh.indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+            }
+        }
+    }
+
+    void AppendWall(scene_core::Mesh& mesh, float halfSize, float z)
+    {
+        const std::uint32_t base = static_cast<std::uint32_t>(mesh.vertexStreams.positions.size() / 3);
+        mesh.vertexStreams.positions.insert(mesh.vertexStreams.positions.end(),
+            { -halfSize, -halfSize, z, halfSize, -halfSize, z, halfSize, halfSize, z, -halfSize, halfSize, z });
+        for (int i = 0; i < 4; ++i) {
+            mesh.vertexStreams.normals.insert(mesh.vertexStreams.normals.end(), { 0.0f, 0.0f, 1.0f });
+        }
+        mesh.indices.insert(mesh.indices.end(), { base, base + 1, base + 2, base, base + 2, base + 3 });
+    }
+
+    // A 3x3 grid of tessellated spheres, one mesh each, in front of a wall with two analytic spheres, lit
+    // by a directional light. Sphere accels span several pages, so accel files store them with clustered
+    // nodes; the wall accel mixes triangles and shapes, so it has primitive references.
+    scene_core::Scene MakeCheckScene()
+    {
+        constexpr std::uint32_t GridSize = 3;
+        scene_core::Scene scene;
+        scene.name = "selfcheck";
+        scene_core::MaterialPBR diffuse;
+        diffuse.metallicFactor = 0.0f;
+        scene.materials.push_back(diffuse);
+        scene_core::MaterialPBR metal;
+        metal.metallicFactor = 1.0f;
+        metal.roughnessFactor = 0.3f;
+        scene.materials.push_back(metal);
+
+        scene_core::Node root;
+        scene.nodes.push_back(root);
+        for (std::uint32_t i = 0; i <= GridSize * GridSize; ++i) {
+            scene_core::Mesh mesh;
+            if (i < GridSize * GridSize) {
+                const float x = static_cast<float>(i % GridSize) - 0.5f * (GridSize - 1);
+                const float y = static_cast<float>(i / GridSize) - 0.5f * (GridSize - 1);
+                AppendSphere(mesh, x, y, 0.0f, 0.45f, 24);
+            } else {
+                AppendWall(mesh, 0.5f * GridSize + 1.0f, -1.0f);
+            }
+            mesh.submeshes.push_back({ i % 2, 0, static_cast<std::uint32_t>(mesh.indices.size()) });
+            scene.meshes.push_back(std::move(mesh));
+
+            scene_core::Node node;
+            node.mesh = { i, scene_core::InvalidIndex };
+            if (i == GridSize * GridSize) {
+                node.shapeGroupIndex = 0;
+            }
+            scene.nodes[0].children.push_back(static_cast<std::uint32_t>(scene.nodes.size()));
+            scene.nodes.push_back(node);
+        }
+
+        scene_core::ShapeGroup shapes;
+        for (const float x : { -1.0f, 1.0f }) {
+            scene_core::Shape shape;
+            shape.transform.translation = { x * (0.5f * GridSize + 0.5f), 0.5f * GridSize + 0.5f, -0.5f };
+            shape.radius = 0.3f;
+            shape.materialIndex = 1;
+            shapes.shapes.push_back(shape);
+        }
+        scene.shapeGroups.push_back(std::move(shapes));
+
+        scene_core::Light light;
+        light.intensity = 3.0f;
+        scene.lights.push_back(light);
+        scene_core::Node lightNode;
+        lightNode.lightIndex = 0;
+        lightNode.localTransform.rotation = { 0.2f, -0.2f, 0.0f, 0.96f };
+        scene.nodes[0].children.push_back(static_cast<std::uint32_t>(scene.nodes.size()));
+        scene.nodes.push_back(lightNode);
+        scene.rootNode = 0;
+        return scene;
+    }
+
+    cpu_rt::RenderSettings MakeCheckSettings()
+    {
+        cpu_rt::RenderSettings settings;
+        settings.width = 96;
+        settings.height = 64;
+        settings.tileSize = 16;
+        settings.samplesPerPixel = 4;
+        settings.seed = 11;
+        settings.aovs = cpu_rt::AovAlbedo | cpu_rt::AovDepth | cpu_rt::AovNodeId;
+        return settings;
+    }
+
+    bool SameImage(const cpu_rt::RenderOutput& a, const cpu_rt::RenderOutput& b)
+    {
+        return a.width == b.width && a.height == b.height && a.radiance == b.radiance && a.aovPlanes == b.aovPlanes && a.nodeIds == b.nodeIds &&
+            a.materialIds == b.materialIds;
+    }
+
+    // Scratch directory, removed when the checks are done.
+    struct Context
+    {
+        std::filesystem::path directory;
+    };
+
+    // A render stopped after N samples and resumed from its checkpoint must match an uninterrupted one.
+    bool CheckCheckpointResume(const Context& context)
+    {
+        const scene_core::Scene scene = MakeCheckScene();
+        const cpu_rt::RenderSettings settings = MakeCheckSettings();
+        const std::string path = (context.directory / "resume.ckp").string();
+
+        cpu_rt::RenderOutput reference;
+        {
+            cpu_rt::Renderer renderer(settings);
+            renderer.SetScene(scene);
+            renderer.RenderSamples(settings.samplesPerPixel);
+            renderer.RenderSamples(settings.samplesPerPixel);
+            reference = renderer.Resolve();
+        }
+        {
+            cpu_rt::Renderer renderer(settings);
+            renderer.SetScene(scene);
+            if (!renderer.OpenCheckpoint(path)) {
+                std::fprintf(stderr, "  cannot open checkpoint %s\n", path.c_str());
+                return false;
+            }
+            renderer.RenderSamples(settings.samplesPerPixel);
+            renderer.CloseCheckpoint();
+        }
+
+        cpu_rt::Renderer renderer(settings);
+        renderer.SetScene(scene);
+        if (!renderer.OpenCheckpoint(path) || renderer.GetAccumulatedSamples() != settings.samplesPerPixel) {
+            std::fprintf(stderr, "  checkpoint resumed at %u samples, expected %u\n", renderer.GetAccumulatedSamples(), settings.samplesPerPixel);
+            return false;
+        }
+        renderer.RenderSamples(settings.samplesPerPixel);
+        renderer.CloseCheckpoint();
+        if (!SameImage(renderer.Resolve(), reference)) {
+            std::fprintf(stderr, "  resumed image differs from the uninterrupted render\n");
+            return false;
+        }
+        return true;
+    }
+
+    // A frame rendered by worker threads over a loopback connection must match a local render.
+    bool CheckDistributedLoopback(const Context& context)
+    {
+        const scene_core::Scene scene = MakeCheckScene();
+        const cpu_rt::RenderSettings settings = MakeCheckSettings();
+        cpu_rt::DistributedSettings distributed;
+#if defined(_WIN32)
+        distributed.address = "127.0.0.1:47878";
+#else
+        distributed.address = "unix:" + (context.directory / "coordinator.sock").string();
+#endif
+        distributed.tilesPerBatch = 2;
+        distributed.idleTimeoutSeconds = 10;
+
+        // Two workers, so tiles from both are merged. They retry until the coordinator listens.
+        std::atomic<bool> coordinatorDone = false;
+        std::vector<std::thread> workers;
+        for (int i = 0; i < 2; ++i) {
+            workers.emplace_back([&]() {
+                cpu_rt::ThreadingSettings threading;
+                threading.threadCount = 2;
+                while (!coordinatorDone && !cpu_rt::RunRenderWorker(distributed.address, threading)) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                }
+            });
+        }
+        cpu_rt::RenderOutput output;
+        const bool rendered = cpu_rt::RenderDistributed(scene, settings, distributed, output);
+        coordinatorDone = true;
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        if (!rendered) {
+            std::fprintf(stderr, "  distributed render on %s failed\n", distributed.address.c_str());
+            return false;
+        }
+        if (!SameImage(output, cpu_rt::Render(scene, settings))) {
+            std::fprintf(stderr, "  distributed image differs from the local render\n");
+            return false;
+        }
+        return true;
+    }
+
+    template<typename T>
+    bool SameArray(const cpu_rt::MappedArray<T>& a, const cpu_rt::MappedArray<T>& b)
+    {
+        return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+    }
+
+    // Same tree, compared node by node from the root, so node clustering in accel files does not matter.
+    bool SameTree(const cpu_rt::Bvh& a, const cpu_rt::Bvh& b)
+    {
+        if (a.nodes.empty() || b.nodes.empty()) {
+            return a.nodes.empty() && b.nodes.empty();
+        }
+        std::vector<std::pair<std::uint32_t, std::uint32_t>> stack = { { 0, 0 } };
+        while (!stack.empty()) {
+            const cpu_rt::BvhNode& nodeA = a.nodes[stack.back().first];
+            const cpu_rt::BvhNode& nodeB = b.nodes[stack.back().second];
+            stack.pop_back();
+            if (std::memcmp(&nodeA.boundsMin, &nodeB.boundsMin, sizeof(cpu_rt::Vec3)) != 0 ||
+                std::memcmp(&nodeA.boundsMax, &nodeB.boundsMax, sizeof(cpu_rt::Vec3)) != 0 || nodeA.primCount != nodeB.primCount) {
+                return false;
+            }
+            if (nodeA.IsLeaf()) {
+                if (nodeA.leftOrFirst != nodeB.leftOrFirst) {
+                    return false;
+                }
+                continue;
+            }
+            stack.push_back({ nodeA.leftOrFirst, nodeB.leftOrFirst });
+            stack.push_back({ nodeA.leftOrFirst + 1, nodeB.leftOrFirst + 1 });
+        }
+        return true;
+    }
+
+    bool SameAccel(const cpu_rt::MeshAccel& a, const cpu_rt::MeshAccel& b)
+    {
+        return a.key == b.key && SameTree(a.bvh, b.bvh) && SameArray(a.triangles, b.triangles) && SameArray(a.triangleIds, b.triangleIds) &&
+            SameArray(a.materialIndices, b.materialIndices) && SameArray(a.shapes, b.shapes) && SameArray(a.primRefs, b.primRefs);
+    }
+
+    // Closest hits of a grid of camera rays; a miss has an invalid instance index.
+    std::vector<cpu_rt::Hit> TraceGrid(const cpu_rt::RtScene& scene)
+    {
+        constexpr std::uint32_t GridSize = 64;
+        std::vector<cpu_rt::Hit> hits(GridSize * GridSize);
+        for (std::uint32_t y = 0; y < GridSize; ++y) {
+            for (std::uint32_t x = 0; x < GridSize; ++x) {
+                const float filmX = (static_cast<float>(x) + 0.5f) / GridSize;
+                const float filmY = (static_cast<float>(y) + 0.5f) / GridSize;
+                cpu_rt::Intersect(scene, scene.topLevel, cpu_rt::GenerateCameraRay(scene.camera, filmX, filmY, 1.0f), hits[y * GridSize + x]);
+            }
+        }
+        return hits;
+    }
+
+    bool SameHits(const std::vector<cpu_rt::Hit>& a, const std::vector<cpu_rt::Hit>& b)
+    {
+        return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(cpu_rt::Hit)) == 0;
+    }
+
+    // Accels stored in the BVH cache and mapped back must have the same trees, arrays and hits as the
+    // in-memory build.
+    bool CheckAccelCacheRoundTrip(const Context& context)
+    {
+        const scene_core::Scene scene = MakeCheckScene();
+        cpu_rt::AccelStorageSettings storage;
+        storage.cacheDirectory = (context.directory / "bvh-cache").string();
+
+        const cpu_rt::RtScene built = cpu_rt::BuildRtScene(scene);
+        // The first build stores every accel, the second maps all of them from the cache.
+        cpu_rt::BuildRtScene(scene, {}, storage);
+        const cpu_rt::RtScene mapped = cpu_rt::BuildRtScene(scene, {}, storage);
+        if (built.meshAccels.size() != mapped.meshAccels.size()) {
+            std::fprintf(stderr, "  %zu accels built, %zu mapped\n", built.meshAccels.size(), mapped.meshAccels.size());
+            return false;
+        }
+        for (std::size_t i = 0; i < built.meshAccels.size(); ++i) {
+            if (!mapped.meshAccels[i].bvh.nodes.IsMapped()) {
+                std::fprintf(stderr, "  accel %zu was not mapped from the cache\n", i);
+                return false;
+            }
+            if (!SameAccel(built.meshAccels[i], mapped.meshAccels[i])) {
+                std::fprintf(stderr, "  accel %zu differs after the cache round trip\n", i);
+                return false;
+            }
+        }
+        if (!SameHits(TraceGrid(built), TraceGrid(mapped))) {
+            std::fprintf(stderr, "  hits differ after the cache round trip\n");
+            return false;
+        }
+        return true;
+    }
+
+    std::vector<char> ReadFile(const std::filesystem::path& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    // Replace the file by renaming a new one over it, like the cache does, so scenes still mapping the old
+    // contents are unaffected.
+    bool ReplaceFile(const std::filesystem::path& path, const std::vector<char>& bytes)
+    {
+        std::filesystem::path temporary = path;
+        temporary += ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+            if (!file.good()) {
+                return false;
+            }
+        }
+        std::error_code error;
+        std::filesystem::rename(temporary, path, error);
+        return !error;
+    }
+
+    // Byte offset of a mapped array in its single-record cache file: the nodes follow the 64-byte header.
+    template<typename T>
+    std::size_t FileOffset(const cpu_rt::MeshAccel& accel, const cpu_rt::MappedArray<T>& array)
+    {
+        return 64 + static_cast<std::size_t>(reinterpret_cast<const char*>(array.data()) - reinterpret_cast<const char*>(accel.bvh.nodes.data()));
+    }
+
+    // Cache records whose nodes or primitive references point out of range must be rejected when mapped.
+    // Triangle IDs past the mesh are caught when BuildRtScene() checks the mapped accel against the scene.
+    // Either way it must rebuild the accel and replace the record.
+    bool CheckCorruptCacheRecord(const Context& context)
+    {
+        const scene_core::Scene scene = MakeCheckScene();
+        cpu_rt::AccelStorageSettings storage;
+        storage.cacheDirectory = (context.directory / "corrupt-cache").string();
+        const cpu_rt::RtScene reference = cpu_rt::BuildRtScene(scene, {}, storage);
+
+        // A clustered sphere accel and the wall accel, which has primitive references.
+        const cpu_rt::MeshAccel* sphere = &reference.meshAccels.front();
+        const cpu_rt::MeshAccel* wall = nullptr;
+        for (const cpu_rt::MeshAccel& accel : reference.meshAccels) {
+            wall = accel.primRefs.empty() ? wall : &accel;
+        }
+        if (wall == nullptr || !sphere->bvh.nodes.IsMapped() || !wall->bvh.nodes.IsMapped()) {
+            std::fprintf(stderr, "  the scene was not cached as expected\n");
+            return false;
+        }
+        std::uint32_t sphereLeaf = 0;
+        while (!sphere->bvh.nodes[sphereLeaf].IsLeaf()) {
+            sphereLeaf++;
+        }
+
+        struct Corruption
+        {
+            const char* what;
+            const cpu_rt::MeshAccel* accel;
+            std::size_t offset;
+            std::uint32_t value;
+            bool rejectedByMap;
+        };
+        constexpr std::size_t LeftOrFirst = offsetof(cpu_rt::BvhNode, leftOrFirst);
+        constexpr std::size_t PrimCount = offsetof(cpu_rt::BvhNode, primCount);
+        const Corruption corruptions[] = {
+            { "child index past the nodes", sphere, FileOffset(*sphere, sphere->bvh.nodes) + LeftOrFirst, 0xfffffff0u, true },
+            { "child cycle to the root", sphere, FileOffset(*sphere, sphere->bvh.nodes) + LeftOrFirst, 0, true },
+            { "leaf range past the triangles", sphere, FileOffset(*sphere, sphere->bvh.nodes) + sphereLeaf * sizeof(cpu_rt::BvhNode) + PrimCount,
+                0x7fffffffu, true },
+            { "triangle reference past the triangles", wall, FileOffset(*wall, wall->primRefs), 0x7fffffffu, true },
+            { "shape reference past the shapes", wall, FileOffset(*wall, wall->primRefs), cpu_rt::AnalyticPrimBit | 1000u, true },
+            { "triangle ID past the mesh", wall, FileOffset(*wall, wall->triangleIds), 1000u, false },
+        };
+        char name[32];
+        for (const Corruption& corruption : corruptions) {
+            std::snprintf(name, sizeof(name), "%016llx.blas", static_cast<unsigned long long>(corruption.accel->key));
+            const std::filesystem::path path = std::filesystem::path(storage.cacheDirectory) / name;
+            const std::vector<char> original = ReadFile(path);
+            std::vector<char> corrupt = original;
+            if (corruption.offset + sizeof(std::uint32_t) > corrupt.size()) {
+                std::fprintf(stderr, "  %s: offset outside the file\n", corruption.what);
+                return false;
+            }
+            std::memcpy(corrupt.data() + corruption.offset, &corruption.value, sizeof(std::uint32_t));
+            cpu_rt::MeshAccel accel;
+            if (!ReplaceFile(path, corrupt) ||
+                (corruption.rejectedByMap && cpu_rt::LoadCachedMeshAccel(storage.cacheDirectory, corruption.accel->key, accel))) {
+                std::fprintf(stderr, "  %s: record was accepted\n", corruption.what);
+                return false;
+            }
+
+            // The rebuild replaces the file and renders the same scene.
+            const cpu_rt::RtScene rebuilt = cpu_rt::BuildRtScene(scene, {}, storage);
+            if (!cpu_rt::LoadCachedMeshAccel(storage.cacheDirectory, corruption.accel->key, accel) || ReadFile(path) != original) {
+                std::fprintf(stderr, "  %s: record was not rebuilt\n", corruption.what);
+                return false;
+            }
+            if (!SameHits(TraceGrid(rebuilt), TraceGrid(reference))) {
+                std::fprintf(stderr, "  %s: hits differ after the rebuild\n", corruption.what);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // A scene must survive a serialize round trip, and element counts that the remaining bytes cannot hold
+    // must be rejected before anything is allocated for them.
+    bool CheckSceneCounts(const Context&)
+    {
+        cpu_rt::ByteWriter writer;
+        cpu_rt::WriteScene(writer, MakeCheckScene());
+        scene_core::Scene scene;
+        cpu_rt::ByteReader reader(writer.Bytes());
+        cpu_rt::ByteWriter rewriter;
+        if (!cpu_rt::ReadScene(reader, scene) || (cpu_rt::WriteScene(rewriter, scene), rewriter.Bytes() != writer.Bytes())) {
+            std::fprintf(stderr, "  scene differs after the serialize round trip\n");
+            return false;
+        }
+
+        // An empty scene followed by zeros. Its node count follows the version, the two empty names and the
+        // root node. One node per remaining byte used to pass, which asked for gigabytes of nodes.
+        constexpr std::size_t NodeCountOffset = sizeof(std::uint32_t) + 2 * sizeof(std::uint64_t) + sizeof(std::uint32_t);
+        constexpr std::size_t Padding = std::size_t(16) << 20;
+        cpu_rt::ByteWriter emptyWriter;
+        cpu_rt::WriteScene(emptyWriter, scene_core::Scene{});
+        std::vector<std::byte> bytes = emptyWriter.Bytes();
+        bytes.resize(bytes.size() + Padding);
+        for (const std::uint64_t count : { static_cast<std::uint64_t>(bytes.size() - NodeCountOffset), ~std::uint64_t(0) }) {
+            std::memcpy(bytes.data() + NodeCountOffset, &count, sizeof(count));
+            cpu_rt::ByteReader corruptReader(bytes);
+            if (cpu_rt::ReadScene(corruptReader, scene)) {
+                std::fprintf(stderr, "  node count %llu was accepted\n", static_cast<unsigned long long>(count));
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // A sphere with its z limits unset must be whole at any radius: rays toward the poles and through high
+    // latitudes hit it where the sphere equation says.
+    bool CheckShapeRadius(const Context&)
+    {
+        constexpr float Radius = 5.0f;
+        scene_core::Scene scene;
+        scene_core::ShapeGroup shapes;
+        scene_core::Shape sphere;
+        sphere.radius = Radius;
+        shapes.shapes.push_back(sphere);
+        scene.shapeGroups.push_back(std::move(shapes));
+        scene_core::Node node;
+        node.shapeGroupIndex = 0;
+        scene.nodes.push_back(node);
+        scene.rootNode = 0;
+        const cpu_rt::RtScene rtScene = cpu_rt::BuildRtScene(scene);
+
+        struct Probe
+        {
+            cpu_rt::Vec3 origin;
+            cpu_rt::Vec3 direction;
+        };
+        const Probe probes[] = {
+            { { 0.0f, 0.0f, 10.0f }, { 0.0f, 0.0f, -1.0f } },
+            { { 0.0f, 0.0f, -10.0f }, { 0.0f, 0.0f, 1.0f } },
+            { { 10.0f, 0.0f, 3.0f }, { -1.0f, 0.0f, 0.0f } },
+            { { 0.0f, 10.0f, -4.5f }, { 0.0f, -1.0f, 0.0f } },
+        };
+        for (const Probe& probe : probes) {
+            cpu_rt::Ray ray;
+            ray.origin = probe.origin;
+            ray.direction = probe.direction;
+            cpu_rt::Hit hit;
+            cpu_rt::Intersect(rtScene, rtScene.topLevel, ray, hit);
+            const cpu_rt::Vec3 p = probe.origin + probe.direction * hit.t;
+            if (!hit.IsValid() || std::fabs(std::sqrt(cpu_rt::Dot(p, p)) - Radius) > 1e-3f) {
+                std::fprintf(stderr, "  ray from (%g, %g, %g) missed the sphere surface\n", probe.origin.x, probe.origin.y, probe.origin.z);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    struct Check
+    {
+        const char* name;
+        bool (*run)(const Context& context);
+    };
+
+    constexpr Check Checks[] = {
+        { "checkpoint", CheckCheckpointResume },
+        { "distributed", CheckDistributedLoopback },
+        { "accel-cache", CheckAccelCacheRoundTrip },
+        { "corrupt-cache", CheckCorruptCacheRecord },
+        { "scene-counts", CheckSceneCounts },
+        { "shape-radius", CheckShapeRadius },
+    };
+}
+
+// Consistency checks of the renderer's persistence and distribution paths on a built-in scene.
+// Usage: cpu_rt_selfcheck [check...]; runs every check without arguments. Returns 1 if any fails.
+int main(int argc, char** argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        bool known = false;
+        for (const Check& check : Checks) {
+            known = known || std::strcmp(argv[i], check.name) == 0;
+        }
+        if (!known) {
+            std::fprintf(stderr, "usage: %s [check...]\n  checks:", argv[0]);
+            for (const Check& check : Checks) {
+                std::fprintf(stderr, " %s", check.name);
+            }
+            std::fprintf(stderr, "\n");
+            return 2;
+        }
+    }
+
+    std::error_code error;
+    Context context;
+    context.directory = std::filesystem::temp_directory_path(error) / ("cpu_rt_selfcheck." + std::to_string(std::random_device{}()));
+    if (error || !std::filesystem::create_directories(context.directory, error)) {
+        std::fprintf(stderr, "cpu_rt_selfcheck: cannot create a scratch directory\n");
+        return 2;
+    }
+
+    std::uint32_t failed = 0;
+    for (const Check& check : Checks) {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; ++i) {
+            selected = selected || std::strcmp(argv[i], check.name) == 0;
+        }
+        if (!selected) {
+            continue;
+        }
+        const bool passed = check.run(context);
+        std::printf("%-14s %s\n", check.name, passed ? "ok" : "FAILED");
+        failed += passed ? 0 : 1;
+    }
+
+    std::filesystem::remove_all(context.directory, error);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,257 @@
+#include "cpu_rt_serialize.h"
+
+namespace cpu_rt
+{
+    namespace
+    {
+        constexpr std::uint32_t SceneFormatVersion = 3;
+
+        void WriteTransform(ByteWriter& writer, const scene_core::Transform& transform)
+        {
+            writer.Write(transform.translation);
+            writer.Write(transform.rotation);
+            writer.Write(transform.scale);
+        }
+
+        bool ReadTransform(ByteReader& reader, scene_core::Transform& transform)
+        {
+            return reader.Read(transform.translation) && reader.Read(transform.rotation) && reader.Read(transform.scale);
+        }
+
+        // Smallest serialized size of each element, with empty strings and vectors.
+        constexpr std::size_t LengthSize = sizeof(std::uint64_t);
+        constexpr std::size_t TransformSize =
+            sizeof(scene_core::Transform::translation) + sizeof(scene_core::Transform::rotation) + sizeof(scene_core::Transform::scale);
+        constexpr std::size_t MinNodeSize = LengthSize + TransformSize + LengthSize + 5 * sizeof(std::uint32_t);
+        constexpr std::size_t MinMeshSize = LengthSize + 8 * LengthSize;
+        constexpr std::size_t MinShapeGroupSize = LengthSize + LengthSize;
+        constexpr std::size_t MinShapeSize = sizeof(std::uint32_t) + TransformSize + 6 * sizeof(float) + sizeof(std::uint32_t);
+        constexpr std::size_t MinMaterialSize = LengthSize + sizeof(scene_core::MaterialPBR::baseColorFactor) +
+            sizeof(scene_core::MaterialPBR::emissiveFactor) + 2 * sizeof(float) + 3 * sizeof(std::uint32_t) + sizeof(std::uint8_t) + sizeof(float);
+        constexpr std::size_t MinTextureSize = LengthSize + LengthSize;
+        constexpr std::size_t MinCameraSize = LengthSize + 3 * sizeof(float);
+        constexpr std::size_t MinLightSize = LengthSize + sizeof(std::uint32_t) + sizeof(scene_core::Light::color) + 4 * sizeof(float);
+
+        // Element counts are bounded by the elements the remaining bytes can hold, so a corrupt count cannot
+        // allocate more than a small multiple of the message size.
+        bool ReadCount(ByteReader& reader, std::size_t minElementSize, std::uint64_t& count)
+        {
+            return reader.Read(count) && count <= reader.Remaining() / minElementSize;
+        }
+    }
+
+    void WriteScene(ByteWriter& writer, const scene_core::Scene& scene)
+    {
+        writer.Write(SceneFormatVersion);
+        writer.WriteString(scene.name);
+        writer.WriteString(scene.sourcePath);
+        writer.Write(scene.rootNode);
+
+        writer.Write(static_cast<std::uint64_t>(scene.nodes.size()));
+        for (const scene_core::Node& node : scene.nodes) {
+            writer.WriteString(node.name);
+            WriteTransform(writer, node.localTransform);
+            writer.WriteVector(node.children);
+            writer.Write(node.mesh.meshIndex);
+            writer.Write(node.mesh.submeshIndex);
+            writer.Write(node.shapeGroupIndex);
+            writer.Write(node.cameraIndex);
+            writer.Write(node.lightIndex);
+        }
+
+        writer.Write(static_cast<std::uint64_t>(scene.meshes.size()));
+        for (const scene_core::Mesh& mesh : scene.meshes) {
+            writer.WriteString(mesh.name);
+            writer.WriteVector(mesh.vertexStreams.positions);
+            writer.WriteVector(mesh.vertexStreams.normals);
+            writer.WriteVector(mesh.vertexStreams.tangents);
+            writer.WriteVector(mesh.vertexStreams.texcoords0);
+            writer.WriteVector(mesh.vertexStreams.texcoords1);
+            writer.WriteVector(mesh.vertexStreams.colors);
+            writer.WriteVector(mesh.indices);
+            writer.WriteVector(mesh.submeshes);
+        }
+
+        writer.Write(static_cast<std::uint64_t>(scene.shapeGroups.size()));
+        for (const scene_core::ShapeGroup& group : scene.shapeGroups) {
+            writer.WriteString(group.name);
+            writer.Write(static_cast<std::uint64_t>(group.shapes.size()));
+            for (const scene_core::Shape& shape : group.shapes) {
+                writer.Write(static_cast<std::uint32_t>(shape.type));
+                WriteTransform(writer, shape.transform);
+                writer.Write(shape.radius);
+                writer.Write(shape.zMin);
+                writer.Write(shape.zMax);
+                writer.Write(shape.height);
+                writer.Write(shape.innerRadius);
+                writer.Write(shape.phiMax);
+                writer.Write(shape.materialIndex);
+            }
+        }
+
+        writer.Write(static_cast<std::uint64_t>(scene.materials.size()));
+        for (const scene_core::MaterialPBR& material : scene.materials) {
+            writer.WriteString(material.name);
+            writer.Write(material.baseColorFactor);
+            writer.Write(material.emissiveFactor);
+            writer.Write(material.metallicFactor);
+            writer.Write(material.roughnessFactor);
+            writer.Write(material.baseColorTextureIndex);
+            writer.Write(material.normalTextureIndex);
+            writer.Write(material.emissiveTextureIndex);
+            writer.Write(static_cast<std::uint8_t>(material.alphaMasked));
+            writer.Write(material.alphaCutoff);
+        }
+
+        writer.Write(static_cast<std::uint64_t>(scene.textures.size()));
+        for (const scene_core::Texture& texture : scene.textures) {
+            writer.WriteString(texture.name);
+            writer.WriteString(texture.uri);
+        }
+
+        writer.Write(static_cast<std::uint64_t>(scene.cameras.size()));
+        for (const scene_core::Camera& camera : scene.cameras) {
+            writer.WriteString(camera.name);
+            writer.Write(camera.verticalFovRadians);
+            writer.Write(camera.nearPlane);
+            writer.Write(camera.farPlane);
+        }
+
+        writer.Write(static_cast<std::uint64_t>(scene.lights.size()));
+        for (const scene_core::Light& light : scene.lights) {
+            writer.WriteString(light.name);
+            writer.Write(static_cast<std::uint32_t>(light.type));
+            writer.Write(light.color);
+            writer.Write(light.intensity);
+            writer.Write(light.range);
+            writer.Write(light.innerConeAngleRadians);
+            writer.Write(light.outerConeAngleRadians);
+        }
+    }
+
+    bool ReadScene(ByteReader& reader, scene_core::Scene& scene)
+    {
+        scene = {};
+        std::uint32_t version = 0;
+        if (!reader.Read(version) || version != SceneFormatVersion) {
+            return false;
+        }
+        reader.ReadString(scene.name);
+        reader.ReadString(scene.sourcePath);
+        reader.Read(scene.rootNode);
+
+        std::uint64_t count = 0;
+        if (!ReadCount(reader, MinNodeSize, count)) {
+            return false;
+        }
+        scene.nodes.resize(static_cast<std::size_t>(count));
+        for (scene_core::Node& node : scene.nodes) {
+            reader.ReadString(node.name);
+            ReadTransform(reader, node.localTransform);
+            reader.ReadVector(node.children);
+            reader.Read(node.mesh.meshIndex);
+            reader.Read(node.mesh.submeshIndex);
+            reader.Read(node.shapeGroupIndex);
+            reader.Read(node.cameraIndex);
+            reader.Read(node.lightIndex);
+        }
+
+        if (!ReadCount(reader, MinMeshSize, count)) {
+            return false;
+        }
+        scene.meshes.resize(static_cast<std::size_t>(count));
+        for (scene_core::Mesh& mesh : scene.meshes) {
+            reader.ReadString(mesh.name);
+            reader.ReadVector(mesh.vertexStreams.positions);
+            reader.ReadVector(mesh.vertexStreams.normals);
+            reader.ReadVector(mesh.vertexStreams.tangents);
+            reader.ReadVector(mesh.vertexStreams.texcoords0);
+            reader.ReadVector(mesh.vertexStreams.texcoords1);
+            reader.ReadVector(mesh.vertexStreams.colors);
+            reader.ReadVector(mesh.indices);
+            reader.ReadVector(mesh.submeshes);
+        }
+
+        if (!ReadCount(reader, MinShapeGroupSize, count)) {
+            return false;
+        }
+        scene.shapeGroups.resize(static_cast<std::size_t>(count));
+        for (scene_core::ShapeGroup& group : scene.shapeGroups) {
+            reader.ReadString(group.name);
+            std::uint64_t shapeCount = 0;
+            if (!ReadCount(reader, MinShapeSize, shapeCount)) {
+                return false;
+            }
+            group.shapes.resize(static_cast<std::size_t>(shapeCount));
+            for (scene_core::Shape& shape : group.shapes) {
+                std::uint32_t type = 0;
+                reader.Read(type);
+                ReadTransform(reader, shape.transform);
+                reader.Read(shape.radius);
+                reader.Read(shape.zMin);
+                reader.Read(shape.zMax);
+                reader.Read(shape.height);
+                reader.Read(shape.innerRadius);
+                reader.Read(shape.phiMax);
+                reader.Read(shape.materialIndex);
+                shape.type = static_cast<scene_core::ShapeType>(type);
+            }
+        }
+
+        if (!ReadCount(reader, MinMaterialSize, count)) {
+            return false;
+        }
+        scene.materials.resize(static_cast<std::size_t>(count));
+        for (scene_core::MaterialPBR& material : scene.materials) {
+            std::uint8_t alphaMasked = 0;
+            reader.ReadString(material.name);
+            reader.Read(material.baseColorFactor);
+            reader.Read(material.emissiveFactor);
+            reader.Read(material.metallicFactor);
+            reader.Read(material.roughnessFactor);
+            reader.Read(material.baseColorTextureIndex);
+            reader.Read(material.normalTextureIndex);
+            reader.Read(material.emissiveTextureIndex);
+            reader.Read(alphaMasked);
+            reader.Read(material.alphaCutoff);
+            material.alphaMasked = alphaMasked != 0;
+        }
+
+        if (!ReadCount(reader, MinTextureSize, count)) {
+            return false;
+        }
+        scene.textures.resize(static_cast<std::size_t>(count));
+        for (scene_core::Texture& texture : scene.textures) {
+            reader.ReadString(texture.name);
+            reader.ReadString(texture.uri);
+        }
+
+        if (!ReadCount(reader, MinCameraSize, count)) {
+            return false;
+        }
+        scene.cameras.resize(static_cast<std::size_t>(count));
+        for (scene_core::Camera& camera : scene.cameras) {
+            reader.ReadString(camera.name);
+            reader.Read(camera.verticalFovRadians);
+            reader.Read(camera.nearPlane);
+            reader.Read(camera.farPlane);
+        }
+
+        if (!ReadCount(reader, MinLightSize, count)) {
+            return false;
+        }
+        scene.lights.resize(static_cast<std::size_t>(count));
+        for (scene_core::Light& light : scene.lights) {
+            std::uint32_t type = 0;
+            reader.ReadString(light.name);
+            reader.Read(type);
+            reader.Read(light.color);
+            reader.Read(light.intensity);
+            reader.Read(light.range);
+            reader.Read(light.innerConeAngleRadians);
+            reader.Read(light.outerConeAngleRadians);
+            light.type = static_cast<scene_core::LightType>(type);
+        }
+        return reader.Ok();
+    }
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "../scene-core/scene.h"
+
+namespace cpu_rt
+{
+    // Append-only binary buffer. Values are stored in host byte order.
+    class ByteWriter
+    {
+    public:
+        template<typename T>
+        void Write(const T& value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            WriteBytes(&value, sizeof(T));
+        }
+
+        template<typename T>
+        void WriteVector(const std::vector<T>& values)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            Write(static_cast<std::uint64_t>(values.size()));
+            WriteBytes(values.data(), values.size() * sizeof(T));
+        }
+
+        void WriteString(const std::string& text)
+        {
+            Write(static_cast<std::uint64_t>(text.size()));
+            WriteBytes(text.data(), text.size());
+        }
+
+        void WriteBytes(const void* data, std::size_t size)
+        {
+            const std::size_t offset = m_bytes.size();
+            m_bytes.resize(offset + size);
+            if (size != 0) {
+                std::memcpy(m_bytes.data() + offset, data, size);
+            }
+        }
+
+        const std::vector<std::byte>& Bytes() const { return m_bytes; }
+
+    private:
+        std::vector<std::byte> m_bytes;
+    };
+
+    // Bounds-checked reader over a ByteWriter buffer. After the first failed read every read fails.
+    class ByteReader
+    {
+    public:
+        explicit ByteReader(std::span<const std::byte> bytes)
+            : m_bytes(bytes)
+        {
+        }
+
+        template<typename T>
+        bool Read(T& value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            return ReadBytes(&value, sizeof(T));
+        }
+
+        template<typename T>
+        bool ReadVector(std::vector<T>& values)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            std::uint64_t count = 0;
+            if (!Read(count) || count > Remaining() / sizeof(T)) {
+                return Fail();
+            }
+            values.resize(static_cast<std::size_t>(count));
+            return ReadBytes(values.data(), values.size() * sizeof(T));
+        }
+
+        bool ReadString(std::string& text)
+        {
+            std::uint64_t size = 0;
+            if (!Read(size) || size > Remaining()) {
+                return Fail();
+            }
+            text.resize(static_cast<std::size_t>(size));
+            return ReadBytes(text.data(), text.size());
+        }
+
+        bool ReadBytes(void* data, std::size_t size)
+        {
+            if (!m_ok || size > Remaining()) {
+                return Fail();
+            }
+            if (size != 0) {
+                std::memcpy(data, m_bytes.data() + m_offset, size);
+            }
+            m_offset += size;
+            return true;
+        }
+
+        bool Ok() const { return m_ok; }
+        std::size_t Remaining() const { return m_bytes.size() - m_offset; }
+
+    private:
+        bool Fail()
+        {
+            m_ok = false;
+            return false;
+        }
+
+        std::span<const std::byte> m_bytes;
+        std::size_t m_offset = 0;
+        bool m_ok = true;
+    };
+
+    void WriteScene(ByteWriter& writer, const scene_core::Scene& scene);
+    bool ReadScene(ByteReader& reader, scene_core::Scene& scene);
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "../scene-core/scene.h"
+#include "cpu_rt_math.h"
+
+namespace cpu_rt
+{
+    // Analytic scene_core::Shape placed in the object space of its MeshAccel.
+    struct AnalyticShape
+    {
+        Affine3 shapeToObject;
+        Affine3 objectToShape;
+        scene_core::ShapeType type = scene_core::ShapeType::Sphere;
+        float radius = 1.0f;
+        float zMin = -1.0f;
+        float zMax = 1.0f;
+        float height = 0.0f;
+        float innerRadius = 0.0f;
+        float phiMax = 2.0f * Pi;
+        std::uint32_t materialIndex = scene_core::InvalidIndex;
+        // Index into scene_core::ShapeGroup::shapes.
+        std::uint32_t shapeId = scene_core::InvalidIndex;
+    };
+
+    // Point and outward normal in shape space.
+    struct ShapePoint
+    {
+        Vec3 position;
+        Vec3 normal;
+    };
+
+    inline AnalyticShape MakeAnalyticShape(const scene_core::Shape& shape, std::uint32_t shapeId)
+    {
+        AnalyticShape result;
+        result.shapeToObject = MakeAffine(shape.transform.translation, shape.transform.rotation, shape.transform.scale);
+        result.objectToShape = Inverse(result.shapeToObject);
+        result.type = shape.type;
+        result.radius = shape.radius;
+        result.height = shape.height;
+        result.innerRadius = std::clamp(shape.innerRadius, 0.0f, shape.radius);
+        result.phiMax = std::clamp(shape.phiMax, 0.0f, 2.0f * Pi);
+        result.materialIndex = shape.materialIndex;
+        result.shapeId = shapeId;
+        const float zMin = std::min(shape.zMin, shape.zMax);
+        const float zMax = std::max(shape.zMin, shape.zMax);
+        if (shape.type == scene_core::ShapeType::Sphere) {
+            result.zMin = std::clamp(zMin, -shape.radius, shape.radius);
+            result.zMax = std::clamp(zMax, -shape.radius, shape.radius);
+        } else {
+            result.zMin = std::isfinite(zMin) ? zMin : -1.0f;
+            result.zMax = std::isfinite(zMax) ? zMax : 1.0f;
+        }
+        return result;
+    }
+
+    inline bool IsDegenerate(const AnalyticShape& shape)
+    {
+        const bool noHeight = shape.type != scene_core::ShapeType::Disk && !(shape.zMax > shape.zMin);
+        return !(shape.radius > 0.0f) || !(shape.phiMax > 0.0f) || noHeight || shape.innerRadius >= shape.radius;
+    }
+
+    // Bounds in the object space of the MeshAccel.
+    inline Aabb ShapeBounds(const AnalyticShape& shape)
+    {
+        Aabb local;
+        const bool disk = shape.type == scene_core::ShapeType::Disk;
+        local.lo = { -shape.radius, -shape.radius, disk ? shape.height : shape.zMin };
+        local.hi = { shape.radius, shape.radius, disk ? shape.height : shape.zMax };
+        return TransformAabb(shape.shapeToObject, local);
+    }
+
+    // Sweep angle of a shape-space point in [0, 2 pi).
+    inline float ShapePhi(float x, float y)
+    {
+        const float phi = std::atan2(y, x);
+        return phi < 0.0f ? phi + 2.0f * Pi : phi;
+    }
+
+    namespace detail
+    {
+        // Roots of a t^2 + b t + c in ascending order, in the numerically stable form.
+        inline bool SolveQuadratic(float a, float b, float c, float& t0, float& t1)
+        {
+            const double discriminant = static_cast<double>(b) * b - 4.0 * static_cast<double>(a) * c;
+            if (discriminant < 0.0 || a == 0.0f) {
+                return false;
+            }
+            const double root = std::sqrt(discriminant);
+            const double q = b < 0.0f ? -0.5 * (b - root) : -0.5 * (b + root);
+            t0 = static_cast<float>(q / a);
+            t1 = q != 0.0 ? static_cast<float>(c / q) : t0;
+            if (t0 > t1) {
+                std::swap(t0, t1);
+            }
+            return true;
+        }
+
+        inline float SphereTheta(float z, float radius)
+        {
+            return std::acos(std::clamp(z / radius, -1.0f, 1.0f));
+        }
+    }
+
+    // Ray in shape space with an unnormalized direction, so t matches the caller's space.
+    // u, v are the shape's surface parameters.
+    inline bool IntersectShape(const AnalyticShape& shape, const Vec3& origin, const Vec3& dir, float tMin, float tMax, float& t, float& u, float& v)
+    {
+        using scene_core::ShapeType;
+        const bool partial = shape.phiMax < 2.0f * Pi;
+
+        if (shape.type == ShapeType::Disk) {
+            if (dir.z == 0.0f) {
+                return false;
+            }
+            t = (shape.height - origin.z) / dir.z;
+            if (!(t > tMin && t < tMax)) {
+                return false;
+            }
+            const float x = origin.x + t * dir.x;
+            const float y = origin.y + t * dir.y;
+            const float distanceSquared = x * x + y * y;
+            if (distanceSquared > shape.radius * shape.radius || distanceSquared < shape.innerRadius * shape.innerRadius) {
+                return false;
+            }
+            const float phi = ShapePhi(x, y);
+            if (partial && phi > shape.phiMax) {
+                return false;
+            }
+            u = phi / shape.phiMax;
+            v = (shape.radius - std::sqrt(distanceSquared)) / (shape.radius - shape.innerRadius);
+            return true;
+        }
+
+        float t0, t1;
+        if (shape.type == ShapeType::Sphere) {
+            const float a = Dot(dir, dir);
+            const float b = 2.0f * Dot(origin, dir);
+            const float c = Dot(origin, origin) - shape.radius * shape.radius;
+            if (!detail::SolveQuadratic(a, b, c, t0, t1)) {
+                return false;
+            }
+        } else {
+            const float a = dir.x * dir.x + dir.y * dir.y;
+            const float b = 2.0f * (origin.x * dir.x + origin.y * dir.y);
+            const float c = origin.x * origin.x + origin.y * origin.y - shape.radius * shape.radius;
+            if (!detail::SolveQuadratic(a, b, c, t0, t1)) {
+                return false;
+            }
+        }
+
+        // Nearest root that lies in the ray interval and inside the clipped part of the surface.
+        for (const float candidate : { t0, t1 }) {
+            if (!(candidate > tMin && candidate < tMax)) {
+                continue;
+            }
+            const Vec3 p = origin + dir * candidate;
+            if (p.z < shape.zMin || p.z > shape.zMax) {
+                continue;
+            }
+            const float phi = ShapePhi(p.x, p.y);
+            if (partial && phi > shape.phiMax) {
+                continue;
+            }
+            t = candidate;
+            u = phi / shape.phiMax;
+            if (shape.type == ShapeType::Sphere) {
+                const float thetaMin = detail::SphereTheta(shape.zMin, shape.radius);
+                const float thetaMax = detail::SphereTheta(shape.zMax, shape.radius);
+                v = (detail::SphereTheta(p.z, shape.radius) - thetaMin) / (thetaMax - thetaMin);
+            } else {
+                v = (p.z - shape.zMin) / (shape.zMax - shape.zMin);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // Surface point at the parameters returned by IntersectShape().
+    inline ShapePoint EvaluateShape(const AnalyticShape& shape, float u, float v)
+    {
+        using scene_core::ShapeType;
+        const float phi = u * shape.phiMax;
+        const float cosPhi = std::cos(phi);
+        const float sinPhi = std::sin(phi);
+
+        ShapePoint point;
+        switch (shape.type) {
+        case ShapeType::Sphere: {
+            const float thetaMin = detail::SphereTheta(shape.zMin, shape.radius);
+            const float thetaMax = detail::SphereTheta(shape.zMax, shape.radius);
+            const float theta = thetaMin + v * (thetaMax - thetaMin);
+            point.normal = { std::sin(theta) * cosPhi, std::sin(theta) * sinPhi, std::cos(theta) };
+            point.position = point.normal * shape.radius;
+            break;
+        }
+        case ShapeType::Cylinder:
+            point.position = { shape.radius * cosPhi, shape.radius * sinPhi, shape.zMin + v * (shape.zMax - shape.zMin) };
+            point.normal = { cosPhi, sinPhi, 0.0f };
+            break;
+        case ShapeType::Disk: {
+            const float rho = shape.radius - v * (shape.radius - shape.innerRadius);
+            point.position = { rho * cosPhi, rho * sinPhi, shape.height };
+            point.normal = { 0.0f, 0.0f, 1.0f };
+            break;
+        }
+        }
+        return point;
+    }
+}
@@ -0,0 +1,334 @@
+#include "cpu_rt_socket.h"
+
+#include <cstring>
+#include <utility>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace cpu_rt
+{
+    namespace
+    {
+        constexpr char UnixPrefix[] = "unix:";
+
+#if defined(_WIN32)
+        void EnsureSocketsInitialized()
+        {
+            struct WinsockInit
+            {
+                WinsockInit()
+                {
+                    WSADATA data;
+                    WSAStartup(MAKEWORD(2, 2), &data);
+                }
+                ~WinsockInit() { WSACleanup(); }
+            };
+            static WinsockInit init;
+        }
+
+        void CloseSocketHandle(Socket::Handle handle) { closesocket(static_cast<SOCKET>(handle)); }
+        constexpr int SendFlags = 0;
+#else
+        void EnsureSocketsInitialized()
+        {
+        }
+
+        void CloseSocketHandle(Socket::Handle handle) { ::close(handle); }
+#if defined(MSG_NOSIGNAL)
+        constexpr int SendFlags = MSG_NOSIGNAL;
+#else
+        constexpr int SendFlags = 0;
+#endif
+#endif
+
+        bool IsUnixAddress(const std::string& address)
+        {
+            return address.rfind(UnixPrefix, 0) == 0;
+        }
+
+        // Resolve "host:port"; an empty host or "*" means any local address when passive is set.
+        addrinfo* ResolveTcp(const std::string& address, bool passive)
+        {
+            const std::size_t colon = address.rfind(':');
+            if (colon == std::string::npos) {
+                return nullptr;
+            }
+            std::string host = address.substr(0, colon);
+            const std::string port = address.substr(colon + 1);
+            if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+                host = host.substr(1, host.size() - 2);
+            }
+
+            addrinfo hints{};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            hints.ai_flags = passive ? AI_PASSIVE : 0;
+            addrinfo* result = nullptr;
+            const char* node = (host.empty() || host == "*") ? nullptr : host.c_str();
+            if (getaddrinfo(node, port.c_str(), &hints, &result) != 0) {
+                return nullptr;
+            }
+            return result;
+        }
+
+        void ConfigureStream(Socket::Handle handle)
+        {
+            // Job messages are small and latency bound.
+            int enable = 1;
+            setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&enable), sizeof(enable));
+#if defined(SO_NOSIGPIPE)
+            setsockopt(handle, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#endif
+        }
+
+#if !defined(_WIN32)
+        bool MakeUnixAddress(const std::string& address, sockaddr_un& unixAddress)
+        {
+            const std::string path = address.substr(sizeof(UnixPrefix) - 1);
+            if (path.empty() || path.size() >= sizeof(unixAddress.sun_path)) {
+                return false;
+            }
+            unixAddress = {};
+            unixAddress.sun_family = AF_UNIX;
+            std::memcpy(unixAddress.sun_path, path.c_str(), path.size() + 1);
+            return true;
+        }
+#endif
+    }
+
+    Socket::Handle Socket::InvalidHandle()
+    {
+#if defined(_WIN32)
+        return static_cast<Handle>(INVALID_SOCKET);
+#else
+        return -1;
+#endif
+    }
+
+    Socket::Socket(Handle handle)
+        : m_handle(handle)
+    {
+    }
+
+    Socket::~Socket()
+    {
+        Close();
+    }
+
+    Socket::Socket(Socket&& other) noexcept
+        : m_handle(std::exchange(other.m_handle, InvalidHandle()))
+    {
+    }
+
+    Socket& Socket::operator=(Socket&& other) noexcept
+    {
+        if (this != &other) {
+            Close();
+            m_handle = std::exchange(other.m_handle, InvalidHandle());
+        }
+        return *this;
+    }
+
+    bool Socket::IsValid() const
+    {
+        return m_handle != InvalidHandle();
+    }
+
+    void Socket::Close()
+    {
+        if (IsValid()) {
+            CloseSocketHandle(m_handle);
+            m_handle = InvalidHandle();
+        }
+    }
+
+    bool Socket::Connect(const std::string& address)
+    {
+        Close();
+        EnsureSocketsInitialized();
+
+        if (IsUnixAddress(address)) {
+#if defined(_WIN32)
+            return false;
+#else
+            sockaddr_un unixAddress;
+            if (!MakeUnixAddress(address, unixAddress)) {
+                return false;
+            }
+            const Handle handle = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (handle == InvalidHandle()) {
+                return false;
+            }
+            if (::connect(handle, reinterpret_cast<const sockaddr*>(&unixAddress), sizeof(unixAddress)) != 0) {
+                CloseSocketHandle(handle);
+                return false;
+            }
+            m_handle = handle;
+            return true;
+#endif
+        }
+
+        addrinfo* addresses = ResolveTcp(address, false);
+        for (addrinfo* info = addresses; info != nullptr; info = info->ai_next) {
+            const Handle handle = static_cast<Handle>(::socket(info->ai_family, info->ai_socktype, info->ai_protocol));
+            if (handle == InvalidHandle()) {
+                continue;
+            }
+            if (::connect(handle, info->ai_addr, static_cast<int>(info->ai_addrlen)) == 0) {
+                ConfigureStream(handle);
+                m_handle = handle;
+                break;
+            }
+            CloseSocketHandle(handle);
+        }
+        if (addresses) {
+            freeaddrinfo(addresses);
+        }
+        return IsValid();
+    }
+
+    bool Socket::SendAll(const void* data, std::size_t size)
+    {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+            const int chunk = static_cast<int>(size < (1u << 30) ? size : (1u << 30));
+            const auto sent = ::send(m_handle, bytes, chunk, SendFlags);
+            if (sent <= 0) {
+                return false;
+            }
+            bytes += sent;
+            size -= static_cast<std::size_t>(sent);
+        }
+        return true;
+    }
+
+    bool Socket::ReceiveAll(void* data, std::size_t size)
+    {
+        char* bytes = static_cast<char*>(data);
+        while (size > 0) {
+            const int chunk = static_cast<int>(size < (1u << 30) ? size : (1u << 30));
+            const auto received = ::recv(m_handle, bytes, chunk, 0);
+            if (received <= 0) {
+                return false;
+            }
+            bytes += received;
+            size -= static_cast<std::size_t>(received);
+        }
+        return true;
+    }
+
+    bool Socket::SetReceiveTimeout(std::uint32_t seconds)
+    {
+#if defined(_WIN32)
+        const DWORD timeout = seconds * 1000;
+#else
+        timeval timeout{};
+        timeout.tv_sec = static_cast<decltype(timeout.tv_sec)>(seconds);
+#endif
+        return setsockopt(m_handle, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout)) == 0;
+    }
+
+    Listener::~Listener()
+    {
+        Close();
+    }
+
+    void Listener::Close()
+    {
+        m_socket.Close();
+#if !defined(_WIN32)
+        if (!m_unixPath.empty()) {
+            ::unlink(m_unixPath.c_str());
+        }
+#endif
+        m_unixPath.clear();
+    }
+
+    bool Listener::Listen(const std::string& address)
+    {
+        Close();
+        EnsureSocketsInitialized();
+
+        if (IsUnixAddress(address)) {
+#if defined(_WIN32)
+            return false;
+#else
+            sockaddr_un unixAddress;
+            if (!MakeUnixAddress(address, unixAddress)) {
+                return false;
+            }
+            Socket socket(::socket(AF_UNIX, SOCK_STREAM, 0));
+            // A stale socket file from a previous run would make bind fail.
+            ::unlink(unixAddress.sun_path);
+            if (!socket.IsValid()
+                || ::bind(socket.m_handle, reinterpret_cast<const sockaddr*>(&unixAddress), sizeof(unixAddress)) != 0
+                || ::listen(socket.m_handle, SOMAXCONN) != 0) {
+                return false;
+            }
+            m_socket = std::move(socket);
+            m_unixPath = unixAddress.sun_path;
+            return true;
+#endif
+        }
+
+        addrinfo* addresses = ResolveTcp(address, true);
+        for (addrinfo* info = addresses; info != nullptr; info = info->ai_next) {
+            Socket socket(static_cast<Socket::Handle>(::socket(info->ai_family, info->ai_socktype, info->ai_protocol)));
+            if (!socket.IsValid()) {
+                continue;
+            }
+            int enable = 1;
+            setsockopt(socket.m_handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&enable), sizeof(enable));
+            if (::bind(socket.m_handle, info->ai_addr, static_cast<int>(info->ai_addrlen)) == 0 && ::listen(socket.m_handle, SOMAXCONN) == 0) {
+                m_socket = std::move(socket);
+                break;
+            }
+        }
+        if (addresses) {
+            freeaddrinfo(addresses);
+        }
+        return m_socket.IsValid();
+    }
+
+    Socket Listener::Accept(std::uint32_t timeoutMilliseconds)
+    {
+        if (!m_socket.IsValid()) {
+            return {};
+        }
+#if defined(_WIN32)
+        WSAPOLLFD poll{};
+        poll.fd = static_cast<SOCKET>(m_socket.m_handle);
+        poll.events = POLLRDNORM;
+        if (WSAPoll(&poll, 1, static_cast<INT>(timeoutMilliseconds)) <= 0) {
+            return {};
+        }
+#else
+        pollfd poll{};
+        poll.fd = m_socket.m_handle;
+        poll.events = POLLIN;
+        if (::poll(&poll, 1, static_cast<int>(timeoutMilliseconds)) <= 0) {
+            return {};
+        }
+#endif
+        Socket socket(static_cast<Socket::Handle>(::accept(m_socket.m_handle, nullptr, nullptr)));
+        if (socket.IsValid() && m_unixPath.empty()) {
+            ConfigureStream(socket.m_handle);
+        }
+        return socket;
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace cpu_rt
+{
+    // Blocking stream socket. Addresses are "host:port" for TCP or "unix:/path" for Unix domain sockets
+    // (not available on Windows).
+    class Socket
+    {
+    public:
+#if defined(_WIN32)
+        using Handle = std::uintptr_t;
+#else
+        using Handle = int;
+#endif
+
+        Socket() = default;
+        explicit Socket(Handle handle);
+        ~Socket();
+
+        Socket(const Socket&) = delete;
+        Socket& operator=(const Socket&) = delete;
+        Socket(Socket&& other) noexcept;
+        Socket& operator=(Socket&& other) noexcept;
+
+        bool Connect(const std::string& address);
+        void Close();
+        bool IsValid() const;
+
+        // Both fail on errors, on timeout and when the peer closed the connection.
+        bool SendAll(const void* data, std::size_t size);
+        bool ReceiveAll(void* data, std::size_t size);
+        // 0 disables the timeout.
+        bool SetReceiveTimeout(std::uint32_t seconds);
+
+    private:
+        Handle m_handle = InvalidHandle();
+
+        static Handle InvalidHandle();
+        friend class Listener;
+    };
+
+    class Listener
+    {
+    public:
+        Listener() = default;
+        ~Listener();
+
+        Listener(const Listener&) = delete;
+        Listener& operator=(const Listener&) = delete;
+
+        bool Listen(const std::string& address);
+        void Close();
+        // Returns an invalid socket if nobody connected within timeoutMilliseconds.
+        Socket Accept(std::uint32_t timeoutMilliseconds);
+
+    private:
+        Socket m_socket;
+        std::string m_unixPath;
+    };
+}
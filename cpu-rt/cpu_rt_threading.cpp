@@ -0,0 +1,337 @@
+#include "cpu_rt_threading.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <utility>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace cpu_rt
+{
+    namespace
+    {
+#if defined(__linux__)
+        // Parse the kernel list format, e.g. "0-3,8-11".
+        std::vector<std::uint32_t> ParseCpuList(const std::string& text)
+        {
+            std::vector<std::uint32_t> result;
+            std::size_t pos = 0;
+            while (pos < text.size()) {
+                std::size_t end = text.find(',', pos);
+                if (end == std::string::npos) {
+                    end = text.size();
+                }
+                const std::string range = text.substr(pos, end - pos);
+                const std::size_t dash = range.find('-');
+                try {
+                    if (dash == std::string::npos) {
+                        result.push_back(static_cast<std::uint32_t>(std::stoul(range)));
+                    } else {
+                        const std::uint32_t first = static_cast<std::uint32_t>(std::stoul(range.substr(0, dash)));
+                        const std::uint32_t last = static_cast<std::uint32_t>(std::stoul(range.substr(dash + 1)));
+                        for (std::uint32_t cpu = first; cpu <= last; ++cpu) {
+                            result.push_back(cpu);
+                        }
+                    }
+                } catch (const std::exception&) {
+                    // Ignore malformed entries such as the trailing newline.
+                }
+                pos = end + 1;
+            }
+            return result;
+        }
+
+        bool ReadFirstLine(const std::string& path, std::string& line)
+        {
+            std::ifstream file(path);
+            return file && std::getline(file, line) && !line.empty();
+        }
+
+        // Physical core of each CPU as (package, core) from sysfs; CPUs without the files get a core of their own.
+        void DetectCores(std::vector<CpuTopology::LogicalCpu>& cpus)
+        {
+            std::map<std::pair<long, long>, std::uint32_t> cores;
+            for (CpuTopology::LogicalCpu& cpu : cpus) {
+                const std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu.id) + "/topology/";
+                std::string package;
+                std::string core;
+                std::pair<long, long> key(-1, -static_cast<long>(cpu.id) - 1);
+                if (ReadFirstLine(dir + "physical_package_id", package) && ReadFirstLine(dir + "core_id", core)) {
+                    try {
+                        key = { std::stol(package), std::stol(core) };
+                    } catch (const std::exception&) {
+                    }
+                }
+                cpu.core = cores.emplace(key, static_cast<std::uint32_t>(cores.size())).first->second;
+            }
+        }
+#elif defined(_WIN32)
+        void DetectCores(std::vector<CpuTopology::LogicalCpu>& cpus)
+        {
+            DWORD bytes = 0;
+            GetLogicalProcessorInformation(nullptr, &bytes);
+            std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(bytes / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+            if (info.empty() || !GetLogicalProcessorInformation(info.data(), &bytes)) {
+                for (CpuTopology::LogicalCpu& cpu : cpus) {
+                    cpu.core = cpu.id;
+                }
+                return;
+            }
+            std::uint32_t coreCount = 0;
+            for (const SYSTEM_LOGICAL_PROCESSOR_INFORMATION& entry : info) {
+                if (entry.Relationship != RelationProcessorCore) {
+                    continue;
+                }
+                for (CpuTopology::LogicalCpu& cpu : cpus) {
+                    if (cpu.id < 64 && (entry.ProcessorMask & (ULONG_PTR(1) << cpu.id))) {
+                        cpu.core = coreCount;
+                    }
+                }
+                coreCount++;
+            }
+        }
+#endif
+    }
+
+    CpuTopology CpuTopology::Detect()
+    {
+        CpuTopology topology;
+
+#if defined(__linux__)
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        const bool hasAllowedMask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+        std::string nodeList;
+        if (ReadFirstLine("/sys/devices/system/node/online", nodeList)) {
+            std::uint32_t denseNode = 0;
+            for (std::uint32_t osNode : ParseCpuList(nodeList)) {
+                std::string cpuList;
+                if (!ReadFirstLine("/sys/devices/system/node/node" + std::to_string(osNode) + "/cpulist", cpuList)) {
+                    continue;
+                }
+                bool nodeHasCpu = false;
+                for (std::uint32_t cpu : ParseCpuList(cpuList)) {
+                    if (hasAllowedMask && (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed))) {
+                        continue;
+                    }
+                    topology.cpus.push_back({ cpu, denseNode });
+                    nodeHasCpu = true;
+                }
+                if (nodeHasCpu) {
+                    denseNode++;
+                }
+            }
+            topology.numaNodeCount = std::max(1u, denseNode);
+        }
+#elif defined(_WIN32)
+        ULONG highestNode = 0;
+        if (GetNumaHighestNodeNumber(&highestNode)) {
+            std::uint32_t denseNode = 0;
+            for (ULONG osNode = 0; osNode <= highestNode; ++osNode) {
+                ULONGLONG mask = 0;
+                if (!GetNumaNodeProcessorMask(static_cast<UCHAR>(osNode), &mask) || mask == 0) {
+                    continue;
+                }
+                for (std::uint32_t cpu = 0; cpu < 64; ++cpu) {
+                    if (mask & (1ull << cpu)) {
+                        topology.cpus.push_back({ cpu, denseNode });
+                    }
+                }
+                denseNode++;
+            }
+            topology.numaNodeCount = std::max(1u, denseNode);
+        }
+#endif
+
+        if (topology.cpus.empty()) {
+            const std::uint32_t count = std::max(1u, std::thread::hardware_concurrency());
+            for (std::uint32_t cpu = 0; cpu < count; ++cpu) {
+                topology.cpus.push_back({ cpu, 0, cpu });
+            }
+            topology.numaNodeCount = 1;
+            return topology;
+        }
+#if defined(__linux__) || defined(_WIN32)
+        DetectCores(topology.cpus);
+#endif
+        return topology;
+    }
+
+    std::uint32_t CpuTopology::PhysicalCoreCount() const
+    {
+        std::uint32_t count = 0;
+        for (const LogicalCpu& cpu : cpus) {
+            count = std::max(count, cpu.core + 1);
+        }
+        return count;
+    }
+
+    std::vector<std::uint32_t> CpuTopology::CpusOfNode(std::uint32_t node) const
+    {
+        std::vector<std::uint32_t> result;
+        for (const LogicalCpu& cpu : cpus) {
+            if (cpu.numaNode == node) {
+                result.push_back(cpu.id);
+            }
+        }
+        return result;
+    }
+
+    bool SetCurrentThreadAffinity(const std::vector<std::uint32_t>& cpus)
+    {
+        if (cpus.empty()) {
+            return false;
+        }
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (std::uint32_t cpu : cpus) {
+            if (cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+        DWORD_PTR mask = 0;
+        for (std::uint32_t cpu : cpus) {
+            if (cpu < sizeof(DWORD_PTR) * 8) {
+                mask |= DWORD_PTR(1) << cpu;
+            }
+        }
+        return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+        return false;
+#endif
+    }
+
+    WorkerPool::WorkerPool(const ThreadingSettings& settings, const CpuTopology& topology)
+    {
+        // Interleave CPUs across nodes so that partial thread counts still use every socket.
+        std::vector<std::vector<std::uint32_t>> nodeCpus(topology.numaNodeCount);
+        for (std::uint32_t node = 0; node < topology.numaNodeCount; ++node) {
+            nodeCpus[node] = topology.CpusOfNode(node);
+        }
+        if (settings.cpuOrder != CpuOrder::Os) {
+            // Rank of each CPU among the hardware threads of its core, in OS order.
+            std::map<std::uint32_t, std::uint32_t> threadsSeen;
+            std::map<std::uint32_t, std::pair<std::uint32_t, std::uint32_t>> coreAndRank;
+            for (const CpuTopology::LogicalCpu& cpu : topology.cpus) {
+                coreAndRank[cpu.id] = { cpu.core, threadsSeen[cpu.core]++ };
+            }
+            const bool physicalFirst = settings.cpuOrder == CpuOrder::PhysicalCoresFirst;
+            for (std::vector<std::uint32_t>& cpus : nodeCpus) {
+                std::stable_sort(cpus.begin(), cpus.end(), [&](std::uint32_t a, std::uint32_t b) {
+                    const auto [coreA, rankA] = coreAndRank[a];
+                    const auto [coreB, rankB] = coreAndRank[b];
+                    return physicalFirst ? std::tie(rankA, coreA) < std::tie(rankB, coreB) : std::tie(coreA, rankA) < std::tie(coreB, rankB);
+                });
+            }
+        }
+        std::vector<CpuTopology::LogicalCpu> cpuOrder;
+        for (std::size_t i = 0; cpuOrder.size() < topology.cpus.size(); ++i) {
+            for (std::uint32_t node = 0; node < topology.numaNodeCount; ++node) {
+                if (i < nodeCpus[node].size()) {
+                    cpuOrder.push_back({ nodeCpus[node][i], node });
+                }
+            }
+        }
+
+        const std::uint32_t threadCount = settings.threadCount != 0
+            ? settings.threadCount
+            : static_cast<std::uint32_t>(cpuOrder.size());
+        const bool numaAware = (settings.numaAware || settings.pinThreads) && topology.numaNodeCount > 1;
+
+        // Compact the node indices to the nodes that actually receive workers.
+        std::map<std::uint32_t, std::uint32_t> usedNodes;
+        std::vector<std::vector<std::uint32_t>> affinities(threadCount);
+        m_workers.resize(threadCount);
+        for (std::uint32_t i = 0; i < threadCount; ++i) {
+            const CpuTopology::LogicalCpu& cpu = cpuOrder[i % cpuOrder.size()];
+            WorkerInfo& worker = m_workers[i];
+            worker.index = i;
+            if (numaAware) {
+                auto it = usedNodes.emplace(cpu.numaNode, static_cast<std::uint32_t>(usedNodes.size())).first;
+                worker.numaNode = it->second;
+            }
+            if (settings.pinThreads) {
+                worker.cpu = cpu.id;
+                affinities[i] = { cpu.id };
+            } else if (numaAware) {
+                affinities[i] = nodeCpus[cpu.numaNode];
+            }
+        }
+
+        m_workersPerNode.assign(std::max<std::size_t>(1, usedNodes.size()), 0);
+        for (WorkerInfo& worker : m_workers) {
+            worker.indexInNode = m_workersPerNode[worker.numaNode]++;
+        }
+
+        m_threads.reserve(threadCount);
+        for (std::uint32_t i = 0; i < threadCount; ++i) {
+            m_threads.emplace_back(&WorkerPool::WorkerMain, this, i, std::move(affinities[i]));
+        }
+    }
+
+    WorkerPool::~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_quit = true;
+        }
+        m_wakeCondition.notify_all();
+        for (std::thread& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    void WorkerPool::Run(const std::function<void(const WorkerInfo&)>& job)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_job = &job;
+        m_pending = WorkerCount();
+        m_generation++;
+        m_wakeCondition.notify_all();
+        m_doneCondition.wait(lock, [this]() { return m_pending == 0; });
+        m_job = nullptr;
+    }
+
+    void WorkerPool::WorkerMain(std::uint32_t index, std::vector<std::uint32_t> affinity)
+    {
+        if (!affinity.empty()) {
+            SetCurrentThreadAffinity(affinity);
+        }
+
+        std::uint64_t seenGeneration = 0;
+        for (;;) {
+            const std::function<void(const WorkerInfo&)>* job = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wakeCondition.wait(lock, [&]() { return m_quit || m_generation != seenGeneration; });
+                if (m_quit) {
+                    return;
+                }
+                seenGeneration = m_generation;
+                job = m_job;
+            }
+
+            (*job)(m_workers[index]);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_pending == 0) {
+                m_doneCondition.notify_one();
+            }
+        }
+    }
+}
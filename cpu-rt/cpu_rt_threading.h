@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cpu_rt
+{
+    inline constexpr std::uint32_t InvalidCpu = ~0u;
+
+    // Logical CPUs grouped by NUMA node. Node indices are dense, starting at 0.
+    struct CpuTopology
+    {
+        struct LogicalCpu
+        {
+            std::uint32_t id = 0;
+            std::uint32_t numaNode = 0;
+            // Dense index of the physical core; SMT siblings share it.
+            std::uint32_t core = 0;
+        };
+
+        std::vector<LogicalCpu> cpus;
+        std::uint32_t numaNodeCount = 1;
+
+        // Query the OS; falls back to a single node with std::thread::hardware_concurrency() CPUs.
+        static CpuTopology Detect();
+
+        std::vector<std::uint32_t> CpusOfNode(std::uint32_t node) const;
+        std::uint32_t PhysicalCoreCount() const;
+    };
+
+    // Order in which workers take the logical CPUs of each NUMA node.
+    enum class CpuOrder
+    {
+        // CPU numbering of the OS.
+        Os,
+        // One worker per physical core before any core runs a second hardware thread.
+        PhysicalCoresFirst,
+        // Fill all hardware threads of a core before moving to the next core.
+        SmtSiblingsFirst,
+    };
+
+    struct ThreadingSettings
+    {
+        // Number of worker threads, 0 selects one per logical CPU.
+        std::uint32_t threadCount = 0;
+        // Pin every worker to a single logical CPU. Workers are spread across NUMA nodes.
+        bool pinThreads = false;
+        // Matters for partial thread counts on SMT machines, together with pinThreads.
+        CpuOrder cpuOrder = CpuOrder::Os;
+        // Bind workers to the CPUs of their NUMA node, first-touch framebuffer rows on the node
+        // that renders them and prefer node-local tiles. Implied by pinThreads.
+        bool numaAware = true;
+        // Keep one copy of the top-level acceleration structure per NUMA node.
+        bool replicateTopLevelPerNode = false;
+    };
+
+    struct WorkerInfo
+    {
+        std::uint32_t index = 0;
+        std::uint32_t numaNode = 0;
+        std::uint32_t indexInNode = 0;
+        std::uint32_t cpu = InvalidCpu;
+    };
+
+    // Fixed set of worker threads that execute fork-join jobs.
+    class WorkerPool
+    {
+    public:
+        WorkerPool(const ThreadingSettings& settings, const CpuTopology& topology);
+        ~WorkerPool();
+
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        std::uint32_t WorkerCount() const { return static_cast<std::uint32_t>(m_workers.size()); }
+        std::uint32_t NumaNodeCount() const { return static_cast<std::uint32_t>(m_workersPerNode.size()); }
+        std::uint32_t WorkersOnNode(std::uint32_t node) const { return m_workersPerNode[node]; }
+        const WorkerInfo& Worker(std::uint32_t index) const { return m_workers[index]; }
+
+        // Run the job once on every worker and block until all of them return.
+        void Run(const std::function<void(const WorkerInfo&)>& job);
+
+    private:
+        void WorkerMain(std::uint32_t index, std::vector<std::uint32_t> affinity);
+
+        std::vector<WorkerInfo> m_workers;
+        std::vector<std::uint32_t> m_workersPerNode;
+        std::vector<std::thread> m_threads;
+
+        std::mutex m_mutex;
+        std::condition_variable m_wakeCondition;
+        std::condition_variable m_doneCondition;
+        const std::function<void(const WorkerInfo&)>* m_job = nullptr;
+        std::uint64_t m_generation = 0;
+        std::uint32_t m_pending = 0;
+        bool m_quit = false;
+    };
+
+    // Call fn(i) for every i in [0, count) on all workers of the pool. Workers take the next index as they
+    // finish one, so uneven items balance themselves. Blocks until every index is done.
+    template<typename Fn>
+    void ParallelFor(WorkerPool& pool, std::size_t count, Fn&& fn)
+    {
+        std::atomic<std::size_t> next = 0;
+        pool.Run([&](const WorkerInfo&) {
+            for (std::size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+                fn(i);
+            }
+        });
+    }
+
+    // ParallelFor() over the rows of an image; fn(y) gets the row index.
+    template<typename Fn>
+    void ParallelRows(WorkerPool& pool, std::uint32_t height, Fn&& fn)
+    {
+        ParallelFor(pool, height, [&](std::size_t y) { fn(static_cast<std::uint32_t>(y)); });
+    }
+
+    // Bind the calling thread to the given logical CPUs. Returns false if the OS call is unavailable or fails.
+    bool SetCurrentThreadAffinity(const std::vector<std::uint32_t>& cpus);
+}
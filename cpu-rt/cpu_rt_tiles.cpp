@@ -0,0 +1,165 @@
+#include "cpu_rt_tiles.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "cpu_rt_math.h"
+
+namespace cpu_rt
+{
+    std::vector<Tile> MakeTiles(std::uint32_t width, std::uint32_t height, std::uint32_t tileSize, const WorkerPool& pool)
+    {
+        std::vector<Tile> tiles;
+        tileSize = std::max(1u, tileSize);
+        const std::uint32_t tileRows = (height + tileSize - 1) / tileSize;
+        const std::uint32_t nodeCount = pool.NumaNodeCount();
+
+        // Prefix sum of workers per node to place band boundaries.
+        std::vector<std::uint32_t> bandEnd(nodeCount);
+        std::uint32_t workerSum = 0;
+        for (std::uint32_t node = 0; node < nodeCount; ++node) {
+            workerSum += pool.WorkersOnNode(node);
+            bandEnd[node] = static_cast<std::uint32_t>(
+                (static_cast<std::uint64_t>(tileRows) * workerSum + pool.WorkerCount() - 1) / pool.WorkerCount());
+        }
+
+        std::uint32_t node = 0;
+        for (std::uint32_t row = 0; row < tileRows; ++row) {
+            while (node + 1 < nodeCount && row >= bandEnd[node]) {
+                node++;
+            }
+            const std::uint32_t y0 = row * tileSize;
+            for (std::uint32_t x0 = 0; x0 < width; x0 += tileSize) {
+                tiles.push_back({ x0, y0, std::min(width, x0 + tileSize), std::min(height, y0 + tileSize), node });
+            }
+        }
+        return tiles;
+    }
+
+    Tile CropRect(const CropWindow& crop, std::uint32_t width, std::uint32_t height)
+    {
+        auto toPixel = [](float value, std::uint32_t size) {
+            return static_cast<std::uint32_t>(std::clamp(value, 0.0f, 1.0f) * static_cast<float>(size) + 0.5f);
+        };
+        Tile rect{ toPixel(crop.x0, width), toPixel(crop.y0, height), toPixel(crop.x1, width), toPixel(crop.y1, height), 0 };
+        rect.x1 = std::max(rect.x0, rect.x1);
+        rect.y1 = std::max(rect.y0, rect.y1);
+        return rect;
+    }
+
+    Tile ClipTile(const Tile& tile, const Tile& rect)
+    {
+        Tile clipped = tile;
+        clipped.x0 = std::max(tile.x0, rect.x0);
+        clipped.y0 = std::max(tile.y0, rect.y0);
+        clipped.x1 = std::max(clipped.x0, std::min(tile.x1, rect.x1));
+        clipped.y1 = std::max(clipped.y0, std::min(tile.y1, rect.y1));
+        if (clipped.x0 == clipped.x1 || clipped.y0 == clipped.y1) {
+            clipped.x1 = clipped.x0;
+            clipped.y1 = clipped.y0;
+        }
+        return clipped;
+    }
+
+    std::vector<float> TilePriorityKeys(const std::vector<Tile>& tiles, std::uint32_t width, std::uint32_t height, const TilePriority& priority)
+    {
+        std::vector<float> keys(tiles.size());
+        if (priority.order == TileOrder::Scanline || tiles.empty()) {
+            for (std::size_t i = 0; i < tiles.size(); ++i) {
+                keys[i] = static_cast<float>(i);
+            }
+            return keys;
+        }
+
+        // Chebyshev ring around the focus in tile units, then angle within the ring.
+        const float tileSize = static_cast<float>(std::max(1u, std::max(tiles[0].x1 - tiles[0].x0, tiles[0].y1 - tiles[0].y0)));
+        const float focusX = priority.focusX * static_cast<float>(width);
+        const float focusY = priority.focusY * static_cast<float>(height);
+        for (std::size_t i = 0; i < tiles.size(); ++i) {
+            const Tile& tile = tiles[i];
+            const float dx = (0.5f * static_cast<float>(tile.x0 + tile.x1) - focusX) / tileSize;
+            const float dy = (0.5f * static_cast<float>(tile.y0 + tile.y1) - focusY) / tileSize;
+            const float ring = std::round(std::max(std::abs(dx), std::abs(dy)));
+            const float turn = (std::atan2(dy, dx) + Pi) / (2.0f * Pi);
+            keys[i] = ring + 0.5f * turn;
+        }
+        return keys;
+    }
+
+    void TileScheduler::Reset(const std::vector<Tile>& tiles, std::uint32_t numaNodeCount, const std::vector<bool>& active)
+    {
+        std::lock_guard lock(m_mutex);
+        if (m_keys.size() != tiles.size()) {
+            m_keys.resize(tiles.size());
+            for (std::size_t i = 0; i < tiles.size(); ++i) {
+                m_keys[i] = static_cast<float>(i);
+            }
+        }
+        m_queues.assign(std::max(1u, numaNodeCount), {});
+        for (std::uint32_t i = 0; i < tiles.size(); ++i) {
+            if (i < active.size() && active[i]) {
+                m_queues[std::min<std::size_t>(tiles[i].numaNode, m_queues.size() - 1)].push_back(i);
+            }
+        }
+        SortQueues();
+    }
+
+    void TileScheduler::SetPriority(const std::vector<Tile>& tiles, std::uint32_t width, std::uint32_t height, const TilePriority& priority)
+    {
+        std::vector<float> keys = TilePriorityKeys(tiles, width, height, priority);
+        std::lock_guard lock(m_mutex);
+        m_keys = std::move(keys);
+        m_globalPriority = priority.order != TileOrder::Scanline;
+        SortQueues();
+    }
+
+    void TileScheduler::SortQueues()
+    {
+        for (std::vector<std::uint32_t>& queue : m_queues) {
+            std::sort(queue.begin(), queue.end(), [this](std::uint32_t a, std::uint32_t b) { return m_keys[a] > m_keys[b]; });
+        }
+    }
+
+    std::vector<std::uint32_t>* TileScheduler::SelectQueue(std::uint32_t numaNode)
+    {
+        const std::uint32_t queueCount = static_cast<std::uint32_t>(m_queues.size());
+        std::vector<std::uint32_t>* best = nullptr;
+        for (std::uint32_t i = 0; i < queueCount; ++i) {
+            std::vector<std::uint32_t>& queue = m_queues[(numaNode + i) % queueCount];
+            if (queue.empty()) {
+                continue;
+            }
+            // Own node first; later queues only win on strictly higher priority.
+            if (best == nullptr || (m_globalPriority && m_keys[queue.back()] < m_keys[best->back()])) {
+                best = &queue;
+            }
+            if (!m_globalPriority) {
+                break;
+            }
+        }
+        return best;
+    }
+
+    bool TileScheduler::Next(std::uint32_t numaNode, std::uint32_t& tileIndex)
+    {
+        std::lock_guard lock(m_mutex);
+        std::vector<std::uint32_t>* queue = SelectQueue(numaNode);
+        if (queue == nullptr) {
+            return false;
+        }
+        tileIndex = queue->back();
+        queue->pop_back();
+        return true;
+    }
+
+    bool TileScheduler::Peek(std::uint32_t numaNode, std::uint32_t& tileIndex)
+    {
+        std::lock_guard lock(m_mutex);
+        const std::vector<std::uint32_t>* queue = SelectQueue(numaNode);
+        if (queue == nullptr) {
+            return false;
+        }
+        tileIndex = queue->back();
+        return true;
+    }
+}
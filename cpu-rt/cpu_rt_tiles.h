@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "cpu_rt_threading.h"
+
+namespace cpu_rt
+{
+    struct Tile
+    {
+        std::uint32_t x0 = 0;
+        std::uint32_t y0 = 0;
+        std::uint32_t x1 = 0;
+        std::uint32_t y1 = 0;
+        // NUMA node whose workers render this tile and own its framebuffer rows.
+        std::uint32_t numaNode = 0;
+    };
+
+    enum class TileOrder
+    {
+        // Row by row within each NUMA band; best memory locality.
+        Scanline,
+        // Rings of tiles around TilePriority::focus, closest first, across all NUMA nodes.
+        Spiral,
+    };
+
+    struct TilePriority
+    {
+        TileOrder order = TileOrder::Scanline;
+        // Spiral center in normalized film coordinates; (0.5, 0.5) is the image center.
+        float focusX = 0.5f;
+        float focusY = 0.5f;
+    };
+
+    // Rendered part of the frame in normalized film coordinates.
+    struct CropWindow
+    {
+        float x0 = 0.0f;
+        float y0 = 0.0f;
+        float x1 = 1.0f;
+        float y1 = 1.0f;
+    };
+
+    // Split the frame into tiles. Tile rows are grouped into horizontal bands, one per NUMA node,
+    // sized in proportion to the number of workers on that node.
+    std::vector<Tile> MakeTiles(std::uint32_t width, std::uint32_t height, std::uint32_t tileSize, const WorkerPool& pool);
+
+    // Pixel rectangle of the crop window, clamped to the frame.
+    Tile CropRect(const CropWindow& crop, std::uint32_t width, std::uint32_t height);
+    // Tile clipped to a rectangle; empty (x0 == x1) if they do not overlap.
+    Tile ClipTile(const Tile& tile, const Tile& rect);
+
+    // Rendering priority per tile, lower first.
+    std::vector<float> TilePriorityKeys(const std::vector<Tile>& tiles, std::uint32_t width, std::uint32_t height, const TilePriority& priority);
+
+    // Hands out tiles to workers. In scanline order workers take node-local tiles first and only then
+    // steal from other nodes; with a priority order every worker takes the globally most important tile.
+    // The priority may change while workers are pulling tiles.
+    class TileScheduler
+    {
+    public:
+        // Start a pass over the tiles whose active flag is set, in the current priority order.
+        void Reset(const std::vector<Tile>& tiles, std::uint32_t numaNodeCount, const std::vector<bool>& active);
+
+        // Reorder the tiles not taken yet. Safe to call from any thread, also during a pass.
+        void SetPriority(const std::vector<Tile>& tiles, std::uint32_t width, std::uint32_t height, const TilePriority& priority);
+
+        // Claim the next tile for a worker on the given node. Returns false when all tiles are taken.
+        bool Next(std::uint32_t numaNode, std::uint32_t& tileIndex);
+        // The tile Next() would return now, without claiming it; another worker may take it first.
+        bool Peek(std::uint32_t numaNode, std::uint32_t& tileIndex);
+
+    private:
+        void SortQueues();
+        // Queue the next tile for the node comes from, or nullptr when all are empty. Requires the lock.
+        std::vector<std::uint32_t>* SelectQueue(std::uint32_t numaNode);
+
+        // A pop is a few instructions and tiles take milliseconds, so one lock is not contended.
+        std::mutex m_mutex;
+        // Remaining tiles per node, most important at the back.
+        std::vector<std::vector<std::uint32_t>> m_queues;
+        std::vector<float> m_keys;
+        bool m_globalPriority = false;
+    };
+}
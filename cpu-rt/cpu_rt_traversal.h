@@ -0,0 +1,292 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "cpu_rt_features.h"
+#include "cpu_rt_scene.h"
+
+namespace cpu_rt
+{
+    // Work done by one traversal, counted by IntersectCounted() for cost heatmaps.
+    struct TraversalStats
+    {
+        // BVH nodes entered, top level and mesh levels together.
+        std::uint32_t nodeVisits = 0;
+        // Instances whose mesh BVH was entered.
+        std::uint32_t instanceVisits = 0;
+        // Triangles and analytic shapes tested.
+        std::uint32_t primitiveTests = 0;
+    };
+
+    // Ray traversal and surface reconstruction, templated on the scene features they have to handle.
+    // Kept in a header so that specialized integrator kernels inline them.
+    namespace detail
+    {
+        // Rays traced by each thread; a thread-local increment is cheap next to a traversal.
+        inline thread_local std::uint64_t tracedRays = 0;
+
+        // Stack-based closest-first traversal. The leaf callback receives the primitive range and
+        // may shrink tMax; returning true terminates the traversal early. Counted adds the nodes entered
+        // to stats; otherwise stats is unused.
+        template<bool Counted = false, typename LeafFn>
+        void TraverseBvh(const Bvh& bvh, const Vec3& origin, const Vec3& invDir, float tMin, float& tMax, LeafFn&& leafFn, TraversalStats* stats = nullptr)
+        {
+            if (bvh.nodes.empty() || IntersectNode(bvh.nodes[0], origin, invDir, tMin, tMax) == Infinity) {
+                return;
+            }
+
+            struct StackEntry
+            {
+                std::uint32_t nodeIndex;
+                float tEntry;
+            };
+            StackEntry stack[MaxTraversalDepth];
+            std::uint32_t stackSize = 0;
+            std::uint32_t nodeIndex = 0;
+            for (;;) {
+                const BvhNode& node = bvh.nodes[nodeIndex];
+                if constexpr (Counted) {
+                    ++stats->nodeVisits;
+                }
+                if (node.IsLeaf()) {
+                    if (leafFn(node.leftOrFirst, node.primCount, tMax)) {
+                        return;
+                    }
+                } else {
+                    const std::uint32_t left = node.leftOrFirst;
+                    const float tLeft = IntersectNode(bvh.nodes[left], origin, invDir, tMin, tMax);
+                    const float tRight = IntersectNode(bvh.nodes[left + 1], origin, invDir, tMin, tMax);
+                    if (tLeft != Infinity && tRight != Infinity) {
+                        const bool leftFirst = tLeft <= tRight;
+                        stack[stackSize++] = leftFirst ? StackEntry{ left + 1, tRight } : StackEntry{ left, tLeft };
+                        nodeIndex = leftFirst ? left : left + 1;
+                        continue;
+                    }
+                    if (tLeft != Infinity) {
+                        nodeIndex = left;
+                        continue;
+                    }
+                    if (tRight != Infinity) {
+                        nodeIndex = left + 1;
+                        continue;
+                    }
+                }
+
+                // Pop the next entry that is still in front of the current closest hit.
+                do {
+                    if (stackSize == 0) {
+                        return;
+                    }
+                    --stackSize;
+                } while (stack[stackSize].tEntry > tMax);
+                nodeIndex = stack[stackSize].nodeIndex;
+            }
+        }
+
+        inline bool IntersectTriangle(const Triangle& tri, const Vec3& origin, const Vec3& dir, float tMin, float tMax, float& t, float& u, float& v)
+        {
+            const Vec3 pvec = Cross(dir, tri.e2);
+            const float det = Dot(tri.e1, pvec);
+            if (std::abs(det) < 1e-12f) {
+                return false;
+            }
+            const float invDet = 1.0f / det;
+            const Vec3 tvec = origin - tri.v0;
+            u = Dot(tvec, pvec) * invDet;
+            if (u < 0.0f || u > 1.0f) {
+                return false;
+            }
+            const Vec3 qvec = Cross(tvec, tri.e1);
+            v = Dot(dir, qvec) * invDet;
+            if (v < 0.0f || u + v > 1.0f) {
+                return false;
+            }
+            t = Dot(tri.e2, qvec) * invDet;
+            return t > tMin && t < tMax;
+        }
+
+        template<bool AnyHit, SceneFeatures Features, bool Counted = false>
+        bool TraceScene(const RtScene& scene, const TopLevelAccel& topLevel, const Ray& ray, Hit& hit, TraversalStats* stats = nullptr)
+        {
+            ++tracedRays;
+            const Vec3 invDir = SafeInverse(ray.direction);
+            float tMax = ray.tMax;
+            bool found = false;
+
+            TraverseBvh<Counted>(topLevel.bvh, ray.origin, invDir, ray.tMin, tMax, [&](std::uint32_t first, std::uint32_t count, float& instTMax) {
+                for (std::uint32_t i = first; i < first + count; ++i) {
+                    if constexpr (Counted) {
+                        ++stats->instanceVisits;
+                    }
+                    const std::uint32_t instanceIndex = topLevel.bvh.primIndices[i];
+                    const Instance& instance = topLevel.instances[instanceIndex];
+                    const MeshAccel& accel = scene.meshAccels[instance.meshAccelIndex];
+
+                    // The object-space direction is not renormalized, so t stays comparable across instances.
+                    Vec3 origin = ray.origin;
+                    Vec3 dir = ray.direction;
+                    Vec3 objInvDir = invDir;
+                    if constexpr ((Features & SceneFeatureInstanceTransforms) != 0) {
+                        origin = instance.worldToObject.TransformPoint(ray.origin);
+                        dir = instance.worldToObject.TransformVector(ray.direction);
+                        objInvDir = SafeInverse(dir);
+                    }
+
+                    bool done = false;
+                    TraverseBvh<Counted>(accel.bvh, origin, objInvDir, ray.tMin, instTMax, [&](std::uint32_t primFirst, std::uint32_t primCount, float& primTMax) {
+                        if constexpr (Counted) {
+                            stats->primitiveTests += primCount;
+                        }
+                        for (std::uint32_t slot = primFirst; slot < primFirst + primCount; ++slot) {
+                            float t, u, v;
+                            std::uint32_t prim = slot;
+                            if constexpr ((Features & SceneFeatureAnalyticShapes) != 0) {
+                                prim = accel.PrimRef(slot);
+                                if (prim & AnalyticPrimBit) {
+                                    const AnalyticShape& shape = accel.shapes[prim & ~AnalyticPrimBit];
+                                    const Vec3 shapeOrigin = shape.objectToShape.TransformPoint(origin);
+                                    const Vec3 shapeDir = shape.objectToShape.TransformVector(dir);
+                                    if (!IntersectShape(shape, shapeOrigin, shapeDir, ray.tMin, primTMax, t, u, v)) {
+                                        continue;
+                                    }
+                                } else if (!IntersectTriangle(accel.triangles[prim], origin, dir, ray.tMin, primTMax, t, u, v)) {
+                                    continue;
+                                }
+                            } else if (!IntersectTriangle(accel.triangles[prim], origin, dir, ray.tMin, primTMax, t, u, v)) {
+                                continue;
+                            }
+                            found = true;
+                            if constexpr (AnyHit) {
+                                done = true;
+                                return true;
+                            }
+                            primTMax = t;
+                            hit.t = t;
+                            hit.u = u;
+                            hit.v = v;
+                            hit.instanceIndex = instanceIndex;
+                            hit.primIndex = prim;
+                        }
+                        return false;
+                    }, stats);
+                    if (done) {
+                        return true;
+                    }
+                }
+                return false;
+            }, stats);
+            return found;
+        }
+
+        template<SceneFeatures Features>
+        Vec3 ToWorldPoint(const Instance& instance, const Vec3& p)
+        {
+            if constexpr ((Features & SceneFeatureInstanceTransforms) != 0) {
+                return instance.objectToWorld.TransformPoint(p);
+            } else {
+                return p;
+            }
+        }
+
+        template<SceneFeatures Features>
+        Vec3 ToWorldNormal(const Instance& instance, const Vec3& n)
+        {
+            if constexpr ((Features & SceneFeatureInstanceTransforms) != 0) {
+                return instance.worldToObject.TransformNormalByInverse(n);
+            } else {
+                return n;
+            }
+        }
+    }
+
+    // Number of Intersect() and Occluded() calls made by the calling thread so far.
+    inline std::uint64_t TracedRayCount()
+    {
+        return detail::tracedRays;
+    }
+
+    // Intersect() compiled for a subset of scene features; the scene must not use any feature outside it.
+    template<SceneFeatures Features>
+    bool Intersect(const RtScene& scene, const TopLevelAccel& topLevel, const Ray& ray, Hit& hit)
+    {
+        return detail::TraceScene<false, Features & TraversalFeatures>(scene, topLevel, ray, hit);
+    }
+
+    template<SceneFeatures Features>
+    bool Occluded(const RtScene& scene, const TopLevelAccel& topLevel, const Ray& ray)
+    {
+        Hit hit;
+        return detail::TraceScene<true, Features & TraversalFeatures>(scene, topLevel, ray, hit);
+    }
+
+    // Intersect() for any scene that also adds its traversal work to stats. Slower than Intersect(); meant
+    // for debug views.
+    inline bool IntersectCounted(const RtScene& scene, const TopLevelAccel& topLevel, const Ray& ray, Hit& hit, TraversalStats& stats)
+    {
+        return detail::TraceScene<false, AllSceneFeatures & TraversalFeatures, true>(scene, topLevel, ray, hit, &stats);
+    }
+
+    template<SceneFeatures Features>
+    SurfaceHit MakeSurfaceHit(const RtScene& scene, const TopLevelAccel& topLevel, const Hit& hit)
+    {
+        const Instance& instance = topLevel.instances[hit.instanceIndex];
+        const MeshAccel& accel = scene.meshAccels[instance.meshAccelIndex];
+        if constexpr ((Features & SceneFeatureAnalyticShapes) != 0) {
+            if (hit.primIndex & AnalyticPrimBit) {
+                const AnalyticShape& shape = accel.shapes[hit.primIndex & ~AnalyticPrimBit];
+                const ShapePoint point = EvaluateShape(shape, hit.u, hit.v);
+                const Vec3 objectNormal = shape.objectToShape.TransformNormalByInverse(point.normal);
+
+                SurfaceHit surface;
+                surface.materialIndex = shape.materialIndex;
+                surface.nodeIndex = instance.nodeIndex;
+                surface.position = detail::ToWorldPoint<Features>(instance, shape.shapeToObject.TransformPoint(point.position));
+                surface.geometricNormal = Normalize(detail::ToWorldNormal<Features>(instance, objectNormal));
+                surface.shadingNormal = surface.geometricNormal;
+                if constexpr ((Features & SceneFeatureTextures) != 0) {
+                    surface.texcoord[0] = hit.u;
+                    surface.texcoord[1] = hit.v;
+                }
+                return surface;
+            }
+        }
+
+        const Triangle& tri = accel.triangles[hit.primIndex];
+        const scene_core::Mesh& mesh = scene.source->meshes[accel.meshIndex];
+
+        SurfaceHit surface;
+        surface.materialIndex = accel.materialIndices[hit.primIndex];
+        surface.nodeIndex = instance.nodeIndex;
+        surface.position = detail::ToWorldPoint<Features>(instance, tri.v0 + tri.e1 * hit.u + tri.e2 * hit.v);
+        surface.geometricNormal = Normalize(detail::ToWorldNormal<Features>(instance, Cross(tri.e1, tri.e2)));
+        surface.shadingNormal = surface.geometricNormal;
+
+        const std::uint32_t first = accel.triangleIds[hit.primIndex] * 3;
+        const std::uint32_t i0 = mesh.indices[first + 0];
+        const std::uint32_t i1 = mesh.indices[first + 1];
+        const std::uint32_t i2 = mesh.indices[first + 2];
+        const float w0 = 1.0f - hit.u - hit.v;
+        const std::size_t vertexCount = mesh.vertexStreams.positions.size() / 3;
+
+        const std::vector<float>& normals = mesh.vertexStreams.normals;
+        if (normals.size() >= vertexCount * 3) {
+            auto normal = [&](std::uint32_t i) { return Vec3(normals[3 * i + 0], normals[3 * i + 1], normals[3 * i + 2]); };
+            const Vec3 n = normal(i0) * w0 + normal(i1) * hit.u + normal(i2) * hit.v;
+            const Vec3 worldN = detail::ToWorldNormal<Features>(instance, n);
+            if (Dot(worldN, worldN) > 0.0f) {
+                surface.shadingNormal = Normalize(worldN);
+            }
+        }
+
+        if constexpr ((Features & SceneFeatureTextures) != 0) {
+            const std::vector<float>& uvs = mesh.vertexStreams.texcoords0;
+            if (uvs.size() >= vertexCount * 2) {
+                surface.texcoord[0] = uvs[2 * i0] * w0 + uvs[2 * i1] * hit.u + uvs[2 * i2] * hit.v;
+                surface.texcoord[1] = uvs[2 * i0 + 1] * w0 + uvs[2 * i1 + 1] * hit.u + uvs[2 * i2 + 1] * hit.v;
+            }
+        }
+        return surface;
+    }
+}
@@ -0,0 +1,24 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "cpu_rt_distributed.h"
+
+// Render worker process for RenderDistributed().
+// Usage: cpu_rt_worker <host:port | unix:/path> [threadCount]
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s <host:port | unix:/path> [threadCount]\n", argv[0]);
+        return 2;
+    }
+
+    cpu_rt::ThreadingSettings threading;
+    if (argc > 2) {
+        threading.threadCount = static_cast<std::uint32_t>(std::strtoul(argv[2], nullptr, 10));
+    }
+    if (!cpu_rt::RunRenderWorker(argv[1], threading)) {
+        std::fprintf(stderr, "cpu_rt_worker: lost connection to %s\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
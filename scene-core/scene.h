@@ -24,6 +24,8 @@ namespace scene_core
         std::vector<float> tangents;
         std::vector<float> texcoords0;
         std::vector<float> texcoords1;
+        // RGBA per vertex, e.g. baked lighting.
+        std::vector<float> colors;
     };
 
     struct Submesh
@@ -41,6 +43,37 @@ namespace scene_core
         std::vector<Submesh> submeshes;
     };
 
+    enum class ShapeType
+    {
+        Sphere,
+        Disk,
+        Cylinder,
+    };
+
+    // Analytic quadric with pbrt's parameterization, placed by transform relative to the owning node.
+    // Spheres and cylinders are centered on the origin around +Z and clipped to [zMin, zMax]; unset (infinite)
+    // limits end spheres at their poles and cylinders at pbrt's default of -1 and 1.
+    // Disks lie in the plane z = height, face +Z and have a hole of innerRadius. phiMax limits the sweep around +Z.
+    struct Shape
+    {
+        ShapeType type = ShapeType::Sphere;
+        Transform transform;
+        float radius = 1.0f;
+        float zMin = -std::numeric_limits<float>::infinity();
+        float zMax = std::numeric_limits<float>::infinity();
+        float height = 0.0f;
+        float innerRadius = 0.0f;
+        float phiMax = 6.28318530718f;
+        std::uint32_t materialIndex = InvalidIndex;
+    };
+
+    // Analytic shapes referenced by nodes like a mesh, so e.g. a particle cloud can be instanced as a whole.
+    struct ShapeGroup
+    {
+        std::string name;
+        std::vector<Shape> shapes;
+    };
+
     struct Texture
     {
         std::string name;
@@ -99,6 +132,7 @@ namespace scene_core
         Transform localTransform;
         std::vector<std::uint32_t> children;
         MeshRef mesh;
+        std::uint32_t shapeGroupIndex = InvalidIndex;
         std::uint32_t cameraIndex = InvalidIndex;
         std::uint32_t lightIndex = InvalidIndex;
     };
@@ -109,6 +143,7 @@ namespace scene_core
         std::string sourcePath;
         std::vector<Node> nodes;
         std::vector<Mesh> meshes;
+        std::vector<ShapeGroup> shapeGroups;
         std::vector<MaterialPBR> materials;
         std::vector<Texture> textures;
         std::vector<Camera> cameras;